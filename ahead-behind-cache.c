@@ -0,0 +1,282 @@
+#include "git-compat-util.h"
+#include "ahead-behind-cache.h"
+#include "chunk-format.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "lockfile.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "path.h"
+#include "refs.h"
+#include "replace-object.h"
+#include "repository.h"
+#include "shallow.h"
+#include "string-list.h"
+#include "strmap.h"
+
+#define AHEAD_BEHIND_CACHE_SIGNATURE 0x41484243 /* "AHBC" */
+#define AHEAD_BEHIND_CACHE_VERSION 1
+#define AHEAD_BEHIND_CACHE_HEADER_SIZE 12
+
+/*
+ * The file starts with a 4-byte signature, a 1-byte version, the 1-byte
+ * hash version (as in the commit-graph), two reserved bytes and the
+ * 4-byte number of entries. Each entry consists of the base and tip
+ * object IDs, the 4-byte ahead and behind counts and the NUL-terminated
+ * ref and base names. A checksum of everything before it ends the file.
+ */
+
+struct ahead_behind_cache {
+	struct repository *repo;
+	char *path;
+	struct strmap entries;
+	unsigned dirty:1;
+};
+
+struct cache_item {
+	struct ahead_behind_cache_entry entry;
+	unsigned used:1;
+};
+
+static int history_is_stable(struct repository *r)
+{
+	if (replace_refs_enabled(r)) {
+		prepare_replace_object(r);
+		if (oidmap_get_size(&r->objects->replace_map))
+			return 0;
+	}
+
+	prepare_commit_graft(r);
+	if (r->parsed_objects &&
+	    (r->parsed_objects->grafts_nr || r->parsed_objects->substituted_parent))
+		return 0;
+	if (is_repository_shallow(r))
+		return 0;
+
+	return 1;
+}
+
+static void cache_key(struct strbuf *key, const char *refname, const char *base)
+{
+	/* refnames cannot contain a space, so the key is unambiguous */
+	strbuf_reset(key);
+	strbuf_addf(key, "%s %s", refname, base);
+}
+
+static const char *read_string(const unsigned char **data,
+			       const unsigned char *end)
+{
+	const char *s = (const char *)*data;
+	const unsigned char *nul = memchr(*data, '\0', end - *data);
+
+	if (!nul)
+		return NULL;
+	*data = nul + 1;
+	return s;
+}
+
+static int parse_cache(struct ahead_behind_cache *cache,
+		       const unsigned char *data, size_t len)
+{
+	const struct git_hash_algo *algop = cache->repo->hash_algo;
+	const unsigned char *end;
+	struct strbuf key = STRBUF_INIT;
+	uint32_t nr;
+
+	if (len < AHEAD_BEHIND_CACHE_HEADER_SIZE + algop->rawsz ||
+	    get_be32(data) != AHEAD_BEHIND_CACHE_SIGNATURE ||
+	    data[4] != AHEAD_BEHIND_CACHE_VERSION ||
+	    data[5] != oid_version(algop) ||
+	    !hashfile_checksum_valid(algop, data, len))
+		return -1;
+
+	nr = get_be32(data + 8);
+	end = data + len - algop->rawsz;
+	data += AHEAD_BEHIND_CACHE_HEADER_SIZE;
+
+	while (nr--) {
+		struct cache_item *item;
+		const char *refname, *base;
+
+		if ((size_t)(end - data) < 2 * algop->rawsz + 8)
+			goto corrupt;
+
+		CALLOC_ARRAY(item, 1);
+		oidread(&item->entry.base, data, algop);
+		oidread(&item->entry.tip, data + algop->rawsz, algop);
+		data += 2 * algop->rawsz;
+		item->entry.ahead = get_be32(data);
+		item->entry.behind = get_be32(data + 4);
+		data += 8;
+
+		refname = read_string(&data, end);
+		base = refname ? read_string(&data, end) : NULL;
+		if (!base) {
+			free(item);
+			goto corrupt;
+		}
+
+		cache_key(&key, refname, base);
+		free(strmap_put(&cache->entries, key.buf, item));
+	}
+
+	strbuf_release(&key);
+	return data == end ? 0 : -1;
+
+corrupt:
+	strbuf_release(&key);
+	return -1;
+}
+
+struct ahead_behind_cache *ahead_behind_cache_load(struct repository *r)
+{
+	struct ahead_behind_cache *cache;
+	struct strbuf buf = STRBUF_INIT;
+
+	if (!history_is_stable(r))
+		return NULL;
+
+	CALLOC_ARRAY(cache, 1);
+	cache->repo = r;
+	cache->path = xstrfmt("%s/info/ahead-behind",
+			      repo_get_object_directory(r));
+	strmap_init(&cache->entries);
+
+	if (strbuf_read_file(&buf, cache->path, 0) > 0 &&
+	    parse_cache(cache, (const unsigned char *)buf.buf, buf.len)) {
+		/* start over, and replace the corrupt file on write */
+		strmap_clear(&cache->entries, 1);
+		strmap_init(&cache->entries);
+		cache->dirty = 1;
+	}
+
+	strbuf_release(&buf);
+	return cache;
+}
+
+const struct ahead_behind_cache_entry *ahead_behind_cache_get(struct ahead_behind_cache *cache,
+							      const char *refname,
+							      const char *base)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct cache_item *item;
+
+	cache_key(&key, refname, base);
+	item = strmap_get(&cache->entries, key.buf);
+	strbuf_release(&key);
+
+	if (!item)
+		return NULL;
+	item->used = 1;
+	return &item->entry;
+}
+
+void ahead_behind_cache_put(struct ahead_behind_cache *cache,
+			    const char *refname, const char *base,
+			    const struct ahead_behind_cache_entry *entry)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct cache_item *item;
+
+	cache_key(&key, refname, base);
+	item = strmap_get(&cache->entries, key.buf);
+	if (!item) {
+		CALLOC_ARRAY(item, 1);
+		strmap_put(&cache->entries, key.buf, item);
+	} else if (oideq(&item->entry.base, &entry->base) &&
+		   oideq(&item->entry.tip, &entry->tip) &&
+		   item->entry.ahead == entry->ahead &&
+		   item->entry.behind == entry->behind) {
+		item->used = 1;
+		strbuf_release(&key);
+		return;
+	}
+
+	item->entry = *entry;
+	item->used = 1;
+	cache->dirty = 1;
+	strbuf_release(&key);
+}
+
+int ahead_behind_cache_write(struct ahead_behind_cache *cache)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct string_list keys = STRING_LIST_INIT_NODUP;
+	struct ref_store *refs = get_main_ref_store(cache->repo);
+	struct strbuf refname = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct string_list_item *key;
+	struct hashfile *f;
+
+	strmap_for_each_entry(&cache->entries, &iter, e) {
+		struct cache_item *item = e->value;
+
+		if (!item->used) {
+			const char *space = strchr(e->key, ' ');
+
+			strbuf_reset(&refname);
+			strbuf_add(&refname, e->key, space - e->key);
+			if (!refs_ref_exists(refs, refname.buf)) {
+				cache->dirty = 1;
+				continue;
+			}
+		}
+		string_list_append(&keys, e->key)->util = item;
+	}
+	strbuf_release(&refname);
+
+	if (!cache->dirty)
+		goto done;
+
+	if (safe_create_leading_directories_const(cache->repo, cache->path) ||
+	    hold_lock_file_for_update(&lk, cache->path, 0) < 0)
+		goto done;
+
+	string_list_sort(&keys);
+
+	f = hashfd(cache->repo->hash_algo, get_lock_file_fd(&lk),
+		   get_lock_file_path(&lk));
+	hashwrite_be32(f, AHEAD_BEHIND_CACHE_SIGNATURE);
+	hashwrite_u8(f, AHEAD_BEHIND_CACHE_VERSION);
+	hashwrite_u8(f, oid_version(cache->repo->hash_algo));
+	hashwrite_u8(f, 0);
+	hashwrite_u8(f, 0);
+	hashwrite_be32(f, keys.nr);
+
+	for_each_string_list_item(key, &keys) {
+		struct cache_item *item = key->util;
+		const char *space = strchr(key->string, ' ');
+
+		hashwrite(f, item->entry.base.hash, cache->repo->hash_algo->rawsz);
+		hashwrite(f, item->entry.tip.hash, cache->repo->hash_algo->rawsz);
+		hashwrite_be32(f, item->entry.ahead);
+		hashwrite_be32(f, item->entry.behind);
+		hashwrite(f, key->string, space - key->string);
+		hashwrite_u8(f, 0);
+		hashwrite(f, space + 1, strlen(space + 1) + 1);
+	}
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE,
+			  CSUM_HASH_IN_STREAM);
+	if (commit_lock_file(&lk) < 0) {
+		string_list_clear(&keys, 0);
+		return error_errno(_("unable to write '%s'"), cache->path);
+	}
+	cache->dirty = 0;
+
+done:
+	rollback_lock_file(&lk);
+	string_list_clear(&keys, 0);
+	return 0;
+}
+
+void ahead_behind_cache_free(struct ahead_behind_cache *cache)
+{
+	if (!cache)
+		return;
+	strmap_clear(&cache->entries, 1);
+	free(cache->path);
+	free(cache);
+}
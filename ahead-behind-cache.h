@@ -0,0 +1,56 @@
+#ifndef AHEAD_BEHIND_CACHE_H
+#define AHEAD_BEHIND_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * A cache of ahead/behind counts, stored in "$GIT_DIR/objects/info/ahead-behind"
+ * and keyed by the name of a ref and the name of the base it was
+ * compared with. Each entry remembers which commits the count was for,
+ * so that a caller noticing that either side has moved can update the
+ * count with ahead_behind_update() instead of starting over.
+ */
+struct ahead_behind_cache;
+
+struct ahead_behind_cache_entry {
+	struct object_id base;
+	struct object_id tip;
+	unsigned int ahead;
+	unsigned int behind;
+};
+
+/*
+ * Load the cache of the given repository. Returns NULL if the history
+ * of the repository can be rewritten by grafts, replace refs or a
+ * shallow file, as the cached counts would not be reliable then. A
+ * missing or corrupt cache file yields an empty cache.
+ */
+struct ahead_behind_cache *ahead_behind_cache_load(struct repository *r);
+
+/*
+ * Look up the count of "refname" against "base", or return NULL.
+ */
+const struct ahead_behind_cache_entry *ahead_behind_cache_get(struct ahead_behind_cache *cache,
+							      const char *refname,
+							      const char *base);
+
+/*
+ * Record the count of "refname" against "base".
+ */
+void ahead_behind_cache_put(struct ahead_behind_cache *cache,
+			    const char *refname, const char *base,
+			    const struct ahead_behind_cache_entry *entry);
+
+/*
+ * Write the cache back if it has changed. Entries which were neither
+ * looked up nor recorded are dropped if their ref no longer exists.
+ * Failing to take the lock is not an error, another process is already
+ * updating the cache. Returns 0 on success and -1 on error.
+ */
+int ahead_behind_cache_write(struct ahead_behind_cache *cache);
+
+void ahead_behind_cache_free(struct ahead_behind_cache *cache);
+
+#endif /* AHEAD_BEHIND_CACHE_H */
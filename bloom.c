@@ -12,10 +12,12 @@
 #include "tree-walk.h"
 #include "config.h"
 #include "repository.h"
+#include "strmap.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
 static struct bloom_filter_slab bloom_filters;
+static struct bloom_filter_slab merge_bloom_filters;
 
 struct pathmap_hash_entry {
     struct hashmap_entry entry;
@@ -35,7 +37,7 @@ static inline unsigned char get_bitmask(uint32_t pos)
 }
 
 static int check_bloom_offset(struct commit_graph *g, uint32_t pos,
-			      uint32_t offset)
+			      uint32_t offset, size_t data_size)
 {
 	/*
 	 * Note that we allow offsets equal to the data size, which would set
@@ -44,40 +46,38 @@ static int check_bloom_offset(struct commit_graph *g, uint32_t pos,
 	 * entries (so we can compute size by comparing adjacent ones). And
 	 * naturally the final entry's end is one-past-the-end of the chunk.
 	 */
-	if (offset <= g->chunk_bloom_data_size - BLOOMDATA_CHUNK_HEADER_SIZE)
+	if (offset <= data_size)
 		return 0;
 
 	warning("ignoring out-of-range offset (%"PRIuMAX") for changed-path"
 		" filter at pos %"PRIuMAX" of %s (chunk size: %"PRIuMAX")",
 		(uintmax_t)offset, (uintmax_t)pos,
-		g->filename, (uintmax_t)g->chunk_bloom_data_size);
+		g->filename, (uintmax_t)data_size);
 	return -1;
 }
 
-int load_bloom_filter_from_graph(struct commit_graph *g,
-				 struct bloom_filter *filter,
-				 uint32_t graph_pos)
+/*
+ * Point "filter" at the entry "lex_pos" of a pair of index and data
+ * chunks, the latter of which holds "data_size" bytes of filters
+ * starting at "data".
+ */
+static int load_filter_from_chunks(struct commit_graph *g,
+				   const unsigned char *indexes,
+				   const unsigned char *data, size_t data_size,
+				   struct bloom_filter *filter,
+				   uint32_t lex_pos)
 {
-	uint32_t lex_pos, start_index, end_index;
-
-	while (graph_pos < g->num_commits_in_base)
-		g = g->base_graph;
-
-	/* The commit graph commit 'c' lives in doesn't carry Bloom filters. */
-	if (!g->chunk_bloom_indexes)
-		return 0;
-
-	lex_pos = graph_pos - g->num_commits_in_base;
+	uint32_t start_index, end_index;
 
-	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
+	end_index = get_be32(indexes + 4 * lex_pos);
 
 	if (lex_pos > 0)
-		start_index = get_be32(g->chunk_bloom_indexes + 4 * (lex_pos - 1));
+		start_index = get_be32(indexes + 4 * (lex_pos - 1));
 	else
 		start_index = 0;
 
-	if (check_bloom_offset(g, lex_pos, end_index) < 0 ||
-	    check_bloom_offset(g, lex_pos - 1, start_index) < 0)
+	if (check_bloom_offset(g, lex_pos, end_index, data_size) < 0 ||
+	    check_bloom_offset(g, lex_pos - 1, start_index, data_size) < 0)
 		return 0;
 
 	if (end_index < start_index) {
@@ -91,15 +91,47 @@ int load_bloom_filter_from_graph(struct commit_graph *g,
 	}
 
 	filter->len = end_index - start_index;
-	filter->data = (unsigned char *)(g->chunk_bloom_data +
-					sizeof(unsigned char) * start_index +
-					BLOOMDATA_CHUNK_HEADER_SIZE);
+	filter->data = (unsigned char *)(data +
+					sizeof(unsigned char) * start_index);
 	filter->version = g->bloom_filter_settings->hash_version;
 	filter->to_free = NULL;
 
 	return 1;
 }
 
+int load_bloom_filter_from_graph(struct commit_graph *g,
+				 struct bloom_filter *filter,
+				 uint32_t graph_pos)
+{
+	while (graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	/* The commit graph commit 'c' lives in doesn't carry Bloom filters. */
+	if (!g->chunk_bloom_indexes)
+		return 0;
+
+	return load_filter_from_chunks(g, g->chunk_bloom_indexes,
+				       g->chunk_bloom_data + BLOOMDATA_CHUNK_HEADER_SIZE,
+				       g->chunk_bloom_data_size - BLOOMDATA_CHUNK_HEADER_SIZE,
+				       filter, graph_pos - g->num_commits_in_base);
+}
+
+int load_merge_bloom_filter_from_graph(struct commit_graph *g,
+				       struct bloom_filter *filter,
+				       uint32_t graph_pos)
+{
+	while (graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	if (!g->chunk_bloom_merge_indexes)
+		return 0;
+
+	return load_filter_from_chunks(g, g->chunk_bloom_merge_indexes,
+				       g->chunk_bloom_merge_data,
+				       g->chunk_bloom_merge_data_size,
+				       filter, graph_pos - g->num_commits_in_base);
+}
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -264,6 +296,7 @@ void add_key_to_filter(const struct bloom_key *key,
 void init_bloom_filters(void)
 {
 	init_bloom_filter_slab(&bloom_filters);
+	init_bloom_filter_slab(&merge_bloom_filters);
 }
 
 static void free_one_bloom_filter(struct bloom_filter *filter)
@@ -276,55 +309,103 @@ static void free_one_bloom_filter(struct bloom_filter *filter)
 void deinit_bloom_filters(void)
 {
 	deep_clear_bloom_filter_slab(&bloom_filters, free_one_bloom_filter);
+	deep_clear_bloom_filter_slab(&merge_bloom_filters, free_one_bloom_filter);
+}
+
+struct bloom_keyset {
+	const struct bloom_filter_settings *settings;
+
+	/* the distinct keys, and their names (for finding them again) */
+	struct bloom_key *keys;
+	size_t keys_nr, keys_alloc;
+	struct strintmap key_index;
+
+	/*
+	 * For each path, the indices of its keys, starting with its
+	 * topmost directory, so that a directory none of the paths below
+	 * it makes it past is only tested once; "path_end[i]" is where
+	 * the keys of the i-th path end in "path_keys".
+	 */
+	size_t *path_keys;
+	size_t path_keys_nr, path_keys_alloc;
+	size_t *path_end;
+	size_t paths_nr, paths_alloc;
+	struct strset paths;
+
+	/* 0 if not tested yet, or 1 + the result of testing the key */
+	unsigned char *state;
+};
+
+struct bloom_keyset *bloom_keyset_new(const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyset *set;
+
+	CALLOC_ARRAY(set, 1);
+	set->settings = settings;
+	strintmap_init_with_options(&set->key_index, -1, NULL, 1);
+	strset_init(&set->paths);
+	return set;
 }
 
-struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
-				      const struct bloom_filter_settings *settings)
-{
-	struct bloom_keyvec *vec;
-	const char *p;
-	size_t sz;
-	size_t nr = 1;
-
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			nr++;
-		p++;
+static size_t keyset_key(struct bloom_keyset *set, const char *path, size_t len)
+{
+	char *name = xmemdupz(path, len);
+	int pos = strintmap_get(&set->key_index, name);
+
+	if (pos < 0) {
+		pos = set->keys_nr;
+		ALLOC_GROW(set->keys, set->keys_nr + 1, set->keys_alloc);
+		bloom_key_fill(&set->keys[set->keys_nr++], path, len,
+			       set->settings);
+		strintmap_set(&set->key_index, name, pos);
 	}
 
-	sz = sizeof(struct bloom_keyvec);
-	sz += nr * sizeof(struct bloom_key);
-	vec = (struct bloom_keyvec *)xcalloc(1, sz);
-	if (!vec)
-		return NULL;
-	vec->count = nr;
-
-	bloom_key_fill(&vec->key[0], path, len, settings);
-	nr = 1;
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/') {
-			bloom_key_fill(&vec->key[nr++], path, p - path, settings);
-		}
-		p--;
+	free(name);
+	return pos;
+}
+
+void bloom_keyset_add(struct bloom_keyset *set, const char *path, size_t len)
+{
+	struct strbuf name = STRBUF_INIT;
+
+	strbuf_add(&name, path, len);
+	if (!strset_add(&set->paths, name.buf)) {
+		strbuf_release(&name);
+		return;
 	}
-	assert(nr == vec->count);
-	return vec;
+	strbuf_release(&name);
+
+	for (size_t i = 1; i <= len; i++) {
+		if (i < len && path[i] != '/')
+			continue;
+		ALLOC_GROW(set->path_keys, set->path_keys_nr + 1,
+			   set->path_keys_alloc);
+		set->path_keys[set->path_keys_nr++] = keyset_key(set, path, i);
+	}
+
+	ALLOC_GROW(set->path_end, set->paths_nr + 1, set->paths_alloc);
+	set->path_end[set->paths_nr++] = set->path_keys_nr;
+	REALLOC_ARRAY(set->state, set->keys_nr);
 }
 
-void bloom_keyvec_free(struct bloom_keyvec *vec)
+size_t bloom_keyset_nr(const struct bloom_keyset *set)
 {
-	if (!vec)
+	return set->paths_nr;
+}
+
+void bloom_keyset_free(struct bloom_keyset *set)
+{
+	if (!set)
 		return;
-	for (size_t nr = 0; nr < vec->count; nr++)
-		bloom_key_clear(&vec->key[nr]);
-	free(vec);
+	for (size_t i = 0; i < set->keys_nr; i++)
+		bloom_key_clear(&set->keys[i]);
+	free(set->keys);
+	strintmap_clear(&set->key_index);
+	free(set->path_keys);
+	free(set->path_end);
+	strset_clear(&set->paths);
+	free(set->state);
+	free(set);
 }
 
 static int pathmap_cmp(const void *hashmap_cmp_fn_data UNUSED,
@@ -349,6 +430,70 @@ static void init_truncated_large_filter(struct bloom_filter *filter,
 	filter->version = version;
 }
 
+/*
+ * Add "path" and each of its leading directories to "pathmap", i.e. for
+ * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so the Bloom
+ * filter could be used to speed up commands like 'git log dir/subdir',
+ * too.
+ *
+ * Note that directories are added without the trailing '/', and that
+ * "path" is clobbered in the process.
+ */
+static void add_changed_path(struct hashmap *pathmap, char *path)
+{
+	struct pathmap_hash_entry *e;
+
+	do {
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(pathmap, &e->entry, NULL))
+			hashmap_add(pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+}
+
+static void fill_bloom_filter(struct bloom_filter *filter,
+			      struct hashmap *pathmap,
+			      const struct bloom_filter_settings *settings,
+			      enum bloom_filter_computed *computed)
+{
+	struct pathmap_hash_entry *e;
+	struct hashmap_iter iter;
+
+	if (hashmap_get_size(pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter, settings->hash_version);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+		return;
+	}
+
+	filter->len = (hashmap_get_size(pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	filter->version = settings->hash_version;
+	if (!filter->len) {
+		if (computed)
+			*computed |= BLOOM_TRUNC_EMPTY;
+		filter->len = 1;
+	}
+	CALLOC_ARRAY(filter->data, filter->len);
+	filter->to_free = filter->data;
+
+	hashmap_for_each_entry(pathmap, &iter, e, entry) {
+		struct bloom_key key;
+		bloom_key_fill(&key, e->path, strlen(e->path), settings);
+		add_key_to_filter(&key, filter, settings);
+		bloom_key_clear(&key);
+	}
+}
+
 #define VISITED   (1u<<21)
 #define HIGH_BITS (1u<<22)
 
@@ -497,64 +642,11 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 
 	if (diff_queued_diff.nr <= settings->max_changed_paths) {
 		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
-
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-		}
 
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter,
-						    settings->hash_version);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_changed_path(&pathmap, diff_queued_diff.queue[i]->two->path);
 
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		filter->version = settings->hash_version;
-		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
-			filter->len = 1;
-		}
-		CALLOC_ARRAY(filter->data, filter->len);
-		filter->to_free = filter->data;
-
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			bloom_key_fill(&key, e->path, strlen(e->path), settings);
-			add_key_to_filter(&key, filter, settings);
-			bloom_key_clear(&key);
-		}
-
-	cleanup:
+		fill_bloom_filter(filter, &pathmap, settings, computed);
 		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
 		init_truncated_large_filter(filter, settings->hash_version);
@@ -570,6 +662,262 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	return filter;
 }
 
+struct bloom_filter *get_merge_bloom_filter(struct repository *r,
+					    struct commit *c)
+{
+	struct bloom_filter *filter;
+	int hash_version;
+
+	filter = get_or_compute_merge_bloom_filter(r, c, 0, NULL, NULL);
+	if (!filter)
+		return NULL;
+
+	prepare_repo_settings(r);
+	hash_version = r->settings.commit_graph_changed_paths_version;
+
+	if (!(hash_version == -1 || hash_version == filter->version))
+		return NULL; /* unusable filter */
+	return filter;
+}
+
+struct bloom_filter *get_or_compute_merge_bloom_filter(struct repository *r,
+						       struct commit *c,
+						       int compute_if_not_present,
+						       const struct bloom_filter_settings *settings,
+						       enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+	struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
+	struct diff_options diffopt;
+	struct commit_list *p;
+	int i, truncated = 0;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!merge_bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&merge_bloom_filters, c);
+
+	if (!filter->data) {
+		struct commit_graph *g;
+		uint32_t graph_pos;
+
+		g = repo_find_commit_pos_in_graph(r, c, &graph_pos);
+		if (g)
+			load_merge_bloom_filter_from_graph(g, filter, graph_pos);
+	}
+
+	/*
+	 * Unlike the first-parent filters, these are cheap enough to
+	 * compute again that a version mismatch is not worth upgrading.
+	 */
+	if (filter->data && filter->len &&
+	    (!settings || settings->hash_version == filter->version))
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	/* ensure commit is parsed so we have parent information */
+	repo_parse_commit(r, c);
+	if (!c->parents || !c->parents->next)
+		return NULL;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	diffopt.max_changes = settings->max_changed_paths;
+	diff_setup_done(&diffopt);
+
+	for (p = c->parents->next; p && !truncated; p = p->next) {
+		diff_tree_oid(&p->item->object.oid, &c->object.oid, "", &diffopt);
+		diffcore_std(&diffopt);
+
+		if (diff_queued_diff.nr > settings->max_changed_paths)
+			truncated = 1;
+		for (i = 0; !truncated && i < diff_queued_diff.nr; i++)
+			add_changed_path(&pathmap, diff_queued_diff.queue[i]->two->path);
+
+		diff_queue_clear(&diff_queued_diff);
+	}
+
+	if (truncated) {
+		init_truncated_large_filter(filter, settings->hash_version);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+	} else {
+		fill_bloom_filter(filter, &pathmap, settings, computed);
+	}
+
+	if (computed)
+		*computed |= BLOOM_COMPUTED;
+
+	hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
+	return filter;
+}
+
+/*
+ * An equivalent of the recursive, rename-less diff_tree_oid() in
+ * get_or_compute_bloom_filter(), which only counts and collects the
+ * changed paths and keeps all of its state to itself.
+ */
+struct bloom_tree_diff {
+	struct repository *repo;
+	struct hashmap pathmap;
+	struct strbuf path;
+	struct strbuf scratch;
+	size_t nr_changes;
+	size_t max_changes;
+};
+
+/*
+ * Deeper trees are left to the diff machinery, which knows about
+ * core.maxTreeDepth.
+ */
+#define BLOOM_TREE_DIFF_MAX_DEPTH 2048
+
+static int bloom_diff_trees(struct bloom_tree_diff *d,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    int depth);
+
+static int bloom_diff_changed(struct bloom_tree_diff *d,
+			      const struct name_entry *old_entry,
+			      const struct name_entry *new_entry,
+			      int depth)
+{
+	const struct name_entry *e = new_entry ? new_entry : old_entry;
+	size_t len = d->path.len;
+	int ret = 0;
+
+	/*
+	 * Whether a submodule change shows up in the diff depends on the
+	 * submodule configuration, so let the diff machinery decide.
+	 */
+	if ((old_entry && S_ISGITLINK(old_entry->mode)) ||
+	    (new_entry && S_ISGITLINK(new_entry->mode)))
+		return -1;
+
+	strbuf_add(&d->path, e->path, tree_entry_len(e));
+
+	if (S_ISDIR(e->mode)) {
+		strbuf_addch(&d->path, '/');
+		ret = bloom_diff_trees(d, old_entry ? &old_entry->oid : NULL,
+				       new_entry ? &new_entry->oid : NULL,
+				       depth + 1);
+	} else {
+		d->nr_changes++;
+		strbuf_reset(&d->scratch);
+		strbuf_addbuf(&d->scratch, &d->path);
+		add_changed_path(&d->pathmap, d->scratch.buf);
+	}
+
+	strbuf_setlen(&d->path, len);
+	return ret;
+}
+
+static int bloom_diff_trees(struct bloom_tree_diff *d,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    int depth)
+{
+	struct tree_desc t1, t2;
+	void *old_buf, *new_buf;
+	int ret = 0;
+
+	if (depth > BLOOM_TREE_DIFF_MAX_DEPTH)
+		return -1;
+
+	old_buf = fill_tree_descriptor(d->repo, &t1, old_oid);
+	new_buf = fill_tree_descriptor(d->repo, &t2, new_oid);
+
+	while (!ret && (t1.size || t2.size)) {
+		int cmp;
+
+		if (d->nr_changes > d->max_changes)
+			break;
+
+		if (!t1.size)
+			cmp = 1;
+		else if (!t2.size)
+			cmp = -1;
+		else
+			cmp = base_name_compare(t1.entry.path,
+						tree_entry_len(&t1.entry),
+						t1.entry.mode,
+						t2.entry.path,
+						tree_entry_len(&t2.entry),
+						t2.entry.mode);
+
+		if (cmp < 0) {
+			ret = bloom_diff_changed(d, &t1.entry, NULL, depth);
+			update_tree_entry(&t1);
+		} else if (cmp > 0) {
+			ret = bloom_diff_changed(d, NULL, &t2.entry, depth);
+			update_tree_entry(&t2);
+		} else {
+			if (!oideq(&t1.entry.oid, &t2.entry.oid) ||
+			    t1.entry.mode != t2.entry.mode)
+				ret = bloom_diff_changed(d, &t1.entry,
+							 &t2.entry, depth);
+			update_tree_entry(&t1);
+			update_tree_entry(&t2);
+		}
+	}
+
+	free(old_buf);
+	free(new_buf);
+	return ret;
+}
+
+int compute_bloom_filter_from_trees(struct repository *r,
+				    const struct object_id *parent_tree,
+				    const struct object_id *tree,
+				    const struct bloom_filter_settings *settings,
+				    struct bloom_filter *filter,
+				    enum bloom_filter_computed *computed)
+{
+	struct bloom_tree_diff d = {
+		.repo = r,
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+		.path = STRBUF_INIT,
+		.scratch = STRBUF_INIT,
+		.max_changes = settings->max_changed_paths,
+	};
+	int ret;
+
+	*computed = BLOOM_NOT_COMPUTED;
+
+	ret = bloom_diff_trees(&d, parent_tree, tree, 0);
+	if (!ret) {
+		if (d.nr_changes <= settings->max_changed_paths) {
+			fill_bloom_filter(filter, &d.pathmap, settings, computed);
+		} else {
+			init_truncated_large_filter(filter,
+						    settings->hash_version);
+			*computed |= BLOOM_TRUNC_LARGE;
+		}
+		*computed |= BLOOM_COMPUTED;
+	}
+
+	hashmap_clear_and_free(&d.pathmap, struct pathmap_hash_entry, entry);
+	strbuf_release(&d.path);
+	strbuf_release(&d.scratch);
+	return ret;
+}
+
+struct bloom_filter *set_bloom_filter(struct commit *c,
+				      struct bloom_filter *filter)
+{
+	struct bloom_filter *slot = bloom_filter_slab_at(&bloom_filters, c);
+
+	free_one_bloom_filter(slot);
+	*slot = *filter;
+	memset(filter, 0, sizeof(*filter));
+	return slot;
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -590,16 +938,34 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 	return 1;
 }
 
-int bloom_filter_contains_vec(const struct bloom_filter *filter,
-			      const struct bloom_keyvec *vec,
-			      const struct bloom_filter_settings *settings)
+int bloom_filter_contains_keyset(const struct bloom_filter *filter,
+				 struct bloom_keyset *set)
 {
-	int ret = 1;
+	size_t i, start = 0;
 
-	for (size_t nr = 0; ret > 0 && nr < vec->count; nr++)
-		ret = bloom_filter_contains(filter, &vec->key[nr], settings);
+	if (!filter->len)
+		return -1;
 
-	return ret;
+	memset(set->state, 0, set->keys_nr);
+
+	for (i = 0; i < set->paths_nr; start = set->path_end[i++]) {
+		size_t j;
+
+		for (j = start; j < set->path_end[i]; j++) {
+			size_t k = set->path_keys[j];
+
+			if (!set->state[k])
+				set->state[k] = 1 + bloom_filter_contains(filter,
+									 &set->keys[k],
+									 set->settings);
+			if (set->state[k] == 1)
+				break;
+		}
+		if (j == set->path_end[i])
+			return 1;
+	}
+
+	return 0;
 }
 
 uint32_t test_bloom_murmur3_seeded(uint32_t seed, const char *data, size_t len,
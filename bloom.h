@@ -2,6 +2,7 @@
 #define BLOOM_H
 
 struct commit;
+struct object_id;
 struct repository;
 struct commit_graph;
 
@@ -74,40 +75,31 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
-/*
- * A bloom_keyvec is a vector of bloom_keys, which
- * can be used to store multiple keys for a single
- * pathspec item.
- */
-struct bloom_keyvec {
-	size_t count;
-	struct bloom_key key[FLEX_ARRAY];
-};
-
 int load_bloom_filter_from_graph(struct commit_graph *g,
 				 struct bloom_filter *filter,
 				 uint32_t graph_pos);
+int load_merge_bloom_filter_from_graph(struct commit_graph *g,
+				       struct bloom_filter *filter,
+				       uint32_t graph_pos);
 
 void bloom_key_fill(struct bloom_key *key, const char *data, size_t len,
 		    const struct bloom_filter_settings *settings);
 void bloom_key_clear(struct bloom_key *key);
 
 /*
- * bloom_keyvec_new - Allocate and populate a bloom_keyvec with keys for the
- * given path.
- *
- * This function splits the input path by '/' and generates a bloom key for each
- * prefix, in reverse order of specificity. For example, given the input
- * "a/b/c", it will generate bloom keys for:
- *   - "a/b/c"
- *   - "a/b"
- *   - "a"
- *
- * The resulting keys are stored in a newly allocated bloom_keyvec.
+ * A bloom_keyset holds the keys for several paths and each of their
+ * leading directories. For example, adding "a/b/c" adds keys for "a",
+ * "a/b" and "a/b/c". Keys the paths have in common (such as those of a
+ * shared leading directory) are computed and tested against each filter
+ * only once, which makes a difference for walks limited to hundreds of
+ * paths.
  */
-struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
-				      const struct bloom_filter_settings *settings);
-void bloom_keyvec_free(struct bloom_keyvec *vec);
+struct bloom_keyset;
+
+struct bloom_keyset *bloom_keyset_new(const struct bloom_filter_settings *settings);
+void bloom_keyset_add(struct bloom_keyset *set, const char *path, size_t len);
+size_t bloom_keyset_nr(const struct bloom_keyset *set);
+void bloom_keyset_free(struct bloom_keyset *set);
 
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
@@ -130,6 +122,34 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 const struct bloom_filter_settings *settings,
 						 enum bloom_filter_computed *computed);
 
+/*
+ * Compute into "filter" the changed-path Bloom filter for a commit whose
+ * root tree is "tree", and whose first parent has the root tree
+ * "parent_tree" (NULL for root commits).
+ *
+ * Unlike get_or_compute_bloom_filter(), this neither looks at nor
+ * stores anything in the filters kept for each commit, and does not go
+ * through the diff machinery. It may therefore be called from several
+ * threads at once, as long as enable_obj_read_lock() is in effect.
+ *
+ * Returns 0 on success, and -1 if the trees contain something that
+ * only get_or_compute_bloom_filter() knows how to handle (such as a
+ * submodule), in which case "filter" is left untouched.
+ */
+int compute_bloom_filter_from_trees(struct repository *r,
+				    const struct object_id *parent_tree,
+				    const struct object_id *tree,
+				    const struct bloom_filter_settings *settings,
+				    struct bloom_filter *filter,
+				    enum bloom_filter_computed *computed);
+
+/*
+ * Make "filter" the Bloom filter of commit "c", taking over its data,
+ * and return the stored filter.
+ */
+struct bloom_filter *set_bloom_filter(struct commit *c,
+				      struct bloom_filter *filter);
+
 /*
  * Find the Bloom filter associated with the given commit "c".
  *
@@ -149,20 +169,37 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
  */
 struct bloom_filter *get_bloom_filter(struct repository *r, struct commit *c);
 
+/*
+ * The merge filter of a merge commit "c" holds the paths which differ
+ * between "c" and any of its parents but the first, so that a path not
+ * in it is known to be unchanged against every one of those parents.
+ * There are no merge filters for commits with fewer than two parents.
+ *
+ * These work like their first-parent counterparts above, except that a
+ * stored filter with a hash version other than that of "settings" is
+ * computed again instead of being upgraded.
+ */
+struct bloom_filter *get_or_compute_merge_bloom_filter(struct repository *r,
+						       struct commit *c,
+						       int compute_if_not_present,
+						       const struct bloom_filter_settings *settings,
+						       enum bloom_filter_computed *computed);
+struct bloom_filter *get_merge_bloom_filter(struct repository *r,
+					    struct commit *c);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
 /*
- * bloom_filter_contains_vec - Check if all keys in a key vector are in the
- * Bloom filter.
+ * Check if any of the paths in the key set may be in the Bloom filter,
+ * i.e. if the filter contains all keys of one of them.
  *
- * Returns 1 if **all** keys in the vector are present in the filter,
- * 0 if **any** key is not present.
+ * Returns 1 if one of the paths may be present, 0 if none of them is,
+ * and -1 if the filter is empty.
  */
-int bloom_filter_contains_vec(const struct bloom_filter *filter,
-			      const struct bloom_keyvec *v,
-			      const struct bloom_filter_settings *settings);
+int bloom_filter_contains_keyset(const struct bloom_filter *filter,
+				 struct bloom_keyset *set);
 
 uint32_t test_bloom_murmur3_seeded(uint32_t seed, const char *data, size_t len,
 				   int version);
@@ -9,6 +9,7 @@
 #include "commit-graph.h"
 #include "odb.h"
 #include "progress.h"
+#include "thread-utils.h"
 #include "replace-object.h"
 #include "strbuf.h"
 #include "tag.h"
@@ -20,8 +21,9 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
-	   "                       <split-options>")
+	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--threads=<n>]\n" \
+	   "                       [--[no-]merge-changed-paths] [--[no-]reachability-index]\n" \
+	   "                       [--[no-]progress] <split-options>")
 
 static const char * const builtin_commit_graph_verify_usage[] = {
 	BUILTIN_COMMIT_GRAPH_VERIFY_USAGE,
@@ -49,6 +51,8 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int enable_merge_changed_paths;
+	int enable_reachability_index;
 } opts;
 
 static struct option common_opts[] = {
@@ -212,6 +216,10 @@ static int git_commit_graph_write_config(const char *var, const char *value,
 		write_opts.max_new_filters = git_config_int(var, value, ctx->kvi);
 	else if (!strcmp(var, "commitgraph.changedpaths"))
 		opts.enable_changed_paths = git_config_bool(var, value) ? 1 : -1;
+	else if (!strcmp(var, "commitgraph.mergechangedpaths"))
+		opts.enable_merge_changed_paths = git_config_bool(var, value) ? 1 : -1;
+	else if (!strcmp(var, "commitgraph.reachabilityindex"))
+		opts.enable_reachability_index = git_config_bool(var, value) ? 1 : -1;
 	/*
 	 * No need to fall-back to 'git_default_config', since this was already
 	 * called in 'cmd_commit_graph()'.
@@ -241,6 +249,10 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "merge-changed-paths", &opts.enable_merge_changed_paths,
+			N_("also compute changed paths of merges against their other parents")),
+		OPT_BOOL(0, "reachability-index", &opts.enable_reachability_index,
+			N_("write an index to answer reachability queries")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
@@ -254,6 +266,9 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 		OPT_CALLBACK_F(0, "max-new-filters", &write_opts.max_new_filters,
 			NULL, N_("maximum number of changed-path Bloom filters to compute"),
 			0, write_option_max_new_filters),
+		OPT_INTEGER_F(0, "threads", &write_opts.threads,
+			N_("use up to <n> threads to compute changed-path Bloom filters"),
+			PARSE_OPT_NONEG),
 		OPT_BOOL(0, "progress", &opts.progress,
 			 N_("force progress reporting")),
 		OPT_END(),
@@ -262,10 +277,13 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.enable_merge_changed_paths = -1;
+	opts.enable_reachability_index = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
 	write_opts.max_new_filters = -1;
+	write_opts.threads = 1;
 
 	trace2_cmd_mode("write");
 
@@ -279,6 +297,11 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 
 	if (opts.reachable + opts.stdin_packs + opts.stdin_commits > 1)
 		die(_("use at most one of --reachable, --stdin-commits, or --stdin-packs"));
+	if (write_opts.threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    write_opts.threads);
+	if (!write_opts.threads)
+		write_opts.threads = online_cpus();
 	if (!opts.obj_dir)
 		opts.obj_dir = repo_get_object_directory(the_repository);
 	if (opts.append)
@@ -292,6 +315,14 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (!opts.enable_merge_changed_paths)
+		flags |= COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS;
+	else if (opts.enable_merge_changed_paths == 1)
+		flags |= COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS;
+	if (!opts.enable_reachability_index)
+		flags |= COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX;
+	else if (opts.enable_reachability_index == 1)
+		flags |= COMMIT_GRAPH_WRITE_REACHABILITY_INDEX;
 
 	source = odb_find_source_or_die(the_repository->objects, opts.obj_dir);
 
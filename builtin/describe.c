@@ -3,6 +3,7 @@
 
 #include "builtin.h"
 #include "config.h"
+#include "describe-index.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hex.h"
@@ -25,6 +26,8 @@
 #include "wildmatch.h"
 #include "prio-queue.h"
 #include "oidset.h"
+#include "quote.h"
+#include "trace2.h"
 
 #define MAX_TAGS	(FLAG_BITS - 1)
 #define DEFAULT_CANDIDATES 10
@@ -52,6 +55,9 @@ static struct string_list exclude_patterns = STRING_LIST_INIT_NODUP;
 static int always;
 static const char *suffix, *dirty, *broken;
 static struct commit_names commit_names;
+static struct describe_index *describe_index;
+static struct strbuf describe_index_key = STRBUF_INIT;
+static intmax_t describe_index_hits;
 
 /* diff-index command arguments to check if working tree is dirty. */
 static const char *diff_index_args[] = {
@@ -362,6 +368,65 @@ static void append_suffix(int depth, const struct object_id *oid, struct strbuf
 		    repo_find_unique_abbrev(the_repository, oid, abbrev));
 }
 
+/*
+ * The options that influence which tag describes a commit, quoted so
+ * that they can be passed to "git describe" again.
+ */
+static void prepare_describe_index_key(void)
+{
+	struct strvec args = STRVEC_INIT;
+	struct string_list_item *item;
+
+	strvec_pushf(&args, "--candidates=%d", max_candidates);
+	if (tags)
+		strvec_push(&args, "--tags");
+	if (first_parent)
+		strvec_push(&args, "--first-parent");
+	for_each_string_list_item(item, &patterns)
+		strvec_pushf(&args, "--match=%s", item->string);
+	for_each_string_list_item(item, &exclude_patterns)
+		strvec_pushf(&args, "--exclude=%s", item->string);
+
+	sq_quote_argv(&describe_index_key, args.v);
+	strbuf_ltrim(&describe_index_key);
+	strvec_clear(&args);
+}
+
+static int describe_commit_from_index(struct commit *cmit, struct strbuf *dst)
+{
+	const struct describe_index_entry *e;
+	struct commit_name *n;
+	unsigned int names_nr = hashmap_get_size(&names);
+
+	e = describe_index_get(describe_index, DESCRIBE_INDEX_DESCRIBE,
+			       describe_index_key.buf, &cmit->object.oid);
+	if (!e)
+		return 0;
+
+	/*
+	 * The search gives up as soon as it has found as many candidates
+	 * as there are names. Unless it stopped because it had enough
+	 * candidates anyway, it would have stopped at the same point only
+	 * if it stopped for this reason with the same number of names, or
+	 * if it did not and there still are more names than it found.
+	 */
+	if (e->match_nr != max_candidates &&
+	    (e->names_nr ? e->names_nr != names_nr : e->match_nr >= names_nr))
+		return 0;
+
+	n = find_commit_name(&e->tagged);
+	if (!n || (!tags && n->prio < 2))
+		return 0;
+
+	describe_index_hits++;
+	append_name(n, dst);
+	if (n->misnamed || abbrev)
+		append_suffix(e->depth, &cmit->object.oid, dst);
+	if (suffix)
+		strbuf_addstr(dst, suffix);
+	return 1;
+}
+
 static void describe_commit(struct commit *cmit, struct strbuf *dst)
 {
 	struct commit *gave_up_on = NULL;
@@ -387,6 +452,8 @@ static void describe_commit(struct commit *cmit, struct strbuf *dst)
 
 	if (!max_candidates)
 		die(_("no tag exactly matches '%s'"), oid_to_hex(&cmit->object.oid));
+	if (describe_index && describe_commit_from_index(cmit, dst))
+		return;
 	if (debug)
 		fprintf(stderr, _("No exact match on refs or tags, searching to describe\n"));
 
@@ -503,6 +570,19 @@ static void describe_commit(struct commit *cmit, struct strbuf *dst)
 	seen_commits += finish_depth_computation(&queue, &all_matches[0]);
 	lazy_queue_clear(&queue);
 
+	if (describe_index) {
+		struct describe_index_entry e = {
+			.depth = all_matches[0].depth,
+			.match_nr = match_cnt,
+		};
+
+		if (gave_up_on && match_cnt != max_candidates)
+			e.names_nr = hashmap_get_size(&names);
+		oidcpy(&e.tagged, &all_matches[0].name->peeled);
+		describe_index_put(describe_index, DESCRIBE_INDEX_DESCRIBE,
+				   describe_index_key.buf, &cmit->object.oid, &e);
+	}
+
 	if (debug) {
 		static int label_width = -1;
 		if (label_width < 0) {
@@ -641,7 +721,7 @@ int cmd_describe(int argc,
 		 const char *prefix,
 		 struct repository *repo UNUSED )
 {
-	int contains = 0;
+	int contains = 0, use_index = 0;
 	struct option options[] = {
 		OPT_BOOL(0, "contains",   &contains, N_("find the tag that comes after the commit")),
 		OPT_BOOL(0, "debug",      &debug, N_("debug search strategy on stderr")),
@@ -737,6 +817,17 @@ int cmd_describe(int argc,
 		return ret;
 	}
 
+	/*
+	 * Load the index before looking at the tags, so that it is never
+	 * newer than the tags the names it records were computed from.
+	 */
+	if (!all && !repo_config_get_bool(the_repository, "core.describeindex",
+					  &use_index) && use_index) {
+		describe_index = describe_index_load(the_repository);
+		if (describe_index)
+			prepare_describe_index_key();
+	}
+
 	hashmap_init(&names, commit_name_neq, NULL, 0);
 	refs_for_each_rawref(get_main_ref_store(the_repository), get_name,
 			     NULL);
@@ -811,5 +902,13 @@ int cmd_describe(int argc,
 		while (argc-- > 0)
 			describe(*argv++, argc == 0);
 	}
+
+	if (describe_index) {
+		trace2_data_intmax("describe-index", the_repository, "hits",
+				   describe_index_hits);
+		describe_index_write(describe_index);
+		describe_index_free(describe_index);
+		strbuf_release(&describe_index_key);
+	}
 	return 0;
 }
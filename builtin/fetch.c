@@ -495,8 +495,9 @@ static struct ref *get_ref_map(struct remote *remote,
 	/* opportunistically-updated references: */
 	struct ref *orefs = NULL, **oref_tail = &orefs;
 
-	struct hashmap existing_refs;
-	int existing_refs_populated = 0;
+	struct ref_read_request *peer_reads = NULL;
+	struct ref **peers = NULL;
+	size_t peers_nr = 0, peers_alloc = 0;
 
 	filter_prefetch_refspec(rs);
 	if (remote)
@@ -609,31 +610,34 @@ static struct ref *get_ref_map(struct remote *remote,
 
 	ref_map = ref_remove_duplicates(ref_map);
 
+	/*
+	 * Look up the current values of the local refs we are about to
+	 * update. Only refs under "refs/" are considered, as those are the
+	 * ones iterating over the local refs would have found.
+	 */
 	for (rm = ref_map; rm; rm = rm->next) {
-		if (rm->peer_ref) {
-			const char *refname = rm->peer_ref->name;
-			struct refname_hash_entry *peer_item;
-			unsigned int hash = strhash(refname);
-
-			if (!existing_refs_populated) {
-				refname_hash_init(&existing_refs);
-				refs_for_each_ref(get_main_ref_store(the_repository),
-						  add_one_refname,
-						  &existing_refs);
-				existing_refs_populated = 1;
-			}
-
-			peer_item = hashmap_get_entry_from_hash(&existing_refs,
-						hash, refname,
-						struct refname_hash_entry, ent);
-			if (peer_item) {
-				struct object_id *old_oid = &peer_item->oid;
-				oidcpy(&rm->peer_ref->old_oid, old_oid);
-			}
+		if (rm->peer_ref && starts_with(rm->peer_ref->name, "refs/")) {
+			ALLOC_GROW(peers, peers_nr + 1, peers_alloc);
+			peers[peers_nr++] = rm->peer_ref;
 		}
 	}
-	if (existing_refs_populated)
-		hashmap_clear_and_free(&existing_refs, struct refname_hash_entry, ent);
+	if (peers_nr) {
+		CALLOC_ARRAY(peer_reads, peers_nr);
+		for (size_t j = 0; j < peers_nr; j++)
+			peer_reads[j].refname = peers[j]->name;
+
+		refs_read_refs_many(get_main_ref_store(the_repository),
+				    peer_reads, peers_nr, RESOLVE_REF_READING);
+
+		for (size_t j = 0; j < peers_nr; j++)
+			if (peer_reads[j].resolved &&
+			    !(peer_reads[j].flags & REF_ISBROKEN))
+				oidcpy(&peers[j]->old_oid, &peer_reads[j].oid);
+
+		ref_read_requests_release(peer_reads, peers_nr);
+		free(peer_reads);
+	}
+	free(peers);
 
 	return ref_map;
 }
@@ -9,6 +9,7 @@
 #include "ref-filter.h"
 #include "strbuf.h"
 #include "strvec.h"
+#include "thread-utils.h"
 
 int for_each_ref_core(int argc, const char **argv, const char *prefix, struct repository *repo, const char *const *usage)
 {
@@ -49,10 +50,12 @@ int for_each_ref_core(int argc, const char **argv, const char *prefix, struct re
 		OPT_BOOL(0, "ignore-case", &icase, N_("sorting and filtering are case insensitive")),
 		OPT_BOOL(0, "stdin", &from_stdin, N_("read reference patterns from stdin")),
 		OPT_BOOL(0, "include-root-refs", &include_root_refs, N_("also include HEAD ref and pseudorefs")),
+		OPT_INTEGER(0, "threads", &format.array_opts.threads, N_("use <n> threads to read objects")),
 		OPT_END(),
 	};
 
 	format.format = "%(objectname) %(objecttype)\t%(refname)";
+	format.array_opts.threads = 1;
 
 	repo_config(repo, git_default_config, NULL);
 
@@ -64,6 +67,12 @@ int for_each_ref_core(int argc, const char **argv, const char *prefix, struct re
 		error("invalid --count argument: `%d'", format.array_opts.max_count);
 		usage_with_options(usage, opts);
 	}
+	if (format.array_opts.threads < 0) {
+		error("invalid --threads argument: `%d'", format.array_opts.threads);
+		usage_with_options(usage, opts);
+	}
+	if (!format.array_opts.threads)
+		format.array_opts.threads = online_cpus();
 	if (HAS_MULTI_BITS(format.quote_style)) {
 		error("more than one quoting style?");
 		usage_with_options(usage, opts);
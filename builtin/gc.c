@@ -16,6 +16,7 @@
 #include "builtin.h"
 #include "abspath.h"
 #include "date.h"
+#include "describe-index.h"
 #include "dir.h"
 #include "environment.h"
 #include "hex.h"
@@ -25,6 +26,7 @@
 #include "parse-options.h"
 #include "run-command.h"
 #include "sigchain.h"
+#include "strmap.h"
 #include "strvec.h"
 #include "commit.h"
 #include "commit-graph.h"
@@ -33,6 +35,8 @@
 #include "pack.h"
 #include "pack-objects.h"
 #include "path.h"
+#include "quote.h"
+#include "oid-array.h"
 #include "reflog.h"
 #include "repack.h"
 #include "rerere.h"
@@ -263,6 +267,7 @@ enum maintenance_task_label {
 	TASK_REFLOG_EXPIRE,
 	TASK_WORKTREE_PRUNE,
 	TASK_RERERE_GC,
+	TASK_DESCRIBE_INDEX,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1224,6 +1229,176 @@ static int maintenance_task_commit_graph(struct maintenance_run_opts *opts,
 	return 0;
 }
 
+static int describe_index_enabled(void)
+{
+	int enabled = 0;
+
+	repo_config_get_bool(the_repository, "core.describeindex", &enabled);
+	return enabled;
+}
+
+static int describe_index_condition(struct gc_config *cfg UNUSED)
+{
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
+	if (!describe_index_enabled())
+		return 0;
+
+	strbuf_addf(&path, "%s/info/describe-index",
+		    repo_get_object_directory(the_repository));
+	ret = file_exists(path.buf);
+	strbuf_release(&path);
+	return ret;
+}
+
+struct describe_index_todo {
+	/* "<kind> <key>" to the commits to name with these options */
+	struct strmap groups;
+	struct oid_array branch_tips;
+};
+
+static struct oid_array *describe_index_group(struct describe_index_todo *todo,
+					      enum describe_index_kind kind,
+					      const char *key)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct oid_array *commits;
+
+	strbuf_addf(&buf, "%d %s", (int)kind, key);
+	commits = strmap_get(&todo->groups, buf.buf);
+	if (!commits) {
+		CALLOC_ARRAY(commits, 1);
+		strmap_put(&todo->groups, buf.buf, commits);
+	}
+	strbuf_release(&buf);
+	return commits;
+}
+
+static void add_dropped_describe_entry(enum describe_index_kind kind,
+				       const char *key,
+				       const struct object_id *commit,
+				       void *data)
+{
+	oid_array_append(describe_index_group(data, kind, key), commit);
+}
+
+static void add_branch_tips_to_describe(enum describe_index_kind kind,
+					const char *key,
+					const struct object_id *commit UNUSED,
+					void *data)
+{
+	struct describe_index_todo *todo = data;
+	struct oid_array *commits;
+
+	/* name-rev cannot name commits that no tag contains yet */
+	if (kind != DESCRIBE_INDEX_DESCRIBE)
+		return;
+
+	commits = describe_index_group(todo, kind, key);
+	for (size_t i = 0; i < todo->branch_tips.nr; i++)
+		oid_array_append(commits, &todo->branch_tips.oid[i]);
+}
+
+static int collect_branch_tip(const struct reference *ref, void *cb_data)
+{
+	struct oid_array *tips = cb_data;
+	oid_array_append(tips, ref->oid);
+	return 0;
+}
+
+static int run_describe_index_group(const char *group, struct oid_array *commits)
+{
+	const size_t batch = 1000;
+	enum describe_index_kind kind = *group - '0';
+	char *key = xstrdup(group + 2);
+	struct strvec args = STRVEC_INIT;
+	int ret = 0;
+
+	if (sq_dequote_to_strvec(key, &args) < 0) {
+		free(key);
+		strvec_clear(&args);
+		return 0;
+	}
+
+	oid_array_sort(commits);
+	for (size_t i = 0; i < commits->nr; i += batch) {
+		struct child_process child = CHILD_PROCESS_INIT;
+
+		child.git_cmd = 1;
+		child.no_stdin = 1;
+		child.no_stdout = 1;
+		child.no_stderr = 1;
+		strvec_pushl(&child.args, "-c", "core.describeIndex=true",
+			     kind == DESCRIBE_INDEX_DESCRIBE ? "describe" : "name-rev",
+			     NULL);
+		strvec_pushv(&child.args, args.v);
+		if (kind == DESCRIBE_INDEX_DESCRIBE)
+			strvec_push(&child.args, "--always");
+		for (size_t j = i; j < commits->nr && j < i + batch; j++) {
+			if (j > i && oideq(&commits->oid[j], &commits->oid[j - 1]))
+				continue;
+			strvec_push(&child.args, oid_to_hex(&commits->oid[j]));
+		}
+
+		if (run_command(&child) < 0)
+			ret = -1;
+	}
+
+	free(key);
+	strvec_clear(&args);
+	return ret;
+}
+
+static int maintenance_task_describe_index(struct maintenance_run_opts *opts UNUSED,
+					   struct gc_config *cfg UNUSED)
+{
+	struct describe_index_todo todo = {
+		.groups = STRMAP_INIT,
+		.branch_tips = OID_ARRAY_INIT,
+	};
+	struct describe_index *idx;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	int ret = 0;
+
+	if (!describe_index_enabled())
+		return 0;
+
+	/*
+	 * Loading the index drops the names that changed tags may have
+	 * influenced. Write it back first, then name those commits again,
+	 * together with the tips of the local branches, which are the
+	 * commits most likely to be described next.
+	 */
+	idx = describe_index_load(the_repository);
+	if (!idx)
+		return 0;
+	refs_for_each_branch_ref(get_main_ref_store(the_repository),
+				 collect_branch_tip, &todo.branch_tips);
+	describe_index_for_each_dropped(idx, add_dropped_describe_entry, &todo);
+	describe_index_for_each_key(idx, add_branch_tips_to_describe, &todo);
+	if (describe_index_write(idx) < 0)
+		ret = 1;
+	describe_index_free(idx);
+
+	strmap_for_each_entry(&todo.groups, &iter, e) {
+		struct oid_array *commits = e->value;
+
+		/*
+		 * A commit that cannot be named any more is not an error
+		 * for this task, so only report failures to run.
+		 */
+		if (run_describe_index_group(e->key, commits) < 0)
+			ret = 1;
+		oid_array_clear(commits);
+	}
+
+	strmap_clear(&todo.groups, 1);
+	oid_array_clear(&todo.branch_tips);
+	return ret;
+}
+
 static int fetch_remote(struct remote *remote, void *cbdata)
 {
 	struct maintenance_run_opts *opts = cbdata;
@@ -1755,6 +1930,11 @@ static const struct maintenance_task tasks[] = {
 		.background = maintenance_task_rerere_gc,
 		.auto_condition = rerere_gc_condition,
 	},
+	[TASK_DESCRIBE_INDEX] = {
+		.name = "describe-index",
+		.background = maintenance_task_describe_index,
+		.auto_condition = describe_index_condition,
+	},
 };
 
 enum task_phase {
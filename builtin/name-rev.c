@@ -7,6 +7,7 @@
 #include "hex.h"
 #include "config.h"
 #include "commit.h"
+#include "describe-index.h"
 #include "tag.h"
 #include "refs.h"
 #include "object-name.h"
@@ -18,6 +19,10 @@
 #include "commit-graph.h"
 #include "wildmatch.h"
 #include "mem-pool.h"
+#include "quote.h"
+#include "strmap.h"
+#include "strvec.h"
+#include "trace2.h"
 
 /*
  * One day.  See the 'name a rev shortly after epoch' test in t6120 when
@@ -27,6 +32,7 @@
 
 struct rev_name {
 	const char *tip_name;
+	const char *refname;
 	timestamp_t taggerdate;
 	int generation;
 	int distance;
@@ -34,10 +40,12 @@ struct rev_name {
 };
 
 define_commit_slab(commit_rev_name, struct rev_name);
+define_commit_slab(commit_indexed_name, const char *);
 
 static timestamp_t generation_cutoff = GENERATION_NUMBER_INFINITY;
 static timestamp_t cutoff = TIME_MAX;
 static struct commit_rev_name rev_names;
+static struct commit_indexed_name indexed_names;
 
 /* Disable the cutoff checks entirely */
 static void disable_cutoff(void)
@@ -175,8 +183,9 @@ static char *get_parent_name(const struct rev_name *name, int parent_number,
 }
 
 static void name_rev(struct commit *start_commit,
-		const char *tip_name, timestamp_t taggerdate,
-		int from_tag, int deref, struct mem_pool *string_pool)
+		const char *refname, const char *tip_name,
+		timestamp_t taggerdate, int from_tag, int deref,
+		struct mem_pool *string_pool)
 {
 	struct prio_queue queue;
 	struct commit *commit;
@@ -197,6 +206,7 @@ static void name_rev(struct commit *start_commit,
 						       tip_name);
 	else
 		start_name->tip_name = mem_pool_strdup(string_pool, tip_name);
+	start_name->refname = refname;
 
 	memset(&queue, 0, sizeof(queue)); /* Use the prio_queue as LIFO */
 	prio_queue_put(&queue, start_commit);
@@ -238,6 +248,7 @@ static void name_rev(struct commit *start_commit,
 								string_pool);
 				else
 					parent_name->tip_name = name->tip_name;
+				parent_name->refname = name->refname;
 				ALLOC_GROW(parents_to_queue,
 					   parents_to_queue_nr + 1,
 					   parents_to_queue_alloc);
@@ -281,6 +292,7 @@ static struct tip_table {
 	struct tip_table_entry {
 		struct object_id oid;
 		const char *refname;
+		const char *full_refname;
 		struct commit *commit;
 		timestamp_t taggerdate;
 		unsigned int from_tag:1;
@@ -296,6 +308,7 @@ static void add_to_tip_table(const struct object_id *oid, const char *refname,
 			     timestamp_t taggerdate, int from_tag, int deref)
 {
 	char *short_refname = NULL;
+	const char *full_refname = refname;
 
 	if (shorten_unambiguous)
 		short_refname = refs_shorten_unambiguous_ref(get_main_ref_store(the_repository),
@@ -309,6 +322,7 @@ static void add_to_tip_table(const struct object_id *oid, const char *refname,
 	oidcpy(&tip_table.table[tip_table.nr].oid, oid);
 	tip_table.table[tip_table.nr].refname = short_refname ?
 		short_refname : xstrdup(refname);
+	tip_table.table[tip_table.nr].full_refname = xstrdup(full_refname);
 	tip_table.table[tip_table.nr].commit = commit;
 	tip_table.table[tip_table.nr].taggerdate = taggerdate;
 	tip_table.table[tip_table.nr].from_tag = from_tag;
@@ -427,8 +441,9 @@ static void name_tips(struct mem_pool *string_pool)
 	for (i = 0; i < tip_table.nr; i++) {
 		struct tip_table_entry *e = &tip_table.table[i];
 		if (e->commit) {
-			name_rev(e->commit, e->refname, e->taggerdate,
-				 e->from_tag, e->deref, string_pool);
+			name_rev(e->commit, e->full_refname, e->refname,
+				 e->taggerdate, e->from_tag, e->deref,
+				 string_pool);
 		}
 	}
 }
@@ -463,10 +478,14 @@ static const char *get_rev_name(const struct object *o, struct strbuf *buf)
 {
 	struct rev_name *n;
 	const struct commit *c;
+	const char **indexed;
 
 	if (o->type != OBJ_COMMIT)
 		return get_exact_ref_match(o);
 	c = (const struct commit *) o;
+	indexed = commit_indexed_name_peek(&indexed_names, c);
+	if (indexed && *indexed)
+		return *indexed;
 	n = get_commit_rev_name(c);
 	if (!n)
 		return NULL;
@@ -505,6 +524,101 @@ static void show_name(const struct object *obj,
 	strbuf_release(&buf);
 }
 
+/*
+ * The options that influence the name of a commit, quoted so that they
+ * can be passed to "git name-rev" again.
+ */
+static void describe_index_key(struct strbuf *key, struct name_ref_data *data)
+{
+	struct strvec args = STRVEC_INIT;
+	struct string_list_item *item;
+
+	strvec_push(&args, "--tags");
+	for_each_string_list_item(item, &data->ref_filters)
+		strvec_pushf(&args, "--refs=%s", item->string);
+	for_each_string_list_item(item, &data->exclude_filters)
+		strvec_pushf(&args, "--exclude=%s", item->string);
+
+	sq_quote_argv(key, args.v);
+	strbuf_ltrim(key);
+	strvec_clear(&args);
+}
+
+/*
+ * Name the commits in "commits" from the index where possible. The
+ * names of the tips are looked up again, as whether they can be
+ * abbreviated depends on the other refs. Returns the number of commits
+ * that could not be named, after setting the cutoff for each of them.
+ */
+static size_t name_from_describe_index(struct describe_index *idx,
+				       const char *key,
+				       struct commit **commits, size_t nr,
+				       struct strmap *tip_names,
+				       struct mem_pool *string_pool)
+{
+	size_t missing = 0;
+
+	for (size_t i = 0; i < tip_table.nr; i++)
+		strmap_put(tip_names, tip_table.table[i].full_refname,
+			   (void *)tip_table.table[i].refname);
+
+	for (size_t i = 0; i < nr; i++) {
+		const struct describe_index_entry *e;
+		const char *tip_name = NULL;
+
+		e = describe_index_get(idx, DESCRIBE_INDEX_NAME_REV, key,
+				       &commits[i]->object.oid);
+		if (e)
+			tip_name = strmap_get(tip_names, e->refname);
+		if (!tip_name) {
+			set_commit_cutoff(commits[i]);
+			commits[missing++] = commits[i];
+			continue;
+		}
+
+		*commit_indexed_name_at(&indexed_names, commits[i]) =
+			mem_pool_strfmt(string_pool, "%s%s", tip_name, e->suffix);
+	}
+
+	return missing;
+}
+
+/*
+ * Record the names that were found by walking. Unless every commit that
+ * was walked to had a generation number, the cutoff may have hidden a
+ * better name, and the names are not worth keeping.
+ */
+static void update_describe_index(struct describe_index *idx,
+				  const char *key,
+				  struct commit **commits, size_t nr,
+				  struct strmap *tip_names)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (generation_cutoff == GENERATION_NUMBER_INFINITY)
+		return;
+
+	for (size_t i = 0; i < nr; i++) {
+		struct rev_name *n = get_commit_rev_name(commits[i]);
+		struct describe_index_entry e = { 0 };
+		const char *tip_name, *name;
+
+		if (!n || !n->refname ||
+		    commit_graph_generation(commits[i]) == GENERATION_NUMBER_INFINITY)
+			continue;
+		tip_name = strmap_get(tip_names, n->refname);
+		name = get_rev_name(&commits[i]->object, &buf);
+		if (!tip_name || !name || !skip_prefix(name, tip_name, &e.suffix))
+			continue;
+
+		e.refname = n->refname;
+		describe_index_put(idx, DESCRIBE_INDEX_NAME_REV, key,
+				   &commits[i]->object.oid, &e);
+	}
+
+	strbuf_release(&buf);
+}
+
 static char const * const name_rev_usage[] = {
 	N_("git name-rev [<options>] <commit>..."),
 	N_("git name-rev [<options>] --all"),
@@ -566,6 +680,12 @@ int cmd_name_rev(int argc,
 {
 	struct mem_pool string_pool;
 	struct object_array revs = OBJECT_ARRAY_INIT;
+	struct describe_index *idx = NULL;
+	struct strbuf index_key = STRBUF_INIT;
+	struct strmap tip_names = STRMAP_INIT;
+	struct commit **commits = NULL;
+	size_t commits_nr = 0, commits_alloc = 0, indexed_nr = 0;
+	int use_index = 0;
 
 #ifndef WITH_BREAKING_CHANGES
 	int transform_stdin = 0;
@@ -599,6 +719,7 @@ int cmd_name_rev(int argc,
 
 	mem_pool_init(&string_pool, 0);
 	init_commit_rev_name(&rev_names);
+	init_commit_indexed_name(&indexed_names);
 	repo_config(the_repository, git_default_config, NULL);
 	argc = parse_options(argc, argv, prefix, opts, name_rev_usage, 0);
 
@@ -618,6 +739,19 @@ int cmd_name_rev(int argc,
 	if (all || annotate_stdin)
 		disable_cutoff();
 
+	/*
+	 * Only names derived from tags can be kept in the index. Load it
+	 * before looking at the tags, so that it is never newer than the
+	 * tags the names it records were computed from.
+	 */
+	if (data.tags_only && argc &&
+	    !repo_config_get_bool(the_repository, "core.describeindex",
+				  &use_index) && use_index) {
+		idx = describe_index_load(the_repository);
+		if (idx)
+			describe_index_key(&index_key, &data);
+	}
+
 	for (; argc; argc--, argv++) {
 		struct object_id oid;
 		struct object *object;
@@ -644,8 +778,12 @@ int cmd_name_rev(int argc,
 			continue;
 		}
 
-		if (commit)
+		if (commit && idx) {
+			ALLOC_GROW(commits, commits_nr + 1, commits_alloc);
+			commits[commits_nr++] = commit;
+		} else if (commit) {
 			set_commit_cutoff(commit);
+		}
 
 		if (peel_tag) {
 			if (!commit) {
@@ -658,10 +796,29 @@ int cmd_name_rev(int argc,
 		add_object_array(object, *argv, &revs);
 	}
 
+	refs_for_each_ref(get_main_ref_store(the_repository), name_ref, &data);
+
+	if (idx) {
+		size_t missing = name_from_describe_index(idx, index_key.buf,
+							  commits, commits_nr,
+							  &tip_names,
+							  &string_pool);
+		indexed_nr = commits_nr - missing;
+		commits_nr = missing;
+	}
+
 	adjust_cutoff_timestamp_for_slop();
 
-	refs_for_each_ref(get_main_ref_store(the_repository), name_ref, &data);
-	name_tips(&string_pool);
+	if (!idx || commits_nr)
+		name_tips(&string_pool);
+
+	if (idx) {
+		update_describe_index(idx, index_key.buf, commits, commits_nr,
+				      &tip_names);
+		trace2_data_intmax("describe-index", the_repository, "hits",
+				   indexed_nr);
+		describe_index_write(idx);
+	}
 
 	if (annotate_stdin) {
 		struct strbuf sb = STRBUF_INIT;
@@ -693,5 +850,9 @@ int cmd_name_rev(int argc,
 	string_list_clear(&data.exclude_filters, 0);
 	mem_pool_discard(&string_pool, 0);
 	object_array_clear(&revs);
+	describe_index_free(idx);
+	strbuf_release(&index_key);
+	strmap_clear(&tip_names, 0);
+	free(commits);
 	return 0;
 }
@@ -343,6 +343,7 @@ static void show_one_alternate_ref(const struct object_id *oid,
 static void write_head_info(void)
 {
 	static struct oidset seen = OIDSET_INIT;
+	struct strvec hidden_excludes = STRVEC_INIT;
 	struct strvec excludes_vector = STRVEC_INIT;
 	const char **exclude_patterns;
 
@@ -353,7 +354,7 @@ static void write_head_info(void)
 	 * ourselves.
 	 */
 	exclude_patterns = get_namespaced_exclude_patterns(
-		hidden_refs_to_excludes(&hidden_refs),
+		hidden_refs_to_excludes(&hidden_refs, &hidden_excludes),
 		get_git_namespace(), &excludes_vector);
 
 	refs_for_each_fullref_in(get_main_ref_store(the_repository), "",
@@ -362,6 +363,7 @@ static void write_head_info(void)
 				   show_one_alternate_ref, &seen);
 
 	oidset_clear(&seen);
+	strvec_clear(&hidden_excludes);
 	strvec_clear(&excludes_vector);
 
 	if (!sent_capabilities)
@@ -1712,36 +1714,47 @@ static void check_aliased_update_internal(struct command *cmd,
 		"inconsistent aliased update";
 }
 
-static void check_aliased_update(struct command *cmd, struct string_list *list)
-{
-	struct strbuf buf = STRBUF_INIT;
-	const char *dst_name;
-	int flag;
-
-	strbuf_addf(&buf, "%s%s", get_git_namespace(), cmd->ref_name);
-	dst_name = refs_resolve_ref_unsafe(get_main_ref_store(the_repository),
-					   buf.buf, 0, NULL, &flag);
-	check_aliased_update_internal(cmd, list, dst_name, flag);
-	strbuf_release(&buf);
-}
-
 static void check_aliased_updates(struct command *commands)
 {
 	struct command *cmd;
 	struct string_list ref_list = STRING_LIST_INIT_NODUP;
+	struct strvec names = STRVEC_INIT;
+	struct ref_read_request *reads;
+	struct command **cmds = NULL;
+	size_t i, cmds_nr = 0, cmds_alloc = 0;
 
 	for (cmd = commands; cmd; cmd = cmd->next) {
 		struct string_list_item *item =
 			string_list_append(&ref_list, cmd->ref_name);
 		item->util = (void *)cmd;
-	}
-	string_list_sort(&ref_list);
 
-	for (cmd = commands; cmd; cmd = cmd->next) {
-		if (!cmd->error_string)
-			check_aliased_update(cmd, &ref_list);
+		if (cmd->error_string)
+			continue;
+		ALLOC_GROW(cmds, cmds_nr + 1, cmds_alloc);
+		cmds[cmds_nr++] = cmd;
+		strvec_pushf(&names, "%s%s", get_git_namespace(), cmd->ref_name);
 	}
+	string_list_sort(&ref_list);
 
+	/* Resolve all the refs at once instead of one by one. */
+	CALLOC_ARRAY(reads, cmds_nr);
+	for (i = 0; i < cmds_nr; i++)
+		reads[i].refname = names.v[i];
+	refs_read_refs_many(get_main_ref_store(the_repository),
+			    reads, cmds_nr, 0);
+
+	for (i = 0; i < cmds_nr; i++) {
+		/* An earlier alias may have rejected this update already. */
+		if (!cmds[i]->error_string)
+			check_aliased_update_internal(cmds[i], &ref_list,
+						      reads[i].resolved,
+						      reads[i].flags);
+	}
+
+	ref_read_requests_release(reads, cmds_nr);
+	free(reads);
+	free(cmds);
+	strvec_clear(&names);
 	string_list_clear(&ref_list, 0);
 }
 
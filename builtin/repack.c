@@ -29,11 +29,19 @@ static int use_delta_islands;
 static int run_update_server_info = 1;
 static char *packdir, *packtmp_name, *packtmp;
 static int midx_must_contain_cruft = 1;
+static int midx_incremental;
+
+enum repack_midx_mode {
+	REPACK_MIDX_NONE = 0,
+	REPACK_MIDX_DEFAULT,
+	REPACK_MIDX_FULL,
+	REPACK_MIDX_INCREMENTAL,
+};
 
 static const char *const git_repack_usage[] = {
 	N_("git repack [-a] [-A] [-d] [-f] [-F] [-l] [-n] [-q] [-b] [-m]\n"
 	   "[--window=<n>] [--depth=<n>] [--threads=<n>] [--keep-pack=<pack-name>]\n"
-	   "[--write-midx] [--name-hash-version=<n>] [--path-walk]"),
+	   "[--write-midx[=<mode>]] [--name-hash-version=<n>] [--path-walk]"),
 	NULL
 };
 
@@ -94,9 +102,32 @@ static int repack_config(const char *var, const char *value,
 		midx_must_contain_cruft = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.midxincremental")) {
+		midx_incremental = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, ctx, cb);
 }
 
+static int option_parse_write_midx(const struct option *opt, const char *arg,
+				   int unset)
+{
+	enum repack_midx_mode *mode = opt->value;
+
+	if (unset)
+		*mode = REPACK_MIDX_NONE;
+	else if (!arg || !*arg)
+		*mode = REPACK_MIDX_DEFAULT;
+	else if (!strcmp(arg, "full"))
+		*mode = REPACK_MIDX_FULL;
+	else if (!strcmp(arg, "incremental"))
+		*mode = REPACK_MIDX_INCREMENTAL;
+	else
+		die(_("invalid value for '%s': '%s'"), opt->long_name, arg);
+
+	return 0;
+}
+
 int cmd_repack(int argc,
 	       const char **argv,
 	       const char *prefix,
@@ -119,7 +150,8 @@ int cmd_repack(int argc,
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	struct pack_objects_args po_args = PACK_OBJECTS_ARGS_INIT;
 	struct pack_objects_args cruft_po_args = PACK_OBJECTS_ARGS_INIT;
-	int write_midx = 0;
+	enum repack_midx_mode write_midx = REPACK_MIDX_NONE;
+	int midx_layer = 0;
 	const char *cruft_expiration = NULL;
 	const char *expire_to = NULL;
 	const char *filter_to = NULL;
@@ -185,8 +217,12 @@ int cmd_repack(int argc,
 				N_("do not repack this pack")),
 		OPT_INTEGER('g', "geometric", &geometry.split_factor,
 			    N_("find a geometric progression with factor <N>")),
-		OPT_BOOL('m', "write-midx", &write_midx,
-			   N_("write a multi-pack index of the resulting packs")),
+		OPT_SET_INT_F('m', NULL, &write_midx,
+			      N_("write a multi-pack index of the resulting packs"),
+			      REPACK_MIDX_DEFAULT, PARSE_OPT_NONEG),
+		OPT_CALLBACK_F(0, "write-midx", &write_midx, N_("mode"),
+			       N_("write a multi-pack index (\"full\" or \"incremental\")"),
+			       PARSE_OPT_OPTARG, option_parse_write_midx),
 		OPT_STRING(0, "expire-to", &expire_to, N_("dir"),
 			   N_("pack prefix to store a pack containing pruned objects")),
 		OPT_STRING(0, "filter-to", &filter_to, N_("dir"),
@@ -220,6 +256,18 @@ int cmd_repack(int argc,
 	if (pack_everything & PACK_CRUFT)
 		pack_everything |= ALL_INTO_ONE;
 
+	if (write_midx == REPACK_MIDX_DEFAULT)
+		write_midx = midx_incremental ? REPACK_MIDX_INCREMENTAL
+					      : REPACK_MIDX_FULL;
+	/*
+	 * An all-into-one repack removes the packs that the existing
+	 * MIDX layers refer to, so it always writes a single, full MIDX
+	 * in their place (compacting any existing chain).
+	 */
+	if (write_midx == REPACK_MIDX_INCREMENTAL &&
+	    !(pack_everything & ALL_INTO_ONE))
+		midx_layer = 1;
+
 	if (write_bitmaps < 0) {
 		if (!write_midx &&
 		    (!(pack_everything & ALL_INTO_ONE) || !is_bare_repository()))
@@ -267,6 +315,7 @@ int cmd_repack(int argc,
 	if (geometry.split_factor) {
 		if (pack_everything)
 			die(_("options '%s' and '%s' cannot be used together"), "--geometric", "-A/-a");
+		geometry.skip_midx_packs = midx_layer;
 		pack_geometry_init(&geometry, &existing, &po_args);
 		pack_geometry_split(&geometry);
 	}
@@ -368,6 +417,9 @@ int cmd_repack(int argc,
 			fprintf(in, "%s\n", pack_basename(geometry.pack[i]));
 		for (i = geometry.split; i < geometry.pack_nr; i++)
 			fprintf(in, "^%s\n", pack_basename(geometry.pack[i]));
+		if (geometry.skip_midx_packs)
+			for_each_string_list_item(item, &existing.midx_packs)
+				fprintf(in, "^%s\n", item->string);
 		fclose(in);
 	}
 
@@ -510,7 +562,8 @@ int cmd_repack(int argc,
 			.packdir = packdir,
 			.show_progress = show_progress,
 			.write_bitmaps = write_bitmaps > 0,
-			.midx_must_contain_cruft = midx_must_contain_cruft
+			.midx_must_contain_cruft = midx_must_contain_cruft,
+			.incremental = midx_layer,
 		};
 
 		ret = write_midx_included_packs(&opts);
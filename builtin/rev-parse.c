@@ -920,8 +920,13 @@ int cmd_rev_parse(int argc,
 				continue;
 			}
 			if (!strcmp(arg, "--all")) {
-				refs_for_each_ref(get_main_ref_store(the_repository),
-						  show_reference, NULL);
+				struct strvec excludes = STRVEC_INIT;
+
+				refs_for_each_fullref_in(get_main_ref_store(the_repository), "",
+							 ref_exclusions_to_exclude_patterns(&ref_excludes,
+											    &excludes),
+							 show_reference, NULL);
+				strvec_clear(&excludes);
 				clear_ref_exclusions(&ref_excludes);
 				continue;
 			}
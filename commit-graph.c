@@ -27,6 +27,8 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
+#include "prio-queue.h"
 
 void git_test_write_commit_graph_or_die(struct odb_source *source)
 {
@@ -50,7 +52,10 @@ void git_test_write_commit_graph_or_die(struct odb_source *source)
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BLOOMMERGEINDEXES 0x4249444d /* "BIDM" */
+#define GRAPH_CHUNKID_BLOOMMERGEDATA 0x4244414d /* "BDAM" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_REACHABILITY 0x52454143 /* "REAC" */
 
 #define GRAPH_VERSION_1 0x1
 #define GRAPH_VERSION GRAPH_VERSION_1
@@ -62,6 +67,18 @@ void git_test_write_commit_graph_or_die(struct odb_source *source)
 #define GRAPH_LAST_EDGE 0x80000000
 
 #define GRAPH_HEADER_SIZE 8
+
+/*
+ * Each commit in the reachability index has four labels: its position
+ * in two different topological orders and the interval it spans in a
+ * depth-first numbering of the first-parent forest.
+ */
+#define GRAPH_REACH_X 0
+#define GRAPH_REACH_Y 1
+#define GRAPH_REACH_PRE 2
+#define GRAPH_REACH_END 3
+#define GRAPH_REACH_NR 4
+#define GRAPH_REACH_NONE 0xffffffff
 #define GRAPH_FANOUT_SIZE (4 * 256)
 
 #define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW (1ULL << 31)
@@ -370,6 +387,30 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_bloom_merge_index(const unsigned char *chunk_start,
+					size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / 4 != g->num_commits) {
+		warning(_("commit-graph merge changed-path index chunk is too small"));
+		return -1;
+	}
+	g->chunk_bloom_merge_indexes = chunk_start;
+	return 0;
+}
+
+static int graph_read_reachability(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / (GRAPH_REACH_NR * sizeof(uint32_t)) != g->num_commits) {
+		warning(_("commit-graph reachability index chunk is wrong size"));
+		return -1;
+	}
+	g->chunk_reachability = chunk_start;
+	return 0;
+}
+
 struct commit_graph *parse_commit_graph(struct repository *r,
 					void *graph_map, size_t graph_size)
 {
@@ -466,8 +507,16 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 			   graph_read_bloom_index, graph);
 		read_chunk(cf, GRAPH_CHUNKID_BLOOMDATA,
 			   graph_read_bloom_data, graph);
+		read_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEINDEXES,
+			   graph_read_bloom_merge_index, graph);
+		pair_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEDATA,
+			   &graph->chunk_bloom_merge_data,
+			   &graph->chunk_bloom_merge_data_size);
 	}
 
+	read_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+		   graph_read_reachability, graph);
+
 	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
 		init_bloom_filters();
 	} else {
@@ -477,6 +526,18 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	/*
+	 * The merge filters share the settings of the BDAT chunk, and
+	 * need both of their own chunks, too.
+	 */
+	if (!graph->chunk_bloom_indexes ||
+	    !graph->chunk_bloom_merge_indexes ||
+	    !graph->chunk_bloom_merge_data) {
+		graph->chunk_bloom_merge_indexes = NULL;
+		graph->chunk_bloom_merge_data = NULL;
+		graph->chunk_bloom_merge_data_size = 0;
+	}
+
 	oidread(&graph->oid, graph->data + graph->data_len - graph->hash_algo->rawsz,
 		r->hash_algo);
 
@@ -558,6 +619,8 @@ static void validate_mixed_bloom_settings(struct commit_graph *g)
 		    g->bloom_filter_settings->hash_version != settings->hash_version) {
 			g->chunk_bloom_indexes = NULL;
 			g->chunk_bloom_data = NULL;
+			g->chunk_bloom_merge_indexes = NULL;
+			g->chunk_bloom_merge_data = NULL;
 			FREE_AND_NULL(g->bloom_filter_settings);
 
 			warning(_("disabling Bloom filters for commit-graph "
@@ -925,10 +988,36 @@ static inline void set_commit_tree(struct commit *c, struct tree *t)
 	c->maybe_tree = t;
 }
 
+/*
+ * Ask the CPU to start loading the rows of the OID lookup, commit data
+ * and generation data chunks that describe the commit at "pos". Walks
+ * that parse a commit usually parse its parents next, and those rows
+ * are scattered throughout the file, so starting the loads while the
+ * current commit is being filled in hides much of their latency.
+ */
+static void prefetch_commit_in_graph(struct commit_graph *g, uint32_t pos)
+{
+	uint32_t lex_index;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base)
+		return;
+
+	lex_index = pos - g->num_commits_in_base;
+	prefetch_for_read(g->chunk_oid_lookup +
+			  st_mult(g->hash_algo->rawsz, lex_index));
+	prefetch_for_read(g->chunk_commit_data +
+			  st_mult(graph_data_width(g->hash_algo), lex_index));
+	if (g->read_generation_data)
+		prefetch_for_read(g->chunk_generation_data +
+				  st_mult(sizeof(uint32_t), lex_index));
+}
+
 static int fill_commit_in_graph(struct commit *item,
 				struct commit_graph *g, uint32_t pos)
 {
-	uint32_t edge_value;
+	uint32_t edge_value, second_edge_value;
 	uint32_t parent_data_pos;
 	struct commit_list **pptr;
 	const unsigned char *commit_data;
@@ -951,9 +1040,16 @@ static int fill_commit_in_graph(struct commit *item,
 	edge_value = get_be32(commit_data + g->hash_algo->rawsz);
 	if (edge_value == GRAPH_PARENT_NONE)
 		return 1;
+
+	second_edge_value = get_be32(commit_data + g->hash_algo->rawsz + 4);
+	prefetch_commit_in_graph(g, edge_value);
+	if (second_edge_value != GRAPH_PARENT_NONE &&
+	    !(second_edge_value & GRAPH_EXTRA_EDGES_NEEDED))
+		prefetch_commit_in_graph(g, second_edge_value);
+
 	pptr = insert_parent_or_die(g, edge_value, pptr);
 
-	edge_value = get_be32(commit_data + g->hash_algo->rawsz + 4);
+	edge_value = second_edge_value;
 	if (edge_value == GRAPH_PARENT_NONE)
 		return 1;
 	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
@@ -1020,6 +1116,42 @@ struct commit_graph *repo_find_commit_pos_in_graph(struct repository *r,
 	return g;
 }
 
+static uint32_t reach_label(struct commit_graph *g, uint32_t pos, int which)
+{
+	return get_be32(g->chunk_reachability +
+			st_mult(sizeof(uint32_t), st_add(st_mult(GRAPH_REACH_NR, pos), which)));
+}
+
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *descendant,
+			   struct commit *ancestor)
+{
+	struct commit_graph *g = prepare_commit_graph(r);
+	uint32_t a, d;
+
+	if (!g || !g->chunk_reachability || g->base_graph)
+		return -1;
+	if (!find_commit_pos_in_graph(descendant, g, &d))
+		return -1;
+	/*
+	 * The graph is closed under reachability, so nothing that it
+	 * contains can reach a commit outside of it.
+	 */
+	if (!find_commit_pos_in_graph(ancestor, g, &a))
+		return 0;
+	if (a == d)
+		return 1;
+
+	if (reach_label(g, a, GRAPH_REACH_PRE) <= reach_label(g, d, GRAPH_REACH_PRE) &&
+	    reach_label(g, d, GRAPH_REACH_PRE) <= reach_label(g, a, GRAPH_REACH_END))
+		return 1;
+	if (reach_label(g, a, GRAPH_REACH_X) > reach_label(g, d, GRAPH_REACH_X) ||
+	    reach_label(g, a, GRAPH_REACH_Y) > reach_label(g, d, GRAPH_REACH_Y))
+		return 0;
+
+	return -1;
+}
+
 struct commit *lookup_commit_in_graph(struct repository *repo, const struct object_id *id)
 {
 	static int commit_graph_paranoia = -1;
@@ -1159,13 +1291,17 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
+		 merge_changed_paths:1,
+		 reachability_index:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
 		 trust_generation_numbers:1;
 
 	struct topo_level_slab *topo_levels;
 	const struct commit_graph_opts *opts;
+	uint32_t *reach_labels;
 	size_t total_bloom_filter_data_size;
+	size_t total_merge_bloom_filter_data_size;
 	const struct bloom_filter_settings *bloom_settings;
 
 	int count_bloom_filter_computed;
@@ -1173,6 +1309,8 @@ struct write_commit_graph_context {
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
 	int count_bloom_filter_upgraded;
+	int count_merge_bloom_filter_computed;
+	int count_merge_bloom_filter_trunc_large;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1368,6 +1506,18 @@ static int write_graph_chunk_generation_data_overflow(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_reachability(struct hashfile *f,
+					  void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < st_mult(GRAPH_REACH_NR, ctx->commits.nr); i++)
+		hashwrite_be32(f, ctx->reach_labels[i]);
+
+	return 0;
+}
+
 static int write_graph_chunk_extra_edges(struct hashfile *f,
 					 void *data)
 {
@@ -1485,6 +1635,46 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_bloom_merge_indexes(struct hashfile *f,
+						 void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_merge_bloom_filter(ctx->r, *list);
+		size_t len = filter ? filter->len : 0;
+		cur_pos += len;
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_bloom_merge_data(struct hashfile *f,
+					      void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_merge_bloom_filter(ctx->r, *list);
+		size_t len = filter ? filter->len : 0;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		if (len)
+			hashwrite(f, filter->data, len * sizeof(unsigned char));
+		list++;
+	}
+
+	return 0;
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1775,6 +1965,187 @@ void ensure_generations_valid(struct repository *r,
 	compute_reachable_generation_numbers(&info, generation_version);
 }
 
+static int compare_reach_x(const void *a_, const void *b_, void *data UNUSED)
+{
+	const uint32_t *a = a_, *b = b_;
+
+	/* prefer the commit which comes last in the first order */
+	if (*a < *b)
+		return 1;
+	if (*a > *b)
+		return -1;
+	return 0;
+}
+
+/*
+ * Label every commit so that "can A reach B?" can usually be answered
+ * from the labels alone (see commit_graph_can_reach()):
+ *
+ *  - X and Y are the positions of the commit in two topological orders
+ *    (parents before children). A commit can only reach commits that
+ *    come before it in both orders. The second order always picks the
+ *    ready commit which comes last in the first one, which makes the two
+ *    orders disagree as much as possible for unrelated commits.
+ *
+ *  - PRE and END are the interval spanned by the commit in a depth-first
+ *    numbering of the forest formed by first-parent edges. A commit whose
+ *    PRE lies in that interval is a first-parent descendant.
+ *
+ * The labels are only meaningful if all parents are in the same graph.
+ */
+static void compute_reachability_index(struct write_commit_graph_context *ctx)
+{
+	size_t nr = ctx->commits.nr, nr_edges = 0, i;
+	uint32_t *first_parent, *pending, *child_start, *children;
+	uint32_t *fp_start, *fp_children, *stack, *cursor;
+	uint32_t *labels, *x, next;
+	size_t stack_nr;
+	struct prio_queue queue = { .compare = compare_reach_x };
+	struct progress *progress = NULL;
+
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			ctx->r,
+			_("Computing commit-graph reachability index"),
+			nr);
+
+	ALLOC_ARRAY(first_parent, nr);
+	CALLOC_ARRAY(pending, nr);
+	CALLOC_ARRAY(child_start, st_add(nr, 1));
+	CALLOC_ARRAY(fp_start, st_add(nr, 1));
+
+	for (i = 0; i < nr; i++) {
+		struct commit_list *parent;
+
+		first_parent[i] = GRAPH_REACH_NONE;
+		for (parent = ctx->commits.list[i]->parents; parent; parent = parent->next) {
+			int pos = oid_pos(&parent->item->object.oid,
+					  ctx->commits.list, ctx->commits.nr,
+					  commit_to_oid);
+			if (pos < 0)
+				BUG("missing parent %s for commit %s",
+				    oid_to_hex(&parent->item->object.oid),
+				    oid_to_hex(&ctx->commits.list[i]->object.oid));
+			if (first_parent[i] == GRAPH_REACH_NONE) {
+				first_parent[i] = pos;
+				fp_start[pos + 1]++;
+			}
+			child_start[pos + 1]++;
+			pending[i]++;
+			nr_edges++;
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		child_start[i + 1] += child_start[i];
+		fp_start[i + 1] += fp_start[i];
+	}
+
+	ALLOC_ARRAY(children, nr_edges);
+	ALLOC_ARRAY(fp_children, nr);
+	ALLOC_ARRAY(cursor, nr);
+
+	COPY_ARRAY(cursor, child_start, nr);
+	for (i = 0; i < nr; i++) {
+		struct commit_list *parent;
+
+		for (parent = ctx->commits.list[i]->parents; parent; parent = parent->next) {
+			int pos = oid_pos(&parent->item->object.oid,
+					  ctx->commits.list, ctx->commits.nr,
+					  commit_to_oid);
+			children[cursor[pos]++] = i;
+		}
+	}
+
+	COPY_ARRAY(cursor, fp_start, nr);
+	for (i = 0; i < nr; i++)
+		if (first_parent[i] != GRAPH_REACH_NONE)
+			fp_children[cursor[first_parent[i]]++] = i;
+
+	CALLOC_ARRAY(labels, st_mult(GRAPH_REACH_NR, nr));
+	ALLOC_ARRAY(x, nr);
+	ALLOC_ARRAY(stack, nr);
+
+	/* First topological order, depth-first among the ready commits. */
+	stack_nr = 0;
+	for (i = 0; i < nr; i++) {
+		cursor[i] = pending[i];
+		if (!pending[i])
+			stack[stack_nr++] = i;
+	}
+	next = 0;
+	while (stack_nr) {
+		uint32_t c = stack[--stack_nr];
+
+		x[c] = next++;
+		for (i = child_start[c]; i < child_start[c + 1]; i++)
+			if (!--cursor[children[i]])
+				stack[stack_nr++] = children[i];
+	}
+	if (next != nr)
+		BUG("commit-graph contains a cycle");
+
+	/* Second topological order, latest X first among the ready commits. */
+	for (i = 0; i < nr; i++) {
+		cursor[i] = pending[i];
+		if (!pending[i])
+			prio_queue_put(&queue, &x[i]);
+	}
+	next = 0;
+	while (queue.nr) {
+		uint32_t c = (uint32_t *)prio_queue_get(&queue) - x;
+
+		labels[GRAPH_REACH_NR * c + GRAPH_REACH_Y] = next++;
+		for (i = child_start[c]; i < child_start[c + 1]; i++)
+			if (!--cursor[children[i]])
+				prio_queue_put(&queue, &x[children[i]]);
+	}
+
+	/* Depth-first intervals over the first-parent forest. */
+	COPY_ARRAY(cursor, fp_start, nr);
+	next = 0;
+	for (i = 0; i < nr; i++) {
+		if (first_parent[i] != GRAPH_REACH_NONE)
+			continue;
+
+		stack_nr = 0;
+		stack[stack_nr++] = i;
+		labels[GRAPH_REACH_NR * i + GRAPH_REACH_PRE] = next++;
+		while (stack_nr) {
+			uint32_t c = stack[stack_nr - 1];
+
+			if (cursor[c] < fp_start[c + 1]) {
+				uint32_t child = fp_children[cursor[c]++];
+				labels[GRAPH_REACH_NR * child + GRAPH_REACH_PRE] = next++;
+				stack[stack_nr++] = child;
+				continue;
+			}
+
+			labels[GRAPH_REACH_NR * c + GRAPH_REACH_END] = next - 1;
+			stack_nr--;
+			display_progress(progress, next);
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		labels[GRAPH_REACH_NR * i + GRAPH_REACH_X] = x[i];
+
+	stop_progress(&progress);
+
+	ctx->reach_labels = labels;
+
+	clear_prio_queue(&queue);
+	free(first_parent);
+	free(pending);
+	free(child_start);
+	free(children);
+	free(fp_start);
+	free(fp_children);
+	free(cursor);
+	free(stack);
+	free(x);
+}
+
 static void trace2_bloom_filter_write_statistics(struct write_commit_graph_context *ctx)
 {
 	trace2_data_intmax("commit-graph", ctx->r, "filter-computed",
@@ -1787,6 +2158,134 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_trunc_large);
 	trace2_data_intmax("commit-graph", ctx->r, "filter-upgraded",
 			   ctx->count_bloom_filter_upgraded);
+	if (ctx->merge_changed_paths) {
+		trace2_data_intmax("commit-graph", ctx->r, "merge-filter-computed",
+				   ctx->count_merge_bloom_filter_computed);
+		trace2_data_intmax("commit-graph", ctx->r, "merge-filter-trunc-large",
+				   ctx->count_merge_bloom_filter_trunc_large);
+	}
+}
+
+/*
+ * Commits are handed to the threads computing Bloom filters in batches
+ * of this many, so that only one batch worth of filters is pending
+ * before being stored in commit order.
+ */
+#define BLOOM_FILTERS_PER_BATCH 8192
+
+struct bloom_precompute {
+	struct commit *commit;
+	struct bloom_filter filter;
+	enum bloom_filter_computed computed;
+	unsigned ok:1;
+};
+
+struct bloom_thread_data {
+	pthread_t pthread;
+	struct write_commit_graph_context *ctx;
+	struct bloom_precompute **todo;
+	size_t nr, offset, step;
+};
+
+static void *compute_bloom_filters_thread(void *_data)
+{
+	struct bloom_thread_data *data = _data;
+	size_t i;
+
+	for (i = data->offset; i < data->nr; i += data->step) {
+		struct bloom_precompute *p = data->todo[i];
+		struct commit *c = p->commit;
+		struct commit *parent = c->parents ? c->parents->item : NULL;
+
+		p->ok = !compute_bloom_filter_from_trees(
+				data->ctx->r,
+				parent ? &parent->maybe_tree->object.oid : NULL,
+				&c->maybe_tree->object.oid,
+				data->ctx->bloom_settings,
+				&p->filter, &p->computed);
+	}
+	return NULL;
+}
+
+/*
+ * Compute the Bloom filters of those commits in "commits" which do not
+ * have one yet (up to "budget" of them) using "nr_threads" threads,
+ * storing the results in "out". Commits for which this did not work out
+ * have their "ok" bit clear, and are left to get_or_compute_bloom_filter().
+ */
+static void precompute_bloom_filters(struct write_commit_graph_context *ctx,
+				     struct commit **commits, size_t nr,
+				     size_t budget, int nr_threads,
+				     struct bloom_precompute *out)
+{
+	struct bloom_precompute **todo;
+	struct bloom_thread_data *data;
+	size_t i, todo_nr = 0;
+	int t;
+
+	ALLOC_ARRAY(todo, nr);
+	for (i = 0; i < nr; i++) {
+		struct commit *c = commits[i];
+
+		memset(&out[i], 0, sizeof(out[i]));
+		if (todo_nr >= budget)
+			continue;
+		if (get_or_compute_bloom_filter(ctx->r, c, 0, NULL, NULL))
+			continue;
+
+		/*
+		 * Parsing commits and looking up their trees touches the
+		 * global object table, so do it here, before the threads
+		 * start.
+		 */
+		if (repo_parse_commit(ctx->r, c) ||
+		    !repo_get_commit_tree(ctx->r, c))
+			continue;
+		if (c->parents &&
+		    (repo_parse_commit(ctx->r, c->parents->item) ||
+		     !repo_get_commit_tree(ctx->r, c->parents->item)))
+			continue;
+
+		out[i].commit = c;
+		todo[todo_nr++] = &out[i];
+	}
+
+	if (!todo_nr)
+		goto cleanup;
+
+	/*
+	 * The threads read objects through a single shared mutex-protected
+	 * object store, but each computes its own diffs.
+	 */
+	enable_obj_read_lock();
+
+	/*
+	 * Let each thread take every "nr_threads"-th commit, so that runs
+	 * of commits which are expensive to diff are spread out.
+	 */
+	CALLOC_ARRAY(data, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int err;
+
+		data[t].ctx = ctx;
+		data[t].todo = todo;
+		data[t].nr = todo_nr;
+		data[t].offset = t;
+		data[t].step = nr_threads;
+
+		err = pthread_create(&data[t].pthread, NULL,
+				     compute_bloom_filters_thread, &data[t]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++)
+		if (pthread_join(data[t].pthread, NULL))
+			die(_("unable to join thread"));
+	free(data);
+
+	disable_obj_read_lock();
+cleanup:
+	free(todo);
 }
 
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
@@ -1794,7 +2293,8 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
-	int max_new_filters;
+	struct bloom_precompute *precomputed = NULL;
+	int max_new_filters, nr_threads = 1;
 
 	init_bloom_filters();
 
@@ -1814,15 +2314,54 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	if (HAVE_THREADS && ctx->opts)
+		nr_threads = ctx->opts->threads;
+	if (nr_threads > 1) {
+		trace2_data_intmax("commit-graph", ctx->r,
+				   "bloom_filter_threads", nr_threads);
+		CALLOC_ARRAY(precomputed, BLOOM_FILTERS_PER_BATCH);
+	}
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
+		struct bloom_precompute *p = NULL;
+		struct bloom_filter *filter;
+
+		if (precomputed) {
+			size_t batch = i % BLOOM_FILTERS_PER_BATCH;
+
+			if (!batch) {
+				size_t nr = ctx->commits.nr - i;
+				if (nr > BLOOM_FILTERS_PER_BATCH)
+					nr = BLOOM_FILTERS_PER_BATCH;
+				precompute_bloom_filters(ctx, sorted_commits + i, nr,
+							 max_new_filters - ctx->count_bloom_filter_computed,
+							 nr_threads, precomputed);
+			}
+			p = &precomputed[batch];
+		}
+
+		/*
+		 * A commit gets a precomputed filter only if it had no
+		 * filter at all, in which case get_or_compute_bloom_filter()
+		 * would compute the very same one as long as we are within
+		 * budget.
+		 */
+		if (p && p->ok &&
+		    ctx->count_bloom_filter_computed < max_new_filters) {
+			filter = set_bloom_filter(c, &p->filter);
+			computed = p->computed;
+		} else {
+			if (p && p->ok)
+				free(p->filter.to_free);
+			filter = get_or_compute_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
+		}
 		if (computed & BLOOM_COMPUTED) {
 			ctx->count_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_EMPTY)
@@ -1835,6 +2374,22 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 			ctx->count_bloom_filter_not_computed++;
 		ctx->total_bloom_filter_data_size += filter
 			? sizeof(unsigned char) * filter->len : 0;
+
+		if (ctx->merge_changed_paths && c->parents && c->parents->next) {
+			filter = get_or_compute_merge_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_merge_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
+			if (computed & BLOOM_COMPUTED) {
+				ctx->count_merge_bloom_filter_computed++;
+				if (computed & BLOOM_TRUNC_LARGE)
+					ctx->count_merge_bloom_filter_trunc_large++;
+			}
+			ctx->total_merge_bloom_filter_data_size += filter
+				? sizeof(unsigned char) * filter->len : 0;
+		}
 		display_progress(progress, i + 1);
 	}
 
@@ -1842,6 +2397,7 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 		trace2_bloom_filter_write_statistics(ctx);
 
 	free(sorted_commits);
+	free(precomputed);
 	stop_progress(&progress);
 }
 
@@ -2129,6 +2685,18 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				 ctx->total_bloom_filter_data_size),
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->changed_paths && ctx->merge_changed_paths) {
+		add_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEINDEXES,
+			  st_mult(sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_bloom_merge_indexes);
+		add_chunk(cf, GRAPH_CHUNKID_BLOOMMERGEDATA,
+			  ctx->total_merge_bloom_filter_data_size,
+			  write_graph_chunk_bloom_merge_data);
+	}
+	if (ctx->reach_labels)
+		add_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+			  st_mult(GRAPH_REACH_NR * sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_reachability);
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  st_mult(hashsz, ctx->num_commit_graphs_after - 1),
@@ -2579,6 +3147,22 @@ int write_commit_graph(struct odb_source *source,
 
 	bloom_settings.hash_version = bloom_settings.hash_version == 2 ? 2 : 1;
 
+	if (flags & COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS)
+		ctx.merge_changed_paths = 1;
+	else if (!(flags & COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS) &&
+		 g && g->chunk_bloom_merge_indexes)
+		/* We have merge filters already. Keep them, too. */
+		ctx.merge_changed_paths = 1;
+	if (!ctx.changed_paths)
+		ctx.merge_changed_paths = 0;
+
+	if (flags & COMMIT_GRAPH_WRITE_REACHABILITY_INDEX)
+		ctx.reachability_index = 1;
+	else if (!(flags & COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX) &&
+		 g && g->chunk_reachability)
+		/* We have a reachability index already. Keep it. */
+		ctx.reachability_index = 1;
+
 	if (ctx.split) {
 		for (struct commit_graph *chain = g; chain; chain = chain->base_graph)
 			ctx.num_commit_graphs_before++;
@@ -2653,6 +3237,13 @@ int write_commit_graph(struct odb_source *source,
 	if (ctx.changed_paths)
 		compute_bloom_filters(&ctx);
 
+	/*
+	 * The labels describe the whole history, so they can only be
+	 * written into a graph without any base layers.
+	 */
+	if (ctx.reachability_index && ctx.num_commit_graphs_after == 1)
+		compute_reachability_index(&ctx);
+
 	res = write_commit_graph_file(&ctx);
 
 	if (ctx.changed_paths)
@@ -2666,6 +3257,7 @@ int write_commit_graph(struct odb_source *source,
 cleanup:
 	free(ctx.graph_name);
 	free(ctx.base_graph_name);
+	free(ctx.reach_labels);
 	free(ctx.commits.list);
 	oid_array_clear(&ctx.oids);
 	clear_topo_level_slab(&topo_levels);
@@ -2714,6 +3306,26 @@ static int commit_graph_checksum_valid(struct commit_graph *g)
 				       g->data, g->data_len);
 }
 
+static void verify_reach_labels(struct commit_graph *g, uint32_t pos,
+				const struct object_id *oid,
+				struct commit *parent, int first_parent)
+{
+	uint32_t parent_pos = commit_graph_position(parent);
+
+	if (parent_pos == COMMIT_NOT_FROM_GRAPH)
+		return;
+
+	if (reach_label(g, parent_pos, GRAPH_REACH_X) >= reach_label(g, pos, GRAPH_REACH_X) ||
+	    reach_label(g, parent_pos, GRAPH_REACH_Y) >= reach_label(g, pos, GRAPH_REACH_Y) ||
+	    (first_parent &&
+	     (reach_label(g, parent_pos, GRAPH_REACH_PRE) >= reach_label(g, pos, GRAPH_REACH_PRE) ||
+	      reach_label(g, parent_pos, GRAPH_REACH_END) < reach_label(g, pos, GRAPH_REACH_END) ||
+	      reach_label(g, pos, GRAPH_REACH_PRE) > reach_label(g, pos, GRAPH_REACH_END))))
+		graph_report(_("commit-graph reachability index for commit %s is inconsistent with its parent %s"),
+			     oid_to_hex(oid),
+			     oid_to_hex(&parent->object.oid));
+}
+
 static int verify_one_commit_graph(struct commit_graph *g,
 				   struct progress *progress,
 				   uint64_t *seen)
@@ -2818,6 +3430,11 @@ static int verify_one_commit_graph(struct commit_graph *g,
 			if (generation > max_generation)
 				max_generation = generation;
 
+			if (g->chunk_reachability && !g->base_graph)
+				verify_reach_labels(g, i, &cur_oid,
+						    graph_parents->item,
+						    graph_parents == graph_commit->parents);
+
 			graph_parents = graph_parents->next;
 			odb_parents = odb_parents->next;
 		}
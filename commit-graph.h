@@ -109,6 +109,10 @@ struct commit_graph {
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
 	size_t chunk_bloom_data_size;
+	const unsigned char *chunk_bloom_merge_indexes;
+	const unsigned char *chunk_bloom_merge_data;
+	size_t chunk_bloom_merge_data_size;
+	const unsigned char *chunk_reachability;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -144,12 +148,26 @@ int corrected_commit_dates_enabled(struct repository *r);
 
 struct bloom_filter_settings *get_bloom_filter_settings(struct repository *r);
 
+/*
+ * Use the reachability index of the commit-graph to decide whether
+ * "descendant" can reach "ancestor" without walking. Returns 1 if it
+ * can, 0 if it cannot, and -1 if the index cannot tell (including when
+ * there is no index, or "descendant" is not in the commit-graph).
+ */
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *descendant,
+			   struct commit *ancestor);
+
 enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_APPEND     = (1 << 0),
 	COMMIT_GRAPH_WRITE_PROGRESS   = (1 << 1),
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_REACHABILITY_INDEX = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX = (1 << 6),
+	COMMIT_GRAPH_WRITE_MERGE_BLOOM_FILTERS = (1 << 7),
+	COMMIT_GRAPH_NO_WRITE_MERGE_BLOOM_FILTERS = (1 << 8),
 };
 
 enum commit_graph_split_flags {
@@ -164,6 +182,7 @@ struct commit_graph_opts {
 	timestamp_t expire_time;
 	enum commit_graph_split_flags split_flags;
 	int max_new_filters;
+	int threads;
 };
 
 /*
@@ -179,101 +179,222 @@ static int merge_bases_many(struct repository *r,
 	return 0;
 }
 
-int get_octopus_merge_bases(struct commit_list *in, struct commit_list **result)
+define_commit_slab(bit_arrays, struct bitmap *);
+static struct bit_arrays bit_arrays;
+
+static struct bitmap *get_bit_array(struct commit *c, int width)
 {
-	struct commit_list *i, *j, *k;
+	struct bitmap **bitmap = bit_arrays_at(&bit_arrays, c);
+	if (!*bitmap)
+		*bitmap = bitmap_word_alloc(width);
+	return *bitmap;
+}
 
-	if (!in)
-		return 0;
+static void free_bit_array(struct commit *c)
+{
+	struct bitmap **bitmap = bit_arrays_at(&bit_arrays, c);
+	if (!*bitmap)
+		return;
+	bitmap_free(*bitmap);
+	*bitmap = NULL;
+}
 
-	commit_list_insert(in->item, result);
+struct paint_many {
+	/* the commits that have a bitmap in bit_arrays */
+	struct commit **walked;
+	size_t walked_nr, walked_alloc;
+	size_t width;
+};
 
-	for (i = in->next; i; i = i->next) {
-		struct commit_list *new_commits = NULL, *end = NULL;
+static struct bitmap *paint_many_bits(struct paint_many *pm, struct commit *c)
+{
+	struct bitmap **bitmap = bit_arrays_at(&bit_arrays, c);
+	if (!*bitmap) {
+		*bitmap = bitmap_word_alloc(pm->width);
+		ALLOC_GROW(pm->walked, pm->walked_nr + 1, pm->walked_alloc);
+		pm->walked[pm->walked_nr++] = c;
+	}
+	return *bitmap;
+}
 
-		for (j = *result; j; j = j->next) {
-			struct commit_list *bases = NULL;
-			if (repo_get_merge_bases(the_repository, i->item,
-						 j->item, &bases) < 0) {
-				free_commit_list(bases);
-				free_commit_list(*result);
-				*result = NULL;
-				return -1;
+/*
+ * Walk down from all "nr" commits at once, remembering for each commit
+ * which of them can reach it as a bitmap in bit_arrays. This answers
+ * the questions that used to need one walk per commit, or per pair of
+ * commits, in a single pass.
+ *
+ * A commit that at least "stale_nr" of the commits can reach is marked
+ * STALE when it is visited, and so are all of its ancestors. If
+ * "result" is not NULL, the commits that became STALE this way are
+ * collected in it. The walk stops when only STALE commits are left in
+ * the queue, or when it goes below "min_generation".
+ *
+ * All input commits must have been parsed, and the caller must call
+ * paint_many_release() once it has read the bitmaps it needs.
+ */
+static int paint_down_many(struct repository *r, struct paint_many *pm,
+			   struct commit **commits, size_t nr,
+			   size_t stale_nr, timestamp_t min_generation,
+			   struct commit_list **result)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct commit_list **tail = result;
+	int ret = 0;
+
+	if (!min_generation && !corrected_commit_dates_enabled(r))
+		queue.compare = compare_commits_by_commit_date;
+
+	pm->width = DIV_ROUND_UP(nr, BITS_IN_EWORD);
+	init_bit_arrays(&bit_arrays);
+
+	for (size_t i = 0; i < nr; i++) {
+		bitmap_set(paint_many_bits(pm, commits[i]), i);
+		prio_queue_put(&queue, commits[i]);
+	}
+
+	while (queue_has_nonstale(&queue)) {
+		struct commit *commit = prio_queue_get(&queue);
+		struct bitmap *bits = paint_many_bits(pm, commit);
+		unsigned int flags = commit->object.flags & STALE;
+
+		if (commit_graph_generation(commit) < min_generation)
+			break;
+
+		if (!flags && bitmap_popcount(bits) >= stale_nr) {
+			if (result && !(commit->object.flags & RESULT)) {
+				commit->object.flags |= RESULT;
+				tail = commit_list_append(commit, tail);
+			}
+			/*
+			 * Only mark the parents stale, so that a result that
+			 * turns out to be reachable from a later one can be
+			 * told apart by its own STALE flag.
+			 */
+			flags = STALE;
+		}
+
+		/*
+		 * Without generation numbers, the queue may hand out a
+		 * commit before all of its descendants, so a parent is
+		 * queued again whenever it learns something new.
+		 */
+		for (struct commit_list *p = commit->parents; p; p = p->next) {
+			struct commit *parent = p->item;
+			struct bitmap *parent_bits;
+
+			if (repo_parse_commit(r, parent)) {
+				ret = error(_("could not parse commit %s"),
+					    oid_to_hex(&parent->object.oid));
+				goto out;
 			}
-			if (!new_commits)
-				new_commits = bases;
-			else
-				end->next = bases;
-			for (k = bases; k; k = k->next)
-				end = k;
+
+			parent_bits = paint_many_bits(pm, parent);
+			if ((parent->object.flags & flags) == flags &&
+			    !bitmap_is_subset(bits, parent_bits))
+				continue;
+
+			bitmap_or(parent_bits, bits);
+			parent->object.flags |= flags;
+			prio_queue_put(&queue, parent);
+		}
+	}
+
+out:
+	clear_prio_queue(&queue);
+	return ret;
+}
+
+static void paint_many_release(struct paint_many *pm)
+{
+	for (size_t i = 0; i < pm->walked_nr; i++) {
+		pm->walked[i]->object.flags &= ~(STALE | RESULT);
+		free_bit_array(pm->walked[i]);
+	}
+	free(pm->walked);
+	clear_bit_arrays(&bit_arrays);
+}
+
+int get_octopus_merge_bases(struct commit_list *in, struct commit_list **result)
+{
+	struct paint_many pm = { 0 };
+	struct commit **commits;
+	size_t nr = commit_list_count(in), i = 0;
+	int ret = 0;
+
+	if (!in)
+		return 0;
+
+	ALLOC_ARRAY(commits, nr);
+	for (; in; in = in->next) {
+		if (repo_parse_commit(the_repository, in->item)) {
+			ret = -1;
+			goto out;
 		}
+		commits[i++] = in->item;
+	}
+
+	/*
+	 * The merge bases are the commits that all of the input can reach
+	 * and that are not an ancestor of another such commit.
+	 */
+	ret = paint_down_many(the_repository, &pm, commits, nr, nr, 0, result);
+	if (ret < 0) {
+		paint_many_release(&pm);
 		free_commit_list(*result);
-		*result = new_commits;
+		*result = NULL;
+		goto out;
 	}
-	return 0;
+
+	/*
+	 * Without generation numbers, a commit may have been found before
+	 * a merge base that descends from it, which then marked it stale.
+	 */
+	for (struct commit_list **p = result; *p; ) {
+		if ((*p)->item->object.flags & STALE)
+			pop_commit(p);
+		else
+			p = &(*p)->next;
+	}
+	paint_many_release(&pm);
+	commit_list_sort_by_date(result);
+
+out:
+	free(commits);
+	return ret;
 }
 
 static int remove_redundant_no_gen(struct repository *r,
 				   struct commit **array,
 				   size_t cnt, size_t *dedup_cnt)
 {
-	struct commit **work;
-	unsigned char *redundant;
-	size_t *filled_index;
-	size_t i, j, filled;
-
-	CALLOC_ARRAY(work, cnt);
-	redundant = xcalloc(cnt, 1);
-	ALLOC_ARRAY(filled_index, cnt - 1);
+	struct paint_many pm = { 0 };
+	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
+	size_t i, filled;
 
-	for (i = 0; i < cnt; i++)
-		repo_parse_commit(r, array[i]);
 	for (i = 0; i < cnt; i++) {
-		struct commit_list *common = NULL;
-		timestamp_t min_generation = commit_graph_generation(array[i]);
+		timestamp_t generation;
 
-		if (redundant[i])
-			continue;
-		for (j = filled = 0; j < cnt; j++) {
-			timestamp_t curr_generation;
-			if (i == j || redundant[j])
-				continue;
-			filled_index[filled] = j;
-			work[filled++] = array[j];
+		repo_parse_commit(r, array[i]);
+		generation = commit_graph_generation(array[i]);
+		if (generation < min_generation)
+			min_generation = generation;
+	}
 
-			curr_generation = commit_graph_generation(array[j]);
-			if (curr_generation < min_generation)
-				min_generation = curr_generation;
-		}
-		if (paint_down_to_common(r, array[i], filled,
-					 work, min_generation, 0, &common)) {
-			clear_commit_marks(array[i], all_flags);
-			clear_commit_marks_many(filled, work, all_flags);
-			free_commit_list(common);
-			free(work);
-			free(redundant);
-			free(filled_index);
-			return -1;
-		}
-		if (array[i]->object.flags & PARENT2)
-			redundant[i] = 1;
-		for (j = 0; j < filled; j++)
-			if (work[j]->object.flags & PARENT1)
-				redundant[filled_index[j]] = 1;
-		clear_commit_marks(array[i], all_flags);
-		clear_commit_marks_many(filled, work, all_flags);
-		free_commit_list(common);
+	/*
+	 * A commit is redundant if any other commit in the array can reach
+	 * it, i.e. if the walk sets a bit other than its own in its bitmap.
+	 */
+	if (paint_down_many(r, &pm, array, cnt, 2, min_generation, NULL) < 0) {
+		paint_many_release(&pm);
+		return -1;
 	}
 
-	/* Now collect the result */
-	COPY_ARRAY(work, array, cnt);
 	for (i = filled = 0; i < cnt; i++)
-		if (!redundant[i])
-			array[filled++] = work[i];
+		if (bitmap_popcount(get_bit_array(array[i], pm.width)) == 1)
+			array[filled++] = array[i];
 	*dedup_cnt = filled;
-	free(work);
-	free(redundant);
-	free(filled_index);
+
+	paint_many_release(&pm);
 	return 0;
 }
 
@@ -496,6 +617,28 @@ int repo_get_merge_bases(struct repository *r,
 	return get_merge_bases_many_0(r, one, 1, &two, 1, result);
 }
 
+/*
+ * Ask the reachability index of the commit-graph whether "commit" can
+ * reach one of the elements on "list". Returns -1 if the index cannot
+ * tell, in which case the caller has to walk.
+ */
+static int reachability_index_test(struct repository *r,
+				   struct commit *commit,
+				   const struct commit_list *list)
+{
+	int result = 0;
+
+	for (; list; list = list->next) {
+		int reach = commit_graph_can_reach(r, commit, list->item);
+		if (reach > 0)
+			return 1;
+		if (reach < 0)
+			result = -1;
+	}
+
+	return result;
+}
+
 /*
  * Is "commit" a descendant of one of the elements on the "with_commit" list?
  */
@@ -506,6 +649,13 @@ int repo_is_descendant_of(struct repository *r,
 	if (!with_commit)
 		return 1;
 
+	switch (reachability_index_test(r, commit, with_commit)) {
+	case 0:
+		return 0;
+	case 1:
+		return 1;
+	}
+
 	if (generation_numbers_enabled(r)) {
 		struct commit_list *from_list = NULL;
 		int result;
@@ -536,7 +686,7 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 			     int ignore_missing_commits)
 {
 	struct commit_list *bases = NULL;
-	int ret = 0, i;
+	int ret = 0, i, unknown = 0;
 	timestamp_t generation, max_generation = GENERATION_NUMBER_ZERO;
 
 	if (repo_parse_commit(r, commit))
@@ -554,6 +704,16 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 	if (generation > max_generation)
 		return ret;
 
+	for (i = 0; i < nr_reference; i++) {
+		int reach = commit_graph_can_reach(r, reference[i], commit);
+		if (reach > 0)
+			return 1;
+		if (reach < 0)
+			unknown = 1;
+	}
+	if (!unknown)
+		return ret;
+
 	if (paint_down_to_common(r, commit,
 				 nr_reference, reference,
 				 generation, ignore_missing_commits, &bases))
@@ -716,6 +876,15 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (commit_graph_generation(candidate) < cutoff)
 		return CONTAINS_NO;
 
+	switch (reachability_index_test(the_repository, candidate, want)) {
+	case 0:
+		*cached = CONTAINS_NO;
+		return CONTAINS_NO;
+	case 1:
+		*cached = CONTAINS_YES;
+		return CONTAINS_YES;
+	}
+
 	return CONTAINS_UNKNOWN;
 }
 
@@ -1020,9 +1189,6 @@ struct commit_list *get_reachable_subset(struct commit **from, size_t nr_from,
 	return found_commits;
 }
 
-define_commit_slab(bit_arrays, struct bitmap *);
-static struct bit_arrays bit_arrays;
-
 static void insert_no_dup(struct prio_queue *queue, struct commit *c)
 {
 	if (c->object.flags & PARENT2)
@@ -1031,23 +1197,6 @@ static void insert_no_dup(struct prio_queue *queue, struct commit *c)
 	c->object.flags |= PARENT2;
 }
 
-static struct bitmap *get_bit_array(struct commit *c, int width)
-{
-	struct bitmap **bitmap = bit_arrays_at(&bit_arrays, c);
-	if (!*bitmap)
-		*bitmap = bitmap_word_alloc(width);
-	return *bitmap;
-}
-
-static void free_bit_array(struct commit *c)
-{
-	struct bitmap **bitmap = bit_arrays_at(&bit_arrays, c);
-	if (!*bitmap)
-		return;
-	bitmap_free(*bitmap);
-	*bitmap = NULL;
-}
-
 void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
@@ -1126,6 +1275,162 @@ void ahead_behind(struct repository *r,
 	clear_prio_queue(&queue);
 }
 
+/*
+ * Collect the commits that "tip" can reach but "old_tip" cannot into
+ * "result". Returns -1 if "old_tip" is not an ancestor of "tip".
+ */
+static int collect_new_commits(struct repository *r,
+			       struct commit *old_tip, struct commit *tip,
+			       struct commit_list **result)
+{
+	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
+	int ret = 0;
+
+	if (old_tip == tip)
+		return 0;
+
+	tip->object.flags |= PARENT1;
+	old_tip->object.flags |= RESULT | STALE;
+	insert_no_dup(&queue, tip);
+	insert_no_dup(&queue, old_tip);
+
+	while (!ret && queue_has_nonstale(&queue)) {
+		struct commit *c = prio_queue_get(&queue);
+		unsigned flags = c->object.flags & (PARENT1 | RESULT);
+		struct commit_list *p;
+
+		/* All of its descendants have been seen by now. */
+		if (c == old_tip && !(flags & PARENT1)) {
+			ret = -1;
+			break;
+		}
+
+		if (flags == PARENT1)
+			commit_list_insert(c, result);
+
+		for (p = c->parents; p; p = p->next) {
+			if (repo_parse_commit(r, p->item)) {
+				ret = -1;
+				break;
+			}
+
+			p->item->object.flags |= flags;
+			if (p->item->object.flags & RESULT)
+				p->item->object.flags |= STALE;
+			insert_no_dup(&queue, p->item);
+		}
+	}
+
+	if (!(old_tip->object.flags & PARENT1))
+		ret = -1;
+
+	/*
+	 * Every commit we marked is reachable from one of the two tips via
+	 * marked commits, so there is no need to go over all objects.
+	 */
+	clear_commit_marks(tip, all_flags);
+	clear_commit_marks(old_tip, all_flags);
+	clear_prio_queue(&queue);
+	if (ret) {
+		free_commit_list(*result);
+		*result = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Count how many commits on "list" can be reached from "from".
+ */
+static unsigned int count_reachable(struct repository *r,
+				    struct commit *from,
+				    struct commit_list *list)
+{
+	timestamp_t generation = commit_graph_generation(from);
+	struct commit **todo = NULL;
+	size_t todo_nr = 0, todo_alloc = 0;
+	unsigned int count = 0;
+
+	for (; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (c == from) {
+			count++;
+			continue;
+		}
+		if (commit_graph_generation(c) >= generation)
+			continue;
+
+		switch (commit_graph_can_reach(r, from, c)) {
+		case 1:
+			count++;
+			break;
+		case -1:
+			ALLOC_GROW(todo, todo_nr + 1, todo_alloc);
+			todo[todo_nr++] = c;
+			break;
+		}
+	}
+
+	if (todo_nr) {
+		struct commit_list *bases = NULL;
+
+		commit_list_insert(from, &bases);
+		tips_reachable_from_bases(r, bases, todo, todo_nr, RESULT);
+		for (size_t i = 0; i < todo_nr; i++) {
+			if (todo[i]->object.flags & RESULT)
+				count++;
+			todo[i]->object.flags &= ~RESULT;
+		}
+		free_commit_list(bases);
+	}
+
+	free(todo);
+	return count;
+}
+
+int ahead_behind_update(struct repository *r,
+			struct commit *old_base, struct commit *old_tip,
+			struct commit *base, struct commit *tip,
+			struct ahead_behind_count *count)
+{
+	struct commit *commits[] = { old_base, old_tip, base, tip };
+	struct commit_list *new_base = NULL, *new_tip = NULL;
+	unsigned int ahead, behind;
+	int ret = -1;
+
+	for (size_t i = 0; i < ARRAY_SIZE(commits); i++)
+		if (repo_parse_commit(r, commits[i]))
+			return -1;
+
+	ensure_generations_valid(r, commits, ARRAY_SIZE(commits));
+
+	if (collect_new_commits(r, old_base, base, &new_base) ||
+	    collect_new_commits(r, old_tip, tip, &new_tip))
+		goto done;
+
+	/*
+	 * The commits new to the tip are ahead unless the new base can
+	 * reach them, and they are no longer behind if the old base
+	 * could reach them; the other way around for the base.
+	 */
+	ahead = count->ahead + commit_list_count(new_tip);
+	ahead -= count_reachable(r, base, new_tip);
+	ahead -= count_reachable(r, old_tip, new_base);
+
+	behind = count->behind + commit_list_count(new_base);
+	behind -= count_reachable(r, tip, new_base);
+	behind -= count_reachable(r, old_base, new_tip);
+
+	count->ahead = ahead;
+	count->behind = behind;
+	ret = 0;
+
+done:
+	free_commit_list(new_base);
+	free_commit_list(new_tip);
+	return ret;
+}
+
 struct commit_and_index {
 	struct commit *commit;
 	unsigned int index;
@@ -130,6 +130,18 @@ void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr);
 
+/*
+ * Given the ahead/behind "count" of "old_tip" against "old_base", update
+ * it to the count of "tip" against "base" by only walking the commits
+ * that were added to either side. Returns -1 without touching "count"
+ * if "old_base" is not an ancestor of "base" or "old_tip" is not an
+ * ancestor of "tip", in which case the caller has to use ahead_behind().
+ */
+int ahead_behind_update(struct repository *r,
+			struct commit *old_base, struct commit *old_tip,
+			struct commit *base, struct commit *tip,
+			struct ahead_behind_count *count);
+
 /*
  * For all tip commits, add 'mark' to their flags if and only if they
  * are reachable from one of the commits in 'bases'.
@@ -0,0 +1,669 @@
+#include "git-compat-util.h"
+#include "describe-index.h"
+#include "chunk-format.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "commit-slab.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "odb.h"
+#include "oid-array.h"
+#include "oidmap.h"
+#include "path.h"
+#include "refs.h"
+#include "replace-object.h"
+#include "repository.h"
+#include "shallow.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "trace2.h"
+
+#define DESCRIBE_INDEX_SIGNATURE 0x44534358 /* "DSCX" */
+#define DESCRIBE_INDEX_VERSION 1
+#define DESCRIBE_INDEX_HEADER_SIZE 16
+
+/*
+ * The file starts with a 4-byte signature, a 1-byte version, the 1-byte
+ * hash version (as in the commit-graph), two reserved bytes, the 4-byte
+ * number of tags and the 4-byte number of entries.
+ *
+ * Each tag consists of the object ID the ref points at, the object ID it
+ * peels to and the NUL-terminated name of the ref.
+ *
+ * Each entry consists of the 1-byte kind, the object IDs of the commit
+ * and of the commit the tag points at, the 4-byte depth, match and name
+ * counts, and the NUL-terminated key, ref name and suffix.
+ *
+ * A checksum of everything before it ends the file.
+ */
+
+struct tag_item {
+	struct object_id oid;
+	struct object_id peeled;
+	unsigned seen:1;
+};
+
+struct index_item {
+	enum describe_index_kind kind;
+	struct object_id commit;
+	char *key;
+	char *refname;
+	char *suffix;
+	struct describe_index_entry entry;
+};
+
+struct describe_index {
+	struct repository *repo;
+	char *path;
+	struct strmap tags;
+	struct strmap entries;
+	struct index_item **dropped;
+	size_t dropped_nr, dropped_alloc;
+	unsigned dirty:1;
+};
+
+define_commit_slab(reach_state, unsigned char);
+
+enum {
+	REACH_UNKNOWN = 0,
+	REACH_VISITING,
+	REACH_NO,
+	REACH_YES,
+};
+
+static int history_is_stable(struct repository *r)
+{
+	if (replace_refs_enabled(r)) {
+		prepare_replace_object(r);
+		if (oidmap_get_size(&r->objects->replace_map))
+			return 0;
+	}
+
+	prepare_commit_graft(r);
+	if (r->parsed_objects &&
+	    (r->parsed_objects->grafts_nr || r->parsed_objects->substituted_parent))
+		return 0;
+	if (is_repository_shallow(r))
+		return 0;
+
+	return 1;
+}
+
+static void index_key(struct strbuf *buf, enum describe_index_kind kind,
+		      const char *key, const struct object_id *commit)
+{
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%d %s %s", (int)kind, oid_to_hex(commit), key);
+}
+
+static void free_index_item(struct index_item *item)
+{
+	if (!item)
+		return;
+	free(item->key);
+	free(item->refname);
+	free(item->suffix);
+	free(item);
+}
+
+static void set_item_entry(struct index_item *item,
+			   const struct describe_index_entry *entry)
+{
+	free(item->refname);
+	free(item->suffix);
+	item->refname = xstrdup_or_null(entry->refname);
+	item->suffix = xstrdup_or_null(entry->suffix);
+
+	item->entry = *entry;
+	item->entry.refname = item->refname;
+	item->entry.suffix = item->suffix;
+}
+
+static const char *read_string(const unsigned char **data,
+			       const unsigned char *end)
+{
+	const char *s = (const char *)*data;
+	const unsigned char *nul = memchr(*data, '\0', end - *data);
+
+	if (!nul)
+		return NULL;
+	*data = nul + 1;
+	return s;
+}
+
+static int parse_index(struct describe_index *idx,
+		       const unsigned char *data, size_t len)
+{
+	const struct git_hash_algo *algop = idx->repo->hash_algo;
+	const unsigned char *end;
+	struct strbuf key = STRBUF_INIT;
+	uint32_t tags_nr, entries_nr;
+
+	if (len < DESCRIBE_INDEX_HEADER_SIZE + algop->rawsz ||
+	    get_be32(data) != DESCRIBE_INDEX_SIGNATURE ||
+	    data[4] != DESCRIBE_INDEX_VERSION ||
+	    data[5] != oid_version(algop) ||
+	    !hashfile_checksum_valid(algop, data, len))
+		return -1;
+
+	tags_nr = get_be32(data + 8);
+	entries_nr = get_be32(data + 12);
+	end = data + len - algop->rawsz;
+	data += DESCRIBE_INDEX_HEADER_SIZE;
+
+	while (tags_nr--) {
+		struct tag_item *tag;
+		const char *refname;
+
+		if ((size_t)(end - data) < 2 * algop->rawsz)
+			goto corrupt;
+
+		CALLOC_ARRAY(tag, 1);
+		oidread(&tag->oid, data, algop);
+		oidread(&tag->peeled, data + algop->rawsz, algop);
+		data += 2 * algop->rawsz;
+
+		refname = read_string(&data, end);
+		if (!refname) {
+			free(tag);
+			goto corrupt;
+		}
+		free(strmap_put(&idx->tags, refname, tag));
+	}
+
+	while (entries_nr--) {
+		struct index_item *item;
+		struct describe_index_entry entry = { 0 };
+		const char *item_key;
+
+		if ((size_t)(end - data) < 1 + 2 * algop->rawsz + 12)
+			goto corrupt;
+
+		CALLOC_ARRAY(item, 1);
+		item->kind = *data++;
+		oidread(&item->commit, data, algop);
+		oidread(&entry.tagged, data + algop->rawsz, algop);
+		data += 2 * algop->rawsz;
+		entry.depth = get_be32(data);
+		entry.match_nr = get_be32(data + 4);
+		entry.names_nr = get_be32(data + 8);
+		data += 12;
+
+		item_key = read_string(&data, end);
+		entry.refname = item_key ? read_string(&data, end) : NULL;
+		entry.suffix = entry.refname ? read_string(&data, end) : NULL;
+		if (!entry.suffix ||
+		    (item->kind != DESCRIBE_INDEX_DESCRIBE &&
+		     item->kind != DESCRIBE_INDEX_NAME_REV)) {
+			free(item);
+			goto corrupt;
+		}
+		if (item->kind == DESCRIBE_INDEX_DESCRIBE)
+			entry.refname = entry.suffix = NULL;
+
+		item->key = xstrdup(item_key);
+		set_item_entry(item, &entry);
+
+		index_key(&key, item->kind, item->key, &item->commit);
+		free_index_item(strmap_put(&idx->entries, key.buf, item));
+	}
+
+	strbuf_release(&key);
+	return data == end ? 0 : -1;
+
+corrupt:
+	strbuf_release(&key);
+	return -1;
+}
+
+struct collect_tags_data {
+	struct repository *repo;
+	struct strmap *old_tags;
+	struct strmap *new_tags;
+	struct oid_array *changed;
+};
+
+static int collect_tag(const struct reference *ref, void *cb_data)
+{
+	struct collect_tags_data *data = cb_data;
+	struct tag_item *tag, *old;
+
+	CALLOC_ARRAY(tag, 1);
+	oidcpy(&tag->oid, ref->oid);
+	if (reference_get_peeled_oid(data->repo, ref, &tag->peeled))
+		oidcpy(&tag->peeled, ref->oid);
+	strmap_put(data->new_tags, ref->name, tag);
+
+	old = strmap_get(data->old_tags, ref->name);
+	if (old) {
+		old->seen = 1;
+		if (oideq(&old->oid, &tag->oid))
+			return 0;
+		oid_array_append(data->changed, &old->peeled);
+	}
+	oid_array_append(data->changed, &tag->peeled);
+	return 0;
+}
+
+/*
+ * Resolve whether "start" can reach one of the commits that were marked
+ * REACH_YES beforehand. Commits with a generation number below
+ * "min_generation" cannot, and the answer for every commit visited is
+ * remembered, so checking many commits costs a single walk.
+ */
+static int can_reach_marked(struct repository *r, struct reach_state *state,
+			    struct commit *start, timestamp_t min_generation)
+{
+	struct commit **stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+	int result;
+
+	ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+	stack[stack_nr++] = start;
+
+	while (stack_nr) {
+		struct commit *c = stack[stack_nr - 1];
+		unsigned char *s = reach_state_at(state, c);
+		struct commit_list *p;
+		int pushed = 0;
+
+		if (*s == REACH_YES || *s == REACH_NO) {
+			stack_nr--;
+			continue;
+		}
+
+		if (*s == REACH_UNKNOWN) {
+			if (repo_parse_commit(r, c) ||
+			    commit_graph_generation(c) < min_generation) {
+				*s = REACH_NO;
+				stack_nr--;
+				continue;
+			}
+
+			*s = REACH_VISITING;
+			for (p = c->parents; p; p = p->next) {
+				if (*reach_state_at(state, p->item) != REACH_UNKNOWN)
+					continue;
+				ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+				stack[stack_nr++] = p->item;
+				pushed = 1;
+			}
+			if (pushed)
+				continue;
+		}
+
+		/* all parents are resolved by now */
+		*s = REACH_NO;
+		for (p = c->parents; p; p = p->next) {
+			if (*reach_state_at(state, p->item) == REACH_YES) {
+				*s = REACH_YES;
+				break;
+			}
+		}
+		stack_nr--;
+	}
+
+	result = *reach_state_at(state, start) == REACH_YES;
+	free(stack);
+	return result;
+}
+
+/*
+ * Mark every commit reachable from "tips" as REACH_YES, stopping at
+ * commits with a generation number below "min_generation".
+ */
+static void mark_reachable(struct repository *r, struct reach_state *state,
+			   struct commit **tips, size_t tips_nr,
+			   timestamp_t min_generation)
+{
+	struct commit **stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+
+	for (size_t i = 0; i < tips_nr; i++) {
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = tips[i];
+	}
+
+	while (stack_nr) {
+		struct commit *c = stack[--stack_nr];
+		unsigned char *s = reach_state_at(state, c);
+
+		if (*s == REACH_YES)
+			continue;
+		if (repo_parse_commit(r, c) ||
+		    commit_graph_generation(c) < min_generation)
+			continue;
+		*s = REACH_YES;
+
+		for (struct commit_list *p = c->parents; p; p = p->next) {
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			stack[stack_nr++] = p->item;
+		}
+	}
+
+	free(stack);
+}
+
+static void drop_stale_entries(struct describe_index *idx,
+			       const struct oid_array *changed)
+{
+	struct repository *r = idx->repo;
+	struct commit **tips = NULL;
+	size_t tips_nr = 0, tips_alloc = 0, name_rev_nr = 0;
+	timestamp_t min_tip_generation = GENERATION_NUMBER_INFINITY;
+	timestamp_t min_name_rev_generation = GENERATION_NUMBER_INFINITY;
+	struct reach_state describe_state, name_rev_state;
+	struct string_list stale = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	for (size_t i = 0; i < changed->nr; i++) {
+		struct commit *c = lookup_commit_reference_gently(r, &changed->oid[i], 1);
+		timestamp_t generation;
+
+		if (!c)
+			continue;
+		generation = commit_graph_generation(c);
+		if (generation < min_tip_generation)
+			min_tip_generation = generation;
+		ALLOC_GROW(tips, tips_nr + 1, tips_alloc);
+		tips[tips_nr++] = c;
+	}
+
+	init_reach_state(&describe_state);
+	init_reach_state(&name_rev_state);
+	for (size_t i = 0; i < tips_nr; i++)
+		*reach_state_at(&describe_state, tips[i]) = REACH_YES;
+
+	strmap_for_each_entry(&idx->entries, &iter, e) {
+		struct index_item *it = e->value;
+		struct commit *c = lookup_commit(r, &it->commit);
+
+		if (!c || repo_parse_commit_gently(r, c, 1)) {
+			/* the commit is gone, nobody will ask for it again */
+			string_list_append(&stale, e->key)->util = it;
+			continue;
+		}
+		if (it->kind == DESCRIBE_INDEX_NAME_REV) {
+			name_rev_nr++;
+			if (commit_graph_generation(c) < min_name_rev_generation)
+				min_name_rev_generation = commit_graph_generation(c);
+		}
+	}
+
+	if (tips_nr && name_rev_nr)
+		mark_reachable(r, &name_rev_state, tips, tips_nr,
+			       min_name_rev_generation);
+
+	strmap_for_each_entry(&idx->entries, &iter, e) {
+		struct index_item *it = e->value;
+		struct commit *c = lookup_commit(r, &it->commit);
+		int is_stale;
+
+		if (!tips_nr || !c || !c->object.parsed)
+			continue;
+
+		if (it->kind == DESCRIBE_INDEX_DESCRIBE)
+			is_stale = can_reach_marked(r, &describe_state, c,
+						    min_tip_generation);
+		else
+			is_stale = *reach_state_at(&name_rev_state, c) == REACH_YES;
+
+		if (is_stale) {
+			ALLOC_GROW(idx->dropped, idx->dropped_nr + 1,
+				   idx->dropped_alloc);
+			idx->dropped[idx->dropped_nr++] = it;
+			string_list_append(&stale, e->key);
+		}
+	}
+
+	/*
+	 * Entries of commits that are gone are freed right away, the
+	 * others are kept around for describe_index_for_each_dropped().
+	 */
+	for_each_string_list_item(item, &stale) {
+		strmap_remove(&idx->entries, item->string, 0);
+		free_index_item(item->util);
+		idx->dirty = 1;
+	}
+
+	trace2_data_intmax("describe-index", r, "dropped", idx->dropped_nr);
+
+	string_list_clear(&stale, 0);
+	clear_reach_state(&describe_state);
+	clear_reach_state(&name_rev_state);
+	free(tips);
+}
+
+struct describe_index *describe_index_load(struct repository *r)
+{
+	struct describe_index *idx;
+	struct strbuf buf = STRBUF_INIT;
+	struct strmap current = STRMAP_INIT;
+	struct oid_array changed = OID_ARRAY_INIT;
+	struct collect_tags_data data = {
+		.repo = r,
+		.new_tags = &current,
+		.changed = &changed,
+	};
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	if (!history_is_stable(r))
+		return NULL;
+
+	CALLOC_ARRAY(idx, 1);
+	idx->repo = r;
+	idx->path = xstrfmt("%s/info/describe-index",
+			    repo_get_object_directory(r));
+	strmap_init(&idx->tags);
+	strmap_init(&idx->entries);
+
+	if (strbuf_read_file(&buf, idx->path, 0) > 0 &&
+	    parse_index(idx, (const unsigned char *)buf.buf, buf.len)) {
+		/* start over, and replace the corrupt file on write */
+		strmap_clear(&idx->tags, 1);
+		strmap_init(&idx->tags);
+		strmap_for_each_entry(&idx->entries, &iter, e)
+			free_index_item(e->value);
+		strmap_clear(&idx->entries, 0);
+		strmap_init(&idx->entries);
+		idx->dirty = 1;
+	}
+	strbuf_release(&buf);
+
+	data.old_tags = &idx->tags;
+	refs_for_each_rawref_in(get_main_ref_store(r), "refs/tags/",
+				collect_tag, &data);
+	strmap_for_each_entry(&idx->tags, &iter, e) {
+		struct tag_item *old = e->value;
+		if (!old->seen)
+			oid_array_append(&changed, &old->peeled);
+	}
+
+	if (changed.nr && strmap_get_size(&idx->entries)) {
+		idx->dirty = 1;
+		drop_stale_entries(idx, &changed);
+	}
+
+	/* from now on, the index describes the current tags */
+	strmap_clear(&idx->tags, 1);
+	idx->tags = current;
+
+	oid_array_clear(&changed);
+	return idx;
+}
+
+const struct describe_index_entry *describe_index_get(struct describe_index *idx,
+						      enum describe_index_kind kind,
+						      const char *key,
+						      const struct object_id *commit)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct index_item *item;
+
+	index_key(&buf, kind, key, commit);
+	item = strmap_get(&idx->entries, buf.buf);
+	strbuf_release(&buf);
+
+	return item ? &item->entry : NULL;
+}
+
+void describe_index_put(struct describe_index *idx,
+			enum describe_index_kind kind, const char *key,
+			const struct object_id *commit,
+			const struct describe_index_entry *entry)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct index_item *item;
+
+	index_key(&buf, kind, key, commit);
+	item = strmap_get(&idx->entries, buf.buf);
+	if (!item) {
+		CALLOC_ARRAY(item, 1);
+		item->kind = kind;
+		oidcpy(&item->commit, commit);
+		item->key = xstrdup(key);
+		strmap_put(&idx->entries, buf.buf, item);
+	}
+
+	set_item_entry(item, entry);
+	idx->dirty = 1;
+	strbuf_release(&buf);
+}
+
+void describe_index_for_each_dropped(struct describe_index *idx,
+				     describe_index_fn fn, void *data)
+{
+	for (size_t i = 0; i < idx->dropped_nr; i++)
+		fn(idx->dropped[i]->kind, idx->dropped[i]->key,
+		   &idx->dropped[i]->commit, data);
+}
+
+void describe_index_for_each_key(struct describe_index *idx,
+				 describe_index_fn fn, void *data)
+{
+	struct string_list keys = STRING_LIST_INIT_DUP;
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list_item *item;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(&idx->entries, &iter, e) {
+		struct index_item *it = e->value;
+
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%d %s", (int)it->kind, it->key);
+		string_list_append(&keys, buf.buf)->util = it;
+	}
+	for (size_t i = 0; i < idx->dropped_nr; i++) {
+		struct index_item *it = idx->dropped[i];
+
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%d %s", (int)it->kind, it->key);
+		string_list_append(&keys, buf.buf)->util = it;
+	}
+	string_list_sort(&keys);
+	string_list_remove_duplicates(&keys, 0);
+
+	for_each_string_list_item(item, &keys) {
+		struct index_item *it = item->util;
+		fn(it->kind, it->key, &it->commit, data);
+	}
+
+	string_list_clear(&keys, 0);
+	strbuf_release(&buf);
+}
+
+int describe_index_write(struct describe_index *idx)
+{
+	const struct git_hash_algo *algop = idx->repo->hash_algo;
+	struct lock_file lk = LOCK_INIT;
+	struct string_list tags = STRING_LIST_INIT_NODUP;
+	struct string_list keys = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct hashfile *f;
+	int ret = 0;
+
+	if (!idx->dirty)
+		return 0;
+
+	if (safe_create_leading_directories_const(idx->repo, idx->path) ||
+	    hold_lock_file_for_update(&lk, idx->path, 0) < 0)
+		return 0;
+
+	strmap_for_each_entry(&idx->tags, &iter, e)
+		string_list_append(&tags, e->key)->util = e->value;
+	strmap_for_each_entry(&idx->entries, &iter, e)
+		string_list_append(&keys, e->key)->util = e->value;
+	string_list_sort(&tags);
+	string_list_sort(&keys);
+
+	f = hashfd(algop, get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, DESCRIBE_INDEX_SIGNATURE);
+	hashwrite_u8(f, DESCRIBE_INDEX_VERSION);
+	hashwrite_u8(f, oid_version(algop));
+	hashwrite_u8(f, 0);
+	hashwrite_u8(f, 0);
+	hashwrite_be32(f, tags.nr);
+	hashwrite_be32(f, keys.nr);
+
+	for_each_string_list_item(item, &tags) {
+		struct tag_item *tag = item->util;
+
+		hashwrite(f, tag->oid.hash, algop->rawsz);
+		hashwrite(f, tag->peeled.hash, algop->rawsz);
+		hashwrite(f, item->string, strlen(item->string) + 1);
+	}
+
+	for_each_string_list_item(item, &keys) {
+		struct index_item *it = item->util;
+		const char *refname = it->refname ? it->refname : "";
+		const char *suffix = it->suffix ? it->suffix : "";
+
+		hashwrite_u8(f, it->kind);
+		hashwrite(f, it->commit.hash, algop->rawsz);
+		hashwrite(f, it->entry.tagged.hash, algop->rawsz);
+		hashwrite_be32(f, it->entry.depth);
+		hashwrite_be32(f, it->entry.match_nr);
+		hashwrite_be32(f, it->entry.names_nr);
+		hashwrite(f, it->key, strlen(it->key) + 1);
+		hashwrite(f, refname, strlen(refname) + 1);
+		hashwrite(f, suffix, strlen(suffix) + 1);
+	}
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE,
+			  CSUM_HASH_IN_STREAM);
+	if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write '%s'"), idx->path);
+	else
+		idx->dirty = 0;
+
+	rollback_lock_file(&lk);
+	string_list_clear(&tags, 0);
+	string_list_clear(&keys, 0);
+	return ret;
+}
+
+void describe_index_free(struct describe_index *idx)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	if (!idx)
+		return;
+	strmap_for_each_entry(&idx->entries, &iter, e)
+		free_index_item(e->value);
+	strmap_clear(&idx->entries, 0);
+	strmap_clear(&idx->tags, 1);
+	for (size_t i = 0; i < idx->dropped_nr; i++)
+		free_index_item(idx->dropped[i]);
+	free(idx->dropped);
+	free(idx->path);
+	free(idx);
+}
@@ -0,0 +1,109 @@
+#ifndef DESCRIBE_INDEX_H
+#define DESCRIBE_INDEX_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * An index of the names that git-describe(1) and git-name-rev(1) gave to
+ * commits, stored in "$GIT_DIR/objects/info/describe-index". Entries are
+ * keyed by the kind of name, a string describing the options that
+ * influence it, and the commit that was named.
+ *
+ * Both kinds of names are only ever derived from tags. The index records
+ * the tags that existed when it was written; when it is loaded, entries
+ * which a tag that was added, deleted or moved since then could have
+ * influenced are dropped:
+ *
+ *  - A describe name of a commit only depends on the tags it can reach,
+ *    so it is dropped if the commit can reach the changed tag.
+ *
+ *  - A name-rev name of a commit only depends on the tags that can reach
+ *    it, so it is dropped if the changed tag can reach the commit.
+ *
+ * New commits never invalidate anything, so in the common case of a new
+ * tag on top of history, only the few commits between the new tag and
+ * the previous one lose their entry.
+ */
+struct describe_index;
+
+enum describe_index_kind {
+	DESCRIBE_INDEX_DESCRIBE,
+	DESCRIBE_INDEX_NAME_REV,
+};
+
+struct describe_index_entry {
+	/*
+	 * For describe: the commit the chosen tag points at, the number of
+	 * commits on top of it, and what is needed to tell whether a walk
+	 * with a different number of candidate tags would have stopped at
+	 * the same point (see builtin/describe.c).
+	 */
+	struct object_id tagged;
+	unsigned int depth;
+	unsigned int match_nr;
+	unsigned int names_nr;
+
+	/*
+	 * For name-rev: the full name of the tag the name starts from, and
+	 * the path from the tag to the commit, e.g. "~2^2".
+	 */
+	const char *refname;
+	const char *suffix;
+};
+
+/*
+ * Load the index of the given repository and drop the entries that the
+ * tags that changed since it was written may have influenced. Returns
+ * NULL if the history of the repository can be rewritten by grafts,
+ * replace refs or a shallow file. A missing or corrupt file yields an
+ * empty index.
+ */
+struct describe_index *describe_index_load(struct repository *r);
+
+/*
+ * Look up the name of "commit", or return NULL.
+ */
+const struct describe_index_entry *describe_index_get(struct describe_index *idx,
+						      enum describe_index_kind kind,
+						      const char *key,
+						      const struct object_id *commit);
+
+/*
+ * Record the name of "commit". The strings in "entry" are copied.
+ */
+void describe_index_put(struct describe_index *idx,
+			enum describe_index_kind kind, const char *key,
+			const struct object_id *commit,
+			const struct describe_index_entry *entry);
+
+typedef void (*describe_index_fn)(enum describe_index_kind kind,
+				  const char *key,
+				  const struct object_id *commit,
+				  void *data);
+
+/*
+ * Call "fn" for each entry that describe_index_load() dropped because a
+ * tag changed, so that the caller can compute it again.
+ */
+void describe_index_for_each_dropped(struct describe_index *idx,
+				     describe_index_fn fn, void *data);
+
+/*
+ * Call "fn" once for each kind and key that has entries in the index.
+ * The commit passed to "fn" is one of the commits that have an entry.
+ */
+void describe_index_for_each_key(struct describe_index *idx,
+				 describe_index_fn fn, void *data);
+
+/*
+ * Write the index back if it has changed. Failing to take the lock is
+ * not an error, another process is already updating the index. Returns
+ * 0 on success and -1 on error.
+ */
+int describe_index_write(struct describe_index *idx);
+
+void describe_index_free(struct describe_index *idx);
+
+#endif /* DESCRIBE_INDEX_H */
@@ -18,10 +18,59 @@
  */
 #include "git-compat-util.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
 
+/*
+ * Carry-save adder: add the three words a, b and c bit by bit, storing
+ * the "twos" bits of each sum in h and the "ones" bits in l.
+ */
+#define CSA(h, l, a, b, c) do { \
+	eword_t u_ = (a) ^ (b); \
+	(h) = ((a) & (b)) | (u_ & (c)); \
+	(l) = u_ ^ (c); \
+} while (0)
+
+/*
+ * Count the bits set in an array of words.
+ *
+ * Rather than computing a (comparatively expensive) population count for
+ * every word, feed blocks of eight words through a tree of carry-save
+ * adders (the "Harley-Seal" method) and only count the resulting "eights"
+ * word once per block. This is plain C which does not depend on any
+ * particular instruction set, but it does about a third of the work of
+ * the naive loop.
+ */
+static size_t popcount_words(const eword_t *words, size_t nr)
+{
+	eword_t ones = 0, twos = 0, fours = 0, eights;
+	eword_t twos_a, twos_b, fours_a, fours_b;
+	size_t i = 0, count = 0;
+
+	for (; i + 8 <= nr; i += 8) {
+		CSA(twos_a, ones, ones, words[i], words[i + 1]);
+		CSA(twos_b, ones, ones, words[i + 2], words[i + 3]);
+		CSA(fours_a, twos, twos, twos_a, twos_b);
+		CSA(twos_a, ones, ones, words[i + 4], words[i + 5]);
+		CSA(twos_b, ones, ones, words[i + 6], words[i + 7]);
+		CSA(fours_b, twos, twos, twos_a, twos_b);
+		CSA(eights, fours, fours, fours_a, fours_b);
+		count += ewah_bit_popcount64(eights);
+	}
+
+	count = 8 * count +
+		4 * ewah_bit_popcount64(fours) +
+		2 * ewah_bit_popcount64(twos) +
+		ewah_bit_popcount64(ones);
+
+	for (; i < nr; i++)
+		count += ewah_bit_popcount64(words[i]);
+
+	return count;
+}
+
 struct bitmap *bitmap_word_alloc(size_t word_alloc)
 {
 	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
@@ -100,21 +149,64 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 	return ewah;
 }
 
+/*
+ * A compressed bitmap is a sequence of marker words, each of which
+ * describes a run of "run_len" clean words (all zeroes or all ones,
+ * depending on "run_bit"), followed by "literal_len" dirty words which
+ * are stored verbatim right after the marker.
+ *
+ * Walking the markers directly (instead of expanding the bitmap one
+ * word at a time with an ewah_iterator) lets the operations below
+ * handle an entire clean run in a single step.
+ */
+struct ewah_marker {
+	size_t run_len;
+	int run_bit;
+	const eword_t *literals;
+	size_t literal_len;
+};
+
+static int ewah_next_marker(struct ewah_bitmap *ewah, size_t *pointer,
+			    struct ewah_marker *m)
+{
+	const eword_t *word;
+
+	if (*pointer >= ewah->buffer_size)
+		return 0;
+
+	word = &ewah->buffer[*pointer];
+	m->run_len = rlw_get_running_len(word);
+	m->run_bit = rlw_get_run_bit(word);
+	m->literals = word + 1;
+	m->literal_len = rlw_get_literal_words(word);
+	if (m->literal_len > ewah->buffer_size - *pointer - 1)
+		m->literal_len = ewah->buffer_size - *pointer - 1;
+
+	*pointer += 1 + m->literal_len;
+	return 1;
+}
+
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
+	struct bitmap *bitmap;
+	struct ewah_marker m;
+	size_t pointer = 0, nr = 0, i = 0;
 
-	ewah_iterator_init(&it, ewah);
+	while (ewah_next_marker(ewah, &pointer, &m))
+		nr = st_add3(nr, m.run_len, m.literal_len);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+	bitmap = bitmap_word_alloc(nr);
+
+	pointer = 0;
+	while (ewah_next_marker(ewah, &pointer, &m)) {
+		if (m.run_bit)
+			memset(bitmap->words + i, 0xff, m.run_len * sizeof(eword_t));
+		i += m.run_len;
+
+		COPY_ARRAY(bitmap->words + i, m.literals, m.literal_len);
+		i += m.literal_len;
 	}
 
-	bitmap->word_alloc = i;
 	return bitmap;
 }
 
@@ -185,9 +277,8 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	size_t i = 0, j, pointer = 0;
+	struct ewah_marker m;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -196,32 +287,59 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
+	while (i < self->word_alloc &&
+	       ewah_next_marker(other, &pointer, &m)) {
+		size_t run_len = m.run_len;
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+		if (run_len > self->word_alloc - i)
+			run_len = self->word_alloc - i;
+		if (m.run_bit)
+			memset(self->words + i, 0xff, run_len * sizeof(eword_t));
+		i += run_len;
+
+		for (j = 0; j < m.literal_len && i < self->word_alloc; j++)
+			self->words[i++] |= m.literals[j];
+	}
 }
 
-size_t bitmap_popcount(struct bitmap *self)
+size_t bitmap_and_ewah_popcount(struct bitmap *self, struct ewah_bitmap *other)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
+	size_t i = 0, j, pointer = 0, count = 0;
+	struct ewah_marker m;
+
+	while (i < self->word_alloc &&
+	       ewah_next_marker(other, &pointer, &m)) {
+		size_t run_len = m.run_len;
+
+		if (run_len > self->word_alloc - i)
+			run_len = self->word_alloc - i;
+		if (m.run_bit)
+			count += popcount_words(self->words + i, run_len);
+		i += run_len;
+
+		for (j = 0; j < m.literal_len && i < self->word_alloc; j++)
+			count += ewah_bit_popcount64(self->words[i++] &
+						     m.literals[j]);
+	}
 
 	return count;
 }
 
-size_t ewah_bitmap_popcount(struct ewah_bitmap *self)
+size_t bitmap_popcount(struct bitmap *self)
 {
-	struct ewah_iterator it;
-	eword_t word;
-	size_t count = 0;
+	return popcount_words(self->words, self->word_alloc);
+}
 
-	ewah_iterator_init(&it, self);
+size_t ewah_bitmap_popcount(struct ewah_bitmap *self)
+{
+	struct ewah_marker m;
+	size_t count = 0, pointer = 0;
 
-	while (ewah_iterator_next(&word, &it))
-		count += ewah_bit_popcount64(word);
+	while (ewah_next_marker(self, &pointer, &m)) {
+		if (m.run_bit)
+			count += m.run_len * BITS_IN_EWORD;
+		count += popcount_words(m.literals, m.literal_len);
+	}
 
 	return count;
 }
@@ -208,6 +208,11 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
 void bitmap_or(struct bitmap *self, const struct bitmap *other);
 
 size_t bitmap_popcount(struct bitmap *self);
+/*
+ * Returns the number of bits set in both 'self' and 'other', without
+ * decompressing 'other'.
+ */
+size_t bitmap_and_ewah_popcount(struct bitmap *self, struct ewah_bitmap *other);
 size_t ewah_bitmap_popcount(struct ewah_bitmap *self);
 int bitmap_is_empty(struct bitmap *self);
 
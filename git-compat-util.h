@@ -106,6 +106,18 @@ DISABLE_WARNING(-Wsign-compare)
 # define BARF_UNLESS_UNSIGNED(var) 0
 #endif
 
+/*
+ * Hint to the CPU that the memory at "addr" will be read soon, so that
+ * the cache miss can overlap with other work. This never faults, even
+ * for addresses outside of any mapping, and is a no-op on compilers
+ * that do not support it.
+ */
+#if GIT_GNUC_PREREQ(3, 1)
+# define prefetch_for_read(addr) __builtin_prefetch((addr), 0)
+#else
+# define prefetch_for_read(addr) ((void)(addr))
+#endif
+
 /*
  * ARRAY_SIZE - get the number of elements in a visible array
  * @x: the array whose size you want.
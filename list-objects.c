@@ -14,6 +14,7 @@
 #include "list-objects-filter.h"
 #include "list-objects-filter-options.h"
 #include "packfile.h"
+#include "packed-oidset.h"
 #include "odb.h"
 #include "trace.h"
 #include "environment.h"
@@ -25,6 +26,12 @@ struct traversal_context {
 	void *show_data;
 	struct filter *filter;
 	int depth;
+
+	/*
+	 * With --stream-objects, the trees and blobs that have been seen,
+	 * see lookup_entry_object().
+	 */
+	struct packed_oidset *seen;
 };
 
 static void show_commit(struct traversal_context *ctx,
@@ -63,6 +70,8 @@ static void process_blob(struct traversal_context *ctx,
 		die("bad blob object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	if (ctx->seen && packed_oidset_insert(ctx->seen, &obj->oid))
+		return;
 
 	/*
 	 * Pre-filter known-missing objects when explicitly requested.
@@ -97,6 +106,48 @@ static void process_tree(struct traversal_context *ctx,
 			 struct strbuf *base,
 			 const char *name);
 
+union entry_object {
+	struct tree tree;
+	struct blob blob;
+};
+
+/*
+ * Find the object for a tree entry. With --stream-objects, the entries
+ * which do not have a "struct object" yet are not added to the object
+ * hash, but "buf" is filled in for them instead, which only lives as
+ * long as the entry is processed. Whether they have been seen already
+ * is kept in ctx->seen, which only needs a bit for most of them.
+ *
+ * Entries that do have an object, e.g. because they were marked
+ * UNINTERESTING before the traversal, are used as usual so that their
+ * flags are respected.
+ */
+static struct object *lookup_entry_object(struct traversal_context *ctx,
+					  const struct object_id *oid,
+					  enum object_type type,
+					  union entry_object *buf)
+{
+	struct repository *r = ctx->revs->repo;
+
+	if (ctx->seen && !lookup_object(r, oid)) {
+		struct object *obj = type == OBJ_TREE ?
+			&buf->tree.object : &buf->blob.object;
+
+		memset(buf, 0, sizeof(*buf));
+		obj->type = type;
+		oidcpy(&obj->oid, oid);
+		return obj;
+	}
+
+	if (type == OBJ_TREE) {
+		struct tree *t = lookup_tree(r, oid);
+		return t ? &t->object : NULL;
+	} else {
+		struct blob *b = lookup_blob(r, oid);
+		return b ? &b->object : NULL;
+	}
+}
+
 static void process_tree_contents(struct traversal_context *ctx,
 				  struct tree *tree,
 				  struct strbuf *base)
@@ -120,7 +171,9 @@ static void process_tree_contents(struct traversal_context *ctx,
 		}
 
 		if (S_ISDIR(entry.mode)) {
-			struct tree *t = lookup_tree(ctx->revs->repo, &entry.oid);
+			union entry_object buf;
+			struct tree *t = (struct tree *)
+				lookup_entry_object(ctx, &entry.oid, OBJ_TREE, &buf);
 			if (!t) {
 				die(_("entry '%s' in tree %s has tree mode, "
 				      "but is not a tree"),
@@ -134,7 +187,9 @@ static void process_tree_contents(struct traversal_context *ctx,
 		else if (S_ISGITLINK(entry.mode))
 			; /* ignore gitlink */
 		else {
-			struct blob *b = lookup_blob(ctx->revs->repo, &entry.oid);
+			union entry_object buf;
+			struct blob *b = (struct blob *)
+				lookup_entry_object(ctx, &entry.oid, OBJ_BLOB, &buf);
 			if (!b) {
 				die(_("entry '%s' in tree %s has blob mode, "
 				      "but is not a blob"),
@@ -163,6 +218,8 @@ static void process_tree(struct traversal_context *ctx,
 		die("bad tree object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	if (ctx->seen && packed_oidset_insert(ctx->seen, &obj->oid))
+		return;
 	if (revs->include_check_obj &&
 	    !revs->include_check_obj(&tree->object, revs->include_check_data))
 		return;
@@ -437,11 +494,16 @@ void traverse_commit_list_filtered(
 		.show_data = show_data,
 	};
 
+	struct packed_oidset seen = PACKED_OIDSET_INIT(revs->repo);
+
 	if (revs->filter.choice)
 		ctx.filter = list_objects_filter__init(omitted, &revs->filter);
+	else if (revs->stream_objects)
+		ctx.seen = &seen;
 
 	do_traverse(&ctx);
 
 	if (ctx.filter)
 		list_objects_filter__free(ctx.filter);
+	packed_oidset_clear(&seen);
 }
@@ -161,6 +161,7 @@ static int ls_refs_config(const char *var, const char *value,
 int ls_refs(struct repository *r, struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct strvec excludes = STRVEC_INIT;
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
@@ -203,9 +204,11 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 		strvec_push(&data.prefixes, "");
 	refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
 					  get_git_namespace(), data.prefixes.v,
-					  hidden_refs_to_excludes(&data.hidden_refs),
+					  hidden_refs_to_excludes(&data.hidden_refs,
+								  &excludes),
 					  send_ref, &data);
 	packet_fflush(stdout);
+	strvec_clear(&excludes);
 	strvec_clear(&data.prefixes);
 	strbuf_release(&data.buf);
 	strvec_clear(&data.hidden_refs);
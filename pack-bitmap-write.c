@@ -27,6 +27,7 @@
 #include "strmap.h"
 #include "midx.h"
 #include "pack-revindex.h"
+#include "thread-utils.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -59,6 +60,10 @@ void bitmap_writer_init(struct bitmap_writer *writer, struct repository *r,
 	string_list_init_dup(&writer->pseudo_merge_groups);
 
 	load_pseudo_merges_from_config(r, &writer->pseudo_merge_groups);
+
+	repo_config_get_int(r, "pack.writebitmapthreads", &writer->nr_threads);
+	repo_config_get_ulong(r, "pack.writebitmapmemory",
+			      &writer->xor_memory_limit);
 }
 
 static void free_pseudo_merge_commit_idx(struct pseudo_merge_commit_idx *idx)
@@ -249,49 +254,145 @@ static uint32_t find_object_pos(struct bitmap_writer *writer,
 	return 0;
 }
 
-static void compute_xor_offsets(struct bitmap_writer *writer)
+/*
+ * Selecting an XOR base for one commit only reads the (already final)
+ * bitmaps of the commits before it, so the search for each commit is
+ * independent of all others. Note that this avoids the EWAH bitmap pool,
+ * which is not thread-safe.
+ */
+static void compute_xor_offset(struct bitmap_writer *writer, int next)
 {
 	static const int MAX_XOR_OFFSET_SEARCH = 10;
 
-	int i, next = 0;
+	struct bitmapped_commit *stored = &writer->selected[next];
+	int best_offset = 0;
+	struct ewah_bitmap *best_bitmap = stored->bitmap;
+	struct ewah_bitmap *test_xor;
+	int i;
 
-	while (next < writer->selected_nr) {
-		struct bitmapped_commit *stored = &writer->selected[next];
-		int best_offset = 0;
-		struct ewah_bitmap *best_bitmap = stored->bitmap;
-		struct ewah_bitmap *test_xor;
+	if (stored->pseudo_merge)
+		goto out;
 
-		if (stored->pseudo_merge)
-			goto next;
+	for (i = 1; i <= MAX_XOR_OFFSET_SEARCH; ++i) {
+		int curr = next - i;
 
-		for (i = 1; i <= MAX_XOR_OFFSET_SEARCH; ++i) {
-			int curr = next - i;
-
-			if (curr < 0)
-				break;
-			if (writer->selected[curr].pseudo_merge)
-				continue;
+		if (curr < 0)
+			break;
+		if (writer->selected[curr].pseudo_merge)
+			continue;
 
-			test_xor = ewah_pool_new();
-			ewah_xor(writer->selected[curr].bitmap, stored->bitmap, test_xor);
+		test_xor = ewah_new();
+		ewah_xor(writer->selected[curr].bitmap, stored->bitmap, test_xor);
 
-			if (test_xor->buffer_size < best_bitmap->buffer_size) {
-				if (best_bitmap != stored->bitmap)
-					ewah_pool_free(best_bitmap);
+		if (test_xor->buffer_size < best_bitmap->buffer_size) {
+			if (best_bitmap != stored->bitmap)
+				ewah_free(best_bitmap);
 
-				best_bitmap = test_xor;
-				best_offset = i;
-			} else {
-				ewah_pool_free(test_xor);
-			}
+			best_bitmap = test_xor;
+			best_offset = i;
+		} else {
+			ewah_free(test_xor);
 		}
+	}
 
-next:
-		stored->xor_offset = best_offset;
-		stored->write_as = best_bitmap;
+out:
+	stored->xor_offset = best_offset;
+	stored->write_as = best_bitmap;
+}
+
+/*
+ * Below this many selected commits, the cost of spawning threads
+ * outweighs the work they would share.
+ */
+#define XOR_OFFSETS_PER_THREAD_MIN 16
+
+struct xor_offsets_thread_data {
+	pthread_t pthread;
+	struct bitmap_writer *writer;
+	int offset;
+	int nr;
+};
+
+static void *compute_xor_offsets_thread(void *_data)
+{
+	struct xor_offsets_thread_data *data = _data;
+	int i;
+
+	for (i = data->offset; i < data->offset + data->nr; i++)
+		compute_xor_offset(data->writer, i);
+	return NULL;
+}
 
-		next++;
+/*
+ * An upper bound on the memory that one thread searching for XOR bases
+ * holds on to: the best candidate so far and the one being tried, each
+ * of which is at most as large as the two bitmaps it was computed from.
+ */
+static size_t xor_offset_memory(struct bitmap_writer *writer)
+{
+	size_t max_words = 0;
+	int i;
+
+	for (i = 0; i < writer->selected_nr; i++) {
+		struct ewah_bitmap *bitmap = writer->selected[i].bitmap;
+
+		if (bitmap && bitmap->buffer_size > max_words)
+			max_words = bitmap->buffer_size;
+	}
+	return st_mult(4 * sizeof(eword_t), max_words);
+}
+
+static void compute_xor_offsets(struct bitmap_writer *writer)
+{
+	struct xor_offsets_thread_data *data;
+	int threads = writer->nr_threads;
+	int i, offset, work;
+
+	if (!HAVE_THREADS)
+		threads = 1;
+	else if (threads <= 0)
+		threads = online_cpus();
+	if (threads > writer->selected_nr / XOR_OFFSETS_PER_THREAD_MIN)
+		threads = writer->selected_nr / XOR_OFFSETS_PER_THREAD_MIN;
+	if (threads > 1 && writer->xor_memory_limit) {
+		size_t per_thread = xor_offset_memory(writer);
+
+		if (per_thread && threads > writer->xor_memory_limit / per_thread)
+			threads = writer->xor_memory_limit / per_thread;
+	}
+
+	if (threads < 2) {
+		for (i = 0; i < writer->selected_nr; i++)
+			compute_xor_offset(writer, i);
+		return;
+	}
+
+	trace2_data_intmax("pack-bitmap-write", writer->repo,
+			   "xor_offsets_threads", threads);
+
+	CALLOC_ARRAY(data, threads);
+	offset = 0;
+	work = DIV_ROUND_UP(writer->selected_nr, threads);
+	for (i = 0; i < threads; i++) {
+		struct xor_offsets_thread_data *p = &data[i];
+		int err;
+
+		p->writer = writer;
+		p->offset = offset;
+		p->nr = work;
+		if (p->offset + p->nr > writer->selected_nr)
+			p->nr = writer->selected_nr - p->offset;
+		offset += p->nr;
+
+		err = pthread_create(&p->pthread, NULL,
+				     compute_xor_offsets_thread, p);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
 	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die(_("unable to join thread"));
+	free(data);
 }
 
 struct bb_commit {
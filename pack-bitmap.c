@@ -22,6 +22,12 @@
 #include "midx.h"
 #include "config.h"
 #include "pseudo-merge.h"
+#include "dir.h"
+#include "object-name.h"
+#include "oidmap.h"
+#include "strmap.h"
+#include "tree.h"
+#include "tree-walk.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -1663,6 +1669,23 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	}
 }
 
+static struct ewah_bitmap *type_bitmap(struct bitmap_index *bitmap_git,
+				       enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return bitmap_git->commits;
+	case OBJ_TREE:
+		return bitmap_git->trees;
+	case OBJ_BLOB:
+		return bitmap_git->blobs;
+	case OBJ_TAG:
+		return bitmap_git->tags;
+	default:
+		BUG("object type %d not stored by bitmap type index", type);
+	}
+}
+
 static void init_type_iterator(struct ewah_or_iterator *it,
 			       struct bitmap_index *bitmap_git,
 			       enum object_type type)
@@ -1797,10 +1820,15 @@ static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
 	return result;
 }
 
-static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
-				       struct object_list *tip_objects,
-				       struct bitmap *to_filter,
-				       enum object_type type)
+/*
+ * Remove all objects of the given type from "to_filter", except for
+ * those which are set in "keep" (if non-NULL).
+ */
+static void filter_bitmap_exclude_type_except(struct bitmap_index *bitmap_git,
+					      struct object_list *tip_objects,
+					      struct bitmap *to_filter,
+					      enum object_type type,
+					      struct bitmap *keep)
 {
 	struct eindex *eindex = &bitmap_git->ext_index;
 	struct bitmap *tips;
@@ -1825,6 +1853,8 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	     i++) {
 		if (i < tips->word_alloc)
 			mask &= ~tips->words[i];
+		if (keep && i < keep->word_alloc)
+			mask &= ~keep->words[i];
 		to_filter->words[i] &= ~mask;
 	}
 
@@ -1837,7 +1867,8 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 		size_t pos = st_add(i, bitmap_num_objects_total(bitmap_git));
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
-		    !bitmap_get(tips, pos))
+		    !bitmap_get(tips, pos) &&
+		    !(keep && bitmap_get(keep, pos)))
 			bitmap_unset(to_filter, pos);
 	}
 
@@ -1845,6 +1876,15 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	bitmap_free(tips);
 }
 
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       struct bitmap *to_filter,
+				       enum object_type type)
+{
+	filter_bitmap_exclude_type_except(bitmap_git, tip_objects, to_filter,
+					  type, NULL);
+}
+
 static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 				    struct object_list *tip_objects,
 				    struct bitmap *to_filter)
@@ -1941,18 +1981,369 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	bitmap_free(tips);
 }
 
+static void bitmap_object_oid(struct bitmap_index *bitmap_git,
+			      struct object_id *oid, uint32_t pos)
+{
+	if (pos < bitmap_num_objects_total(bitmap_git)) {
+		if (bitmap_is_midx(bitmap_git))
+			nth_midxed_object_oid(oid, bitmap_git->midx,
+					      pack_pos_to_midx(bitmap_git->midx, pos));
+		else
+			nth_bitmap_object_oid(bitmap_git, oid,
+					      pack_pos_to_index(bitmap_git->pack, pos));
+	} else {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		pos -= bitmap_num_objects_total(bitmap_git);
+		oidcpy(oid, &eindex->objects[pos]->oid);
+	}
+}
+
+/*
+ * Filters which depend on the path (or depth) at which an object is
+ * reachable cannot be answered from the bitmaps alone, but they do not
+ * need a full object walk either: the commits are known from the
+ * result, and only trees which are part of the result need to be
+ * opened, since anything below a tree reachable from the "haves" is
+ * not part of the result, either.
+ *
+ * Call "fn" with the root tree of each commit in "reachable".
+ */
+typedef void (*root_tree_fn)(struct tree *tree, void *data);
+
+static void for_each_reachable_root_tree(struct bitmap_index *bitmap_git,
+					 struct bitmap *reachable,
+					 root_tree_fn fn, void *data)
+{
+	struct repository *repo = bitmap_repo(bitmap_git);
+	struct ewah_or_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	for (i = 0, init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+	     i < reachable->word_alloc && ewah_or_iterator_next(&mask, &it);
+	     i++) {
+		eword_t word = reachable->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct object_id oid;
+			struct commit *c;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+
+			bitmap_object_oid(bitmap_git, &oid,
+					  i * BITS_IN_EWORD + offset);
+			c = lookup_commit(repo, &oid);
+			if (!c || repo_parse_commit(repo, c))
+				die(_("unable to parse commit %s"),
+				    oid_to_hex(&oid));
+			fn(repo_get_commit_tree(repo, c), data);
+		}
+	}
+	ewah_or_iterator_release(&it);
+
+	for (i = 0; i < bitmap_git->ext_index.count; i++) {
+		struct object *obj = bitmap_git->ext_index.objects[i];
+		struct commit *c;
+
+		if (obj->type != OBJ_COMMIT ||
+		    !bitmap_get(reachable,
+				st_add(i, bitmap_num_objects_total(bitmap_git))))
+			continue;
+
+		c = (struct commit *)obj;
+		if (repo_parse_commit(repo, c))
+			die(_("unable to parse commit %s"),
+			    oid_to_hex(&obj->oid));
+		fn(repo_get_commit_tree(repo, c), data);
+	}
+}
+
+/*
+ * Return the bitmap position of "oid" if it is part of "reachable", or
+ * -1 otherwise.
+ */
+static int reachable_position(struct bitmap_index *bitmap_git,
+			      struct bitmap *reachable,
+			      const struct object_id *oid)
+{
+	int pos = bitmap_position(bitmap_git, oid);
+	if (pos < 0 || !bitmap_get(reachable, pos))
+		return -1;
+	return pos;
+}
+
+static void parse_tree_or_die(struct tree *tree)
+{
+	if (parse_tree_gently(tree, 1))
+		die("bad tree object %s", oid_to_hex(&tree->object.oid));
+}
+
+struct tree_depth_seen {
+	struct oidmap_entry base;
+	size_t depth;
+};
+
+struct tree_depth_walk {
+	struct bitmap_index *bitmap_git;
+	struct bitmap *reachable;
+	struct bitmap *included;
+	unsigned long exclude_depth;
+
+	/*
+	 * The minimum depth at which each tree was walked. A tree only
+	 * needs to be walked again if it is later found at a shallower
+	 * depth.
+	 */
+	struct oidmap seen_at_depth;
+};
+
+static void tree_depth_walk_tree(struct tree_depth_walk *w,
+				 struct tree *tree, size_t depth)
+{
+	struct repository *repo = bitmap_repo(w->bitmap_git);
+	struct tree_depth_seen *seen;
+	struct tree_desc desc;
+	struct name_entry entry;
+	int pos;
+
+	pos = reachable_position(w->bitmap_git, w->reachable,
+				 &tree->object.oid);
+	if (pos < 0)
+		return;
+
+	seen = oidmap_get(&w->seen_at_depth, &tree->object.oid);
+	if (!seen) {
+		CALLOC_ARRAY(seen, 1);
+		oidcpy(&seen->base.oid, &tree->object.oid);
+		oidmap_put(&w->seen_at_depth, seen);
+	} else if (depth >= seen->depth) {
+		return;
+	}
+	seen->depth = depth;
+
+	if (depth >= w->exclude_depth)
+		return;
+	bitmap_set(w->included, pos);
+
+	/* Everything in this tree lives at "depth + 1". */
+	if (depth + 1 >= w->exclude_depth)
+		return;
+
+	parse_tree_or_die(tree);
+	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISDIR(entry.mode)) {
+			struct tree *t = lookup_tree(repo, &entry.oid);
+			if (!t)
+				die(_("entry '%s' in tree %s has tree mode, "
+				      "but is not a tree"),
+				    entry.path, oid_to_hex(&tree->object.oid));
+			tree_depth_walk_tree(w, t, depth + 1);
+		} else if (!S_ISGITLINK(entry.mode)) {
+			pos = reachable_position(w->bitmap_git, w->reachable,
+						 &entry.oid);
+			if (pos >= 0)
+				bitmap_set(w->included, pos);
+		}
+	}
+
+	free_tree_buffer(tree);
+}
+
+static void tree_depth_walk_root(struct tree *tree, void *data)
+{
+	tree_depth_walk_tree(data, tree, 0);
+}
+
 static void filter_bitmap_tree_depth(struct bitmap_index *bitmap_git,
 				     struct object_list *tip_objects,
 				     struct bitmap *to_filter,
 				     unsigned long limit)
 {
-	if (limit)
-		BUG("filter_bitmap_tree_depth given non-zero limit");
+	struct tree_depth_walk w = {
+		.bitmap_git = bitmap_git,
+		.reachable = to_filter,
+		.exclude_depth = limit,
+	};
+
+	if (!limit) {
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_TREE);
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB);
+		return;
+	}
 
-	filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
-				   OBJ_TREE);
-	filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
-				   OBJ_BLOB);
+	w.included = bitmap_new();
+	oidmap_init(&w.seen_at_depth, 0);
+
+	for_each_reachable_root_tree(bitmap_git, to_filter,
+				     tree_depth_walk_root, &w);
+
+	filter_bitmap_exclude_type_except(bitmap_git, tip_objects, to_filter,
+					  OBJ_TREE, w.included);
+	filter_bitmap_exclude_type_except(bitmap_git, tip_objects, to_filter,
+					  OBJ_BLOB, w.included);
+
+	oidmap_clear(&w.seen_at_depth, 1);
+	bitmap_free(w.included);
+}
+
+struct sparse_walk {
+	struct bitmap_index *bitmap_git;
+	struct bitmap *reachable;
+	struct bitmap *matched;
+	struct pattern_list pl;
+	struct strbuf path;
+
+	/*
+	 * Trees which have already been walked at a given path, keyed
+	 * by "<oid> <path>". Whether a blob matches depends only on its
+	 * path, so walking the same tree at the same path again (as
+	 * happens for each commit which did not touch it) cannot match
+	 * anything new.
+	 */
+	struct strset walked;
+
+	/*
+	 * Trees in which every reachable blob has matched, which need
+	 * not be walked again at any path.
+	 */
+	struct oidset complete;
+};
+
+/*
+ * Walk "tree", found at "w->path", marking the blobs in it which match
+ * the sparse patterns. Return 1 if any reachable blob in it did not
+ * match, and 0 otherwise.
+ */
+static int sparse_walk_tree(struct sparse_walk *w, struct tree *tree,
+			    size_t filename_offset,
+			    enum pattern_match_result default_match)
+{
+	struct repository *repo = bitmap_repo(w->bitmap_git);
+	struct strbuf key = STRBUF_INIT;
+	enum pattern_match_result match;
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t pathlen = w->path.len;
+	int dtype, prov_omit = 0, seen;
+
+	if (reachable_position(w->bitmap_git, w->reachable,
+			       &tree->object.oid) < 0)
+		return 0;
+	if (oidset_contains(&w->complete, &tree->object.oid))
+		return 0;
+
+	strbuf_addf(&key, "%s %s", oid_to_hex(&tree->object.oid), w->path.buf);
+	seen = !strset_add(&w->walked, key.buf);
+	strbuf_release(&key);
+	if (seen)
+		return 1;
+
+	dtype = DT_DIR;
+	match = path_matches_pattern_list(w->path.buf, w->path.len,
+					  w->path.buf + filename_offset,
+					  &dtype, &w->pl, repo->index);
+	if (match == UNDECIDED)
+		match = default_match;
+
+	parse_tree_or_die(tree);
+	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		enum pattern_match_result blob_match;
+		int pos;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+
+		if (pathlen)
+			strbuf_addch(&w->path, '/');
+		filename_offset = w->path.len;
+		strbuf_add(&w->path, entry.path, tree_entry_len(&entry));
+
+		if (S_ISDIR(entry.mode)) {
+			struct tree *t = lookup_tree(repo, &entry.oid);
+			if (!t)
+				die(_("entry '%s' in tree %s has tree mode, "
+				      "but is not a tree"),
+				    entry.path, oid_to_hex(&tree->object.oid));
+			prov_omit |= sparse_walk_tree(w, t, filename_offset,
+						      match);
+			goto next;
+		}
+
+		pos = reachable_position(w->bitmap_git, w->reachable,
+					 &entry.oid);
+		if (pos < 0 || bitmap_get(w->matched, pos))
+			goto next;
+
+		dtype = DT_REG;
+		blob_match = path_matches_pattern_list(w->path.buf, w->path.len,
+						       w->path.buf + filename_offset,
+						       &dtype, &w->pl,
+						       repo->index);
+		if (blob_match == UNDECIDED)
+			blob_match = match;
+		if (blob_match == MATCHED)
+			bitmap_set(w->matched, pos);
+		else
+			prov_omit = 1;
+next:
+		strbuf_setlen(&w->path, pathlen);
+	}
+
+	free_tree_buffer(tree);
+
+	if (!prov_omit)
+		oidset_insert(&w->complete, &tree->object.oid);
+	return prov_omit;
+}
+
+static void sparse_walk_root(struct tree *tree, void *data)
+{
+	struct sparse_walk *w = data;
+	sparse_walk_tree(w, tree, 0, NOT_MATCHED);
+}
+
+static void filter_bitmap_sparse(struct bitmap_index *bitmap_git,
+				 struct object_list *tip_objects,
+				 struct bitmap *to_filter,
+				 const char *sparse_oid_name)
+{
+	struct sparse_walk w = {
+		.bitmap_git = bitmap_git,
+		.reachable = to_filter,
+		.path = STRBUF_INIT,
+		.complete = OIDSET_INIT,
+	};
+	struct object_id sparse_oid;
+
+	if (repo_get_oid_with_flags(bitmap_repo(bitmap_git), sparse_oid_name,
+				    &sparse_oid, GET_OID_BLOB))
+		die(_("unable to access sparse blob in '%s'"),
+		    sparse_oid_name);
+	if (add_patterns_from_blob_to_list(&sparse_oid, "", 0, &w.pl) < 0)
+		die(_("unable to parse sparse filter data in %s"),
+		    oid_to_hex(&sparse_oid));
+
+	w.matched = bitmap_new();
+	strset_init(&w.walked);
+
+	for_each_reachable_root_tree(bitmap_git, to_filter,
+				     sparse_walk_root, &w);
+
+	filter_bitmap_exclude_type_except(bitmap_git, tip_objects, to_filter,
+					  OBJ_BLOB, w.matched);
+
+	bitmap_free(w.matched);
+	oidset_clear(&w.complete);
+	strset_clear(&w.walked);
+	strbuf_release(&w.path);
+	clear_pattern_list(&w.pl);
 }
 
 static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
@@ -1973,6 +2364,38 @@ static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
 		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter, OBJ_BLOB);
 }
 
+/*
+ * The filters which walk trees only look at trees which are still part
+ * of "to_filter", so when combining filters, they must run before any
+ * filter which may remove trees. Sparse filters only ever remove blobs,
+ * so they run first of all.
+ */
+static int filter_bitmap_pass(struct list_objects_filter_options *filter)
+{
+	if (filter->choice == LOFC_SPARSE_OID)
+		return 0;
+	if (filter->choice == LOFC_TREE_DEPTH && filter->tree_exclude_depth)
+		return 1;
+	return 2;
+}
+
+/*
+ * Returns 1 if the filter needs to know the path (or depth) at which
+ * each tree and blob was found.
+ */
+static int filter_needs_paths(struct list_objects_filter_options *filter)
+{
+	int i;
+
+	if (filter->choice == LOFC_COMBINE) {
+		for (i = 0; i < filter->sub_nr; i++)
+			if (filter_needs_paths(&filter->sub[i]))
+				return 1;
+		return 0;
+	}
+	return filter_bitmap_pass(filter) < 2;
+}
+
 static int filter_bitmap(struct bitmap_index *bitmap_git,
 			 struct object_list *tip_objects,
 			 struct bitmap *to_filter,
@@ -1996,8 +2419,7 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 		return 0;
 	}
 
-	if (filter->choice == LOFC_TREE_DEPTH &&
-	    filter->tree_exclude_depth == 0) {
+	if (filter->choice == LOFC_TREE_DEPTH) {
 		if (bitmap_git)
 			filter_bitmap_tree_depth(bitmap_git, tip_objects,
 						 to_filter,
@@ -2005,6 +2427,14 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 		return 0;
 	}
 
+	if (filter->choice == LOFC_SPARSE_OID) {
+		if (bitmap_git)
+			filter_bitmap_sparse(bitmap_git, tip_objects,
+					     to_filter,
+					     filter->sparse_oid_name);
+		return 0;
+	}
+
 	if (filter->choice == LOFC_OBJECT_TYPE) {
 		if (bitmap_git)
 			filter_bitmap_object_type(bitmap_git, tip_objects,
@@ -2014,11 +2444,16 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 	}
 
 	if (filter->choice == LOFC_COMBINE) {
-		int i;
-		for (i = 0; i < filter->sub_nr; i++) {
-			if (filter_bitmap(bitmap_git, tip_objects, to_filter,
-					  &filter->sub[i]) < 0)
-				return -1;
+		int pass, i;
+		for (pass = 0; pass < 3; pass++) {
+			for (i = 0; i < filter->sub_nr; i++) {
+				if (filter_bitmap_pass(&filter->sub[i]) != pass)
+					continue;
+				if (filter_bitmap(bitmap_git, tip_objects,
+						  to_filter,
+						  &filter->sub[i]) < 0)
+					return -1;
+			}
 		}
 		return 0;
 	}
@@ -2067,7 +2502,8 @@ int for_each_bitmapped_object(struct bitmap_index *bitmap_git,
 	size_t full_word_count;
 	int ret;
 
-	if (!can_filter_bitmap(filter)) {
+	if (!can_filter_bitmap(filter) ||
+	    (filter && filter_needs_paths(filter))) {
 		ret = -1;
 		goto out;
 	}
@@ -2157,6 +2593,21 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 			object_list_insert(object, &wants);
 	}
 
+	/*
+	 * Filters which depend on an object's path walk down from the root
+	 * tree of each commit in the result. We do not know the path of
+	 * trees or blobs which were asked for directly, so leave those to
+	 * the regular traversal.
+	 */
+	if (filter_needs_paths(&revs->filter)) {
+		struct object_list *p;
+
+		for (p = wants; p; p = p->next)
+			if (p->item->type != OBJ_COMMIT &&
+			    p->item->type != OBJ_TAG)
+				goto cleanup;
+	}
+
 	use_boundary_traversal = git_env_bool(GIT_TEST_PACK_USE_BITMAP_BOUNDARY_TRAVERSAL, -1);
 	if (use_boundary_traversal < 0) {
 		prepare_repo_settings(revs->repo);
@@ -2622,9 +3073,20 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	init_type_iterator(&it, bitmap_git, type);
 
-	while (i < objects->word_alloc && ewah_or_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
+	if (!bitmap_git->base_nr) {
+		/*
+		 * With a single layer there is only one type bitmap to
+		 * consider, so we can count against its compressed form
+		 * directly and skip over clean runs in one go.
+		 */
+		count = bitmap_and_ewah_popcount(objects,
+						 type_bitmap(bitmap_git, type));
+	} else {
+		while (i < objects->word_alloc &&
+		       ewah_or_iterator_next(&filter, &it)) {
+			eword_t word = objects->words[i++] & filter;
+			count += ewah_bit_popcount64(word);
+		}
 	}
 
 	for (i = 0; i < eindex->count; ++i) {
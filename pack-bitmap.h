@@ -144,6 +144,8 @@ struct bitmap_writer {
 
 	struct progress *progress;
 	int show_progress;
+	int nr_threads;
+	unsigned long xor_memory_limit;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
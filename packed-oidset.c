@@ -0,0 +1,103 @@
+#include "git-compat-util.h"
+#include "packed-oidset.h"
+#include "ewah/ewok.h"
+#include "midx.h"
+#include "odb.h"
+#include "packfile.h"
+#include "repository.h"
+
+#define RECENT_NR (1 << 14)
+
+static void prepare_ranges(struct packed_oidset *set)
+{
+	struct packed_git *p;
+
+	set->prepared = 1;
+
+	odb_prepare_alternates(set->repo->objects);
+	for (struct odb_source *source = set->repo->objects->sources;
+	     source; source = source->next) {
+		struct multi_pack_index *m = get_multi_pack_index(source);
+
+		if (!m)
+			continue;
+		ALLOC_GROW(set->ranges, set->ranges_nr + 1, set->ranges_alloc);
+		set->ranges[set->ranges_nr++] = (struct packed_oidset_range) {
+			.midx = m,
+			.nr = m->num_objects + m->num_objects_in_base,
+		};
+	}
+
+	repo_for_each_pack(set->repo, p) {
+		if (p->multi_pack_index || open_pack_index(p))
+			continue;
+		ALLOC_GROW(set->ranges, set->ranges_nr + 1, set->ranges_alloc);
+		set->ranges[set->ranges_nr++] = (struct packed_oidset_range) {
+			.pack = p,
+			.nr = p->num_objects,
+		};
+	}
+}
+
+static struct packed_oidset_range *find_range(struct packed_oidset *set,
+					      const struct object_id *oid,
+					      uint32_t *pos)
+{
+	if (!set->prepared)
+		prepare_ranges(set);
+
+	for (size_t i = 0; i < set->ranges_nr; i++) {
+		struct packed_oidset_range *range = &set->ranges[i];
+
+		if (range->midx ? bsearch_midx(oid, range->midx, pos) :
+				  bsearch_pack(oid, range->pack, pos))
+			return range;
+	}
+	return NULL;
+}
+
+int packed_oidset_insert(struct packed_oidset *set, const struct object_id *oid)
+{
+	struct packed_oidset_range *range;
+	struct object_id *recent;
+	uint32_t pos;
+
+	if (!set->recent)
+		CALLOC_ARRAY(set->recent, RECENT_NR);
+	recent = &set->recent[oidhash(oid) & (RECENT_NR - 1)];
+	if (oideq(recent, oid))
+		return 1;
+	oidcpy(recent, oid);
+
+	range = find_range(set, oid, &pos);
+	if (!range)
+		return oidset_insert(&set->other, oid);
+	if (!range->seen)
+		range->seen = bitmap_word_alloc(DIV_ROUND_UP(range->nr, BITS_IN_EWORD));
+	else if (bitmap_get(range->seen, pos))
+		return 1;
+	bitmap_set(range->seen, pos);
+	return 0;
+}
+
+int packed_oidset_contains(struct packed_oidset *set, const struct object_id *oid)
+{
+	struct packed_oidset_range *range;
+	uint32_t pos;
+
+	range = find_range(set, oid, &pos);
+	if (!range)
+		return oidset_contains(&set->other, oid);
+	return range->seen && bitmap_get(range->seen, pos);
+}
+
+void packed_oidset_clear(struct packed_oidset *set)
+{
+	for (size_t i = 0; i < set->ranges_nr; i++)
+		bitmap_free(set->ranges[i].seen);
+	FREE_AND_NULL(set->ranges);
+	set->ranges_nr = set->ranges_alloc = 0;
+	set->prepared = 0;
+	oidset_clear(&set->other);
+	FREE_AND_NULL(set->recent);
+}
@@ -0,0 +1,61 @@
+#ifndef PACKED_OIDSET_H
+#define PACKED_OIDSET_H
+
+#include "oidset.h"
+
+struct repository;
+struct bitmap;
+
+/**
+ * A set of object ids like oidset, which uses a single bit for each
+ * object that is in a pack: objects are identified by their position in
+ * the multi-pack-index or in the pack index. Objects that are not in
+ * any pack fall back to an oidset.
+ *
+ * This makes it possible to remember which objects a traversal has
+ * already seen without keeping a "struct object" for each of them.
+ */
+struct packed_oidset {
+	struct repository *repo;
+
+	/*
+	 * The multi-pack-indexes and the packs which they do not cover,
+	 * in the order they are searched. The list is taken when the
+	 * first object is inserted, so that an object that is in more
+	 * than one pack is always found at the same place.
+	 */
+	struct packed_oidset_range {
+		struct multi_pack_index *midx;
+		struct packed_git *pack;
+		size_t nr;
+		struct bitmap *seen;
+	} *ranges;
+	size_t ranges_nr, ranges_alloc;
+	int prepared;
+
+	struct oidset other;
+
+	/*
+	 * A small cache of objects known to be in the set, indexed by
+	 * their hash, which saves looking up objects that are inserted
+	 * over and over again in the indexes.
+	 */
+	struct object_id *recent;
+};
+
+#define PACKED_OIDSET_INIT(r) { .repo = (r), .other = OIDSET_INIT }
+
+/**
+ * Insert the oid into the set. Returns 1 if the oid was already in the
+ * set, 0 otherwise.
+ */
+int packed_oidset_insert(struct packed_oidset *set, const struct object_id *oid);
+
+/**
+ * Returns true iff `set` contains `oid`.
+ */
+int packed_oidset_contains(struct packed_oidset *set, const struct object_id *oid);
+
+void packed_oidset_clear(struct packed_oidset *set);
+
+#endif /* PACKED_OIDSET_H */
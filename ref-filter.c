@@ -31,8 +31,11 @@
 #include "wt-status.h"
 #include "commit-slab.h"
 #include "commit-reach.h"
+#include "ahead-behind-cache.h"
 #include "worktree.h"
 #include "hashmap.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -903,6 +906,7 @@ static int ahead_behind_atom_parser(struct ref_format *format UNUSED,
 	if (!arg)
 		return strbuf_addf_ret(err, -1, _("expected format: %%(ahead-behind:<committish>)"));
 
+	atom->u.base.name = xstrdup(arg);
 	atom->u.base.commit = lookup_commit_reference_by_name(arg);
 	if (!atom->u.base.commit)
 		die("failed to find '%s'", arg);
@@ -2360,6 +2364,41 @@ static const char *get_refname(struct used_atom *atom, struct ref_array_item *re
 	return show_ref(&atom->u.refname, ref->refname);
 }
 
+/*
+ * An object read ahead of time by prefetch_ref_objects(), on behalf of
+ * the ref whose values are populated next.
+ */
+struct ref_object_prefetch {
+	struct ref_array_item *ref;
+	struct expand_data data;
+	int ret;
+};
+
+static struct ref_object_prefetch *prefetched;
+
+static int read_ref_object(struct expand_data *oi, int deref)
+{
+	struct expand_data *p;
+
+	if (deref || !prefetched)
+		return odb_read_object_info_extended(the_repository->objects,
+						     &oi->oid, &oi->info,
+						     OBJECT_INFO_LOOKUP_REPLACE);
+
+	p = &prefetched->data;
+	if (!oideq(&p->oid, &oi->oid))
+		BUG("prefetched object %s instead of %s", oid_to_hex(&p->oid),
+		    oid_to_hex(&oi->oid));
+
+	oi->type = p->type;
+	oi->size = p->size;
+	oi->disk_size = p->disk_size;
+	oidcpy(&oi->delta_base_oid, &p->delta_base_oid);
+	oi->content = p->content;
+	p->content = NULL;
+	return prefetched->ret;
+}
+
 static int get_object(struct ref_array_item *ref, int deref,
 		      struct expand_data *oi, struct strbuf *err)
 {
@@ -2375,8 +2414,7 @@ static int get_object(struct ref_array_item *ref, int deref,
 		oi->info.typep = &oi->type;
 	}
 
-	if (odb_read_object_info_extended(the_repository->objects, &oi->oid, &oi->info,
-					  OBJECT_INFO_LOOKUP_REPLACE)) {
+	if (read_ref_object(oi, deref)) {
 		ret = strbuf_addf_ret(err, -1, _("missing object %s for %s"),
 				      oid_to_hex(&oi->oid), ref->refname);
 		goto out;
@@ -3051,29 +3089,231 @@ static int filter_one(const struct reference *ref, void *cb_data)
 }
 
 /*  Free memory allocated for a ref_array_item */
-static void free_array_item(struct ref_array_item *item)
+static void free_ref_values(struct ref_array_item *item)
 {
-	free((char *)item->symref);
 	if (item->value) {
 		int i;
 		for (i = 0; i < used_atom_cnt; i++)
 			free((char *)item->value[i].s);
-		free(item->value);
+		FREE_AND_NULL(item->value);
 	}
+}
+
+static void free_array_item(struct ref_array_item *item)
+{
+	free((char *)item->symref);
+	free_ref_values(item);
 	free(item->counts);
 	free(item->is_base);
 	free(item);
 }
 
+/*
+ * Refs whose objects are read on multiple threads are handled in batches
+ * of this many, so that only one batch worth of object contents is held
+ * in memory at a time.
+ */
+#define REF_OBJECTS_PER_BATCH 8192
+
+/*
+ * Mostly randomly chosen: we cap the parallelism to 20 threads, and
+ * want to read at least 500 objects per thread for it to be worth
+ * starting one.
+ */
+#define MAX_PARALLEL_READS (20)
+#define READS_PER_THREAD (500)
+
+struct prefetch_thread_data {
+	pthread_t pthread;
+	struct ref_object_prefetch *todo;
+	size_t nr, offset, step;
+};
+
+static void *prefetch_ref_objects_thread(void *_data)
+{
+	struct prefetch_thread_data *data = _data;
+
+	for (size_t i = data->offset; i < data->nr; i += data->step) {
+		struct ref_object_prefetch *p = &data->todo[i];
+
+		p->ret = odb_read_object_info_extended(the_repository->objects,
+						       &p->data.oid, &p->data.info,
+						       OBJECT_INFO_LOOKUP_REPLACE);
+	}
+	return NULL;
+}
+
+/*
+ * Ask for the same information about the object of "ref" as
+ * populate_value() does via "oi", but store it in "p".
+ */
+static void prepare_ref_object_prefetch(struct ref_object_prefetch *p,
+					struct ref_array_item *ref)
+{
+	struct expand_data *d = &p->data;
+
+	memset(p, 0, sizeof(*p));
+	p->ref = ref;
+	oidcpy(&d->oid, &ref->objectname);
+
+	if (oi.info.typep)
+		d->info.typep = &d->type;
+	if (oi.info.sizep)
+		d->info.sizep = &d->size;
+	if (oi.info.disk_sizep)
+		d->info.disk_sizep = &d->disk_size;
+	if (oi.info.delta_base_oid)
+		d->info.delta_base_oid = &d->delta_base_oid;
+	if (oi.info.contentp) {
+		d->info.contentp = &d->content;
+		d->info.sizep = &d->size;
+		d->info.typep = &d->type;
+	}
+}
+
+static void prefetch_ref_objects(struct ref_object_prefetch *todo,
+				 size_t nr, int nr_threads)
+{
+	struct prefetch_thread_data *data;
+	int t;
+
+	/*
+	 * The threads only read objects, which is safe under the
+	 * object read lock. Parsing them touches the global object
+	 * table and is left to the main thread.
+	 */
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(data, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int err;
+
+		data[t].todo = todo;
+		data[t].nr = nr;
+		data[t].offset = t;
+		data[t].step = nr_threads;
+
+		err = pthread_create(&data[t].pthread, NULL,
+				     prefetch_ref_objects_thread, &data[t]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++)
+		if (pthread_join(data[t].pthread, NULL))
+			die(_("unable to join thread"));
+	free(data);
+
+	disable_obj_read_lock();
+}
+
+/*
+ * Return the number of threads to read the objects of "nr" refs with,
+ * given that up to "nr_threads" threads were asked for.
+ */
+static int ref_object_threads(int nr_threads, int nr)
+{
+	if (!HAVE_THREADS)
+		return 1;
+	if (nr_threads > nr / READS_PER_THREAD)
+		nr_threads = nr / READS_PER_THREAD;
+	if (nr_threads > MAX_PARALLEL_READS)
+		nr_threads = MAX_PARALLEL_READS;
+	return nr_threads;
+}
+
+/*
+ * Whether populate_value() needs the contents of the objects. Other
+ * object info, like the type or size of packed objects, is looked up
+ * under the object read lock, so threads would only take turns.
+ * Reading contents lets them inflate in parallel.
+ */
+static int need_ref_contents(void)
+{
+	/* Mirror what populate_value() asks for. */
+	if (need_tagged)
+		oi.info.contentp = &oi.content;
+	return !!oi.info.contentp;
+}
+
+/*
+ * Populate the values of the first "nr" refs in the array up front,
+ * reading the objects they need on up to "nr_threads" threads. Refs that run into an error are left alone so that
+ * the error is reported when their values are needed.
+ */
+static void populate_ref_values(struct ref_array *array, int nr,
+				int nr_threads)
+{
+	struct ref_object_prefetch *todo;
+	struct strbuf err = STRBUF_INIT;
+	int i;
+
+	nr_threads = ref_object_threads(nr_threads, nr);
+	if (nr_threads < 2 || !need_ref_contents())
+		return;
+
+	trace2_data_intmax("ref-filter", the_repository, "prefetch_threads",
+			   nr_threads);
+
+	ALLOC_ARRAY(todo, REF_OBJECTS_PER_BATCH);
+	for (i = 0; i < nr; i += REF_OBJECTS_PER_BATCH) {
+		size_t todo_nr = 0, j;
+		int end = i + REF_OBJECTS_PER_BATCH;
+
+		if (end > nr)
+			end = nr;
+		for (j = i; j < end; j++)
+			if (!array->items[j]->value)
+				prepare_ref_object_prefetch(&todo[todo_nr++],
+							    array->items[j]);
+		if (!todo_nr)
+			continue;
+
+		prefetch_ref_objects(todo, todo_nr, nr_threads);
+
+		for (j = 0; j < todo_nr; j++) {
+			struct ref_array_item *ref = todo[j].ref;
+
+			prefetched = &todo[j];
+			if (populate_value(ref, &err))
+				free_ref_values(ref);
+			else
+				fill_missing_values(ref->value);
+			prefetched = NULL;
+
+			free(todo[j].data.content);
+			strbuf_reset(&err);
+		}
+	}
+
+	free(todo);
+	strbuf_release(&err);
+}
+
 struct ref_filter_and_format_cbdata {
 	struct ref_filter *filter;
 	struct ref_format *format;
 
 	struct ref_filter_and_format_internal {
 		int count;
+
+		/*
+		 * Refs that are waiting for their objects to be read on
+		 * multiple threads before they are printed, if any.
+		 */
+		struct ref_array *batch;
 	} internal;
 };
 
+static void flush_ref_batch(struct ref_array *batch, struct ref_format *format)
+{
+	populate_ref_values(batch, batch->nr, format->array_opts.threads);
+	print_formatted_ref_array(batch, format);
+
+	for (int i = 0; i < batch->nr; i++)
+		free_array_item(batch->items[i]);
+	batch->nr = 0;
+}
+
 static int filter_and_format_one(const struct reference *ref, void *cb_data)
 {
 	struct ref_filter_and_format_cbdata *ref_cbdata = cb_data;
@@ -3084,6 +3324,15 @@ static int filter_and_format_one(const struct reference *ref, void *cb_data)
 	if (!item)
 		return 0;
 
+	if (ref_cbdata->internal.batch) {
+		struct ref_array *batch = ref_cbdata->internal.batch;
+
+		ref_array_append(batch, item);
+		if (batch->nr >= REF_OBJECTS_PER_BATCH)
+			flush_ref_batch(batch, ref_cbdata->format);
+		goto out;
+	}
+
 	if (format_ref_array_item(item, ref_cbdata->format, &output, &err))
 		die("%s", err.buf);
 
@@ -3096,6 +3345,7 @@ static int filter_and_format_one(const struct reference *ref, void *cb_data)
 	strbuf_release(&err);
 	free_array_item(item);
 
+out:
 	/*
 	 * Increment the running count of refs that match the filter. If
 	 * max_count is set and we've reached the max, stop the ref
@@ -3124,7 +3374,8 @@ void ref_array_clear(struct ref_array *array)
 			free(atom->u.head);
 		else if (atom->atom_type == ATOM_DESCRIBE)
 			strvec_clear(&atom->u.describe_args);
-		else if (atom->atom_type == ATOM_ISBASE)
+		else if (atom->atom_type == ATOM_AHEADBEHIND ||
+			 atom->atom_type == ATOM_ISBASE)
 			free(atom->u.base.name);
 		else if (atom->atom_type == ATOM_TRAILERS ||
 			 (atom->atom_type == ATOM_CONTENTS &&
@@ -3200,11 +3451,114 @@ static void reach_filter(struct ref_array *array,
 	free(to_clear);
 }
 
+/*
+ * Like ahead_behind(), but reuse or update the counts found in "cache",
+ * and only walk for the remaining ones. "names" holds the name of the
+ * base or ref for each of the "commits". The new counts are only written
+ * back to the cache if "write" is set.
+ */
+static void cached_ahead_behind(struct repository *r,
+				struct ahead_behind_cache *cache, int write,
+				struct commit **commits, const char **names,
+				size_t commits_nr,
+				struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct commit **todo_commits;
+	struct ahead_behind_count *todo;
+	size_t *todo_index, *commit_map;
+	size_t todo_commits_nr = 0, todo_nr = 0;
+	intmax_t hits = 0, updated = 0;
+
+	ALLOC_ARRAY(todo_commits, commits_nr);
+	ALLOC_ARRAY(commit_map, commits_nr);
+	ALLOC_ARRAY(todo, counts_nr);
+	ALLOC_ARRAY(todo_index, counts_nr);
+
+	for (size_t i = 0; i < commits_nr; i++)
+		commit_map[i] = SIZE_MAX;
+
+	for (size_t i = 0; i < counts_nr; i++) {
+		struct ahead_behind_count *count = &counts[i];
+		struct commit *base = commits[count->base_index];
+		struct commit *tip = commits[count->tip_index];
+		const struct ahead_behind_cache_entry *entry;
+
+		entry = ahead_behind_cache_get(cache, names[count->tip_index],
+					       names[count->base_index]);
+		if (entry) {
+			struct commit *old_base, *old_tip;
+
+			count->ahead = entry->ahead;
+			count->behind = entry->behind;
+			if (oideq(&entry->base, &base->object.oid) &&
+			    oideq(&entry->tip, &tip->object.oid)) {
+				hits++;
+				continue;
+			}
+
+			old_base = lookup_commit_reference_gently(r, &entry->base, 1);
+			old_tip = lookup_commit_reference_gently(r, &entry->tip, 1);
+			if (old_base && old_tip &&
+			    !ahead_behind_update(r, old_base, old_tip,
+						 base, tip, count)) {
+				updated++;
+				continue;
+			}
+		}
+
+		if (commit_map[count->base_index] == SIZE_MAX) {
+			commit_map[count->base_index] = todo_commits_nr;
+			todo_commits[todo_commits_nr++] = base;
+		}
+		if (commit_map[count->tip_index] == SIZE_MAX) {
+			commit_map[count->tip_index] = todo_commits_nr;
+			todo_commits[todo_commits_nr++] = tip;
+		}
+		todo[todo_nr].base_index = commit_map[count->base_index];
+		todo[todo_nr].tip_index = commit_map[count->tip_index];
+		todo_index[todo_nr++] = i;
+	}
+
+	ahead_behind(r, todo_commits, todo_commits_nr, todo, todo_nr);
+
+	for (size_t i = 0; i < todo_nr; i++) {
+		counts[todo_index[i]].ahead = todo[i].ahead;
+		counts[todo_index[i]].behind = todo[i].behind;
+	}
+
+	for (size_t i = 0; write && i < counts_nr; i++) {
+		struct ahead_behind_cache_entry entry = {
+			.ahead = counts[i].ahead,
+			.behind = counts[i].behind,
+		};
+
+		oidcpy(&entry.base, &commits[counts[i].base_index]->object.oid);
+		oidcpy(&entry.tip, &commits[counts[i].tip_index]->object.oid);
+		ahead_behind_cache_put(cache, names[counts[i].tip_index],
+				       names[counts[i].base_index], &entry);
+	}
+	if (write)
+		ahead_behind_cache_write(cache);
+
+	trace2_data_intmax("ahead-behind", r, "cache/hit", hits);
+	trace2_data_intmax("ahead-behind", r, "cache/updated", updated);
+	trace2_data_intmax("ahead-behind", r, "cache/computed", todo_nr);
+
+	free(todo_commits);
+	free(commit_map);
+	free(todo);
+	free(todo_index);
+}
+
 void filter_ahead_behind(struct repository *r,
 			 struct ref_array *array)
 {
 	struct commit **commits;
+	const char **names;
+	struct ahead_behind_cache *cache = NULL;
 	size_t bases_nr, commits_nr;
+	const char *use_cache;
+	int write_cache = 0;
 
 	if (!array->nr)
 		return;
@@ -3217,9 +3571,12 @@ void filter_ahead_behind(struct repository *r,
 		return;
 
 	ALLOC_ARRAY(commits, st_add(bases_nr, array->nr));
+	ALLOC_ARRAY(names, st_add(bases_nr, array->nr));
 	for (size_t i = 0, j = 0; i < used_atom_cnt; i++) {
-		if (used_atom[i].atom_type == ATOM_AHEADBEHIND)
+		if (used_atom[i].atom_type == ATOM_AHEADBEHIND) {
+			names[j] = used_atom[i].u.base.name;
 			commits[j++] = used_atom[i].u.base.commit;
+		}
 	}
 
 	ALLOC_ARRAY(array->counts, st_mult(bases_nr, array->nr));
@@ -3229,6 +3586,7 @@ void filter_ahead_behind(struct repository *r,
 	for (size_t i = 0; i < array->nr; i++) {
 		const char *name = array->items[i]->refname;
 		commits[commits_nr] = lookup_commit_reference_by_name(name);
+		names[commits_nr] = name;
 
 		if (!commits[commits_nr])
 			continue;
@@ -3245,8 +3603,28 @@ void filter_ahead_behind(struct repository *r,
 		commits_nr++;
 	}
 
-	ahead_behind(r, commits, commits_nr, array->counts, array->counts_nr);
+	/*
+	 * Only write to the cache when asked to explicitly, so that merely
+	 * listing refs does not modify the repository.
+	 */
+	if (!repo_config_get_string_tmp(r, "core.aheadbehindcache", &use_cache)) {
+		if (!strcmp(use_cache, "update"))
+			write_cache = 1;
+		if (write_cache || git_parse_maybe_bool(use_cache) > 0)
+			cache = ahead_behind_cache_load(r);
+	}
+
+	if (cache)
+		cached_ahead_behind(r, cache, write_cache,
+				    commits, names, commits_nr,
+				    array->counts, array->counts_nr);
+	else
+		ahead_behind(r, commits, commits_nr,
+			     array->counts, array->counts_nr);
+
+	ahead_behind_cache_free(cache);
 	free(commits);
+	free(names);
 }
 
 void filter_is_base(struct repository *r,
@@ -3443,17 +3821,41 @@ void filter_and_format_refs(struct ref_filter *filter, unsigned int type,
 			.format = format,
 		};
 
+		struct ref_array batch = { 0 };
+
 		save_commit_buffer_orig = save_commit_buffer;
 		save_commit_buffer = 0;
 
+		/*
+		 * Only hold back refs while iterating when their objects
+		 * can be read on multiple threads.
+		 */
+		if (ref_object_threads(format->array_opts.threads,
+				       REF_OBJECTS_PER_BATCH) > 1 &&
+		    need_ref_contents())
+			ref_cbdata.internal.batch = &batch;
+
 		do_filter_refs(filter, type, filter_and_format_one, &ref_cbdata);
 
+		if (batch.nr)
+			flush_ref_batch(&batch, format);
+		free(batch.items);
+
 		save_commit_buffer = save_commit_buffer_orig;
 	} else {
 		struct ref_array array = { 0 };
+		int nr;
+
 		filter_refs(&array, filter, type);
 		filter_ahead_behind(the_repository, &array);
 		filter_is_base(the_repository, &array);
+
+		nr = array.nr;
+		if (!sorting && format->array_opts.max_count &&
+		    format->array_opts.max_count < nr)
+			nr = format->array_opts.max_count;
+		populate_ref_values(&array, nr, format->array_opts.threads);
+
 		ref_array_sort(sorting, &array);
 		print_formatted_ref_array(&array, format);
 		ref_array_clear(&array);
@@ -3541,23 +3943,80 @@ static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, stru
 		? -cmp : cmp;
 }
 
-static int compare_refs(const void *a_, const void *b_, void *ref_sorting)
+/*
+ * Compare "a" and "b" by the sort keys starting at "s", and by their
+ * refnames if these are all equal.
+ */
+static int compare_ref_items(struct ref_sorting *sorting, struct ref_sorting *s,
+			     struct ref_array_item *a, struct ref_array_item *b)
 {
-	struct ref_array_item *a = *((struct ref_array_item **)a_);
-	struct ref_array_item *b = *((struct ref_array_item **)b_);
-	struct ref_sorting *s;
-
-	for (s = ref_sorting; s; s = s->next) {
+	for (; s; s = s->next) {
 		int cmp = cmp_ref_sorting(s, a, b);
 		if (cmp)
 			return cmp;
 	}
-	s = ref_sorting;
-	return s && s->sort_flags & REF_SORTING_ICASE ?
+	return sorting && sorting->sort_flags & REF_SORTING_ICASE ?
 		strcasecmp(a->refname, b->refname) :
 		strcmp(a->refname, b->refname);
 }
 
+static int compare_refs(const void *a_, const void *b_, void *ref_sorting)
+{
+	struct ref_array_item *a = *((struct ref_array_item **)a_);
+	struct ref_array_item *b = *((struct ref_array_item **)b_);
+
+	return compare_ref_items(ref_sorting, ref_sorting, a, b);
+}
+
+/*
+ * The value of the primary sort key of a ref, extracted once before
+ * sorting so that most comparisons do not have to go through the atom
+ * values of the refs.
+ */
+struct ref_sort_key {
+	struct ref_array_item *item;
+	const char *s;
+	size_t len;
+	uintmax_t value;
+};
+
+static int compare_ref_sort_keys(const void *a_, const void *b_, void *ref_sorting)
+{
+	const struct ref_sort_key *a = a_, *b = b_;
+	struct ref_sorting *s = ref_sorting;
+	int cmp;
+
+	if (used_atom[s->atom].type == FIELD_STR) {
+		cmp = s->sort_flags & REF_SORTING_ICASE ?
+			memcasecmp(a->s, b->s, a->len < b->len ? a->len : b->len) :
+			memcmp(a->s, b->s, a->len < b->len ? a->len : b->len);
+		if (!cmp && a->len != b->len)
+			cmp = a->len < b->len ? -1 : 1;
+	} else {
+		cmp = a->value < b->value ? -1 : a->value > b->value;
+	}
+	if (cmp)
+		return s->sort_flags & REF_SORTING_REVERSE ? -cmp : cmp;
+
+	return compare_ref_items(s, s->next, a->item, b->item);
+}
+
+/*
+ * Whether the primary sort key can be compared via a "struct ref_sort_key"
+ * with the same result as cmp_ref_sorting().
+ */
+static int can_use_sort_keys(struct ref_sorting *s, struct ref_array *array)
+{
+	if (s->sort_flags & REF_SORTING_VERSION)
+		return 0;
+	if (s->sort_flags & REF_SORTING_DETACHED_HEAD_FIRST) {
+		for (int i = 0; i < array->nr; i++)
+			if (array->items[i]->kind & FILTER_REFS_DETACHED_HEAD)
+				return 0;
+	}
+	return 1;
+}
+
 void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting,
 				    unsigned int mask, int on)
 {
@@ -3571,8 +4030,35 @@ void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting,
 
 void ref_array_sort(struct ref_sorting *sorting, struct ref_array *array)
 {
-	if (sorting)
+	struct ref_sort_key *keys;
+	struct strbuf err = STRBUF_INIT;
+
+	if (!sorting)
+		return;
+	if (!can_use_sort_keys(sorting, array)) {
 		QSORT_S(array->items, array->nr, compare_refs, sorting);
+		return;
+	}
+
+	ALLOC_ARRAY(keys, array->nr);
+	for (int i = 0; i < array->nr; i++) {
+		struct ref_sort_key *key = &keys[i];
+		struct atom_value *v;
+
+		if (get_ref_atom_value(array->items[i], sorting->atom, &v, &err))
+			die("%s", err.buf);
+		key->item = array->items[i];
+		key->s = v->s;
+		key->len = v->s_size < 0 ? strlen(v->s) : v->s_size;
+		key->value = v->value;
+	}
+	strbuf_release(&err);
+
+	QSORT_S(keys, array->nr, compare_ref_sort_keys, sorting);
+
+	for (int i = 0; i < array->nr; i++)
+		array->items[i] = keys[i].item;
+	free(keys);
 }
 
 static void append_literal(const char *cp, const char *ep, struct ref_formatting_state *state)
@@ -104,6 +104,11 @@ struct ref_format {
 	struct {
 		int max_count;
 		int omit_empty;
+		/*
+		 * The number of threads to read object contents with;
+		 * zero reads them on the main thread, too.
+		 */
+		int threads;
 	} array_opts;
 };
 
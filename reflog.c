@@ -2,6 +2,7 @@
 #define DISABLE_SIGN_COMPARE_WARNINGS
 
 #include "git-compat-util.h"
+#include "commit-graph.h"
 #include "config.h"
 #include "environment.h"
 #include "gettext.h"
@@ -297,8 +298,9 @@ static int keep_entry(struct commit **it, struct object_id *oid)
 /*
  * Starting from commits in the cb->mark_list, mark commits that are
  * reachable from them.  Stop the traversal at commits older than
- * the expire_limit and queue them back, so that the caller can call
- * us again to restart the traversal with longer expire_limit.
+ * the expire_limit, or whose generation number is not above
+ * cb->mark_generation, and queue them back, so that the caller can
+ * call us again to restart the traversal with looser limits.
  */
 static void mark_reachable(struct expire_reflog_policy_cb *cb)
 {
@@ -318,7 +320,8 @@ static void mark_reachable(struct expire_reflog_policy_cb *cb)
 		if (repo_parse_commit(the_repository, commit))
 			continue;
 		commit->object.flags |= REACHABLE;
-		if (commit->date < expire_limit) {
+		if (commit->date < expire_limit ||
+		    commit_graph_generation(commit) <= cb->mark_generation) {
 			commit_list_insert(commit, &leftover);
 			continue;
 		}
@@ -356,9 +359,26 @@ static int is_unreachable(struct expire_reflog_policy_cb *cb, struct commit *com
 	if (commit->object.flags & REACHABLE)
 		return 0;
 
-	if (cb->mark_list && cb->mark_limit) {
-		cb->mark_limit = 0; /* dig down to the root */
-		mark_reachable(cb);
+	/*
+	 * Dig deeper.  Generation numbers strictly decrease along parent
+	 * links, so when the commit-graph knows this commit we only need
+	 * to walk down to its generation instead of to the root.  What is
+	 * left over is kept for digging deeper on behalf of older entries
+	 * of the same reflog.
+	 */
+	if (cb->mark_list) {
+		timestamp_t generation;
+
+		load_commit_graph_info(the_repository, commit);
+		generation = commit_graph_generation(commit);
+		if (generation == GENERATION_NUMBER_INFINITY)
+			generation = 0;
+
+		if (cb->mark_limit || generation < cb->mark_generation) {
+			cb->mark_limit = 0;
+			cb->mark_generation = generation;
+			mark_reachable(cb);
+		}
 	}
 
 	return !(commit->object.flags & REACHABLE);
@@ -51,6 +51,7 @@ struct expire_reflog_policy_cb {
 	} unreachable_expire_kind;
 	struct commit_list *mark_list;
 	unsigned long mark_limit;
+	timestamp_t mark_generation;
 	struct reflog_expire_options opts;
 	struct commit *tip_commit;
 	struct commit_list *tips;
@@ -1679,28 +1679,57 @@ int ref_is_hidden(const char *refname, const char *refname_full,
 	return 0;
 }
 
-const char **hidden_refs_to_excludes(const struct strvec *hide_refs)
+/*
+ * Returns true if one of `a` and `b` names a ref or a hierarchy of refs
+ * that the other one is part of.
+ */
+static int hidden_refs_overlap(const char *a, const char *b)
+{
+	const char *p;
+
+	if (skip_prefix(a, b, &p) && (!*p || *p == '/'))
+		return 1;
+	if (skip_prefix(b, a, &p) && (!*p || *p == '/'))
+		return 1;
+	return 0;
+}
+
+const char **hidden_refs_to_excludes(const struct strvec *hide_refs,
+				     struct strvec *out)
 {
-	const char **pattern;
-	for (pattern = hide_refs->v; *pattern; pattern++) {
+	for (size_t i = 0; i < hide_refs->nr; i++) {
+		const char *match = hide_refs->v[i];
+		size_t j;
+
 		/*
-		 * We can't feed any excludes from hidden refs config
-		 * sections, since later rules may override previous
-		 * ones. For example, with rules "refs/foo" and
-		 * "!refs/foo/bar", we should show "refs/foo/bar" (and
-		 * everything underneath it), but the earlier exclusion
-		 * would cause us to skip all of "refs/foo".  We
-		 * likewise don't implement the namespace stripping
-		 * required for '^' rules.
-		 *
-		 * Both are possible to do, but complicated, so avoid
-		 * populating the jump list at all if we see either of
-		 * these patterns.
+		 * We can't feed '!' rules to the refs machinery, and we
+		 * don't implement the namespace handling required for '^'
+		 * rules, so these are left to `ref_is_hidden()`.
 		 */
-		if (**pattern == '!' || **pattern == '^')
-			return NULL;
+		if (*match == '!' || *match == '^')
+			continue;
+
+		/*
+		 * The last matching rule wins, so we can only skip over all
+		 * of "refs/foo" if no later rule like "!refs/foo/bar" or
+		 * "!refs" shows some of it again. A later "!^" rule may
+		 * match anything depending on the namespace.
+		 */
+		for (j = i + 1; j < hide_refs->nr; j++) {
+			const char *other = hide_refs->v[j];
+
+			if (*other++ != '!')
+				continue;
+			if (*other == '^' || hidden_refs_overlap(match, other))
+				break;
+		}
+		if (j < hide_refs->nr)
+			continue;
+
+		strvec_push(out, match);
 	}
-	return hide_refs->v;
+
+	return out->v;
 }
 
 const char **get_namespaced_exclude_patterns(const char **exclude_patterns,
@@ -2120,6 +2149,111 @@ const char *refs_resolve_ref_unsafe(struct ref_store *refs,
 	return NULL;
 }
 
+void refs_read_raw_refs(struct ref_store *ref_store,
+			struct ref_raw_read *reads, size_t nr)
+{
+	if (ref_store->be->read_raw_refs) {
+		ref_store->be->read_raw_refs(ref_store, reads, nr);
+		return;
+	}
+
+	for (size_t i = 0; i < nr; i++)
+		reads[i].ret = refs_read_raw_ref(ref_store, reads[i].refname,
+						 &reads[i].oid, &reads[i].referent,
+						 &reads[i].type,
+						 &reads[i].failure_errno);
+}
+
+static void ref_read_request_resolve(struct ref_store *refs,
+				     struct ref_read_request *req,
+				     int resolve_flags)
+{
+	const char *resolved = refs_resolve_ref_unsafe(refs, req->refname,
+						       resolve_flags,
+						       &req->oid, &req->flags);
+	req->resolved = xstrdup_or_null(resolved);
+}
+
+static int ref_read_request_cmp(const void *va, const void *vb)
+{
+	const struct ref_read_request *a = *(const struct ref_read_request **)va;
+	const struct ref_read_request *b = *(const struct ref_read_request **)vb;
+	return strcmp(a->refname, b->refname);
+}
+
+void refs_read_refs_many(struct ref_store *refs,
+			 struct ref_read_request *requests, size_t nr,
+			 int resolve_flags)
+{
+	struct ref_read_request **sorted;
+	struct ref_raw_read *reads;
+	size_t sorted_nr = 0;
+
+	ALLOC_ARRAY(sorted, nr);
+	for (size_t i = 0; i < nr; i++) {
+		struct ref_read_request *req = &requests[i];
+
+		req->resolved = NULL;
+		req->flags = 0;
+
+		/*
+		 * Badly named refs and pseudorefs need special treatment,
+		 * so we leave them to `refs_resolve_ref_unsafe()`.
+		 */
+		if (check_refname_format(req->refname, REFNAME_ALLOW_ONELEVEL) ||
+		    is_pseudo_ref(req->refname)) {
+			ref_read_request_resolve(refs, req, resolve_flags);
+			continue;
+		}
+
+		sorted[sorted_nr++] = req;
+	}
+	QSORT(sorted, sorted_nr, ref_read_request_cmp);
+
+	CALLOC_ARRAY(reads, sorted_nr);
+	for (size_t i = 0; i < sorted_nr; i++) {
+		reads[i].refname = sorted[i]->refname;
+		strbuf_init(&reads[i].referent, 0);
+	}
+
+	refs_read_raw_refs(refs, reads, sorted_nr);
+
+	/* This mirrors the first round of `refs_resolve_ref_unsafe()`. */
+	for (size_t i = 0; i < sorted_nr; i++) {
+		struct ref_read_request *req = sorted[i];
+		struct ref_raw_read *read = &reads[i];
+
+		if (!read->ret && (read->type & REF_ISSYMREF)) {
+			/* Symbolic refs are rare, resolve them one by one. */
+			ref_read_request_resolve(refs, req, resolve_flags);
+		} else if (!read->ret) {
+			oidcpy(&req->oid, &read->oid);
+			req->flags = read->type;
+			req->resolved = xstrdup(req->refname);
+		} else {
+			req->flags = read->type;
+			if (!(resolve_flags & RESOLVE_REF_READING) &&
+			    (read->failure_errno == ENOENT ||
+			     read->failure_errno == EISDIR ||
+			     read->failure_errno == ENOTDIR)) {
+				oidclr(&req->oid, refs->repo->hash_algo);
+				req->resolved = xstrdup(req->refname);
+			}
+		}
+
+		strbuf_release(&read->referent);
+	}
+
+	free(reads);
+	free(sorted);
+}
+
+void ref_read_requests_release(struct ref_read_request *requests, size_t nr)
+{
+	for (size_t i = 0; i < nr; i++)
+		FREE_AND_NULL(requests[i].resolved);
+}
+
 /* backend functions */
 int ref_store_create_on_disk(struct ref_store *refs, int flags, struct strbuf *err)
 {
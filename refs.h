@@ -102,6 +102,37 @@ int refs_read_ref_full(struct ref_store *refs, const char *refname,
 
 int refs_read_ref(struct ref_store *refs, const char *refname, struct object_id *oid);
 
+/*
+ * A single lookup of a batch passed to `refs_read_refs_many()`.
+ */
+struct ref_read_request {
+	/* The reference to look up. */
+	const char *refname;
+
+	/*
+	 * The results, with the same meaning as the return value and the
+	 * out parameters of `refs_resolve_ref_unsafe()`. `resolved` is NULL
+	 * if the reference cannot be resolved and must be released with
+	 * `ref_read_requests_release()`.
+	 */
+	char *resolved;
+	struct object_id oid;
+	int flags;
+};
+
+/*
+ * Resolve many references at once, as if by calling
+ * `refs_resolve_ref_unsafe()` with the given `resolve_flags` on each of
+ * them. The requests may be in any order. This is a lot faster than
+ * looking up the references one by one, as backends can look up all of
+ * them in a single pass over their sorted storage.
+ */
+void refs_read_refs_many(struct ref_store *refs,
+			 struct ref_read_request *requests, size_t nr,
+			 int resolve_flags);
+
+void ref_read_requests_release(struct ref_read_request *requests, size_t nr);
+
 #define NOT_A_SYMREF -2
 
 /*
@@ -1016,10 +1047,14 @@ int parse_hide_refs_config(const char *var, const char *value, const char *,
 int ref_is_hidden(const char *, const char *, const struct strvec *);
 
 /*
- * Returns an array of patterns to use as excluded_patterns, if none of the
- * hidden references use the token '!' or '^'.
+ * Collect those hidden references into `out` that can be used as
+ * excluded_patterns, that is the ones that hide a whole hierarchy of refs
+ * without a later '!' rule showing parts of it again, and return its
+ * array. Rules using '^' are never used. As with all excluded_patterns,
+ * the caller still needs to check `ref_is_hidden()` for each ref.
  */
-const char **hidden_refs_to_excludes(const struct strvec *hide_refs);
+const char **hidden_refs_to_excludes(const struct strvec *hide_refs,
+				     struct strvec *out);
 
 /*
  * Prefix all exclude patterns with the namespace, if any. This is required
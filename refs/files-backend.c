@@ -28,6 +28,7 @@
 #include "../wrapper.h"
 #include "../write-or-die.h"
 #include "../revision.h"
+#include "../thread-utils.h"
 #include <wildmatch.h>
 
 /*
@@ -96,7 +97,7 @@ struct files_ref_store {
 static void clear_loose_ref_cache(struct files_ref_store *refs)
 {
 	if (refs->loose) {
-		free_ref_cache(refs->loose);
+		release_ref_cache(refs->loose);
 		refs->loose = NULL;
 	}
 }
@@ -170,7 +171,7 @@ static struct files_ref_store *files_downcast(struct ref_store *ref_store,
 static void files_ref_store_release(struct ref_store *ref_store)
 {
 	struct files_ref_store *refs = files_downcast(ref_store, 0, "release");
-	free_ref_cache(refs->loose);
+	release_ref_cache(refs->loose);
 	free(refs->gitcommondir);
 	ref_store_release(refs->packed_ref_store);
 	free(refs->packed_ref_store);
@@ -310,9 +311,29 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 	int dirnamelen = strlen(dirname);
 	struct strbuf refname;
 	struct strbuf path = STRBUF_INIT;
+	struct stat st;
 
 	files_ref_path(refs, &path, dirname);
 
+	/*
+	 * Remember the metadata of the directory, so that we notice when
+	 * references are added, removed or updated in it, which always
+	 * happens by renaming files into place. Take it before reading
+	 * the directory, so that we err on the side of reading it again.
+	 */
+	if (!stat(path.buf, &st)) {
+		fill_stat_data(&dir->stat, &st);
+		dir->have_stat = 1;
+
+		/*
+		 * If the directory was modified just now, another change
+		 * within the resolution of the timestamps would not be
+		 * noticed. Make sure that it is read again next time.
+		 */
+		if (st.st_mtime >= time(NULL))
+			memset(&dir->stat, 0, sizeof(dir->stat));
+	}
+
 	d = opendir(path.buf);
 	if (!d) {
 		strbuf_release(&path);
@@ -349,6 +370,41 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 	add_per_worktree_entries_to_dir(dir, dirname);
 }
 
+/*
+ * Check whether `dir` still reflects the loose references on disk.
+ * Besides the directory itself, the targets of symbolic references
+ * in it might have changed, so resolve those again.
+ */
+static int loose_validate_ref_dir(struct ref_store *ref_store,
+				  struct ref_dir *dir, const char *dirname)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "validate_ref_dir");
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int ret = 0;
+
+	files_ref_path(refs, &path, dirname);
+	if (stat(path.buf, &st) || match_stat_data(&dir->stat, &st))
+		ret = 1;
+	strbuf_release(&path);
+
+	for (int i = 0; !ret && i < dir->nr; i++) {
+		struct ref_entry *entry = dir->entries[i];
+		struct object_id oid;
+
+		if ((entry->flag & (REF_ISSYMREF | REF_BAD_NAME)) != REF_ISSYMREF)
+			continue;
+		if (!refs_resolve_ref_unsafe(&refs->base, entry->name,
+					     RESOLVE_REF_READING, &oid, NULL))
+			oidclr(&oid, refs->base.repo->hash_algo);
+		if (!oideq(&oid, &entry->u.value.oid))
+			ret = 1;
+	}
+
+	return ret;
+}
+
 static int for_each_root_ref(struct files_ref_store *refs,
 			     int (*cb)(const char *refname, void *cb_data),
 			     void *cb_data)
@@ -426,9 +482,22 @@ static void add_root_refs(struct files_ref_store *refs,
 	for_each_root_ref(refs, fill_root_ref, &data);
 }
 
+/*
+ * Return the cache of loose references, creating it if necessary. The
+ * cache is kept around for the lifetime of the ref store, which may be
+ * long in servers and other long-running processes, so make sure that
+ * the directories that may hold references starting with `prefix` (or
+ * all of them if it is NULL) are still current. If the cache is stale
+ * and in use by an iterator, that iterator keeps the old one while
+ * we start over with a new one.
+ */
 static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs,
+					     const char *prefix,
 					     unsigned int flags)
 {
+	if (refs->loose && validate_ref_cache(refs->loose, prefix) < 0)
+		clear_loose_ref_cache(refs);
+
 	if (!refs->loose) {
 		struct ref_dir *dir;
 
@@ -437,7 +506,8 @@ static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs,
 		 * are about to read the only subdirectory that can
 		 * hold references:
 		 */
-		refs->loose = create_ref_cache(&refs->base, loose_fill_ref_dir);
+		refs->loose = create_ref_cache(&refs->base, loose_fill_ref_dir,
+					       loose_validate_ref_dir);
 
 		/* We're going to fill the top level ourselves: */
 		refs->loose->root->flag &= ~REF_INCOMPLETE;
@@ -597,6 +667,56 @@ static int files_read_raw_ref(struct ref_store *ref_store, const char *refname,
 	return read_ref_internal(ref_store, refname, oid, referent, type, failure_errno, 0);
 }
 
+static void files_read_raw_refs(struct ref_store *ref_store,
+				struct ref_raw_read *reads, size_t nr)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "read_raw_refs");
+	struct ref_raw_read *packed_reads;
+	size_t *packed_pos, packed_nr = 0;
+
+	CALLOC_ARRAY(packed_reads, nr);
+	ALLOC_ARRAY(packed_pos, nr);
+
+	for (size_t i = 0; i < nr; i++) {
+		struct ref_raw_read *read = &reads[i];
+
+		read->ret = read_ref_internal(ref_store, read->refname, &read->oid,
+					      &read->referent, &read->type,
+					      &read->failure_errno, 1);
+
+		/*
+		 * Like `read_ref_internal()`, fall back to the packed refs
+		 * if there is no loose ref or a directory in its place. We
+		 * look all of them up at once below.
+		 */
+		if (read->ret && (read->failure_errno == ENOENT ||
+				  read->failure_errno == EISDIR)) {
+			packed_reads[packed_nr].refname = read->refname;
+			strbuf_init(&packed_reads[packed_nr].referent, 0);
+			packed_pos[packed_nr++] = i;
+		}
+	}
+
+	refs_read_raw_refs(refs->packed_ref_store, packed_reads, packed_nr);
+
+	for (size_t i = 0; i < packed_nr; i++) {
+		struct ref_raw_read *packed = &packed_reads[i];
+		struct ref_raw_read *read = &reads[packed_pos[i]];
+
+		read->type = packed->type;
+		if (!packed->ret) {
+			oidcpy(&read->oid, &packed->oid);
+			read->failure_errno = 0;
+			read->ret = 0;
+		}
+		strbuf_release(&packed->referent);
+	}
+
+	free(packed_reads);
+	free(packed_pos);
+}
+
 static int files_read_symbolic_ref(struct ref_store *ref_store, const char *refname,
 				   struct strbuf *referent)
 {
@@ -1039,7 +1159,7 @@ static struct ref_iterator *files_ref_iterator_begin(
 	 * disk, and re-reads it if not.
 	 */
 
-	loose_iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, flags),
+	loose_iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, prefix, flags),
 					      prefix, ref_store->repo, 1);
 
 	/*
@@ -1426,7 +1546,7 @@ static int should_pack_refs(struct files_ref_store *refs,
 	if (limit < 16)
 		limit = 16;
 
-	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, 0), NULL,
+	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, NULL, 0), NULL,
 					refs->base.repo, 0);
 	while ((ret = ref_iterator_advance(iter)) == ITER_OK) {
 		if (should_pack_ref(refs, &iter->ref, opts))
@@ -1466,7 +1586,7 @@ static int files_optimize(struct ref_store *ref_store,
 
 	packed_refs_lock(refs->packed_ref_store, LOCK_DIE_ON_ERROR, &err);
 
-	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, 0), NULL,
+	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs, NULL, 0), NULL,
 					refs->base.repo, 0);
 	while ((ok = ref_iterator_advance(iter)) == ITER_OK) {
 		/*
@@ -1586,6 +1706,7 @@ static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *
 							struct ref_lock *lock,
 							const struct object_id *oid,
 							int skip_oid_verification,
+							int *fsync_pending,
 							struct strbuf *err);
 static int commit_ref_update(struct files_ref_store *refs,
 			     struct ref_lock *lock,
@@ -1733,7 +1854,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 	}
 	oidcpy(&lock->old_oid, &orig_oid);
 
-	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, &err) ||
+	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, NULL, &err) ||
 	    commit_ref_update(refs, lock, &orig_oid, logmsg, 0, &err)) {
 		error("unable to write current sha1 into %s: %s", newrefname, err.buf);
 		strbuf_release(&err);
@@ -1751,7 +1872,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 		goto rollbacklog;
 	}
 
-	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, &err) ||
+	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, NULL, &err) ||
 	    commit_ref_update(refs, lock, &orig_oid, NULL, REF_SKIP_CREATE_REFLOG, &err)) {
 		error("unable to write current sha1 into %s: %s", oldrefname, err.buf);
 		strbuf_release(&err);
@@ -1988,6 +2109,53 @@ static int files_log_ref_write(struct files_ref_store *refs,
 	return 0;
 }
 
+/*
+ * Flush the contents of a reference lockfile to disk. When the caller
+ * passes `fsync_pending` and `core.fsyncMethod=batch` is in effect, only
+ * ask the kernel to write out the data and note that the caller has to
+ * issue a single hardware flush via flush_ref_fsync_batch() before any
+ * of the lockfiles is renamed into place.
+ */
+static int fsync_ref_lock(struct ref_lock *lock, int *fsync_pending)
+{
+	int fd = get_lock_file_fd(&lock->lk);
+
+	if (fsync_pending && batch_fsync_enabled(FSYNC_COMPONENT_REFERENCE)) {
+		if (!git_fsync(fd, FSYNC_WRITEOUT_ONLY)) {
+			*fsync_pending = 1;
+			return 0;
+		}
+		if (errno == ENOSYS)
+			warning(_("core.fsyncMethod = batch is unsupported on this platform"));
+	}
+	return fsync_component(FSYNC_COMPONENT_REFERENCE, fd);
+}
+
+/*
+ * Issue a full hardware flush against a temporary file to make the
+ * lockfiles that have only been written out by fsync_ref_lock() durable
+ * before they are renamed to their final names.
+ */
+static int flush_ref_fsync_batch(struct files_ref_store *refs,
+				 struct strbuf *err)
+{
+	struct strbuf temp_path = STRBUF_INIT;
+	struct tempfile *temp;
+	int ret = 0;
+
+	strbuf_addf(&temp_path, "%s/bulk_fsync_XXXXXX", refs->gitcommondir);
+	temp = mks_tempfile(temp_path.buf);
+	if (!temp ||
+	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_tempfile_fd(temp)) < 0) {
+		strbuf_addf(err, "unable to flush references to disk: %s",
+			    strerror(errno));
+		ret = -1;
+	}
+	delete_tempfile(&temp);
+	strbuf_release(&temp_path);
+	return ret;
+}
+
 /*
  * Write oid into the open lockfile, then close the lockfile. On
  * errors, rollback the lockfile, fill in *err and return -1.
@@ -1996,6 +2164,7 @@ static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *
 							struct ref_lock *lock,
 							const struct object_id *oid,
 							int skip_oid_verification,
+							int *fsync_pending,
 							struct strbuf *err)
 {
 	static char term = '\n';
@@ -2024,7 +2193,7 @@ static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *
 	fd = get_lock_file_fd(&lock->lk);
 	if (write_in_full(fd, oid_to_hex(oid), refs->base.repo->hash_algo->hexsz) < 0 ||
 	    write_in_full(fd, &term, 1) < 0 ||
-	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_lock_file_fd(&lock->lk)) < 0 ||
+	    fsync_ref_lock(lock, fsync_pending) < 0 ||
 	    close_ref_gently(lock) < 0) {
 		strbuf_addf(err,
 			    "couldn't write '%s'", get_lock_file_path(&lock->lk));
@@ -2627,6 +2796,11 @@ struct files_transaction_backend_data {
 	struct ref_transaction *packed_transaction;
 	int packed_refs_locked;
 	struct strmap ref_locks;
+	/*
+	 * Some lockfiles have only been written out to the page cache
+	 * and need a hardware flush before they are committed.
+	 */
+	int fsync_pending;
 };
 
 /*
@@ -2825,7 +2999,7 @@ static enum ref_transaction_error lock_ref_for_update(struct files_ref_store *re
 			ret = write_ref_to_lockfile(
 				refs, lock, &update->new_oid,
 				update->flags & REF_SKIP_OID_VERIFICATION,
-				err);
+				&backend_data->fsync_pending, err);
 			if (ret) {
 				char *write_err = strbuf_detach(err, NULL);
 
@@ -3272,6 +3446,130 @@ static int files_transaction_finish_initial(struct files_ref_store *refs,
 	return ret;
 }
 
+/*
+ * Deleting many references is dominated by the latency of the unlink()
+ * and rmdir() calls, which neither touch the ref store nor any other
+ * global state. Spread them over several threads once there are enough
+ * of them: we cap the parallelism to 20 threads, and want at least 500
+ * references per thread for it to be worth starting one.
+ */
+#define REMOVE_MAX_PARALLEL (20)
+#define REMOVE_THREAD_COST (500)
+
+enum remove_deleted_step {
+	/* Unlink the reflogs of deleted references and their empty parents. */
+	REMOVE_DELETED_REFLOGS,
+	/* Unlink the loose references marked with REF_DELETED_RMDIR. */
+	REMOVE_DELETED_LOOSE_REFS,
+	/* Remove the empty parents of references marked REF_DELETED_RMDIR. */
+	REMOVE_DELETED_PARENTS,
+};
+
+struct remove_deleted_data {
+	pthread_t pthread;
+	struct files_ref_store *refs;
+	struct ref_transaction *transaction;
+	enum remove_deleted_step step;
+	size_t offset, nr;
+	int *unlink_errno;
+};
+
+static void *remove_deleted_thread(void *_data)
+{
+	struct remove_deleted_data *p = _data;
+	struct strbuf sb = STRBUF_INIT;
+
+	for (size_t i = p->offset; i < p->offset + p->nr; i++) {
+		struct ref_update *update = p->transaction->updates[i];
+		struct ref_lock *lock = update->backend_data;
+
+		switch (p->step) {
+		case REMOVE_DELETED_REFLOGS:
+			if (update->rejection_err ||
+			    !(update->flags & REF_DELETING) ||
+			    update->flags & (REF_LOG_ONLY | REF_IS_PRUNING))
+				break;
+			strbuf_reset(&sb);
+			files_reflog_path(p->refs, &sb, update->refname);
+			if (unlink(sb.buf) && errno != ENOENT)
+				p->unlink_errno[i] = errno;
+			else
+				try_remove_empty_parents(p->refs, update->refname,
+							 REMOVE_EMPTY_PARENTS_REFLOG);
+			break;
+		case REMOVE_DELETED_LOOSE_REFS:
+			if (!(update->flags & REF_DELETED_RMDIR) ||
+			    ((update->type & REF_ISPACKED) &&
+			     !(update->type & REF_ISSYMREF)))
+				break;
+			/* It is a loose reference. */
+			strbuf_reset(&sb);
+			files_ref_path(p->refs, &sb, lock->ref_name);
+			if (unlink(sb.buf) && errno != ENOENT)
+				p->unlink_errno[i] = errno;
+			break;
+		case REMOVE_DELETED_PARENTS:
+			if (update->flags & REF_DELETED_RMDIR)
+				try_remove_empty_parents(p->refs, update->refname,
+							 REMOVE_EMPTY_PARENTS_REF);
+			break;
+		}
+	}
+
+	strbuf_release(&sb);
+	return NULL;
+}
+
+/*
+ * Perform `step` for all updates of the transaction, in parallel if the
+ * transaction is large enough. Failures to unlink a file are recorded
+ * in `unlink_errno`, which is indexed like the updates, so that the
+ * caller can report them in the order of the transaction.
+ */
+static void remove_deleted_refs(struct files_ref_store *refs,
+				struct ref_transaction *transaction,
+				enum remove_deleted_step step,
+				int *unlink_errno)
+{
+	struct remove_deleted_data data[REMOVE_MAX_PARALLEL];
+	size_t threads = 1, offset = 0;
+
+	if (HAVE_THREADS)
+		threads = transaction->nr / REMOVE_THREAD_COST;
+	if (threads < 1)
+		threads = 1;
+	if (threads > REMOVE_MAX_PARALLEL)
+		threads = REMOVE_MAX_PARALLEL;
+
+	for (size_t i = 0; i < threads; i++) {
+		struct remove_deleted_data *p = &data[i];
+
+		p->refs = refs;
+		p->transaction = transaction;
+		p->step = step;
+		p->unlink_errno = unlink_errno;
+		p->offset = offset;
+		p->nr = (transaction->nr - offset) / (threads - i);
+		offset += p->nr;
+	}
+
+	if (threads == 1) {
+		remove_deleted_thread(&data[0]);
+		return;
+	}
+
+	for (size_t i = 0; i < threads; i++) {
+		int err = pthread_create(&data[i].pthread, NULL,
+					 remove_deleted_thread, &data[i]);
+		if (err)
+			die(_("unable to create threaded ref deletion: %s"),
+			    strerror(err));
+	}
+	for (size_t i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded ref deletion");
+}
+
 static int files_transaction_finish(struct ref_store *ref_store,
 				    struct ref_transaction *transaction,
 				    struct strbuf *err)
@@ -3283,6 +3581,7 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	struct strbuf sb = STRBUF_INIT;
 	struct files_transaction_backend_data *backend_data;
 	struct ref_transaction *packed_transaction;
+	int *unlink_errno = NULL;
 
 
 	assert(err);
@@ -3297,6 +3596,14 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	backend_data = transaction->backend_data;
 	packed_transaction = backend_data->packed_transaction;
 
+	if (backend_data->fsync_pending) {
+		if (flush_ref_fsync_batch(refs, err)) {
+			ret = REF_TRANSACTION_ERROR_GENERIC;
+			goto cleanup;
+		}
+		backend_data->fsync_pending = 0;
+	}
+
 	/* Perform updates first so live commits remain referenced */
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
@@ -3347,21 +3654,16 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	 * than leaving a reflog without a reference (the latter is a
 	 * mildly invalid repository state):
 	 */
+	CALLOC_ARRAY(unlink_errno, transaction->nr);
+	remove_deleted_refs(refs, transaction, REMOVE_DELETED_REFLOGS,
+			    unlink_errno);
 	for (i = 0; i < transaction->nr; i++) {
-		struct ref_update *update = transaction->updates[i];
-
-		if (update->rejection_err)
+		if (!unlink_errno[i])
 			continue;
-
-		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY) &&
-		    !(update->flags & REF_IS_PRUNING)) {
-			strbuf_reset(&sb);
-			files_reflog_path(refs, &sb, update->refname);
-			if (!unlink_or_warn(sb.buf))
-				try_remove_empty_parents(refs, update->refname,
-							 REMOVE_EMPTY_PARENTS_REFLOG);
-		}
+		strbuf_reset(&sb);
+		files_reflog_path(refs, &sb, transaction->updates[i]->refname);
+		errno = unlink_errno[i];
+		warning_errno("unable to unlink '%s'", sb.buf);
 	}
 
 	/*
@@ -3382,25 +3684,27 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	/* Now delete the loose versions of the references: */
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
-		struct ref_lock *lock = update->backend_data;
 
 		if (update->rejection_err)
 			continue;
 
 		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY)) {
+		    !(update->flags & REF_LOG_ONLY))
 			update->flags |= REF_DELETED_RMDIR;
-			if (!(update->type & REF_ISPACKED) ||
-			    update->type & REF_ISSYMREF) {
-				/* It is a loose reference. */
-				strbuf_reset(&sb);
-				files_ref_path(refs, &sb, lock->ref_name);
-				if (unlink_or_msg(sb.buf, err)) {
-					ret = REF_TRANSACTION_ERROR_GENERIC;
-					goto cleanup;
-				}
-			}
-		}
+	}
+	remove_deleted_refs(refs, transaction, REMOVE_DELETED_LOOSE_REFS,
+			    unlink_errno);
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_lock *lock = transaction->updates[i]->backend_data;
+
+		if (!unlink_errno[i])
+			continue;
+		strbuf_reset(&sb);
+		files_ref_path(refs, &sb, lock->ref_name);
+		strbuf_addf(err, "unable to unlink '%s': %s",
+			    sb.buf, strerror(unlink_errno[i]));
+		ret = REF_TRANSACTION_ERROR_GENERIC;
+		goto cleanup;
 	}
 
 	clear_loose_ref_cache(refs);
@@ -3408,21 +3712,14 @@ static int files_transaction_finish(struct ref_store *ref_store,
 cleanup:
 	files_transaction_cleanup(refs, transaction);
 
-	for (i = 0; i < transaction->nr; i++) {
-		struct ref_update *update = transaction->updates[i];
-
-		if (update->flags & REF_DELETED_RMDIR) {
-			/*
-			 * The reference was deleted. Delete any
-			 * empty parent directories. (Note that this
-			 * can only work because we have already
-			 * removed the lockfile.)
-			 */
-			try_remove_empty_parents(refs, update->refname,
-						 REMOVE_EMPTY_PARENTS_REF);
-		}
-	}
+	/*
+	 * Delete any empty parent directories of the references that
+	 * were deleted. (Note that this can only work because we have
+	 * already removed the lockfiles.)
+	 */
+	remove_deleted_refs(refs, transaction, REMOVE_DELETED_PARENTS, NULL);
 
+	free(unlink_errno);
 	strbuf_release(&sb);
 	return ret;
 }
@@ -3998,6 +4295,7 @@ struct ref_storage_be refs_be_files = {
 
 	.iterator_begin = files_ref_iterator_begin,
 	.read_raw_ref = files_read_raw_ref,
+	.read_raw_refs = files_read_raw_refs,
 	.read_symbolic_ref = files_read_symbolic_ref,
 
 	.reflog_iterator_begin = files_reflog_iterator_begin,
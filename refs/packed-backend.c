@@ -3,6 +3,7 @@
 
 #include "../git-compat-util.h"
 #include "../config.h"
+#include "../csum-file.h"
 #include "../dir.h"
 #include "../fsck.h"
 #include "../gettext.h"
@@ -105,6 +106,18 @@ struct snapshot {
 	 */
 	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled;
 
+	/*
+	 * The contents of the `packed-refs.idx` file, if there is one
+	 * that belongs to the `packed-refs` file (see `load_index()`);
+	 * otherwise NULL. `index_offsets` points at `index_nr` 8-byte
+	 * offsets of the records relative to `start`.
+	 */
+	unsigned char *index;
+	size_t index_len;
+	int index_mmapped;
+	const unsigned char *index_offsets;
+	size_t index_nr;
+
 	/*
 	 * Count of references to this instance, including the pointer
 	 * from `packed_ref_store::snapshot`, if any. The instance
@@ -162,6 +175,12 @@ struct packed_ref_store {
 	 * `packed_ref_store`) must not be freed.
 	 */
 	struct tempfile *tempfile;
+
+	/*
+	 * Temporary file used when writing the "packed-refs.idx" file
+	 * that goes along with the new "packed-refs" file, if any.
+	 */
+	struct tempfile *index_tempfile;
 };
 
 /*
@@ -190,6 +209,23 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	snapshot->buf = snapshot->start = snapshot->eof = NULL;
 }
 
+/*
+ * Forget about the `packed-refs.idx` file of `snapshot`, if any. The
+ * snapshot can be used without it, just less efficiently.
+ */
+static void clear_snapshot_index(struct snapshot *snapshot)
+{
+	if (snapshot->index_mmapped)
+		munmap(snapshot->index, snapshot->index_len);
+	else
+		free(snapshot->index);
+	snapshot->index = NULL;
+	snapshot->index_len = 0;
+	snapshot->index_mmapped = 0;
+	snapshot->index_offsets = NULL;
+	snapshot->index_nr = 0;
+}
+
 /*
  * Decrease the reference count of `*snapshot`. If it goes to zero,
  * free `*snapshot` and return true; otherwise return false.
@@ -198,6 +234,7 @@ static int release_snapshot(struct snapshot *snapshot)
 {
 	if (!--snapshot->referrers) {
 		stat_validity_clear(&snapshot->validity);
+		clear_snapshot_index(snapshot);
 		clear_snapshot_buffer(snapshot);
 		free(snapshot);
 		return 1;
@@ -269,6 +306,7 @@ static void packed_ref_store_release(struct ref_store *ref_store)
 	clear_snapshot(refs);
 	rollback_lock_file(&refs->lock);
 	delete_tempfile(&refs->tempfile);
+	delete_tempfile(&refs->index_tempfile);
 	free(refs->path);
 }
 
@@ -330,7 +368,9 @@ static int cmp_packed_ref_records(const void *v1, const void *v2,
 
 /*
  * Compare a snapshot record at `rec` to the specified NUL-terminated
- * refname.
+ * refname. If `start` is false, records whose names start with
+ * `refname`, including an exact match, compare as smaller, so that a
+ * search finds the end of the records with that prefix.
  */
 static int cmp_record_to_refname(const char *rec, const char *refname,
 				 int start, const struct snapshot *snapshot)
@@ -340,7 +380,7 @@ static int cmp_record_to_refname(const char *rec, const char *refname,
 
 	while (1) {
 		if (*r1 == '\n')
-			return *r2 ? -1 : 0;
+			return (*r2 || !start) ? -1 : 0;
 		if (!*r2)
 			return start ? 1 : -1;
 		if (*r1 != *r2)
@@ -582,7 +622,211 @@ static int load_contents(struct snapshot *snapshot)
 	return ret;
 }
 
+/*
+ * A `packed-refs` file can be accompanied by a `packed-refs.idx` file
+ * that records where each record of the `packed-refs` file starts, so
+ * that we do not have to search for the start of the records when
+ * looking up references. It is written if `core.packedRefsIndex` is
+ * set and consists of (all integers in network byte order):
+ *
+ *   - The 4-byte signature "PRIX".
+ *
+ *   - The 4-byte version number, currently 1.
+ *
+ *   - The 4-byte format ID of the hash algorithm.
+ *
+ *   - 4 bytes of flags. PACKED_INDEX_NAMES_VERIFIED says that all
+ *     reference names in the `packed-refs` file have been verified to
+ *     be valid when it was written. Readers check the names anyway:
+ *     as the hash below is not verified when reading, the flag cannot
+ *     vouch for a `packed-refs` file that was edited in place.
+ *
+ *   - The 8-byte number of records.
+ *
+ *   - The hash of the records of the `packed-refs` file, i.e. of
+ *     everything after its header line.
+ *
+ *   - One 8-byte offset per record, relative to the first record.
+ *
+ *   - The hash of all of the above.
+ *
+ * The header line of the `packed-refs` file carries an "index:<hash>"
+ * trait with the same hash of its records. An index whose hash does
+ * not match, for example because an older version of Git rewrote the
+ * `packed-refs` file without updating the index, is ignored. We never
+ * compute the hash when reading; it only serves to tie the two files
+ * together.
+ */
+#define PACKED_INDEX_SIGNATURE 0x50524958 /* "PRIX" */
+#define PACKED_INDEX_VERSION 1
+#define PACKED_INDEX_HEADER_SIZE 24
+#define PACKED_INDEX_NAMES_VERIFIED (1u << 0)
+#define PACKED_INDEX_TRAIT "index:"
+
+static char *packed_index_path(struct packed_ref_store *refs)
+{
+	return xstrfmt("%s.idx", refs->path);
+}
+
+/*
+ * Return the start of the `i`th record of `snapshot` according to its
+ * index, or NULL if the index is corrupt.
+ */
+static const char *index_record(struct snapshot *snapshot, size_t i)
+{
+	uint64_t off = get_be64(snapshot->index_offsets + i * 8);
+	const char *rec;
+
+	if (off >= snapshot->eof - snapshot->start)
+		return NULL;
+	rec = snapshot->start + off;
+	if ((rec != snapshot->start && rec[-1] != '\n') || *rec == '^' ||
+	    snapshot->eof - rec < snapshot_hexsz(snapshot) + 2)
+		return NULL;
+
+	return rec;
+}
+
+static void drop_corrupt_index(struct snapshot *snapshot)
+{
+	warning("ignoring corrupt index of %s", snapshot->refs->path);
+	clear_snapshot_index(snapshot);
+}
+
+/*
+ * Load the `packed-refs.idx` file if its records hash matches `hash`,
+ * the one found in the header of the `packed-refs` file. A missing or
+ * mismatching index is silently ignored.
+ */
+static void load_index(struct snapshot *snapshot, const unsigned char *hash)
+{
+	const struct git_hash_algo *algop = snapshot->refs->base.repo->hash_algo;
+	char *path = packed_index_path(snapshot->refs);
+	const unsigned char *data;
+	const char *last;
+	struct stat st;
+	uint64_t nr;
+	size_t size;
+	int fd;
+
+	fd = git_open(path);
+	free(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return;
+	}
+
+	size = xsize_t(st.st_size);
+	if (size < PACKED_INDEX_HEADER_SIZE + 2 * algop->rawsz) {
+		close(fd);
+		return;
+	}
+
+	if (mmap_strategy == MMAP_OK) {
+		snapshot->index = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		snapshot->index_mmapped = 1;
+	} else {
+		snapshot->index = xmalloc(size);
+		if (read_in_full(fd, snapshot->index, size) != size) {
+			close(fd);
+			clear_snapshot_index(snapshot);
+			return;
+		}
+	}
+	snapshot->index_len = size;
+	close(fd);
+
+	data = snapshot->index;
+	nr = get_be64(data + 16);
+	if (get_be32(data) != PACKED_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != PACKED_INDEX_VERSION ||
+	    get_be32(data + 8) != algop->format_id ||
+	    !hasheq(data + PACKED_INDEX_HEADER_SIZE, hash, algop) ||
+	    nr > (size - PACKED_INDEX_HEADER_SIZE - 2 * algop->rawsz) / 8 ||
+	    size != PACKED_INDEX_HEADER_SIZE + 2 * algop->rawsz + nr * 8) {
+		clear_snapshot_index(snapshot);
+		return;
+	}
+
+	snapshot->index_offsets = data + PACKED_INDEX_HEADER_SIZE + algop->rawsz;
+	snapshot->index_nr = nr;
+
+	/*
+	 * The hash matched, so the index should be fine. Still make sure
+	 * that it covers all of the records before we rely on it.
+	 */
+	if (!nr) {
+		if (snapshot->start != snapshot->eof)
+			drop_corrupt_index(snapshot);
+		return;
+	}
+	last = index_record(snapshot, nr - 1);
+	if (!last || find_end_of_record(last, snapshot->eof) != snapshot->eof)
+		drop_corrupt_index(snapshot);
+}
+
+/*
+ * Like `find_reference_location_1()`, but do the binary search over
+ * the index of `snapshot`. If the index turns out to be corrupt, drop
+ * it and return NULL.
+ */
+static const char *find_reference_location_index(struct snapshot *snapshot,
+						 const char *from,
+						 const char *refname,
+						 int mustexist, int start)
+{
+	size_t lo = 0, hi = snapshot->index_nr;
+	const char *rec;
+
+	if (from != snapshot->start) {
+		/* Find the first record at or after `from`. */
+		uint64_t off = from - snapshot->start;
+
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (get_be64(snapshot->index_offsets + mid * 8) < off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		hi = snapshot->index_nr;
+	}
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp;
+
+		rec = index_record(snapshot, mid);
+		if (!rec)
+			goto corrupt;
+
+		cmp = cmp_record_to_refname(rec, refname, start, snapshot);
+		if (cmp < 0)
+			lo = mid + 1;
+		else if (cmp > 0)
+			hi = mid;
+		else
+			return rec;
+	}
+
+	if (mustexist)
+		return NULL;
+	if (lo == snapshot->index_nr)
+		return snapshot->eof;
+	rec = index_record(snapshot, lo);
+	if (rec)
+		return rec;
+
+corrupt:
+	drop_corrupt_index(snapshot);
+	return NULL;
+}
+
 static const char *find_reference_location_1(struct snapshot *snapshot,
+					     const char *from,
 					     const char *refname, int mustexist,
 					     int start)
 {
@@ -600,7 +844,7 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 	 * preceding records all have reference names that come
 	 * *before* `refname`.
 	 */
-	const char *lo = snapshot->start;
+	const char *lo = from;
 
 	/*
 	 * A pointer to a the first character of a record whose
@@ -608,6 +852,16 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->index) {
+		const char *rec = find_reference_location_index(snapshot, from,
+								refname,
+								mustexist,
+								start);
+		/* Fall back to searching the records if the index was bad. */
+		if (snapshot->index)
+			return rec;
+	}
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -647,7 +901,8 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 static const char *find_reference_location(struct snapshot *snapshot,
 					   const char *refname, int mustexist)
 {
-	return find_reference_location_1(snapshot, refname, mustexist, 1);
+	return find_reference_location_1(snapshot, snapshot->start, refname,
+					 mustexist, 1);
 }
 
 /*
@@ -662,7 +917,8 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
 					       const char *refname,
 					       int mustexist)
 {
-	return find_reference_location_1(snapshot, refname, mustexist, 0);
+	return find_reference_location_1(snapshot, snapshot->start, refname,
+					 mustexist, 0);
 }
 
 /*
@@ -697,11 +953,18 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
  *   `sorted`:
  *
  *      The references in this file are known to be sorted by refname.
+ *
+ *   `index:<hash>`:
+ *
+ *      The file is accompanied by a `packed-refs.idx` file for the
+ *      records whose hash is <hash>; see `load_index()`.
  */
 static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
-	int sorted = 0;
+	const struct git_hash_algo *algop = refs->base.repo->hash_algo;
+	unsigned char index_hash[GIT_MAX_RAWSZ];
+	int sorted = 0, indexed = 0;
 
 	snapshot->refs = refs;
 	acquire_snapshot(snapshot);
@@ -738,6 +1001,16 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 
 		sorted = unsorted_string_list_has_string(&traits, "sorted");
 
+		for (size_t i = 0; i < traits.nr; i++) {
+			const char *hex;
+
+			if (skip_prefix(traits.items[i].string,
+					PACKED_INDEX_TRAIT, &hex) &&
+			    strlen(hex) == algop->hexsz &&
+			    !hex_to_bytes(index_hash, hex, algop->rawsz))
+				indexed = 1;
+		}
+
 		/* perhaps other traits later as well */
 
 		/* The "+ 1" is for the LF character. */
@@ -774,6 +1047,13 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		snapshot->eof = buf_copy + size;
 	}
 
+	/*
+	 * An unsorted file was not written by us, so it cannot have an
+	 * index, whatever its header says.
+	 */
+	if (sorted && indexed)
+		load_index(snapshot, index_hash);
+
 	return snapshot;
 }
 
@@ -834,6 +1114,66 @@ static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 	return 0;
 }
 
+/*
+ * The number of records that `packed_read_raw_refs()` scans linearly
+ * before falling back to a binary search for the next reference.
+ */
+#define PACKED_READ_SCAN_RECORDS 8
+
+static void packed_read_raw_refs(struct ref_store *ref_store,
+				 struct ref_raw_read *reads, size_t nr)
+{
+	struct packed_ref_store *refs =
+		packed_downcast(ref_store, REF_STORE_READ, "read_raw_refs");
+	struct snapshot *snapshot = get_snapshot(refs);
+	const char *pos = snapshot->start;
+
+	/*
+	 * The reads are sorted, so each reference can only be found after
+	 * the position where we found the previous one. References that are
+	 * close to each other are found by scanning forward from there, all
+	 * others by a binary search over the rest of the file.
+	 */
+	for (size_t i = 0; i < nr; i++) {
+		struct ref_raw_read *read = &reads[i];
+		const char *rec = NULL;
+		int cmp = -1;
+
+		read->type = 0;
+
+		for (int j = 0; j < PACKED_READ_SCAN_RECORDS && pos < snapshot->eof; j++) {
+			cmp = cmp_record_to_refname(pos, read->refname, 1, snapshot);
+			if (cmp >= 0)
+				break;
+			pos = find_end_of_record(pos, snapshot->eof);
+		}
+
+		if (pos < snapshot->eof && cmp < 0) {
+			pos = find_reference_location_1(snapshot, pos,
+							read->refname, 0, 1);
+			if (pos < snapshot->eof)
+				cmp = cmp_record_to_refname(pos, read->refname,
+							    1, snapshot);
+		}
+
+		if (pos < snapshot->eof && !cmp)
+			rec = pos;
+
+		if (!rec) {
+			/* refname is not a packed reference. */
+			read->failure_errno = ENOENT;
+			read->ret = -1;
+			continue;
+		}
+
+		if (get_oid_hex_algop(rec, &read->oid, ref_store->repo->hash_algo))
+			die_invalid_line(refs->path, rec, snapshot->eof - rec);
+
+		read->type = REF_ISPACKED;
+		read->ret = 0;
+	}
+}
+
 /*
  * This value is set in `base.flags` if the peeled value of the
  * current reference is known. In that case, `peeled` contains the
@@ -906,7 +1246,7 @@ static int next_record(struct packed_ref_iterator *iter)
 		}
 	}
 
-	if (iter->pos == iter->eof)
+	if (iter->pos >= iter->eof)
 		return ITER_DONE;
 
 	iter->base.ref.flags = REF_ISPACKED;
@@ -1027,6 +1367,14 @@ static int packed_ref_iterator_seek(struct ref_iterator *ref_iterator,
 	iter->pos = start;
 	iter->eof = iter->snapshot->eof;
 
+	/*
+	 * Stop at the end of the references with the prefix instead of
+	 * parsing the record after them.
+	 */
+	if (iter->prefix && *iter->prefix)
+		iter->eof = find_reference_location_end(iter->snapshot,
+							iter->prefix, 0);
+
 	return 0;
 }
 
@@ -1192,19 +1540,95 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	return ref_iterator;
 }
 
+/*
+ * What we need to remember while writing a `packed-refs` file in
+ * order to write its `packed-refs.idx` file afterwards.
+ */
+struct packed_index_writer {
+	int enabled;
+	uint32_t flags;
+	struct git_hash_ctx ctx;
+	uint64_t *offsets;
+	size_t nr, alloc;
+	uint64_t pos;
+	struct strbuf buf;
+};
+
 /*
  * Write an entry to the packed-refs file for the specified refname.
  * If peeled is non-NULL, write it as the entry's peeled value. On
  * error, return a nonzero value and leave errno set at the value left
- * by the failing call to `fprintf()`.
+ * by the failing call to `fwrite()`.
  */
-static int write_packed_entry(FILE *fh, const char *refname,
+static int write_packed_entry(FILE *fh, struct packed_index_writer *index,
+			      const char *refname,
 			      const struct object_id *oid,
 			      const struct object_id *peeled)
 {
-	if (fprintf(fh, "%s %s\n", oid_to_hex(oid), refname) < 0 ||
-	    (peeled && fprintf(fh, "^%s\n", oid_to_hex(peeled)) < 0))
+	struct strbuf *buf = &index->buf;
+
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s %s\n", oid_to_hex(oid), refname);
+	if (peeled)
+		strbuf_addf(buf, "^%s\n", oid_to_hex(peeled));
+	if (fwrite(buf->buf, 1, buf->len, fh) != buf->len)
+		return -1;
+
+	if (index->enabled) {
+		ALLOC_GROW(index->offsets, index->nr + 1, index->alloc);
+		index->offsets[index->nr++] = index->pos;
+		index->pos += buf->len;
+		git_hash_update(&index->ctx, buf->buf, buf->len);
+	}
+
+	return 0;
+}
+
+/*
+ * Write the `packed-refs.idx` file for the records described by
+ * `index` to a tempfile, which `packed_transaction_finish()` renames
+ * into place. `hash` is the hash of the records. On error, write an
+ * error message to `err` and return a nonzero value.
+ */
+static int write_packed_index(struct packed_ref_store *refs,
+			      struct packed_index_writer *index,
+			      const unsigned char *hash,
+			      struct strbuf *err)
+{
+	const struct git_hash_algo *algop = refs->base.repo->hash_algo;
+	struct hashfile *f;
+	char *path;
+
+	path = xstrfmt("%s.idx.new", refs->path);
+	refs->index_tempfile = create_tempfile(path);
+	if (!refs->index_tempfile) {
+		strbuf_addf(err, "unable to create file %s: %s",
+			    path, strerror(errno));
+		free(path);
 		return -1;
+	}
+	free(path);
+
+	f = hashfd(algop, get_tempfile_fd(refs->index_tempfile),
+		   get_tempfile_path(refs->index_tempfile));
+	hashwrite_be32(f, PACKED_INDEX_SIGNATURE);
+	hashwrite_be32(f, PACKED_INDEX_VERSION);
+	hashwrite_be32(f, algop->format_id);
+	hashwrite_be32(f, index->flags);
+	hashwrite_be64(f, index->nr);
+	hashwrite(f, hash, algop->rawsz);
+	for (size_t i = 0; i < index->nr; i++)
+		hashwrite_be64(f, index->offsets[i]);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_REFERENCE,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	if (close_tempfile_gently(refs->index_tempfile)) {
+		strbuf_addf(err, "error closing file %s: %s",
+			    get_tempfile_path(refs->index_tempfile),
+			    strerror(errno));
+		delete_tempfile(&refs->index_tempfile);
+		return -1;
+	}
 
 	return 0;
 }
@@ -1319,6 +1743,15 @@ int packed_refs_size(struct ref_store *ref_store,
 static const char PACKED_REFS_HEADER[] =
 	"# pack-refs with: peeled fully-peeled sorted \n";
 
+/*
+ * The header we write if there is going to be an index. It is followed
+ * by the hash of the records and " \n". As we only know the hash once
+ * the records have been written, we write a null hash at first and
+ * fill in the real one at the end.
+ */
+static const char PACKED_REFS_INDEXED_HEADER[] =
+	"# pack-refs with: peeled fully-peeled sorted " PACKED_INDEX_TRAIT;
+
 static int packed_ref_store_create_on_disk(struct ref_store *ref_store UNUSED,
 					   int flags UNUSED,
 					   struct strbuf *err UNUSED)
@@ -1331,12 +1764,21 @@ static int packed_ref_store_remove_on_disk(struct ref_store *ref_store,
 					   struct strbuf *err)
 {
 	struct packed_ref_store *refs = packed_downcast(ref_store, 0, "remove");
+	char *index_path;
 
 	if (remove_path(refs->path) < 0) {
 		strbuf_addstr(err, "could not delete packed-refs");
 		return -1;
 	}
 
+	index_path = packed_index_path(refs);
+	if (unlink(index_path) < 0 && errno != ENOENT) {
+		strbuf_addstr(err, "could not delete packed-refs.idx");
+		free(index_path);
+		return -1;
+	}
+	free(index_path);
+
 	return 0;
 }
 
@@ -1361,11 +1803,15 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 	int ok;
 	FILE *out;
 	struct strbuf sb = STRBUF_INIT;
+	struct packed_index_writer index = { .buf = STRBUF_INIT };
 	char *packed_refs_path;
 
 	if (!is_lock_file_locked(&refs->lock))
 		BUG("write_with_updates() called while unlocked");
 
+	repo_config_get_bool(refs->base.repo, "core.packedrefsindex",
+			     &index.enabled);
+
 	/*
 	 * If packed-refs is a symlink, we want to overwrite the
 	 * symlinked-to file, not the symlink itself. Also, put the
@@ -1390,8 +1836,15 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 		goto error;
 	}
 
-	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
+	if (index.enabled) {
+		refs->base.repo->hash_algo->init_fn(&index.ctx);
+		index.flags = PACKED_INDEX_NAMES_VERIFIED;
+		if (fprintf(out, "%s%s \n", PACKED_REFS_INDEXED_HEADER,
+			    oid_to_hex(null_oid(refs->base.repo->hash_algo))) < 0)
+			goto write_error;
+	} else if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0) {
 		goto write_error;
+	}
 
 	/*
 	 * We iterate in parallel through the current list of refs and
@@ -1508,7 +1961,9 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 
 		if (cmp < 0) {
 			/* Pass the old reference through. */
-			if (write_packed_entry(out, iter->ref.name,
+			if (iter->ref.flags & REF_BAD_NAME)
+				index.flags &= ~PACKED_INDEX_NAMES_VERIFIED;
+			if (write_packed_entry(out, &index, iter->ref.name,
 					       iter->ref.oid, iter->ref.peeled_oid))
 				goto write_error;
 
@@ -1530,7 +1985,9 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 			int peel_error = peel_object(refs->base.repo, &update->new_oid,
 						     &peeled, PEEL_OBJECT_VERIFY_TAGGED_OBJECT_TYPE);
 
-			if (write_packed_entry(out, update->refname,
+			if (check_refname_format(update->refname, REFNAME_ALLOW_ONELEVEL))
+				index.flags &= ~PACKED_INDEX_NAMES_VERIFIED;
+			if (write_packed_entry(out, &index, update->refname,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1545,6 +2002,19 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 		goto error;
 	}
 
+	if (index.enabled) {
+		unsigned char hash[GIT_MAX_RAWSZ];
+
+		git_hash_final(hash, &index.ctx);
+		if (fseek(out, strlen(PACKED_REFS_INDEXED_HEADER), SEEK_SET) ||
+		    fputs(hash_to_hex_algop(hash, refs->base.repo->hash_algo), out) < 0)
+			goto write_error;
+		if (write_packed_index(refs, &index, hash, err)) {
+			ret = REF_TRANSACTION_ERROR_GENERIC;
+			goto error;
+		}
+	}
+
 	if (fflush(out) ||
 	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_tempfile_fd(refs->tempfile)) ||
 	    close_tempfile_gently(refs->tempfile)) {
@@ -1553,10 +2023,13 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 			    strerror(errno));
 		strbuf_release(&sb);
 		delete_tempfile(&refs->tempfile);
-		return REF_TRANSACTION_ERROR_GENERIC;
+		delete_tempfile(&refs->index_tempfile);
+		ret = REF_TRANSACTION_ERROR_GENERIC;
+		goto out;
 	}
 
-	return 0;
+	ret = 0;
+	goto out;
 
 write_error:
 	strbuf_addf(err, "error writing to %s: %s",
@@ -1566,6 +2039,10 @@ static enum ref_transaction_error write_with_updates(struct packed_ref_store *re
 error:
 	ref_iterator_free(iter);
 	delete_tempfile(&refs->tempfile);
+	delete_tempfile(&refs->index_tempfile);
+out:
+	free(index.offsets);
+	strbuf_release(&index.buf);
 	return ret;
 }
 
@@ -1677,6 +2154,8 @@ static void packed_transaction_cleanup(struct packed_ref_store *refs,
 	if (data) {
 		if (is_tempfile_active(refs->tempfile))
 			delete_tempfile(&refs->tempfile);
+		if (is_tempfile_active(refs->index_tempfile))
+			delete_tempfile(&refs->index_tempfile);
 
 		if (data->own_lock && is_lock_file_locked(&refs->lock)) {
 			packed_refs_unlock(&refs->base);
@@ -1754,10 +2233,23 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
 	int ret = REF_TRANSACTION_ERROR_GENERIC;
-	char *packed_refs_path;
+	int indexed = is_tempfile_active(refs->index_tempfile);
+	char *index_path = packed_index_path(refs);
+	char *packed_refs_path = NULL;
 
 	clear_snapshot(refs);
 
+	/*
+	 * Move the index into place first, so that it is there by the
+	 * time the new packed-refs file refers to it. Readers of the old
+	 * file notice that it does not match, and ignore it.
+	 */
+	if (indexed && rename_tempfile(&refs->index_tempfile, index_path)) {
+		strbuf_addf(err, "error replacing %s: %s",
+			    index_path, strerror(errno));
+		goto cleanup;
+	}
+
 	packed_refs_path = get_locked_file_path(&refs->lock);
 	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
 		strbuf_addf(err, "error replacing %s: %s",
@@ -1765,9 +2257,14 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 		goto cleanup;
 	}
 
+	/* An index left behind by an earlier write is of no use anymore. */
+	if (!indexed)
+		unlink_or_warn(index_path);
+
 	ret = 0;
 
 cleanup:
+	free(index_path);
 	free(packed_refs_path);
 	packed_transaction_cleanup(refs, transaction);
 	return ret;
@@ -2148,6 +2645,7 @@ struct ref_storage_be refs_be_packed = {
 
 	.iterator_begin = packed_ref_iterator_begin,
 	.read_raw_ref = packed_read_raw_ref,
+	.read_raw_refs = packed_read_raw_refs,
 	.read_symbolic_ref = NULL,
 
 	.reflog_iterator_begin = packed_reflog_iterator_begin,
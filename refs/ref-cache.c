@@ -48,12 +48,15 @@ struct ref_entry *create_ref_entry(const char *refname,
 }
 
 struct ref_cache *create_ref_cache(struct ref_store *refs,
-				   fill_ref_dir_fn *fill_ref_dir)
+				   fill_ref_dir_fn *fill_ref_dir,
+				   validate_ref_dir_fn *validate_ref_dir)
 {
 	struct ref_cache *ret = xcalloc(1, sizeof(*ret));
 
 	ret->ref_store = refs;
 	ret->fill_ref_dir = fill_ref_dir;
+	ret->validate_ref_dir = validate_ref_dir;
+	ret->referrers = 1;
 	ret->root = create_dir_entry(ret, "", 0);
 	return ret;
 }
@@ -74,9 +77,9 @@ static void free_ref_entry(struct ref_entry *entry)
 	free(entry);
 }
 
-void free_ref_cache(struct ref_cache *cache)
+void release_ref_cache(struct ref_cache *cache)
 {
-	if (!cache)
+	if (!cache || --cache->referrers)
 		return;
 	free_ref_entry(cache->root);
 	free(cache);
@@ -92,6 +95,7 @@ static void clear_ref_dir(struct ref_dir *dir)
 		free_ref_entry(dir->entries[i]);
 	FREE_AND_NULL(dir->entries);
 	dir->sorted = dir->nr = dir->alloc = 0;
+	dir->have_stat = 0;
 }
 
 struct ref_entry *create_dir_entry(struct ref_cache *cache,
@@ -318,6 +322,50 @@ static void prime_ref_dir(struct ref_dir *dir, const char *prefix)
 	}
 }
 
+/*
+ * Validate the directory `entry` and its subdirectories as described
+ * for `validate_ref_cache()`. If `shared` is set, only check them and
+ * return -1 as soon as one is out of date.
+ */
+static int validate_ref_dir(struct ref_cache *cache, struct ref_entry *entry,
+			    const char *prefix, int shared)
+{
+	struct ref_dir *dir = &entry->u.subdir;
+	int i;
+
+	if (entry->flag & REF_INCOMPLETE)
+		return 0;
+	if (prefix && overlaps_prefix(entry->name, prefix) == PREFIX_EXCLUDES_DIR)
+		return 0;
+
+	if (dir->have_stat &&
+	    cache->validate_ref_dir(cache->ref_store, dir, entry->name)) {
+		if (shared)
+			return -1;
+		clear_ref_dir(dir);
+		entry->flag |= REF_INCOMPLETE;
+		return 0;
+	}
+
+	for (i = 0; i < dir->nr; i++) {
+		struct ref_entry *child = dir->entries[i];
+
+		if ((child->flag & REF_DIR) &&
+		    validate_ref_dir(cache, child, prefix, shared) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int validate_ref_cache(struct ref_cache *cache, const char *prefix)
+{
+	if (!cache->validate_ref_dir)
+		return 0;
+	return validate_ref_dir(cache, cache->root, prefix,
+				cache->referrers > 1);
+}
+
 /*
  * A level in the reference hierarchy that is currently being iterated
  * through.
@@ -552,6 +600,7 @@ static void cache_ref_iterator_release(struct ref_iterator *ref_iterator)
 		(struct cache_ref_iterator *)ref_iterator;
 	free(iter->prefix);
 	free(iter->levels);
+	release_ref_cache(iter->cache);
 }
 
 static struct ref_iterator_vtable cache_ref_iterator_vtable = {
@@ -575,6 +624,7 @@ struct ref_iterator *cache_ref_iterator_begin(struct ref_cache *cache,
 
 	iter->repo = repo;
 	iter->cache = cache;
+	iter->cache->referrers++;
 	iter->prime_dir = prime_dir;
 
 	if (cache_ref_iterator_seek(&iter->base, prefix,
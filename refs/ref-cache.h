@@ -2,6 +2,7 @@
 #define REFS_REF_CACHE_H
 
 #include "hash.h"
+#include "statinfo.h"
 
 struct ref_dir;
 struct ref_store;
@@ -15,6 +16,15 @@ struct repository;
 typedef void fill_ref_dir_fn(struct ref_store *ref_store,
 			     struct ref_dir *dir, const char *dirname);
 
+/*
+ * If this ref_cache is kept around between iterations, this function
+ * is used to check whether a ref_dir that has been filled (and whose
+ * `have_stat` is set) still reflects what is on disk. It returns 0 if
+ * it does, and 1 if the directory has to be read again.
+ */
+typedef int validate_ref_dir_fn(struct ref_store *ref_store,
+				struct ref_dir *dir, const char *dirname);
+
 struct ref_cache {
 	struct ref_entry *root;
 
@@ -26,6 +36,19 @@ struct ref_cache {
 	 * NULL.
 	 */
 	fill_ref_dir_fn *fill_ref_dir;
+
+	/*
+	 * Function used by `validate_ref_cache()` to check filled
+	 * directories. May be NULL.
+	 */
+	validate_ref_dir_fn *validate_ref_dir;
+
+	/*
+	 * Count of references to this instance, including the one held
+	 * by its owner and one for each iterator over it. The cache is
+	 * freed when the last one is dropped.
+	 */
+	unsigned int referrers;
 };
 
 /*
@@ -86,6 +109,14 @@ struct ref_dir {
 	struct ref_cache *cache;
 
 	struct ref_entry **entries;
+
+	/*
+	 * If `have_stat` is set, `fill_ref_dir` recorded in `stat` the
+	 * metadata of the directory that this ref_dir was read from, for
+	 * use by `validate_ref_dir`.
+	 */
+	int have_stat;
+	struct stat_data stat;
 };
 
 /*
@@ -184,15 +215,33 @@ struct ref_entry *create_ref_entry(const char *refname,
  * `ref_cache` when they are accessed. If it is NULL, then the whole
  * `ref_cache` must be filled (including clearing its directories'
  * `REF_INCOMPLETE` bits) before it is used, and `refs` can be NULL,
- * too.
+ * too. `validate_ref_dir` may be NULL if the cache is never
+ * validated. The caller holds the only reference to the new cache.
  */
 struct ref_cache *create_ref_cache(struct ref_store *refs,
-				   fill_ref_dir_fn *fill_ref_dir);
+				   fill_ref_dir_fn *fill_ref_dir,
+				   validate_ref_dir_fn *validate_ref_dir);
 
 /*
- * Free the `ref_cache` and all of its associated data.
+ * Drop a reference to `cache`. Once the last reference is gone, free
+ * the `ref_cache` and all of its associated data.
+ */
+void release_ref_cache(struct ref_cache *cache);
+
+/*
+ * Check whether the directories of `cache` that have been read and
+ * that could hold references starting with `prefix` (all of them if
+ * `prefix` is NULL) are still current. Directories that are not are
+ * marked incomplete, so that they are read again when they are next
+ * accessed.
+ *
+ * That frees their entries, which iterators over the cache might
+ * still be looking at. So if anybody besides the caller holds a
+ * reference to the cache, it is left alone, and -1 is returned if it
+ * is out of date; the caller should then replace it with a new cache.
+ * Iterators keep on seeing the old one. Otherwise, return 0.
  */
-void free_ref_cache(struct ref_cache *cache);
+int validate_ref_cache(struct ref_cache *cache, const char *prefix);
 
 /*
  * Add a ref_entry to the end of dir (unsorted).  Entry is always
@@ -206,7 +255,7 @@ void add_entry_to_dir(struct ref_dir *dir, struct ref_entry *entry);
  * specified, only include references whose names start with that
  * prefix. If `prime_dir` is true, then fill any incomplete
  * directories before beginning the iteration. The output is ordered
- * by refname.
+ * by refname. The iterator holds a reference to `cache`.
  */
 struct ref_iterator *cache_ref_iterator_begin(struct ref_cache *cache,
 					      const char *prefix,
@@ -3,6 +3,7 @@
 
 #include "refs.h"
 #include "iterator.h"
+#include "strbuf.h"
 #include "string-list.h"
 
 struct fsck_options;
@@ -148,6 +149,27 @@ int refs_read_raw_ref(struct ref_store *ref_store, const char *refname,
 		      struct object_id *oid, struct strbuf *referent,
 		      unsigned int *type, int *failure_errno);
 
+/*
+ * A single read of a batch passed to `refs_read_raw_refs()`. The fields
+ * after `refname` receive the results of `refs_read_raw_ref()`, with `ret`
+ * being its return value.
+ */
+struct ref_raw_read {
+	const char *refname;
+	struct object_id oid;
+	struct strbuf referent;
+	unsigned int type;
+	int failure_errno;
+	int ret;
+};
+
+/*
+ * Read many references non-recursively. The reads must be sorted by
+ * refname.
+ */
+void refs_read_raw_refs(struct ref_store *ref_store,
+			struct ref_raw_read *reads, size_t nr);
+
 /*
  * Mark a given update as rejected with a given reason.
  */
@@ -523,6 +545,16 @@ typedef int read_raw_ref_fn(struct ref_store *ref_store, const char *refname,
 			    struct object_id *oid, struct strbuf *referent,
 			    unsigned int *type, int *failure_errno);
 
+/*
+ * Read many references non-recursively, with the same semantics as
+ * calling `read_raw_ref_fn` on each of them. The reads are sorted by
+ * refname, which allows backends to find all of them in a single pass
+ * over their storage. This function is optional: if not implemented by a
+ * backend, then `read_raw_ref_fn` is called for each of the references.
+ */
+typedef void read_raw_refs_fn(struct ref_store *ref_store,
+			      struct ref_raw_read *reads, size_t nr);
+
 /*
  * Read a symbolic reference from the specified reference store. This function
  * is optional: if not implemented by a backend, then `read_raw_ref_fn` is used
@@ -560,6 +592,7 @@ struct ref_storage_be {
 
 	ref_iterator_begin_fn *iterator_begin;
 	read_raw_ref_fn *read_raw_ref;
+	read_raw_refs_fn *read_raw_refs;
 
 	/*
 	 * Please refer to `refs_read_symbolic_ref()` for the expected
@@ -22,6 +22,7 @@
 #include "../reftable/reftable-record.h"
 #include "../reftable/reftable-stack.h"
 #include "../repo-settings.h"
+#include "../run-command.h"
 #include "../setup.h"
 #include "../strmap.h"
 #include "../trace2.h"
@@ -38,6 +39,12 @@
 struct reftable_backend {
 	struct reftable_stack *stack;
 	struct reftable_iterator it;
+
+	/* The absolute path of the directory containing the stack. */
+	char *gitdir;
+
+	/* The background compaction process we started, if any. */
+	pid_t compaction_pid;
 };
 
 static void reftable_backend_on_reload(void *payload)
@@ -46,21 +53,127 @@ static void reftable_backend_on_reload(void *payload)
 	reftable_iterator_destroy(&be->it);
 }
 
+/*
+ * Check whether the background compaction process is still running,
+ * and reap it if it has exited.
+ */
+static int reftable_backend_compaction_running(struct reftable_backend *be)
+{
+	pid_t pid;
+
+	if (!be->compaction_pid)
+		return 0;
+
+	while ((pid = waitpid(be->compaction_pid, NULL, WNOHANG)) < 0 &&
+	       errno == EINTR)
+		; /* nothing */
+	if (!pid)
+		return 1;
+
+	be->compaction_pid = 0;
+	return 0;
+}
+
+/*
+ * With "reftable.autoCompaction=background", compact the stack in a
+ * separate git-pack-refs(1) process which we do not wait for. Writers
+ * are not blocked by the compaction, as it only locks "tables.list"
+ * while picking the tables to compact and while swapping them out.
+ */
+static void reftable_backend_compact_in_background(void *payload)
+{
+	struct reftable_backend *be = payload;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+
+	/*
+	 * A single process compacts everything that needs compaction, so
+	 * there is no point in starting another one while it is running.
+	 */
+	if (reftable_backend_compaction_running(be))
+		return;
+
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.no_stdout = 1;
+	cmd.no_stderr = 1;
+	strvec_pushf(&cmd.args, "--git-dir=%s", be->gitdir);
+	strvec_pushl(&cmd.args, "pack-refs", "--auto", NULL);
+
+	/*
+	 * Failing to start the process is not an error: the next write or
+	 * git-maintenance(1) will compact the stack.
+	 */
+	if (!start_command(&cmd)) {
+		trace2_data_intmax("reftable", NULL, "background-compaction", 1);
+		be->compaction_pid = cmd.pid;
+	}
+	child_process_clear(&cmd);
+}
+
 static int reftable_backend_init(struct reftable_backend *be,
 				 const char *path,
 				 const struct reftable_write_options *_opts)
 {
 	struct reftable_write_options opts = *_opts;
+	char *gitdir;
+	size_t len;
+
+	if (!strip_suffix(path, "/reftable", &len))
+		BUG("reftable stack not in a 'reftable' directory: %s", path);
+	gitdir = xstrndup(path, len);
+	be->gitdir = absolute_pathdup(gitdir);
+	free(gitdir);
+
 	opts.on_reload = reftable_backend_on_reload;
 	opts.on_reload_payload = be;
+	if (opts.on_compaction_required)
+		opts.on_compaction_required_payload = be;
 	return reftable_new_stack(&be->stack, path, &opts);
 }
 
 static void reftable_backend_release(struct reftable_backend *be)
 {
+	/*
+	 * Reap the compaction process if it is done, but do not wait for
+	 * it: that is what running it in the background is about.
+	 */
+	reftable_backend_compaction_running(be);
 	reftable_stack_destroy(be->stack);
 	be->stack = NULL;
 	reftable_iterator_destroy(&be->it);
+	FREE_AND_NULL(be->gitdir);
+}
+
+static void reftable_backend_parse_ref(struct reftable_backend *be,
+				       const struct reftable_ref_record *ref,
+				       struct object_id *oid,
+				       struct strbuf *referent,
+				       unsigned int *type)
+{
+	if (ref->value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref->value.symref);
+		*type |= REF_ISSYMREF;
+	} else if (reftable_ref_record_val1(ref)) {
+		unsigned int hash_id;
+
+		switch (reftable_stack_hash_id(be->stack)) {
+		case REFTABLE_HASH_SHA1:
+			hash_id = GIT_HASH_SHA1;
+			break;
+		case REFTABLE_HASH_SHA256:
+			hash_id = GIT_HASH_SHA256;
+			break;
+		default:
+			BUG("unhandled hash ID %d", reftable_stack_hash_id(be->stack));
+		}
+
+		oidread(oid, reftable_ref_record_val1(ref),
+			&hash_algos[hash_id]);
+	} else {
+		/* We got a tombstone, which should not happen. */
+		BUG("unhandled reference value type %d", ref->value_type);
+	}
 }
 
 static int reftable_backend_read_ref(struct reftable_backend *be,
@@ -91,30 +204,7 @@ static int reftable_backend_read_ref(struct reftable_backend *be,
 		goto done;
 	}
 
-	if (ref.value_type == REFTABLE_REF_SYMREF) {
-		strbuf_reset(referent);
-		strbuf_addstr(referent, ref.value.symref);
-		*type |= REF_ISSYMREF;
-	} else if (reftable_ref_record_val1(&ref)) {
-		unsigned int hash_id;
-
-		switch (reftable_stack_hash_id(be->stack)) {
-		case REFTABLE_HASH_SHA1:
-			hash_id = GIT_HASH_SHA1;
-			break;
-		case REFTABLE_HASH_SHA256:
-			hash_id = GIT_HASH_SHA256;
-			break;
-		default:
-			BUG("unhandled hash ID %d", reftable_stack_hash_id(be->stack));
-		}
-
-		oidread(oid, reftable_ref_record_val1(&ref),
-			&hash_algos[hash_id]);
-	} else {
-		/* We got a tombstone, which should not happen. */
-		BUG("unhandled reference value type %d", ref.value_type);
-	}
+	reftable_backend_parse_ref(be, &ref, oid, referent, type);
 
 done:
 	assert(ret != REFTABLE_API_ERROR);
@@ -122,6 +212,87 @@ static int reftable_backend_read_ref(struct reftable_backend *be,
 	return ret;
 }
 
+/*
+ * The number of records that `reftable_read_cursor_find()` steps over
+ * before it seeks the iterator instead.
+ */
+#define REFTABLE_READ_SCAN_RECORDS 16
+
+/*
+ * Finds references in a stack in sorted order. As long as the iterator
+ * is positioned, `ref` is the first record at or after `last` (unless
+ * the iterator is exhausted), so the next reference can be looked for by
+ * stepping forward from there instead of seeking.
+ */
+struct reftable_read_cursor {
+	struct reftable_backend *be;
+	struct reftable_ref_record ref;
+	struct strbuf last;
+	unsigned positioned : 1,
+		 exhausted : 1;
+};
+
+/*
+ * Look up `refname` and leave its record in `c->ref`. Returns 0 if it
+ * was found, 1 if it does not exist and a negative error code otherwise.
+ */
+static int reftable_read_cursor_find(struct reftable_read_cursor *c,
+				     const char *refname)
+{
+	int ret;
+
+	if (c->positioned && strcmp(c->last.buf, refname) <= 0) {
+		for (int i = 0; !c->exhausted; i++) {
+			int cmp = strcmp(c->ref.refname, refname);
+
+			if (cmp >= 0) {
+				strbuf_reset(&c->last);
+				strbuf_addstr(&c->last, refname);
+				return !!cmp;
+			}
+			if (i == REFTABLE_READ_SCAN_RECORDS)
+				break;
+
+			ret = reftable_iterator_next_ref(&c->be->it, &c->ref);
+			if (ret < 0) {
+				c->positioned = 0;
+				return ret;
+			}
+			c->exhausted = ret > 0;
+		}
+
+		if (c->exhausted) {
+			strbuf_reset(&c->last);
+			strbuf_addstr(&c->last, refname);
+			return 1;
+		}
+	}
+
+	c->positioned = 0;
+	if (!c->be->it.ops) {
+		ret = reftable_stack_init_ref_iterator(c->be->stack, &c->be->it);
+		if (ret)
+			return ret;
+	}
+
+	ret = reftable_iterator_seek_ref(&c->be->it, refname);
+	if (ret)
+		return ret;
+
+	ret = reftable_iterator_next_ref(&c->be->it, &c->ref);
+	if (ret < 0)
+		return ret;
+
+	c->positioned = 1;
+	c->exhausted = ret > 0;
+	strbuf_reset(&c->last);
+	strbuf_addstr(&c->last, refname);
+
+	if (c->exhausted)
+		return 1;
+	return !!strcmp(c->ref.refname, refname);
+}
+
 struct reftable_ref_store {
 	struct ref_store base;
 
@@ -337,6 +508,23 @@ static int reftable_be_config(const char *var, const char *value,
 		if (factor > UINT8_MAX)
 			die("reftable geometric factor cannot exceed %u", (unsigned)UINT8_MAX);
 		opts->auto_compaction_factor = factor;
+	} else if (!strcmp(var, "reftable.autocompaction")) {
+		int enabled = git_parse_maybe_bool(value);
+
+		if (enabled >= 0) {
+			opts->disable_auto_compact = !enabled;
+			opts->on_compaction_required = NULL;
+		} else if (value && !strcmp(value, "background")) {
+			opts->disable_auto_compact = 0;
+			opts->on_compaction_required = reftable_backend_compact_in_background;
+		} else {
+			die("invalid value for reftable.autoCompaction: %s", value);
+		}
+	} else if (!strcmp(var, "reftable.compressionthreads")) {
+		int threads = git_config_int(var, value, ctx->kvi);
+		if (threads < 0)
+			die("reftable compression threads cannot be negative");
+		opts->log_compression_threads = threads;
 	} else if (!strcmp(var, "reftable.locktimeout")) {
 		int64_t lock_timeout = git_config_int64(var, value, ctx->kvi);
 		if (lock_timeout > LONG_MAX)
@@ -382,13 +570,14 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 		BUG("unknown hash algorithm %d", repo->hash_algo->format_id);
 	}
 	refs->write_options.default_permissions = calc_shared_perm(the_repository, 0666 & ~mask);
-	refs->write_options.disable_auto_compact =
-		!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1);
 	refs->write_options.lock_timeout_ms = 100;
 	refs->write_options.fsync = reftable_be_fsync;
 
 	repo_config(the_repository, reftable_be_config, &refs->write_options);
 
+	if (!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1))
+		refs->write_options.disable_auto_compact = 1;
+
 	/*
 	 * It is somewhat unfortunate that we have to mirror the default block
 	 * size of the reftable library here. But given that the write options
@@ -909,6 +1098,77 @@ static int reftable_be_read_raw_ref(struct ref_store *ref_store,
 	return 0;
 }
 
+static void reftable_be_read_raw_refs(struct ref_store *ref_store,
+				      struct ref_raw_read *reads, size_t nr)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_raw_refs");
+	struct reftable_read_cursor *cursors = NULL;
+	size_t cursors_nr = 0, cursors_alloc = 0;
+
+	for (size_t i = 0; i < nr; i++) {
+		struct ref_raw_read *read = &reads[i];
+		struct reftable_read_cursor *c = NULL;
+		struct reftable_backend *be;
+		const char *refname;
+		int ret;
+
+		read->type = 0;
+		read->failure_errno = 0;
+
+		if (refs->err < 0) {
+			read->ret = refs->err;
+			continue;
+		}
+
+		/*
+		 * Reload each stack only once for the whole batch, as
+		 * reloading discards the iterator of the cursor.
+		 */
+		ret = backend_for(&be, refs, read->refname, &refname, 0);
+		if (ret) {
+			read->ret = ret;
+			continue;
+		}
+
+		for (size_t j = 0; j < cursors_nr; j++)
+			if (cursors[j].be == be)
+				c = &cursors[j];
+		if (!c) {
+			ret = reftable_stack_reload(be->stack);
+			if (ret) {
+				read->ret = ret;
+				continue;
+			}
+
+			ALLOC_GROW(cursors, cursors_nr + 1, cursors_alloc);
+			c = &cursors[cursors_nr++];
+			memset(c, 0, sizeof(*c));
+			c->be = be;
+			strbuf_init(&c->last, 0);
+		}
+
+		ret = reftable_read_cursor_find(c, refname);
+		assert(ret != REFTABLE_API_ERROR);
+		if (ret < 0) {
+			read->ret = ret;
+		} else if (ret > 0) {
+			read->failure_errno = ENOENT;
+			read->ret = -1;
+		} else {
+			reftable_backend_parse_ref(be, &c->ref, &read->oid,
+						   &read->referent, &read->type);
+			read->ret = 0;
+		}
+	}
+
+	for (size_t i = 0; i < cursors_nr; i++) {
+		reftable_ref_record_release(&cursors[i].ref);
+		strbuf_release(&cursors[i].last);
+	}
+	free(cursors);
+}
+
 static int reftable_be_read_symbolic_ref(struct ref_store *ref_store,
 					 const char *refname,
 					 struct strbuf *referent)
@@ -1685,6 +1945,9 @@ static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
 		ret = reftable_addition_commit(tx_data->args[i].addition);
 		if (ret < 0)
 			goto done;
+
+		trace2_data_intmax("reftable", tx_data->args[i].refs->base.repo, "tables",
+				   reftable_stack_tables_len(tx_data->args[i].be->stack));
 	}
 
 done:
@@ -2490,20 +2753,17 @@ struct reflog_expiry_arg {
 	struct object_id update_oid;
 	const char *refname;
 	size_t len;
+	/* Whether to write the marker that says the reflog exists. */
+	int write_existence_marker;
 };
 
 static int write_reflog_expiry_table(struct reftable_writer *writer, void *cb_data)
 {
 	struct reflog_expiry_arg *arg = cb_data;
 	uint64_t ts = reftable_stack_next_update_index(arg->stack);
-	uint64_t live_records = 0;
 	size_t i;
 	int ret;
 
-	for (i = 0; i < arg->len; i++)
-		if (arg->records[i].value_type == REFTABLE_LOG_UPDATE)
-			live_records++;
-
 	ret = reftable_writer_set_limits(writer, ts, ts);
 	if (ret < 0)
 		return ret;
@@ -2534,7 +2794,7 @@ static int write_reflog_expiry_table(struct reftable_writer *writer, void *cb_da
 	 * completely, but write a placeholder reflog entry that indicates that
 	 * the reflog still exists.
 	 */
-	if (!live_records) {
+	if (arg->write_existence_marker) {
 		struct reftable_log_record log = {
 			.refname = (char *)arg->refname,
 			.value_type = REFTABLE_LOG_UPDATE,
@@ -2587,7 +2847,9 @@ static int reftable_be_reflog_expire(struct ref_store *ref_store,
 	struct object_id oid = {0};
 	struct strbuf referent = STRBUF_INIT;
 	uint8_t *last_hash = NULL;
-	size_t logs_nr = 0, logs_alloc = 0, i;
+	size_t logs_nr = 0, logs_alloc = 0, rewritten_nr = 0, i;
+	size_t live_records = 0;
+	int have_existence_marker = 0;
 	unsigned int type = 0;
 	int ret;
 
@@ -2638,6 +2900,7 @@ static int reftable_be_reflog_expire(struct ref_store *ref_store,
 		 * in when there are no live reflog records.
 		 */
 		if (is_null_oid(&old_oid) && is_null_oid(&new_oid)) {
+			have_existence_marker = 1;
 			reftable_log_record_release(&log);
 			continue;
 		}
@@ -2677,26 +2940,43 @@ static int reftable_be_reflog_expire(struct ref_store *ref_store,
 			if ((flags & EXPIRE_REFLOGS_REWRITE) && last_hash)
 				memcpy(dest->value.update.old_hash, last_hash, GIT_MAX_RAWSZ);
 			last_hash = logs[i].value.update.new_hash;
+			live_records++;
 		}
 	}
 
-	if (flags & EXPIRE_REFLOGS_UPDATE_REF && last_hash && !is_null_oid(&oid))
-		oidread(&arg.update_oid, last_hash, ref_store->repo->hash_algo);
+	/*
+	 * Only write out the records that have changed. All the others stay
+	 * valid in the tables they are stored in already, so that expiring a
+	 * reflog that has nothing to prune does not write anything at all.
+	 */
+	for (i = 0; i < logs_nr; i++) {
+		if (rewritten[i].value_type == logs[i].value_type &&
+		    !memcmp(rewritten[i].value.update.old_hash,
+			    logs[i].value.update.old_hash, GIT_MAX_RAWSZ))
+			continue;
+		rewritten[rewritten_nr++] = rewritten[i];
+	}
+
+	if (flags & EXPIRE_REFLOGS_UPDATE_REF && last_hash && !is_null_oid(&oid)) {
+		struct object_id last_oid;
+
+		oidread(&last_oid, last_hash, ref_store->repo->hash_algo);
+		if (!oideq(&last_oid, &oid))
+			oidcpy(&arg.update_oid, &last_oid);
+	}
 
 	arg.refs = refs;
 	arg.records = rewritten;
-	arg.len = logs_nr;
+	arg.len = rewritten_nr;
 	arg.stack = be->stack;
 	arg.refname = refname;
+	arg.write_existence_marker = !live_records &&
+		(rewritten_nr || !have_existence_marker);
 
 	ret = reftable_addition_add(add, &write_reflog_expiry_table, &arg);
 	if (ret < 0)
 		goto done;
 
-	/*
-	 * Future improvement: we could skip writing records that were
-	 * not changed.
-	 */
 	if (!(flags & EXPIRE_REFLOGS_DRY_RUN))
 		ret = reftable_addition_commit(add);
 
@@ -2786,6 +3066,7 @@ struct ref_storage_be refs_be_reftable = {
 
 	.iterator_begin = reftable_be_iterator_begin,
 	.read_raw_ref = reftable_be_read_raw_ref,
+	.read_raw_refs = reftable_be_read_raw_refs,
 	.read_symbolic_ref = reftable_be_read_symbolic_ref,
 
 	.reflog_iterator_begin = reftable_be_reflog_iterator_begin,
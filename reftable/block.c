@@ -87,7 +87,7 @@ int block_writer_init(struct block_writer *bw, uint8_t typ, uint8_t *block,
 		REFTABLE_CALLOC_ARRAY(bw->zstream, 1);
 		if (!bw->zstream)
 			return REFTABLE_OUT_OF_MEMORY_ERROR;
-		deflateInit(bw->zstream, 9);
+		deflateInit(bw->zstream, LOG_BLOCK_COMPRESSION_LEVEL);
 	}
 
 	return 0;
@@ -146,7 +146,7 @@ int block_writer_add(struct block_writer *w, struct reftable_record *rec)
 	return err;
 }
 
-int block_writer_finish(struct block_writer *w)
+int block_writer_finish_uncompressed(struct block_writer *w)
 {
 	for (uint32_t i = 0; i < w->restart_len; i++) {
 		reftable_put_be24(w->block + w->next, w->restarts[i]);
@@ -157,58 +157,73 @@ int block_writer_finish(struct block_writer *w)
 	w->next += 2;
 	reftable_put_be24(w->block + 1 + w->header_off, w->next);
 
+	return w->next;
+}
+
+int block_compress_log(struct z_stream_s *zstream, uint8_t *block,
+		       uint32_t header_off, uint32_t len,
+		       unsigned char **compressed, size_t *compressed_cap)
+{
+	int block_header_skip = 4 + header_off;
+	uLongf src_len = len - block_header_skip, compressed_len;
+	int ret;
+
+	ret = deflateReset(zstream);
+	if (ret != Z_OK)
+		return REFTABLE_ZLIB_ERROR;
+
 	/*
-	 * Log records are stored zlib-compressed. Note that the compression
-	 * also spans over the restart points we have just written.
+	 * Precompute the upper bound of how many bytes the compressed
+	 * data may end up with. Combined with `Z_FINISH`, `deflate()`
+	 * is guaranteed to return `Z_STREAM_END`.
 	 */
-	if (block_writer_type(w) == REFTABLE_BLOCK_TYPE_LOG) {
-		int block_header_skip = 4 + w->header_off;
-		uLongf src_len = w->next - block_header_skip, compressed_len;
-		int ret;
+	compressed_len = deflateBound(zstream, src_len);
+	REFTABLE_ALLOC_GROW_OR_NULL(*compressed, compressed_len, *compressed_cap);
+	if (!*compressed)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
 
-		ret = deflateReset(w->zstream);
-		if (ret != Z_OK)
-			return REFTABLE_ZLIB_ERROR;
+	zstream->next_out = *compressed;
+	zstream->avail_out = compressed_len;
+	zstream->next_in = block + block_header_skip;
+	zstream->avail_in = src_len;
 
-		/*
-		 * Precompute the upper bound of how many bytes the compressed
-		 * data may end up with. Combined with `Z_FINISH`, `deflate()`
-		 * is guaranteed to return `Z_STREAM_END`.
-		 */
-		compressed_len = deflateBound(w->zstream, src_len);
-		REFTABLE_ALLOC_GROW_OR_NULL(w->compressed, compressed_len,
-					    w->compressed_cap);
-		if (!w->compressed) {
-			ret = REFTABLE_OUT_OF_MEMORY_ERROR;
-			return ret;
-		}
+	/*
+	 * We want to perform all decompression in a single step, which
+	 * is why we can pass Z_FINISH here. As we have precomputed the
+	 * deflated buffer's size via `deflateBound()` this function is
+	 * guaranteed to succeed according to the zlib documentation.
+	 */
+	ret = deflate(zstream, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return REFTABLE_ZLIB_ERROR;
 
-		w->zstream->next_out = w->compressed;
-		w->zstream->avail_out = compressed_len;
-		w->zstream->next_in = w->block + block_header_skip;
-		w->zstream->avail_in = src_len;
+	/*
+	 * Overwrite the uncompressed data we have already written and
+	 * return the length of the block up to the end of the compressed
+	 * data.
+	 */
+	memcpy(block + block_header_skip, *compressed, zstream->total_out);
+	return zstream->total_out + block_header_skip;
+}
 
-		/*
-		 * We want to perform all decompression in a single step, which
-		 * is why we can pass Z_FINISH here. As we have precomputed the
-		 * deflated buffer's size via `deflateBound()` this function is
-		 * guaranteed to succeed according to the zlib documentation.
-		 */
-		ret = deflate(w->zstream, Z_FINISH);
-		if (ret != Z_STREAM_END)
-			return REFTABLE_ZLIB_ERROR;
+int block_writer_finish(struct block_writer *w)
+{
+	int ret = block_writer_finish_uncompressed(w);
 
-		/*
-		 * Overwrite the uncompressed data we have already written and
-		 * adjust the `next` pointer to point right after the
-		 * compressed data.
-		 */
-		memcpy(w->block + block_header_skip, w->compressed,
-		       w->zstream->total_out);
-		w->next = w->zstream->total_out + block_header_skip;
+	/*
+	 * Log records are stored zlib-compressed. Note that the compression
+	 * also spans over the restart points we have just written.
+	 */
+	if (ret >= 0 && block_writer_type(w) == REFTABLE_BLOCK_TYPE_LOG) {
+		ret = block_compress_log(w->zstream, w->block, w->header_off,
+					 w->next, &w->compressed,
+					 &w->compressed_cap);
+		if (ret < 0)
+			return ret;
+		w->next = ret;
 	}
 
-	return w->next;
+	return ret;
 }
 
 static int read_block(struct reftable_block_source *source,
@@ -60,6 +60,27 @@ int block_writer_add(struct block_writer *w, struct reftable_record *rec);
 /* appends the key restarts, and compress the block if necessary. */
 int block_writer_finish(struct block_writer *w);
 
+/*
+ * Like block_writer_finish(), but leaves log blocks uncompressed so that
+ * they can be compressed with block_compress_log() later on, e.g. on a
+ * different thread. Returns the length of the block.
+ */
+int block_writer_finish_uncompressed(struct block_writer *w);
+
+/* The zlib compression level used for log blocks. */
+#define LOG_BLOCK_COMPRESSION_LEVEL 9
+
+/*
+ * Compress the records of the finished log block `block` of length `len`
+ * in place. The first `header_off + 4` bytes hold the table and block
+ * headers and are left alone. `zstream` must have been set up with
+ * deflateInit() and `compressed` is used as scratch buffer. Returns the
+ * new length of the block or a negative error code.
+ */
+int block_compress_log(struct z_stream_s *zstream, uint8_t *block,
+		       uint32_t header_off, uint32_t len,
+		       unsigned char **compressed, size_t *compressed_cap);
+
 /* clears out internally allocated block_writer members. */
 void block_writer_release(struct block_writer *bw);
 
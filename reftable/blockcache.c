@@ -0,0 +1,254 @@
+#include "blockcache.h"
+
+#include "basics.h"
+#include "block.h"
+#include "blocksource.h"
+#include "reftable-error.h"
+
+/* The number of hash buckets, must be a power of two. */
+#define BLOCK_CACHE_BUCKETS 256
+
+struct block_cache_entry {
+	const struct reftable_table *table;
+	uint64_t off;
+
+	/* The decompressed block and the metadata parsed from it. */
+	uint8_t *data;
+	size_t len;
+	uint32_t header_off;
+	uint32_t hash_size;
+	uint16_t restart_count;
+	uint32_t restart_off;
+	uint32_t full_block_size;
+	uint8_t block_type;
+
+	/*
+	 * The cache holds one reference, and each block that uses the data
+	 * holds another one.
+	 */
+	size_t refcount;
+
+	struct block_cache_entry *bucket_next;
+	struct block_cache_entry *lru_prev, *lru_next;
+};
+
+struct reftable_block_cache {
+	struct block_cache_entry *buckets[BLOCK_CACHE_BUCKETS];
+
+	/* Entries ordered from most to least recently used. */
+	struct block_cache_entry *lru_head, *lru_tail;
+
+	size_t size, max_size;
+	size_t entries;
+	uint64_t hits, misses;
+	size_t refcount;
+};
+
+static size_t block_cache_bucket(const struct reftable_table *t, uint64_t off)
+{
+	uint64_t h = (uintptr_t)t ^ (off * 0x9e3779b97f4a7c15ULL);
+	return (h ^ (h >> 29)) & (BLOCK_CACHE_BUCKETS - 1);
+}
+
+static void block_cache_entry_decref(struct block_cache_entry *e)
+{
+	if (--e->refcount)
+		return;
+	reftable_free(e->data);
+	reftable_free(e);
+}
+
+/*
+ * Blocks handed out by the cache use the entry as their block source, so
+ * that releasing the block drops its reference to the entry.
+ */
+static void block_cache_entry_release_data(void *arg,
+					   struct reftable_block_data *data REFTABLE_UNUSED)
+{
+	block_cache_entry_decref(arg);
+}
+
+static struct reftable_block_source_vtable block_cache_entry_vtable = {
+	.release_data = &block_cache_entry_release_data,
+};
+
+static void lru_unlink(struct reftable_block_cache *cache,
+		       struct block_cache_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		cache->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		cache->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(struct reftable_block_cache *cache,
+			   struct block_cache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = e;
+	else
+		cache->lru_tail = e;
+	cache->lru_head = e;
+}
+
+static void block_cache_evict(struct reftable_block_cache *cache,
+			      struct block_cache_entry *e)
+{
+	struct block_cache_entry **p =
+		&cache->buckets[block_cache_bucket(e->table, e->off)];
+
+	while (*p != e)
+		p = &(*p)->bucket_next;
+	*p = e->bucket_next;
+	lru_unlink(cache, e);
+
+	cache->size -= e->len;
+	cache->entries--;
+	block_cache_entry_decref(e);
+}
+
+int reftable_block_cache_new(struct reftable_block_cache **out,
+			     size_t max_size)
+{
+	struct reftable_block_cache *cache;
+
+	REFTABLE_CALLOC_ARRAY(cache, 1);
+	if (!cache)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	cache->max_size = max_size;
+	cache->refcount = 1;
+
+	*out = cache;
+	return 0;
+}
+
+void reftable_block_cache_incref(struct reftable_block_cache *cache)
+{
+	cache->refcount++;
+}
+
+void reftable_block_cache_decref(struct reftable_block_cache *cache)
+{
+	if (!cache)
+		return;
+	if (--cache->refcount)
+		return;
+	while (cache->lru_head)
+		block_cache_evict(cache, cache->lru_head);
+	reftable_free(cache);
+}
+
+int reftable_block_cache_get(struct reftable_block_cache *cache,
+			     const struct reftable_table *t, uint64_t off,
+			     struct reftable_block *block)
+{
+	struct block_cache_entry *e;
+
+	for (e = cache->buckets[block_cache_bucket(t, off)]; e; e = e->bucket_next)
+		if (e->table == t && e->off == off)
+			break;
+	if (!e) {
+		cache->misses++;
+		return 1;
+	}
+	cache->hits++;
+
+	if (cache->lru_head != e) {
+		lru_unlink(cache, e);
+		lru_push_front(cache, e);
+	}
+
+	block_source_release_data(&block->block_data);
+	block->block_data.data = e->data;
+	block->block_data.len = e->len;
+	block->block_data.source.ops = &block_cache_entry_vtable;
+	block->block_data.source.arg = e;
+	e->refcount++;
+
+	block->header_off = e->header_off;
+	block->hash_size = e->hash_size;
+	block->restart_count = e->restart_count;
+	block->restart_off = e->restart_off;
+	block->full_block_size = e->full_block_size;
+	block->block_type = e->block_type;
+
+	return 0;
+}
+
+int reftable_block_cache_put(struct reftable_block_cache *cache,
+			     const struct reftable_table *t, uint64_t off,
+			     struct reftable_block *block)
+{
+	size_t bucket = block_cache_bucket(t, off);
+	struct block_cache_entry *e;
+
+	/*
+	 * Only take over blocks that own their decompressed data, and never
+	 * let a single block flush the whole cache.
+	 */
+	if (!block->uncompressed_data ||
+	    block->block_data.data != block->uncompressed_data ||
+	    block->block_data.len > cache->max_size / 2)
+		return 0;
+
+	REFTABLE_CALLOC_ARRAY(e, 1);
+	if (!e)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+
+	e->table = t;
+	e->off = off;
+	e->data = block->uncompressed_data;
+	e->len = block->block_data.len;
+	e->header_off = block->header_off;
+	e->hash_size = block->hash_size;
+	e->restart_count = block->restart_count;
+	e->restart_off = block->restart_off;
+	e->full_block_size = block->full_block_size;
+	e->block_type = block->block_type;
+	e->refcount = 2;
+
+	block->uncompressed_data = NULL;
+	block->uncompressed_cap = 0;
+	block->block_data.source.ops = &block_cache_entry_vtable;
+	block->block_data.source.arg = e;
+
+	while (cache->lru_tail && cache->size + e->len > cache->max_size)
+		block_cache_evict(cache, cache->lru_tail);
+
+	e->bucket_next = cache->buckets[bucket];
+	cache->buckets[bucket] = e;
+	lru_push_front(cache, e);
+	cache->size += e->len;
+	cache->entries++;
+
+	return 0;
+}
+
+void reftable_block_cache_evict_table(struct reftable_block_cache *cache,
+				      const struct reftable_table *t)
+{
+	struct block_cache_entry *e = cache->lru_head;
+
+	while (e) {
+		struct block_cache_entry *next = e->lru_next;
+		if (e->table == t)
+			block_cache_evict(cache, e);
+		e = next;
+	}
+}
+
+void reftable_block_cache_stats(struct reftable_block_cache *cache,
+				struct reftable_block_cache_stats *out)
+{
+	out->hits = cache->hits;
+	out->misses = cache->misses;
+	out->entries = cache->entries;
+	out->size = cache->size;
+}
@@ -0,0 +1,67 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "system.h"
+
+struct reftable_block;
+struct reftable_table;
+
+/*
+ * A size-bounded cache of decompressed log blocks that is shared by the
+ * tables of a stack. Log blocks are stored zlib-compressed, so without the
+ * cache every seek into the logs would have to inflate the blocks it
+ * touches again. Ref, object and index blocks are not compressed and are
+ * read straight from the mapped table, so they are never cached.
+ *
+ * Blocks handed out by the cache share its data. The data stays valid
+ * until the block is released, even if the entry is evicted in the
+ * meantime.
+ */
+struct reftable_block_cache;
+
+/*
+ * Create a new cache that holds up to `max_size` bytes of decompressed
+ * data. The cache starts with a refcount of 1.
+ */
+int reftable_block_cache_new(struct reftable_block_cache **out,
+			     size_t max_size);
+
+void reftable_block_cache_incref(struct reftable_block_cache *cache);
+void reftable_block_cache_decref(struct reftable_block_cache *cache);
+
+/*
+ * Initialize `block` with the cached block of table `t` at offset `off`.
+ * Returns 0 on a hit and 1 on a miss, in which case `block` is left
+ * untouched.
+ */
+int reftable_block_cache_get(struct reftable_block_cache *cache,
+			     const struct reftable_table *t, uint64_t off,
+			     struct reftable_block *block);
+
+/*
+ * Store the log block `block` of table `t` at offset `off` that has just
+ * been decompressed by `reftable_block_init()`. The cache takes over the
+ * decompressed data, which the block keeps on using. Returns 0 on success
+ * or when the block is not worth caching, and a negative error code
+ * otherwise.
+ */
+int reftable_block_cache_put(struct reftable_block_cache *cache,
+			     const struct reftable_table *t, uint64_t off,
+			     struct reftable_block *block);
+
+/* Drop all entries of table `t`, which is about to go away. */
+void reftable_block_cache_evict_table(struct reftable_block_cache *cache,
+				      const struct reftable_table *t);
+
+/* Statistics, mainly for the benefit of tests. */
+struct reftable_block_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	size_t entries;
+	size_t size;
+};
+
+void reftable_block_cache_stats(struct reftable_block_cache *cache,
+				struct reftable_block_cache_stats *out);
+
+#endif
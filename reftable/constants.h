@@ -14,5 +14,6 @@
 #define MAX_RESTARTS ((1 << 16) - 1)
 #define DEFAULT_BLOCK_SIZE 4096
 #define DEFAULT_GEOMETRIC_FACTOR 2
+#define DEFAULT_LOG_BLOCK_CACHE_SIZE (1024 * 1024)
 
 #endif
@@ -102,6 +102,9 @@ int reftable_stack_init_log_iterator(struct reftable_stack *st,
 struct reftable_merged_table *
 reftable_stack_merged_table(struct reftable_stack *st);
 
+/* returns the number of tables in the stack. */
+size_t reftable_stack_tables_len(struct reftable_stack *st);
+
 /* frees all resources associated with the stack. */
 void reftable_stack_destroy(struct reftable_stack *st);
 
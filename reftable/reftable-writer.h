@@ -52,6 +52,22 @@ struct reftable_write_options {
 	 */
 	uint8_t auto_compaction_factor;
 
+	/*
+	 * The number of bytes of decompressed log blocks that a stack keeps
+	 * cached in memory across its tables, so that repeated reads of the
+	 * same logs do not have to inflate them again. Defaults to 1MiB if
+	 * unset.
+	 */
+	uint32_t log_block_cache_size;
+
+	/*
+	 * The number of threads used to compress log blocks while the writer
+	 * keeps on encoding records. Log blocks are compressed inline when
+	 * this is 0 or 1, or when the table only has a single log block.
+	 * The resulting table is the same either way.
+	 */
+	unsigned int log_compression_threads;
+
 	/*
 	 * The number of milliseconds to wait when trying to lock "tables.list".
 	 * Note that this does not apply to locking individual tables, as these
@@ -77,6 +93,16 @@ struct reftable_write_options {
 	 */
 	void (*on_reload)(void *payload);
 	void *on_reload_payload;
+
+	/*
+	 * Optional callback to execute instead of auto-compacting the stack
+	 * when committing an addition left it in need of compaction. This
+	 * can be used to compact the stack outside of the writing process,
+	 * e.g. by spawning a background process. It is not called when
+	 * `disable_auto_compact` is set.
+	 */
+	void (*on_compaction_required)(void *payload);
+	void *on_compaction_required_payload;
 };
 
 /* reftable_block_stats holds statistics for a single block type */
@@ -9,6 +9,7 @@
 #include "stack.h"
 
 #include "system.h"
+#include "blockcache.h"
 #include "constants.h"
 #include "merged.h"
 #include "reftable-error.h"
@@ -154,6 +155,11 @@ reftable_stack_merged_table(struct reftable_stack *st)
 	return st->merged;
 }
 
+size_t reftable_stack_tables_len(struct reftable_stack *st)
+{
+	return st->merged->tables_len;
+}
+
 static int has_name(char **names, const char *name)
 {
 	while (*names) {
@@ -213,6 +219,7 @@ void reftable_stack_destroy(struct reftable_stack *st)
 		st->list_fd = -1;
 	}
 
+	reftable_block_cache_decref(st->block_cache);
 	REFTABLE_FREE_AND_NULL(st->list_file);
 	REFTABLE_FREE_AND_NULL(st->reftable_dir);
 	reftable_free(st);
@@ -310,6 +317,8 @@ static int reftable_stack_reload_once(struct reftable_stack *st,
 			err = reftable_table_new(&table, &src, name);
 			if (err < 0)
 				goto done;
+
+			table_set_block_cache(table, st->block_cache);
 		}
 
 		new_tables[new_tables_len] = table;
@@ -544,6 +553,8 @@ int reftable_new_stack(struct reftable_stack **dest, const char *dir,
 		opts = *_opts;
 	if (opts.hash_id == 0)
 		opts.hash_id = REFTABLE_HASH_SHA1;
+	if (!opts.log_block_cache_size)
+		opts.log_block_cache_size = DEFAULT_LOG_BLOCK_CACHE_SIZE;
 
 	*dest = NULL;
 
@@ -561,6 +572,11 @@ int reftable_new_stack(struct reftable_stack **dest, const char *dir,
 		goto out;
 	}
 
+	err = reftable_block_cache_new(&p->block_cache,
+				       opts.log_block_cache_size);
+	if (err < 0)
+		goto out;
+
 	err = reftable_stack_reload_maybe_reuse(p, 1);
 	if (err < 0)
 		goto out;
@@ -836,7 +852,21 @@ int reftable_addition_commit(struct reftable_addition *add)
 	if (err)
 		goto done;
 
-	if (!add->stack->opts.disable_auto_compact) {
+	if (!add->stack->opts.disable_auto_compact &&
+	    add->stack->opts.on_compaction_required) {
+		bool required;
+
+		/*
+		 * The caller takes care of compacting the stack, so that
+		 * committing the addition does not have to wait for it.
+		 */
+		err = reftable_stack_compaction_required(add->stack, true,
+							 &required);
+		if (err < 0)
+			goto done;
+		if (required)
+			add->stack->opts.on_compaction_required(add->stack->opts.on_compaction_required_payload);
+	} else if (!add->stack->opts.disable_auto_compact) {
 		/*
 		 * Auto-compact the stack to keep the number of tables in
 		 * control. It is possible that a concurrent writer is already
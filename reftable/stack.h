@@ -25,6 +25,7 @@ struct reftable_stack {
 	struct reftable_table **tables;
 	size_t tables_len;
 	struct reftable_merged_table *merged;
+	struct reftable_block_cache *block_cache;
 	struct reftable_compaction_stats stats;
 };
 
@@ -10,6 +10,7 @@
 
 #include "system.h"
 #include "block.h"
+#include "blockcache.h"
 #include "blocksource.h"
 #include "constants.h"
 #include "iter.h"
@@ -172,13 +173,31 @@ int table_init_block(struct reftable_table *t, struct reftable_block *block,
 	if (next_off >= t->size)
 		return 1;
 
+	if (t->block_cache && want_typ == REFTABLE_BLOCK_TYPE_LOG &&
+	    !reftable_block_cache_get(t->block_cache, t, next_off, block))
+		return 0;
+
 	err = reftable_block_init(block, &t->source, next_off, header_off,
 				  t->block_size, hash_size(t->hash_id), want_typ);
+	if (!err && t->block_cache && block->block_type == REFTABLE_BLOCK_TYPE_LOG)
+		err = reftable_block_cache_put(t->block_cache, t, next_off, block);
 	if (err)
 		reftable_block_release(block);
 	return err;
 }
 
+void table_set_block_cache(struct reftable_table *t,
+			   struct reftable_block_cache *cache)
+{
+	if (t->block_cache) {
+		reftable_block_cache_evict_table(t->block_cache, t);
+		reftable_block_cache_decref(t->block_cache);
+	}
+	t->block_cache = cache;
+	if (cache)
+		reftable_block_cache_incref(cache);
+}
+
 static void table_iter_close(struct table_iter *ti)
 {
 	table_iter_block_done(ti);
@@ -606,6 +625,7 @@ void reftable_table_decref(struct reftable_table *t)
 		return;
 	if (--t->refcount)
 		return;
+	table_set_block_cache(t, NULL);
 	block_source_close(&t->source);
 	REFTABLE_FREE_AND_NULL(t->name);
 	reftable_free(t);
@@ -26,4 +26,11 @@ int table_init_iter(struct reftable_table *t,
 int table_init_block(struct reftable_table *t, struct reftable_block *block,
 		     uint64_t next_off, uint8_t want_typ);
 
+/*
+ * Make the table keep its decompressed log blocks in the given cache,
+ * which may be shared with other tables. Passing NULL stops caching.
+ */
+void table_set_block_cache(struct reftable_table *t,
+			   struct reftable_block_cache *cache);
+
 #endif
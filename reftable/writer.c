@@ -15,6 +15,7 @@
 #include "record.h"
 #include "tree.h"
 #include "reftable-error.h"
+#include "thread-utils.h"
 
 /* finishes a block, and writes it to storage */
 static int writer_flush_block(struct reftable_writer *w);
@@ -25,6 +26,51 @@ static void writer_clear_index(struct reftable_writer *w);
 /* finishes writing a 'r' (refs) or 'g' (reflogs) section */
 static int writer_finish_public_section(struct reftable_writer *w);
 
+/* writes out queued log blocks until at most `keep` of them are left */
+static int writer_drain_log_blocks(struct reftable_writer *w, size_t keep);
+
+/* starts threads to compress log blocks in the background */
+static int writer_compression_start(struct reftable_writer *w);
+
+/* stops the compression threads, if any */
+static void writer_compression_stop(struct reftable_writer *w);
+
+/*
+ * A log block that has been handed over to the compression threads. The
+ * blocks are written to storage in the order in which they were queued,
+ * so that the resulting table does not depend on the number of threads.
+ */
+struct writer_log_block {
+	uint8_t *data;
+	uint32_t len;
+	uint32_t header_off;
+	int entries;
+	uint32_t restarts;
+	struct reftable_buf last_key;
+
+	/* The length of the compressed block, or a negative error code. */
+	int result;
+	int done;
+};
+
+struct writer_compression {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	size_t threads_nr;
+	int shutdown;
+
+	/*
+	 * A ring of log blocks. The counters only ever increase: blocks in
+	 * [written, queued) are in flight, and blocks in [picked, queued)
+	 * are still waiting for a thread to compress them.
+	 */
+	struct writer_log_block *blocks;
+	size_t blocks_nr;
+	uint64_t written, picked, queued;
+};
+
 static struct reftable_block_stats *
 writer_reftable_block_stats(struct reftable_writer *w, uint8_t typ)
 {
@@ -128,7 +174,11 @@ static int writer_reinit_block_writer(struct reftable_writer *w, uint8_t typ)
 {
 	int block_start = 0, ret;
 
-	if (w->next == 0)
+	/*
+	 * The first block of the table also holds the table header. Note that
+	 * blocks queued for compression have not been written yet.
+	 */
+	if (w->next == 0 && !(w->compression && w->compression->queued))
 		block_start = header_size(writer_version(w));
 
 	reftable_buf_reset(&w->last_key);
@@ -209,6 +259,7 @@ static void writer_release(struct reftable_writer *w)
 		block_writer_release(&w->block_writer_data);
 		w->block_writer = NULL;
 		writer_clear_index(w);
+		writer_compression_stop(w);
 		reftable_buf_release(&w->last_key);
 		reftable_buf_release(&w->scratch);
 	}
@@ -321,8 +372,18 @@ static int writer_add_record(struct reftable_writer *w,
 		goto done;
 	/*
 	 * The current block is full, so we need to flush and reinitialize the
-	 * writer to start writing the next block.
+	 * writer to start writing the next block. There is more than a single
+	 * log block to compress now, so this is when it becomes worthwhile to
+	 * hand them over to the compression threads.
 	 */
+	if (reftable_record_type(rec) == REFTABLE_BLOCK_TYPE_LOG &&
+	    !w->compression && w->opts.log_compression_threads > 1 &&
+	    HAVE_THREADS) {
+		err = writer_compression_start(w);
+		if (err < 0)
+			goto done;
+	}
+
 	err = writer_flush_block(w);
 	if (err < 0)
 		goto done;
@@ -515,6 +576,10 @@ static int writer_finish_section(struct reftable_writer *w)
 	if (err < 0)
 		return err;
 
+	err = writer_drain_log_blocks(w, 0);
+	if (err < 0)
+		return err;
+
 	/*
 	 * When the section we are about to index has a lot of blocks then the
 	 * index itself may span across multiple blocks, as well. This would
@@ -795,27 +860,22 @@ static void writer_clear_index(struct reftable_writer *w)
 	w->index_cap = 0;
 }
 
-static int writer_flush_nonempty_block(struct reftable_writer *w)
+/*
+ * Write a finished block of `raw_bytes` bytes to storage and add an index
+ * record for it. `entries`, `restarts` and `last_key` describe the records
+ * contained in the block.
+ */
+static int writer_write_block(struct reftable_writer *w, uint8_t *block,
+			      uint8_t typ, int raw_bytes, int entries,
+			      uint32_t restarts, struct reftable_buf *last_key)
 {
 	struct reftable_index_record index_record = {
 		.last_key = REFTABLE_BUF_INIT,
 	};
-	uint8_t typ = block_writer_type(w->block_writer);
 	struct reftable_block_stats *bstats;
-	int raw_bytes, padding = 0, err;
+	int padding = 0, err;
 	uint64_t block_typ_off;
 
-	/*
-	 * Finish the current block. This will cause the block writer to emit
-	 * restart points and potentially compress records in case we are
-	 * writing a log block.
-	 *
-	 * Note that this is still happening in memory.
-	 */
-	raw_bytes = block_writer_finish(w->block_writer);
-	if (raw_bytes < 0)
-		return raw_bytes;
-
 	/*
 	 * By default, all records except for log records are padded to the
 	 * block size.
@@ -827,8 +887,8 @@ static int writer_flush_nonempty_block(struct reftable_writer *w)
 	block_typ_off = (bstats->blocks == 0) ? w->next : 0;
 	if (block_typ_off > 0)
 		bstats->offset = block_typ_off;
-	bstats->entries += w->block_writer->entries;
-	bstats->restarts += w->block_writer->restart_len;
+	bstats->entries += entries;
+	bstats->restarts += restarts;
 	bstats->blocks++;
 	w->stats.blocks++;
 
@@ -837,9 +897,9 @@ static int writer_flush_nonempty_block(struct reftable_writer *w)
 	 * to also write the reftable header.
 	 */
 	if (!w->next)
-		writer_write_header(w, w->block);
+		writer_write_header(w, block);
 
-	err = padded_write(w, w->block, raw_bytes, padding);
+	err = padded_write(w, block, raw_bytes, padding);
 	if (err < 0)
 		return err;
 
@@ -859,16 +919,245 @@ static int writer_flush_nonempty_block(struct reftable_writer *w)
 
 	index_record.offset = w->next;
 	reftable_buf_reset(&index_record.last_key);
-	err = reftable_buf_add(&index_record.last_key, w->block_writer->last_key.buf,
-			       w->block_writer->last_key.len);
+	err = reftable_buf_add(&index_record.last_key, last_key->buf,
+			       last_key->len);
 	if (err < 0)
 		return err;
 	w->index[w->index_len] = index_record;
 	w->index_len++;
 
 	w->next += padding + raw_bytes;
+
+	return 0;
+}
+
+static void *writer_compression_thread(void *arg)
+{
+	struct writer_compression *c = arg;
+	struct z_stream_s zstream = { 0 };
+	unsigned char *compressed = NULL;
+	size_t compressed_cap = 0;
+	int zlib_err;
+
+	zlib_err = deflateInit(&zstream, LOG_BLOCK_COMPRESSION_LEVEL) != Z_OK;
+
+	pthread_mutex_lock(&c->mutex);
+	while (1) {
+		struct writer_log_block *b;
+		int result;
+
+		while (!c->shutdown && c->picked == c->queued)
+			pthread_cond_wait(&c->work_cond, &c->mutex);
+		if (c->picked == c->queued)
+			break;
+		b = &c->blocks[c->picked++ % c->blocks_nr];
+		pthread_mutex_unlock(&c->mutex);
+
+		if (zlib_err)
+			result = REFTABLE_ZLIB_ERROR;
+		else
+			result = block_compress_log(&zstream, b->data,
+						    b->header_off, b->len,
+						    &compressed, &compressed_cap);
+
+		pthread_mutex_lock(&c->mutex);
+		b->result = result;
+		b->done = 1;
+		pthread_cond_signal(&c->done_cond);
+	}
+	pthread_mutex_unlock(&c->mutex);
+
+	if (!zlib_err)
+		deflateEnd(&zstream);
+	reftable_free(compressed);
+	return NULL;
+}
+
+static int writer_compression_start(struct reftable_writer *w)
+{
+	struct writer_compression *c;
+	int err;
+
+	REFTABLE_CALLOC_ARRAY(c, 1);
+	if (!c)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	pthread_mutex_init(&c->mutex, NULL);
+	pthread_cond_init(&c->work_cond, NULL);
+	pthread_cond_init(&c->done_cond, NULL);
+	w->compression = c;
+
+	/*
+	 * Allow for two blocks per thread so that the threads have the next
+	 * block at hand while we write out the ones they have finished.
+	 */
+	c->blocks_nr = 2 * w->opts.log_compression_threads;
+	REFTABLE_CALLOC_ARRAY(c->blocks, c->blocks_nr);
+	if (!c->blocks) {
+		err = REFTABLE_OUT_OF_MEMORY_ERROR;
+		goto out;
+	}
+	for (size_t i = 0; i < c->blocks_nr; i++) {
+		reftable_buf_init(&c->blocks[i].last_key);
+		REFTABLE_ALLOC_ARRAY(c->blocks[i].data, w->opts.block_size);
+		if (!c->blocks[i].data) {
+			err = REFTABLE_OUT_OF_MEMORY_ERROR;
+			goto out;
+		}
+	}
+
+	REFTABLE_CALLOC_ARRAY(c->threads, w->opts.log_compression_threads);
+	if (!c->threads) {
+		err = REFTABLE_OUT_OF_MEMORY_ERROR;
+		goto out;
+	}
+	for (size_t i = 0; i < w->opts.log_compression_threads; i++) {
+		if (pthread_create(&c->threads[i], NULL,
+				   writer_compression_thread, c))
+			break;
+		c->threads_nr++;
+	}
+
+	/* Fall back to compressing inline if we could not start any thread. */
+	if (!c->threads_nr)
+		writer_compression_stop(w);
+
+	return 0;
+
+out:
+	writer_compression_stop(w);
+	return err;
+}
+
+static void writer_compression_stop(struct reftable_writer *w)
+{
+	struct writer_compression *c = w->compression;
+
+	if (!c)
+		return;
+
+	pthread_mutex_lock(&c->mutex);
+	c->shutdown = 1;
+	pthread_cond_broadcast(&c->work_cond);
+	pthread_mutex_unlock(&c->mutex);
+	for (size_t i = 0; i < c->threads_nr; i++)
+		pthread_join(c->threads[i], NULL);
+
+	for (size_t i = 0; c->blocks && i < c->blocks_nr; i++) {
+		reftable_free(c->blocks[i].data);
+		reftable_buf_release(&c->blocks[i].last_key);
+	}
+	reftable_free(c->blocks);
+	reftable_free(c->threads);
+	pthread_cond_destroy(&c->work_cond);
+	pthread_cond_destroy(&c->done_cond);
+	pthread_mutex_destroy(&c->mutex);
+	REFTABLE_FREE_AND_NULL(w->compression);
+}
+
+static int writer_drain_log_blocks(struct reftable_writer *w, size_t keep)
+{
+	struct writer_compression *c = w->compression;
+	int err = 0;
+
+	if (!c)
+		return 0;
+
+	pthread_mutex_lock(&c->mutex);
+	while (c->written < c->queued) {
+		struct writer_log_block *b = &c->blocks[c->written % c->blocks_nr];
+
+		if (!b->done) {
+			if (c->queued - c->written <= keep)
+				break;
+			pthread_cond_wait(&c->done_cond, &c->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&c->mutex);
+
+		err = b->result;
+		if (err >= 0)
+			err = writer_write_block(w, b->data, REFTABLE_BLOCK_TYPE_LOG,
+						 b->result, b->entries,
+						 b->restarts, &b->last_key);
+
+		pthread_mutex_lock(&c->mutex);
+		b->done = 0;
+		c->written++;
+		if (err < 0)
+			break;
+	}
+	pthread_mutex_unlock(&c->mutex);
+
+	return err;
+}
+
+/*
+ * Hand the current log block over to the compression threads. It is
+ * written to storage by `writer_drain_log_blocks()` once it has been
+ * compressed.
+ */
+static int writer_queue_log_block(struct reftable_writer *w)
+{
+	struct writer_compression *c = w->compression;
+	struct block_writer *bw = w->block_writer;
+	struct writer_log_block *b;
+	int raw_bytes, err;
+
+	err = writer_drain_log_blocks(w, c->blocks_nr - 1);
+	if (err < 0)
+		return err;
+
+	raw_bytes = block_writer_finish_uncompressed(bw);
+	if (raw_bytes < 0)
+		return raw_bytes;
+
+	b = &c->blocks[c->queued % c->blocks_nr];
+	memcpy(b->data, bw->block, raw_bytes);
+	b->len = raw_bytes;
+	b->header_off = bw->header_off;
+	b->entries = bw->entries;
+	b->restarts = bw->restart_len;
+	reftable_buf_reset(&b->last_key);
+	err = reftable_buf_add(&b->last_key, bw->last_key.buf, bw->last_key.len);
+	if (err < 0)
+		return err;
+
+	pthread_mutex_lock(&c->mutex);
+	c->queued++;
+	pthread_cond_signal(&c->work_cond);
+	pthread_mutex_unlock(&c->mutex);
+
 	w->block_writer = NULL;
+	return 0;
+}
+
+static int writer_flush_nonempty_block(struct reftable_writer *w)
+{
+	uint8_t typ = block_writer_type(w->block_writer);
+	int raw_bytes, err;
 
+	if (typ == REFTABLE_BLOCK_TYPE_LOG && w->compression)
+		return writer_queue_log_block(w);
+
+	/*
+	 * Finish the current block. This will cause the block writer to emit
+	 * restart points and potentially compress records in case we are
+	 * writing a log block.
+	 *
+	 * Note that this is still happening in memory.
+	 */
+	raw_bytes = block_writer_finish(w->block_writer);
+	if (raw_bytes < 0)
+		return raw_bytes;
+
+	err = writer_write_block(w, w->block, typ, raw_bytes,
+				 w->block_writer->entries,
+				 w->block_writer->restart_len,
+				 &w->block_writer->last_key);
+	if (err < 0)
+		return err;
+
+	w->block_writer = NULL;
 	return 0;
 }
 
@@ -48,6 +48,13 @@ struct reftable_writer {
 	struct tree_node *obj_index_tree;
 
 	struct reftable_stats stats;
+
+	/*
+	 * Threads compressing log blocks in the background, set up once the
+	 * first log block fills up when `log_compression_threads` asks for
+	 * it. NULL otherwise.
+	 */
+	struct writer_compression *compression;
 };
 
 #endif
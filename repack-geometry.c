@@ -65,6 +65,8 @@ void pack_geometry_init(struct pack_geometry *geometry,
 		}
 		if (p->is_cruft)
 			continue;
+		if (geometry->skip_midx_packs && p->multi_pack_index)
+			continue;
 
 		ALLOC_GROW(geometry->pack,
 			   geometry->pack_nr + 1,
@@ -283,6 +283,29 @@ static void remove_redundant_bitmaps(struct string_list *include,
 	strbuf_release(&path);
 }
 
+static void midx_drop_existing_layers(struct string_list *include,
+				      struct existing_packs *existing)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list_item *item;
+
+	/*
+	 * An incremental MIDX layer may only refer to packs which are
+	 * not already covered by one of the layers beneath it, so drop
+	 * any packs which the existing chain already knows about.
+	 */
+	for_each_string_list_item(item, &existing->midx_packs) {
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, item->string);
+		strbuf_strip_suffix(&buf, ".pack");
+		strbuf_addstr(&buf, ".idx");
+
+		string_list_remove(include, buf.buf, 0);
+	}
+
+	strbuf_release(&buf);
+}
+
 int write_midx_included_packs(struct repack_write_midx_opts *opts)
 {
 	struct child_process cmd = CHILD_PROCESS_INIT;
@@ -293,6 +316,8 @@ int write_midx_included_packs(struct repack_write_midx_opts *opts)
 	int ret = 0;
 
 	midx_included_packs(&include, opts);
+	if (opts->incremental)
+		midx_drop_existing_layers(&include, opts->existing);
 	if (!include.nr)
 		goto done;
 
@@ -302,6 +327,9 @@ int write_midx_included_packs(struct repack_write_midx_opts *opts)
 	strvec_push(&cmd.args, "multi-pack-index");
 	strvec_pushl(&cmd.args, "write", "--stdin-packs", NULL);
 
+	if (opts->incremental)
+		strvec_push(&cmd.args, "--incremental");
+
 	if (opts->show_progress)
 		strvec_push(&cmd.args, "--progress");
 	else
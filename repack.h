@@ -104,6 +104,14 @@ struct pack_geometry {
 	uint32_t split;
 
 	int split_factor;
+
+	/*
+	 * When set, packs which are already part of the multi-pack
+	 * index are left out of the progression entirely, so that a
+	 * geometric repack only ever rolls up packs written since the
+	 * last MIDX layer.
+	 */
+	int skip_midx_packs;
 };
 
 void pack_geometry_init(struct pack_geometry *geometry,
@@ -128,6 +136,7 @@ struct repack_write_midx_opts {
 	int show_progress;
 	int write_bitmaps;
 	int midx_must_contain_cruft;
+	int incremental;
 };
 
 void midx_snapshot_refs(struct repository *repo, struct tempfile *f);
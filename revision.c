@@ -652,6 +652,9 @@ static unsigned int count_bloom_filter_maybe;
 static unsigned int count_bloom_filter_definitely_not;
 static unsigned int count_bloom_filter_false_positive;
 static unsigned int count_bloom_filter_not_present;
+static unsigned int count_merge_bloom_filter_maybe;
+static unsigned int count_merge_bloom_filter_definitely_not;
+static unsigned int count_merge_bloom_filter_false_positive;
 
 static void trace2_bloom_filter_statistics_atexit(void)
 {
@@ -667,6 +670,20 @@ static void trace2_bloom_filter_statistics_atexit(void)
 	trace2_data_json("bloom", the_repository, "statistics", &jw);
 
 	jw_release(&jw);
+
+	if (!count_merge_bloom_filter_maybe &&
+	    !count_merge_bloom_filter_definitely_not)
+		return;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "maybe", count_merge_bloom_filter_maybe);
+	jw_object_intmax(&jw, "definitely_not", count_merge_bloom_filter_definitely_not);
+	jw_object_intmax(&jw, "false_positive", count_merge_bloom_filter_false_positive);
+	jw_end(&jw);
+
+	trace2_data_json("bloom", the_repository, "merge_statistics", &jw);
+
+	jw_release(&jw);
 }
 
 static int forbid_bloom_filters(struct pathspec *spec)
@@ -676,7 +693,8 @@ static int forbid_bloom_filters(struct pathspec *spec)
 		PATHSPEC_MAXDEPTH |
 		PATHSPEC_LITERAL |
 		PATHSPEC_GLOB |
-		PATHSPEC_ATTR;
+		PATHSPEC_ATTR |
+		PATHSPEC_EXCLUDE;
 
 	if (spec->magic & ~allowed_magic)
 		return 1;
@@ -687,16 +705,17 @@ static int forbid_bloom_filters(struct pathspec *spec)
 	return 0;
 }
 
-static void release_revisions_bloom_keyvecs(struct rev_info *revs);
-
-static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
-					    const struct pathspec_item *pi,
-					    const struct bloom_filter_settings *settings)
+static int add_pathspec_to_bloom_keyset(struct bloom_keyset *set,
+					const struct pathspec_item *pi)
 {
-	char *path_alloc = NULL;
-	const char *path;
 	size_t len;
-	int res = -1;
+
+	/*
+	 * A path can only match if it matches one of the positive
+	 * items, so the excluded ones do not matter.
+	 */
+	if (pi->magic & PATHSPEC_EXCLUDE)
+		return 0;
 
 	len = pi->nowildcard_len;
 	if (len != pi->len) {
@@ -713,20 +732,10 @@ static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
 		len--;
 
 	if (!len)
-		goto cleanup;
-
-	if (len != pi->len) {
-		path_alloc = xmemdupz(pi->match, len);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	*out = bloom_keyvec_new(path, len, settings);
+		return -1;
 
-	res = 0;
-cleanup:
-	free(path_alloc);
-	return res;
+	bloom_keyset_add(set, pi->match, len);
+	return 0;
 }
 
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
@@ -746,15 +755,15 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->pruning.pathspec.nr)
 		return;
 
-	revs->bloom_keyvecs_nr = revs->pruning.pathspec.nr;
-	CALLOC_ARRAY(revs->bloom_keyvecs, revs->bloom_keyvecs_nr);
+	revs->bloom_keyset = bloom_keyset_new(revs->bloom_filter_settings);
 
 	for (int i = 0; i < revs->pruning.pathspec.nr; i++) {
-		if (convert_pathspec_to_bloom_keyvec(&revs->bloom_keyvecs[i],
-						     &revs->pruning.pathspec.items[i],
-						     revs->bloom_filter_settings))
+		if (add_pathspec_to_bloom_keyset(revs->bloom_keyset,
+						 &revs->pruning.pathspec.items[i]))
 			goto fail;
 	}
+	if (!bloom_keyset_nr(revs->bloom_keyset))
+		goto fail;
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
@@ -765,11 +774,18 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 
 fail:
 	revs->bloom_filter_settings = NULL;
-	release_revisions_bloom_keyvecs(revs);
+	bloom_keyset_free(revs->bloom_keyset);
+	revs->bloom_keyset = NULL;
 }
 
+/*
+ * Check the changed-path Bloom filter of "commit" against its first
+ * parent, or, for a later parent, the one of a merge against all its
+ * parents but the first.
+ */
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
-						 struct commit *commit)
+						 struct commit *commit,
+						 int nth_parent)
 {
 	struct bloom_filter *filter;
 	int result = 0;
@@ -777,20 +793,25 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	if (commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY)
 		return -1;
 
-	filter = get_bloom_filter(revs->repo, commit);
+	if (nth_parent)
+		filter = get_merge_bloom_filter(revs->repo, commit);
+	else
+		filter = get_bloom_filter(revs->repo, commit);
 
 	if (!filter) {
-		count_bloom_filter_not_present++;
+		if (!nth_parent)
+			count_bloom_filter_not_present++;
 		return -1;
 	}
 
-	for (size_t nr = 0; !result && nr < revs->bloom_keyvecs_nr; nr++) {
-		result = bloom_filter_contains_vec(filter,
-						   revs->bloom_keyvecs[nr],
-						   revs->bloom_filter_settings);
-	}
+	result = bloom_filter_contains_keyset(filter, revs->bloom_keyset);
 
-	if (result)
+	if (nth_parent) {
+		if (result)
+			count_merge_bloom_filter_maybe++;
+		else
+			count_merge_bloom_filter_definitely_not++;
+	} else if (result)
 		count_bloom_filter_maybe++;
 	else
 		count_bloom_filter_definitely_not++;
@@ -828,8 +849,9 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keyvecs_nr && !nth_parent) {
-		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+	if (revs->bloom_keyset) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit,
+								  nth_parent);
 
 		if (bloom_ret == 0)
 			return REV_TREE_SAME;
@@ -839,9 +861,12 @@ static int rev_compare_tree(struct rev_info *revs,
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
 
-	if (!nth_parent)
-		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME) {
+		if (nth_parent)
+			count_merge_bloom_filter_false_positive++;
+		else
 			count_bloom_filter_false_positive++;
+	}
 
 	return tree_difference;
 }
@@ -855,8 +880,8 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit,
 	if (!t1)
 		return 0;
 
-	if (!nth_parent && revs->bloom_keyvecs_nr) {
-		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+	if (!nth_parent && revs->bloom_keyset) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit, 0);
 		if (!bloom_ret)
 			return 1;
 	}
@@ -1586,6 +1611,40 @@ int ref_excluded(const struct ref_exclusions *exclusions, const char *path)
 	return 0;
 }
 
+const char **ref_exclusions_to_exclude_patterns(const struct ref_exclusions *exclusions,
+						struct strvec *out)
+{
+	const char *namespace = get_git_namespace();
+	struct strvec hidden = STRVEC_INIT;
+	struct string_list_item *item;
+
+	/*
+	 * Without WM_PATHNAME, a pattern that ends in a slash followed by a
+	 * single star matches everything below that directory.
+	 */
+	for_each_string_list_item(item, &exclusions->excluded_refs) {
+		const char *pattern = item->string;
+		size_t len = strlen(pattern);
+		char *prefix;
+
+		if (len < 2 || strcmp(pattern + len - 2, "/*"))
+			continue;
+
+		prefix = xmemdupz(pattern, len - 1);
+		if (!has_glob_specials(prefix))
+			strvec_push(out, prefix);
+		free(prefix);
+	}
+
+	/* Hidden refs apply to the ref name with the namespace stripped. */
+	hidden_refs_to_excludes(&exclusions->hidden_refs, &hidden);
+	for (size_t i = 0; i < hidden.nr; i++)
+		strvec_pushf(out, "%s%s", namespace, hidden.v[i]);
+	strvec_clear(&hidden);
+
+	return out->v;
+}
+
 void init_ref_exclusions(struct ref_exclusions *exclusions)
 {
 	struct ref_exclusions blank = REF_EXCLUSIONS_INIT;
@@ -1682,6 +1741,23 @@ static void handle_refs(struct ref_store *refs,
 	for_each(refs, handle_one_ref, &cb);
 }
 
+static void handle_all_refs(struct ref_store *refs,
+			    struct rev_info *revs, unsigned flags)
+{
+	struct strvec excludes = STRVEC_INIT;
+	struct all_refs_cb cb;
+
+	if (!refs)
+		return;
+
+	init_all_refs_cb(&cb, revs, flags);
+	refs_for_each_fullref_in(refs, "",
+				 ref_exclusions_to_exclude_patterns(&revs->ref_excludes,
+								    &excludes),
+				 handle_one_ref, &cb);
+	strvec_clear(&excludes);
+}
+
 static void handle_one_reflog_commit(struct object_id *oid, void *cb_data)
 {
 	struct all_refs_cb *cb = cb_data;
@@ -2466,6 +2542,8 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 		revs->dense = 0;
 	} else if (!strcmp(arg, "--in-commit-order")) {
 		revs->tree_blobs_in_commit_order = 1;
+	} else if (!strcmp(arg, "--stream-objects")) {
+		revs->stream_objects = 1;
 	} else if (!strcmp(arg, "--remove-empty")) {
 		revs->remove_empty_trees = 1;
 	} else if (!strcmp(arg, "--merges")) {
@@ -2803,7 +2881,7 @@ static int handle_revision_pseudo_opt(struct rev_info *revs,
 	 * register it in the list at the top of handle_revision_opt.
 	 */
 	if (!strcmp(arg, "--all")) {
-		handle_refs(refs, revs, *flags, refs_for_each_ref);
+		handle_all_refs(refs, revs, *flags);
 		handle_refs(refs, revs, *flags, refs_head_ref);
 		if (!revs->single_worktree) {
 			struct all_refs_cb cb;
@@ -3234,14 +3312,6 @@ static void release_revisions_mailmap(struct string_list *mailmap)
 
 static void release_revisions_topo_walk_info(struct topo_walk_info *info);
 
-static void release_revisions_bloom_keyvecs(struct rev_info *revs)
-{
-	for (size_t nr = 0; nr < revs->bloom_keyvecs_nr; nr++)
-		bloom_keyvec_free(revs->bloom_keyvecs[nr]);
-	FREE_AND_NULL(revs->bloom_keyvecs);
-	revs->bloom_keyvecs_nr = 0;
-}
-
 static void free_void_commit_list(void *list)
 {
 	free_commit_list(list);
@@ -3270,7 +3340,8 @@ void release_revisions(struct rev_info *revs)
 	clear_decoration(&revs->treesame, free);
 	line_log_free(revs);
 	oidset_clear(&revs->missing_commits);
-	release_revisions_bloom_keyvecs(revs);
+	bloom_keyset_free(revs->bloom_keyset);
+	revs->bloom_keyset = NULL;
 }
 
 static void add_child(struct rev_info *revs, struct commit *parent, struct commit *child)
@@ -3669,6 +3740,13 @@ struct topo_walk_info {
 	struct prio_queue topo_queue;
 	struct indegree_slab indegree;
 	struct author_date_slab author_date;
+
+	/*
+	 * The starting points which have not been considered for the
+	 * topo_queue yet, see init_topo_walk().
+	 */
+	struct commit **pending_tips;
+	size_t pending_tips_nr, pending_tips_alloc, pending_tips_next;
 };
 
 static int topo_walk_atexit_registered;
@@ -3794,6 +3872,7 @@ static void release_revisions_topo_walk_info(struct topo_walk_info *info)
 	clear_prio_queue(&info->topo_queue);
 	clear_indegree_slab(&info->indegree);
 	clear_author_date_slab(&info->author_date);
+	free(info->pending_tips);
 	free(info);
 }
 
@@ -3836,6 +3915,21 @@ static void init_topo_walk(struct rev_info *revs)
 	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
 	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
 
+	/*
+	 * In graph order, the starting points sit at the bottom of the
+	 * topo_queue (which is a stack then), below everything their
+	 * walk puts there later, and are only shown once that is used up.
+	 * So instead of computing the indegrees down to the oldest of
+	 * them right away, which with many refs (think "--all") means
+	 * walking most of the history to show the first commit, we
+	 * consider each starting point only when the topo_queue runs
+	 * empty, see next_topo_commit(). Only the negative ones need
+	 * to be walked down to right away, to mark what they can reach
+	 * as uninteresting.
+	 *
+	 * The other orders may need to show a starting point at any
+	 * time, so they have to know their indegrees up front.
+	 */
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
@@ -3848,7 +3942,9 @@ static void init_topo_walk(struct rev_info *revs)
 		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
 
 		generation = commit_graph_generation(c);
-		if (generation < info->min_generation)
+		if (generation < info->min_generation &&
+		    (revs->sort_order != REV_SORT_IN_GRAPH_ORDER ||
+		     (c->object.flags & UNINTERESTING)))
 			info->min_generation = generation;
 
 		*(indegree_slab_at(&info->indegree, c)) = 1;
@@ -3861,17 +3957,14 @@ static void init_topo_walk(struct rev_info *revs)
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
 
-		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+		if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER) {
+			ALLOC_GROW(info->pending_tips, info->pending_tips_nr + 1,
+				   info->pending_tips_alloc);
+			info->pending_tips[info->pending_tips_nr++] = c;
+		} else if (*(indegree_slab_at(&info->indegree, c)) == 1)
 			prio_queue_put(&info->topo_queue, c);
 	}
 
-	/*
-	 * This is unfortunate; the initial tips need to be shown
-	 * in the order given from the revision traversal machinery.
-	 */
-	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER)
-		prio_queue_reverse(&info->topo_queue);
-
 	if (trace2_is_enabled() && !topo_walk_atexit_registered) {
 		atexit(trace2_topo_walk_statistics_atexit);
 		topo_walk_atexit_registered = 1;
@@ -3886,6 +3979,26 @@ static struct commit *next_topo_commit(struct rev_info *revs)
 	/* pop next off of topo_queue */
 	c = prio_queue_get(&info->topo_queue);
 
+	/*
+	 * Otherwise the next starting point which is not reachable from
+	 * any commit walked so far is up. One which was reachable is
+	 * either still waiting for some of its children to be shown or
+	 * has gone through the topo_queue already, as the indegree of
+	 * anything in there is 1.
+	 */
+	while (!c && info->pending_tips_next < info->pending_tips_nr) {
+		struct commit *tip = info->pending_tips[info->pending_tips_next++];
+		timestamp_t generation = commit_graph_generation(tip);
+
+		if (generation < info->min_generation) {
+			info->min_generation = generation;
+			compute_indegrees_to_depth(revs, info->min_generation);
+		}
+
+		if (*(indegree_slab_at(&info->indegree, tip)) == 1)
+			c = tip;
+	}
+
 	if (c)
 		*(indegree_slab_at(&info->indegree, c)) = 0;
 
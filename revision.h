@@ -62,7 +62,7 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_keyvec;
+struct bloom_keyset;
 struct bloom_filter_settings;
 struct option;
 struct parse_opt_ctx_t;
@@ -209,6 +209,7 @@ struct rev_info {
 			exclude_first_parent_only:1,
 			line_level_traverse:1,
 			tree_blobs_in_commit_order:1,
+			stream_objects:1,
 
 			/*
 			 * Blobs are shown without regard for their existence.
@@ -358,9 +359,8 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_keyvec **bloom_keyvecs;
-	int bloom_keyvecs_nr;
+	/* The bloom filter keys for the pathspec */
+	struct bloom_keyset *bloom_keyset;
 
 	/*
 	 * The bloom filter settings used to generate the key.
@@ -500,6 +500,15 @@ void clear_ref_exclusions(struct ref_exclusions *);
 void add_ref_exclusion(struct ref_exclusions *, const char *exclude);
 void exclude_hidden_refs(struct ref_exclusions *, const char *section);
 
+/*
+ * Collect the exclusions that name whole hierarchies of refs into `out`
+ * and return its array, to be passed as exclude patterns to the ref
+ * iterators so that these can skip over them. This is only an
+ * optimization, each ref still needs to be checked with `ref_excluded()`.
+ */
+const char **ref_exclusions_to_exclude_patterns(const struct ref_exclusions *,
+						struct strvec *out);
+
 /**
  * This function can be used if you want to add commit objects as revision
  * information. You can use the `UNINTERESTING` object flag to indicate if
@@ -2140,4 +2140,83 @@ test_expect_success GPG 'show lack of signature with custom format' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup many refs for threaded object reads' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		test_commit_bulk --message="commit %s" 600 &&
+		git rev-list HEAD |
+		sed -e "s,.*,create refs/heads/branch-& &," |
+		git update-ref --stdin &&
+		git rev-list HEAD |
+		while read commit
+		do
+			echo "tag tag-$commit" &&
+			echo "from $commit" &&
+			printf "tagger %s <%s> %s\n" \
+				"$GIT_COMMITTER_NAME" \
+				"$GIT_COMMITTER_EMAIL" \
+				"$GIT_COMMITTER_DATE" &&
+			echo "data <<EOF" &&
+			echo "tag for $commit" &&
+			echo "EOF" || return 1
+		done | git fast-import
+	)
+'
+
+test_threaded_reads () {
+	format=$1 &&
+	shift &&
+	args="$*" &&
+	test_expect_success "threaded object reads: $format $args" '
+		(
+			cd threads &&
+			${git_for_each_ref} --threads=1 --format="$format" $args >expect &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				${git_for_each_ref} --threads=4 --format="$format" $args >actual &&
+			test_cmp expect actual &&
+			test_trace2_data ref-filter prefetch_threads 2 <trace.event &&
+			rm trace.event
+		)
+	'
+}
+
+test_threaded_reads "%(refname) %(objecttype) %(objectsize) %(body)"
+test_threaded_reads "%(refname) %(*objectname) %(*subject)"
+test_threaded_reads "%(contents)" --sort=-creatordate
+test_threaded_reads "%(subject)" --sort=objectsize --sort=-taggerdate
+test_threaded_reads "%(refname)" --sort=contents:body --ignore-case
+test_threaded_reads "%(objectsize:disk) %(subject)" --count=1100 --no-sort
+
+test_expect_success 'object info without contents is read without threads' '
+	(
+		cd threads &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" ${git_for_each_ref} \
+			--threads=4 --format="%(objecttype) %(objectsize)" &&
+		! grep prefetch_threads trace.event &&
+		rm trace.event
+	)
+'
+
+test_expect_success 'object contents are read on one thread by default' '
+	(
+		cd threads &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" ${git_for_each_ref} \
+			--format="%(subject)" &&
+		! grep prefetch_threads trace.event &&
+		rm trace.event
+	)
+'
+
+test_expect_success 'few refs are read without threads' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		${git_for_each_ref} --threads=4 --format="%(subject)" refs/heads/ &&
+	! grep prefetch_threads trace.event
+'
+
+test_expect_success 'negative --threads is rejected' '
+	test_must_fail ${git_for_each_ref} --threads=-1 2>err &&
+	test_grep "invalid --threads argument" err
+'
+
 test_done
@@ -127,6 +127,13 @@ int cmd__reach(int ac, const char **av)
 		printf("%s(A,X):\n", av[1]);
 		print_sorted_commit_ids(list);
 		free_commit_list(list);
+	} else if (!strcmp(av[1], "get_octopus_merge_bases")) {
+		struct commit_list *list = NULL;
+		if (get_octopus_merge_bases(X, &list) < 0)
+			exit(128);
+		printf("%s(X):\n", av[1]);
+		print_sorted_commit_ids(list);
+		free_commit_list(list);
 	} else if (!strcmp(av[1], "reduce_heads")) {
 		struct commit_list *list = reduce_heads(X);
 		printf("%s(X):\n", av[1]);
@@ -34,6 +34,12 @@ static void dump_graph_info(struct commit_graph *graph)
 		printf(" bloom_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
+	if (graph->chunk_bloom_merge_indexes)
+		printf(" bloom_merge_indexes");
+	if (graph->chunk_bloom_merge_data)
+		printf(" bloom_merge_data");
+	if (graph->chunk_reachability)
+		printf(" reachability");
 	printf("\n");
 
 	printf("options:");
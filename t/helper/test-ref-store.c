@@ -10,6 +10,7 @@
 #include "repository.h"
 #include "strbuf.h"
 #include "revision.h"
+#include "run-command.h"
 
 struct flag_definition {
 	const char *name;
@@ -50,7 +51,12 @@ static unsigned int parse_flags(const char *str, struct flag_definition *defs)
 	return result;
 }
 
-static struct flag_definition empty_flags[] = { { NULL, 0 } };
+static struct flag_definition resolve_ref_flags[] = {
+	FLAG_DEF(RESOLVE_REF_READING),
+	FLAG_DEF(RESOLVE_REF_NO_RECURSE),
+	FLAG_DEF(RESOLVE_REF_ALLOW_BAD_NAME),
+	{ NULL, 0 }
+};
 
 static const char *notnull(const char *arg, const char *name)
 {
@@ -176,11 +182,58 @@ static int cmd_for_each_ref__exclude(struct ref_store *refs, const char **argv)
 					NULL);
 }
 
+struct for_each_ref_exec_data {
+	struct ref_store *refs;
+	const char *prefix;
+	const char *command;
+	int done;
+};
+
+static int each_ref_exec(const struct reference *ref, void *cb_data)
+{
+	struct for_each_ref_exec_data *data = cb_data;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+
+	each_ref(ref, NULL);
+	if (data->done++)
+		return 0;
+
+	/*
+	 * Change the references behind our back, then iterate again while
+	 * the outer iteration is still going on.
+	 */
+	fflush(stdout);
+	cmd.use_shell = 1;
+	strvec_push(&cmd.args, data->command);
+	if (run_command(&cmd))
+		return -1;
+
+	printf("--\n");
+	if (refs_for_each_ref_in(data->refs, data->prefix, each_ref, NULL))
+		return -1;
+	printf("--\n");
+	return 0;
+}
+
+static int cmd_for_each_ref__exec(struct ref_store *refs, const char **argv)
+{
+	struct for_each_ref_exec_data data = {
+		.refs = refs,
+		.prefix = notnull(*argv++, "prefix"),
+		.command = notnull(*argv++, "command"),
+	};
+
+	if (refs_for_each_ref_in(refs, data.prefix, each_ref_exec, &data))
+		return 1;
+	printf("--\n");
+	return refs_for_each_ref_in(refs, data.prefix, each_ref, NULL);
+}
+
 static int cmd_resolve_ref(struct ref_store *refs, const char **argv)
 {
 	struct object_id oid = *null_oid(the_hash_algo);
 	const char *refname = notnull(*argv++, "refname");
-	int resolve_flags = arg_flags(*argv++, "resolve-flags", empty_flags);
+	int resolve_flags = arg_flags(*argv++, "resolve-flags", resolve_ref_flags);
 	int flags;
 	const char *ref;
 
@@ -190,6 +243,31 @@ static int cmd_resolve_ref(struct ref_store *refs, const char **argv)
 	return ref ? 0 : 1;
 }
 
+static int cmd_resolve_refs(struct ref_store *refs, const char **argv)
+{
+	int flags = arg_flags(*argv++, "resolve-flags", resolve_ref_flags);
+	struct ref_read_request *requests;
+	size_t nr = 0;
+
+	while (argv[nr])
+		nr++;
+	CALLOC_ARRAY(requests, nr);
+	for (size_t i = 0; i < nr; i++)
+		requests[i].refname = argv[i];
+
+	refs_read_refs_many(refs, requests, nr, flags);
+	for (size_t i = 0; i < nr; i++) {
+		struct ref_read_request *req = &requests[i];
+		printf("%s %s 0x%x\n",
+		       oid_to_hex(req->resolved ? &req->oid : null_oid(the_hash_algo)),
+		       req->resolved ? req->resolved : "(null)", req->flags);
+	}
+
+	ref_read_requests_release(requests, nr);
+	free(requests);
+	return 0;
+}
+
 static int cmd_verify_ref(struct ref_store *refs, const char **argv)
 {
 	const char *refname = notnull(*argv++, "refname");
@@ -313,7 +391,9 @@ static struct command commands[] = {
 	{ "rename-ref", cmd_rename_ref },
 	{ "for-each-ref", cmd_for_each_ref },
 	{ "for-each-ref--exclude", cmd_for_each_ref__exclude },
+	{ "for-each-ref--exec", cmd_for_each_ref__exec },
 	{ "resolve-ref", cmd_resolve_ref },
+	{ "resolve-refs", cmd_resolve_refs },
 	{ "verify-ref", cmd_verify_ref },
 	{ "for-each-reflog", cmd_for_each_reflog },
 	{ "for-each-reflog-ent", cmd_for_each_reflog_ent },
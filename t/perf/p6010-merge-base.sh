@@ -98,4 +98,16 @@ test_expect_success 'verify result' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup many heads' '
+	git rev-list one two | awk "NR % 64 == 0" >heads
+'
+
+test_perf 'git merge-base --independent without commit-graph' '
+	git -c core.commitGraph=false merge-base --independent $(cat heads)
+'
+
+test_perf 'git merge-base --octopus' '
+	git merge-base --all --octopus $(cat heads)
+'
+
 test_done
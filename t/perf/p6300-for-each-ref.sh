@@ -62,6 +62,9 @@ test_for_each_ref () {
 run_tests () {
 	test_for_each_ref "$1"
 	test_for_each_ref "$1, no sort" --no-sort
+	test_for_each_ref "$1, contents" '--format="%(refname) %(contents)"'
+	test_for_each_ref "$1, contents, thread per CPU" --threads=0 '--format="%(refname) %(contents)"'
+	test_for_each_ref "$1, sorted by date" --sort=-committerdate '--format="%(refname) %(subject)"'
 	test_for_each_ref "$1, --count=1" --count=1
 	test_for_each_ref "$1, --count=1, no sort" --no-sort --count=1
 	test_for_each_ref "$1, tags" refs/tags/
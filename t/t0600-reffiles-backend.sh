@@ -519,4 +519,210 @@ test_expect_success 'symref transaction supports false symlink config' '
 	test_cmp expect actual
 '
 
+test_expect_success 'pack-refs writes packed-refs index if configured' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		git branch b1 &&
+		git branch b2 &&
+		git tag -a -m annotated annotated &&
+		git for-each-ref >expect &&
+		git -c core.packedRefsIndex=true pack-refs --all &&
+		test_path_is_file .git/packed-refs.idx &&
+		head -n 1 .git/packed-refs >header &&
+		test_grep " index:" header &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		git for-each-ref refs/tags/ >actual &&
+		grep refs/tags/ expect >expect.tags &&
+		test_cmp expect.tags actual &&
+		git rev-parse A b2 annotated^{} >actual &&
+		git rev-parse A A A >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'packed-refs index is kept up to date' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_config core.packedRefsIndex true &&
+		test_commit A &&
+		git branch b1 &&
+		git branch b2 &&
+		git pack-refs --all &&
+		git branch -D b1 &&
+		git update-ref refs/heads/b3 HEAD &&
+		git pack-refs --all &&
+		test_must_fail git rev-parse --verify -q refs/heads/b1 &&
+		git rev-parse --verify refs/heads/b3 &&
+		git for-each-ref --format="%(refname)" refs/heads/ >actual &&
+		cat >expect <<-\EOF &&
+		refs/heads/b2
+		refs/heads/b3
+		refs/heads/main
+		EOF
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'packed-refs index is removed without core.packedRefsIndex' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		git branch b1 &&
+		git -c core.packedRefsIndex=true pack-refs --all &&
+		test_path_is_file .git/packed-refs.idx &&
+		git branch -D b1 &&
+		test_path_is_missing .git/packed-refs.idx &&
+		head -n 1 .git/packed-refs >header &&
+		test_grep ! " index:" header
+	)
+'
+
+test_expect_success 'stale packed-refs index is ignored' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_config core.packedRefsIndex true &&
+		test_commit A &&
+		git branch b1 &&
+		git branch b2 &&
+		git pack-refs --all &&
+		cp .git/packed-refs.idx stale.idx &&
+		git branch -D b1 &&
+		git branch c1 &&
+		git pack-refs --all &&
+		cp stale.idx .git/packed-refs.idx &&
+		git for-each-ref --format="%(refname)" refs/heads/ >actual 2>err &&
+		cat >expect <<-\EOF &&
+		refs/heads/b2
+		refs/heads/c1
+		refs/heads/main
+		EOF
+		test_cmp expect actual &&
+		test_must_be_empty err
+	)
+'
+
+test_expect_success 'refnames are checked despite a packed-refs index' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		git branch ab &&
+		git -c core.packedRefsIndex=true pack-refs --all &&
+		test_path_is_file .git/packed-refs.idx &&
+
+		# An edit that keeps the size of the file and its header
+		# still matches the index.
+		sed -e "s,refs/heads/ab$,refs/heads/a.," .git/packed-refs >packed &&
+		mv packed .git/packed-refs &&
+		git for-each-ref --format="%(refname)" refs/heads/ >actual 2>err &&
+		test_grep "ignoring ref with broken name refs/heads/a\." err &&
+		test_grep ! "refs/heads/a\." actual &&
+
+		sed -e "s,refs/heads/a\.$,refs/../abcde," .git/packed-refs >packed &&
+		mv packed .git/packed-refs &&
+		test_must_fail git for-each-ref 2>err &&
+		test_grep "packed refname is dangerous" err
+	)
+'
+
+test_expect_success 'corrupt packed-refs index is ignored' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		git branch b1 &&
+		git branch b2 &&
+		git -c core.packedRefsIndex=true pack-refs --all &&
+		git for-each-ref >expect &&
+
+		# Point the last record somewhere past the end of packed-refs.
+		rawsz=$(test_oid rawsz) &&
+		size=$(wc -c <.git/packed-refs.idx) &&
+		printf "\377\377\377\377\377\377\377\377" |
+		dd of=.git/packed-refs.idx bs=1 seek=$((size - rawsz - 8)) conv=notrunc &&
+		git for-each-ref >actual 2>err &&
+		test_cmp expect actual &&
+		test_grep "ignoring corrupt index" err
+	)
+'
+
+check_fsync_events () {
+	local trace="$1" &&
+	shift &&
+
+	cat >expect &&
+	sed -n \
+		-e '/^{"event":"counter",.*"category":"fsync",/ {
+			s/.*"category":"fsync",//;
+			s/}$//;
+			p;
+		}' \
+		<"$trace" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'ref transaction: core.fsyncMethod=batch flushes once' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+	git init repo &&
+	test_commit -C repo initial &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+	GIT_TEST_FSYNC=true \
+		git -C repo -c core.fsync=reference -c core.fsyncMethod=batch \
+		update-ref --stdin <<-EOF &&
+	create refs/heads/a HEAD
+	create refs/heads/b HEAD
+	create refs/heads/c HEAD
+	EOF
+	if grep "core.fsyncMethod = batch is unsupported" trace2.txt
+	then
+		check_fsync_events trace2.txt <<-EOF
+		"name":"hardware-flush","count":4
+		EOF
+	else
+		check_fsync_events trace2.txt <<-EOF
+		"name":"writeout-only","count":3
+		"name":"hardware-flush","count":1
+		EOF
+	fi &&
+	git -C repo for-each-ref --format="%(refname)" refs/heads/a refs/heads/b refs/heads/c >actual &&
+	test_line_count = 3 actual &&
+	find repo/.git -name "bulk_fsync_*" >leftover &&
+	test_must_be_empty leftover
+'
+
+test_expect_success 'deleting many loose refs removes refs, reflogs and directories' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		test_seq 1200 |
+		sed "s,.*,create refs/pull/&/head HEAD," >create &&
+		git -c core.logAllRefUpdates=always update-ref --stdin <create &&
+		git pack-refs --include "refs/pull/1*" &&
+		test_path_is_file .git/logs/refs/pull/1200/head &&
+
+		sed "s,^create \([^ ]*\) .*,delete \1," create >delete &&
+		git update-ref --stdin <delete &&
+		git for-each-ref refs/pull >actual &&
+		test_must_be_empty actual &&
+		test_dir_is_empty .git/refs/pull &&
+		test_dir_is_empty .git/logs/refs/pull &&
+		git rev-parse --verify A
+	)
+'
+
 test_done
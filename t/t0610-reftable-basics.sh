@@ -355,6 +355,59 @@ test_expect_success 'ref transaction: env var disables compaction' '
 	test_line_count -lt $expected repo/.git/reftable/tables.list
 '
 
+test_expect_success 'ref transaction: reftable.autoCompaction=false disables compaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction false &&
+
+	start=$(wc -l <repo/.git/reftable/tables.list) &&
+	iterations=5 &&
+	expected=$((start + iterations)) &&
+
+	for i in $(test_seq $iterations)
+	do
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	test_line_count = $expected repo/.git/reftable/tables.list &&
+
+	git -C repo pack-refs --auto &&
+	test_line_count -lt $expected repo/.git/reftable/tables.list
+'
+
+test_expect_success !MINGW 'ref transaction: reftable.autoCompaction=background' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	for i in $(test_seq 5)
+	do
+		GIT_TEST_REFTABLE_AUTOCOMPACTION=false \
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	tables=$(($(wc -l <repo/.git/reftable/tables.list) + 1)) &&
+
+	# Reading from fd 9, which the background process inherits, waits
+	# until it has exited.
+	doesnt_matter=$(GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo -c reftable.autoCompaction=background \
+		update-ref foo HEAD 9>&1) &&
+	test_subcommand git --git-dir="$(pwd)/repo/.git" pack-refs --auto <trace2.txt &&
+	grep "\"key\":\"tables\",\"value\":\"$tables\"" trace2.txt &&
+	test $(grep -c "\"event\":\"atexit\"" trace2.txt) = 2 &&
+	test_line_count -lt $tables repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: invalid reftable.autoCompaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_must_fail git -C repo -c reftable.autoCompaction=foo \
+		update-ref foo HEAD 2>err &&
+	test_grep "invalid value for reftable.autoCompaction: foo" err
+'
+
 test_expect_success 'ref transaction: alternating table sizes are compacted' '
 	test_when_finished "rm -rf repo" &&
 
@@ -507,6 +560,38 @@ test_expect_success 'pack-refs: compacts tables' '
 	test_line_count = 1 repo/.git/reftable/tables.list
 '
 
+test_expect_success 'pack-refs: reftable.compressionThreads does not change the table' '
+	test_when_finished "rm -rf repo repo-threaded" &&
+	git init repo &&
+	test_commit -C repo A &&
+	test_commit -C repo B &&
+	for i in $(test_seq 20)
+	do
+		rev=$(test $((i % 2)) = 0 && echo A || echo B) &&
+		test_seq 50 |
+		sed "s,.*,update refs/heads/branch& $rev," |
+		git -C repo -c reftable.autoCompaction=false \
+			-c core.logAllRefUpdates=always \
+			update-ref -m "update $i" --stdin || return 1
+	done &&
+	cp -R repo repo-threaded &&
+
+	git -C repo -c reftable.compressionThreads=1 pack-refs &&
+	git -C repo-threaded -c reftable.compressionThreads=4 pack-refs &&
+	test_line_count = 1 repo/.git/reftable/tables.list &&
+	test_cmp repo/.git/reftable/$(cat repo/.git/reftable/tables.list) \
+		repo-threaded/.git/reftable/$(cat repo-threaded/.git/reftable/tables.list) &&
+	git -C repo-threaded reflog show branch7 >reflog &&
+	test_line_count = 20 reflog
+'
+
+test_expect_success 'pack-refs: invalid reftable.compressionThreads' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	test_must_fail git -C repo -c reftable.compressionThreads=-1 pack-refs 2>err &&
+	test_grep "reftable compression threads cannot be negative" err
+'
+
 test_expect_success 'pack-refs: compaction raises locking errors' '
 	test_when_finished "rm -rf repo" &&
 	git init repo &&
@@ -877,6 +962,35 @@ test_expect_success 'reflog: expiry empties reflog' '
 	)
 '
 
+test_expect_success 'reflog: expiry without anything to prune writes no table' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit initial &&
+		git checkout -b branch &&
+		test_commit fileA &&
+		test_commit fileB &&
+
+		git reflog show refs/heads/branch >expect &&
+		cp .git/reftable/tables.list tables.expect &&
+		git reflog expire --all --expire=never --expire-unreachable=never &&
+		git reflog expire --all --expire=never --expire-unreachable=never \
+			--rewrite --updateref &&
+		test_cmp tables.expect .git/reftable/tables.list &&
+		git reflog show refs/heads/branch >actual &&
+		test_cmp expect actual &&
+
+		git reflog expire branch --expire=all &&
+		cp .git/reftable/tables.list tables.expect &&
+		git reflog expire branch --expire=all &&
+		test_cmp tables.expect .git/reftable/tables.list &&
+		git reflog show refs/heads/branch >actual &&
+		test_must_be_empty actual &&
+		test-tool ref-store main reflog-exists refs/heads/branch
+	)
+'
+
 test_expect_success 'reflog: can be deleted' '
 	test_when_finished "rm -rf repo" &&
 	git init repo &&
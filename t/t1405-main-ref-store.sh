@@ -122,4 +122,64 @@ test_expect_success 'delete_ref(refs/heads/foo)' '
 	test_must_fail git rev-parse refs/heads/foo --
 '
 
+test_expect_success 'read_refs_many() matches resolve_ref()' '
+	git branch loose &&
+	git branch packed &&
+	git branch loose-over-packed &&
+	git pack-refs --all &&
+	test_commit --no-tag newer &&
+	git update-ref refs/heads/loose-over-packed HEAD &&
+	git symbolic-ref refs/heads/sym refs/heads/loose &&
+	git symbolic-ref refs/heads/dangling refs/heads/missing &&
+	set -- refs/heads/sym refs/heads/packed refs/heads/missing HEAD \
+		refs/heads/loose refs/heads/dangling refs/heads \
+		refs/heads/loose-over-packed refs/heads/..bad refs/heads/packed &&
+	for flags in 0 RESOLVE_REF_READING RESOLVE_REF_NO_RECURSE \
+		RESOLVE_REF_ALLOW_BAD_NAME
+	do
+		for ref in "$@"
+		do
+			test_might_fail $RUN resolve-ref "$ref" $flags || return 1
+		done >expected &&
+		$RUN resolve-refs $flags "$@" >actual &&
+		test_cmp expected actual || return 1
+	done
+'
+
+test_expect_success 'read_refs_many() with many refs' '
+	test_seq 200 | sed "s,.*,create refs/many/& HEAD," | git update-ref --stdin &&
+	git pack-refs --all &&
+	test_seq 150 | sed "s,.*,update refs/many/&0 HEAD~," | git update-ref --stdin &&
+	set -- $(test_seq 400 | sed -n "s,^.*[147]$,refs/many/&,p" | sort -r) refs/many/1 &&
+	for ref in "$@"
+	do
+		test_might_fail $RUN resolve-ref "$ref" RESOLVE_REF_READING || return 1
+	done >expected &&
+	$RUN resolve-refs RESOLVE_REF_READING "$@" >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'for_each_ref() notices changes by other processes' '
+	new=$(git rev-parse HEAD) &&
+	old=$(git rev-parse HEAD~) &&
+	git update-ref refs/exec/a $old &&
+	git update-ref refs/exec/b $old &&
+	$RUN for-each-ref--exec refs/exec/ \
+		"git update-ref -d refs/exec/b &&
+		 git update-ref refs/exec/c $old &&
+		 git update-ref refs/exec/a $new" >actual &&
+	cat >expected <<-EOF &&
+	$old a 0x0
+	--
+	$new a 0x0
+	$old c 0x0
+	--
+	$old b 0x0
+	--
+	$new a 0x0
+	$old c 0x0
+	EOF
+	test_cmp expected actual
+'
+
 test_done
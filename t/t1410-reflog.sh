@@ -701,4 +701,38 @@ test_expect_success 'expire with pattern config' '
 	test_cmp expect actual.sorted
 '
 
+test_expect_success 'expire unreachable entries with a commit-graph' '
+	test_when_finished "rm -rf gen" &&
+	git init gen &&
+	(
+		cd gen &&
+		test_commit A &&
+		test_commit B &&
+		test_commit C &&
+		test_commit D &&
+		test_commit E &&
+		git checkout -b side B &&
+		test_commit S &&
+		git checkout - &&
+		git commit-graph write --reachable &&
+
+		test_tick &&
+		git update-ref refs/heads/gen S &&
+		test_tick &&
+		git update-ref refs/heads/gen B &&
+		test_tick &&
+		git update-ref refs/heads/gen E &&
+		git branch -D side &&
+
+		# The walk from the tip stops before B, so that both S and
+		# B need digging deeper into the history, but only B is
+		# reachable.
+		git reflog expire --expire=$(git log -1 --format=%ct D) \
+			--expire-unreachable=now gen &&
+		git rev-parse E >expect &&
+		git reflog show --format=%H gen >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
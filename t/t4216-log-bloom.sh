@@ -154,6 +154,17 @@ test_expect_success 'git log with multiple literal paths uses Bloom filter' '
 	test_bloom_filters_used "-- file*"
 '
 
+test_expect_success 'git log with many overlapping paths uses Bloom filter' '
+	paths="A A/B/file2 A/B A/B/C/file3 A/B/C file4 A/file1 A/B/file2" &&
+	for i in $(test_seq 100)
+	do
+		paths="$paths A/B/C/nofile$i nodir$i/file" || return 1
+	done &&
+	test_bloom_filters_used "-- $paths" &&
+	test_bloom_filters_used "--full-history -- $paths" &&
+	test_bloom_filters_used "-- $(echo $paths | sed "s/file4//")"
+'
+
 test_expect_success 'git log with paths all contain non-wildcard part uses Bloom filter' '
 	test_bloom_filters_used "-- A/\* file4" &&
 	test_bloom_filters_used "-- A/file\*" &&
@@ -175,6 +186,8 @@ test_expect_success 'git log with path contains various magic signatures' '
 	test_bloom_filters_used "-- \:\(glob\)A/\*\*/C" &&
 	test_bloom_filters_not_used "-- \:\(icase\)FILE4" &&
 	test_bloom_filters_not_used "-- \:\(exclude\)A/B/C" &&
+	test_bloom_filters_used "-- A \:\(exclude\)A/B/C" &&
+	test_bloom_filters_used "-- A/B/C/file3 file4 \:\(exclude\)A/B" &&
 
 	test_when_finished "rm -f .gitattributes" &&
 	cat >.gitattributes <<-EOF &&
@@ -753,6 +766,155 @@ test_expect_success 'when writing commit graph, reuse changed-path of another ve
 	test_filter_upgraded 1 trace2.txt
 '
 
+test_expect_success 'set up repo for threaded Bloom filters' '
+	git init threads &&
+	(
+		cd threads &&
+		mkdir -p A/B/C D &&
+		for i in 1 2 3 4 5
+		do
+			echo $i >A/file$i &&
+			echo $i >A/B/file$i &&
+			echo $i >A/B/C/file$i &&
+			echo $i >D/file$i || return 1
+		done &&
+		git add . &&
+		git commit -m initial &&
+
+		echo changed >A/B/file1 &&
+		test_chmod +x A/B/C/file2 &&
+		git add . &&
+		git commit -m "modify and chmod" &&
+
+		git rm -r D &&
+		echo file >D &&
+		git add D &&
+		git commit -m "directory to file" &&
+
+		git rm D &&
+		mkdir D &&
+		echo 1 >D/file1 &&
+		git add D &&
+		git commit -m "file to directory" &&
+
+		git update-index --add --cacheinfo \
+			160000,$(git rev-parse HEAD),sub &&
+		git commit -m "add submodule" &&
+
+		git update-index --cacheinfo \
+			160000,$(git rev-parse HEAD~2),sub &&
+		git commit -m "update submodule" &&
+
+		git rm -r A &&
+		git commit -m "remove everything below A"
+	)
+'
+
+test_expect_success 'threaded Bloom filter computation produces identical graph' '
+	for max in 3 512
+	do
+		rm -f threads/.git/objects/info/commit-graph &&
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=$max \
+			git -C threads commit-graph write --reachable \
+			--changed-paths --threads=1 &&
+		mv threads/.git/objects/info/commit-graph expect &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=$max \
+			git -C threads commit-graph write --reachable \
+			--changed-paths --threads=3 &&
+		grep "\"key\":\"bloom_filter_threads\",\"value\":\"3\"" \
+			trace2.txt &&
+		test_cmp_bin expect threads/.git/objects/info/commit-graph ||
+		return 1
+	done
+'
+
+test_expect_success '--threads rejects negative values' '
+	test_must_fail git -C threads commit-graph write --reachable \
+		--changed-paths --threads=-1 2>err &&
+	test_grep "invalid number of threads" err
+'
+
+test_expect_success 'set up repo with merges' '
+	git init merges &&
+	(
+		cd merges &&
+		mkdir -p A/B C &&
+		test_commit base A/B/file &&
+		for i in 1 2 3
+		do
+			git checkout -b side$i main &&
+			test_commit side$i-c C/file$i &&
+			test_commit side$i-a A/file$i &&
+			git checkout main &&
+			test_commit main$i A/B/file &&
+			git merge --no-ff -m "merge side$i" side$i || return 1
+		done &&
+		git checkout -b octo main &&
+		test_commit octo-1 A/B/file &&
+		git checkout -b octo2 main &&
+		test_commit octo-2 C/octo &&
+		git checkout main &&
+		test_commit main4 D &&
+		git merge -m octopus octo octo2
+	)
+'
+
+test_expect_success 'merge changed-path Bloom filters are written and kept' '
+	git -C merges commit-graph write --reachable --changed-paths \
+		--merge-changed-paths &&
+	test-tool -C merges read-graph >out &&
+	test_grep "bloom_merge_indexes bloom_merge_data" out &&
+
+	git -C merges commit-graph write --reachable --changed-paths &&
+	test-tool -C merges read-graph >out &&
+	test_grep "bloom_merge_indexes bloom_merge_data" out &&
+
+	git -C merges commit-graph write --reachable --no-merge-changed-paths &&
+	test-tool -C merges read-graph >out &&
+	test_grep ! bloom_merge out &&
+
+	git -C merges -c commitGraph.mergeChangedPaths=true \
+		commit-graph write --reachable --no-changed-paths &&
+	test-tool -C merges read-graph >out &&
+	test_grep ! bloom out &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C merges -c commitGraph.mergeChangedPaths=true \
+		commit-graph write --reachable --changed-paths &&
+	test-tool -C merges read-graph >out &&
+	test_grep "bloom_merge_indexes bloom_merge_data" out &&
+	grep "\"key\":\"merge-filter-computed\",\"value\":\"4\"" trace2.txt
+'
+
+for option in "" "--full-history" "--simplify-merges" "--sparse" "--show-pulls"
+do
+	test_expect_success "merge Bloom filters with log $option" '
+		for path in A A/B A/B/file A/file2 C C/file3 D E
+		do
+			git -C merges -c core.commitGraph=false log \
+				--format=%s $option -- $path >expect &&
+			git -C merges -c core.commitGraph=true log \
+				--format=%s $option -- $path >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
+done
+
+test_expect_success 'merge Bloom filters spare tree comparisons' '
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -C merges log --full-history -- C/file3 >/dev/null &&
+	grep "merge_statistics:{\"maybe\":[0-9]*,\"definitely_not\":[1-9]" \
+		trace.perf &&
+	rm -f trace.perf &&
+
+	git -C merges commit-graph write --reachable --no-merge-changed-paths &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -C merges log --full-history -- C/file3 >/dev/null &&
+	test_grep ! merge_statistics trace.perf
+'
+
 corrupt_graph () {
 	test_when_finished "rm -rf $graph" &&
 	git commit-graph write --reachable --changed-paths &&
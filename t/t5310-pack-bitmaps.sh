@@ -586,6 +586,29 @@ test_expect_success 'left-right count not confused by bitmap-index' '
 	test_cmp expect actual
 '
 
+test_expect_success 'threaded bitmap writing produces identical output' '
+	git init threaded &&
+	test_when_finished "rm -fr threaded" &&
+	(
+		cd threaded &&
+		test_commit_bulk 300 &&
+
+		git -c pack.writeBitmapThreads=1 repack -adb &&
+		cp .git/objects/pack/*.bitmap expect.bitmap &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace2" \
+			git -c pack.writeBitmapThreads=2 repack -adb &&
+		grep "\"key\":\"xor_offsets_threads\",\"value\":\"2\"" trace2 &&
+		test_cmp_bin expect.bitmap .git/objects/pack/*.bitmap &&
+
+		rm trace2 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2" git -c pack.writeBitmapThreads=2 \
+			-c pack.writeBitmapMemory=1 repack -adb &&
+		! grep xor_offsets_threads trace2 &&
+		test_cmp_bin expect.bitmap .git/objects/pack/*.bitmap
+	)
+'
+
 test_bitmap_cases "pack.writeBitmapLookupTable"
 
 test_expect_success 'verify writing bitmap lookup table when enabled' '
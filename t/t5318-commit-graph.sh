@@ -990,4 +990,49 @@ test_expect_success 'config commitGraph.changedPaths acts like --changed-paths'
 	)
 '
 
+test_expect_success 'reachability index is kept and needs a single layer' '
+	git init reachability-index &&
+	(
+		cd reachability-index &&
+		# the layers written below must not be merged behind our back
+		sane_unset GIT_TEST_COMMIT_GRAPH &&
+		test_commit first &&
+
+		git commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		test_grep ! "reachability" out &&
+
+		git commit-graph write --reachable --reachability-index &&
+		test-tool read-graph >out &&
+		test_grep "chunks:.* reachability" out &&
+		git commit-graph verify &&
+
+		# the index is written again by default once it exists
+		test_commit second &&
+		git commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		test_grep "chunks:.* reachability" out &&
+		git merge-base --is-ancestor first second &&
+		test_must_fail git merge-base --is-ancestor second first &&
+
+		git commit-graph write --reachable --no-reachability-index &&
+		test-tool read-graph >out &&
+		test_grep ! "reachability" out &&
+
+		git -c commitGraph.reachabilityIndex=true \
+			commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		test_grep "chunks:.* reachability" out &&
+
+		# a layer on top of a base graph cannot carry the index
+		test_commit third &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 .git/objects/info/commit-graphs/commit-graph-chain &&
+		test-tool read-graph >out &&
+		test_grep ! "reachability" out &&
+		git merge-base --is-ancestor first third &&
+		git commit-graph verify
+	)
+'
+
 test_done
@@ -248,4 +248,37 @@ test_expect_success 'rev-list -z --boundary' '
 	test_cmp expect actual
 '
 
+test_expect_success 'rev-list --objects --stream-objects' '
+	test_when_finished rm -rf repo &&
+
+	git init repo &&
+	(
+		cd repo &&
+		mkdir dir &&
+		test_commit one dir/one.t &&
+		test_commit two dir/two.t &&
+		git repack -d &&
+		test_commit three &&
+		cp dir/one.t copy.t &&
+		git add copy.t &&
+		test_commit four &&
+		git repack -d &&
+		test_commit five dir/five.t &&
+
+		for args in "--all" "--all --not two" "HEAD HEAD^{tree}" \
+			"--in-commit-order --all" "--objects-edge HEAD ^three"
+		do
+			git rev-list --objects $args >expect &&
+			git rev-list --objects --stream-objects $args >actual &&
+			test_cmp expect actual || return 1
+		done &&
+
+		git multi-pack-index write &&
+		git repack -a &&
+		git rev-list --objects --all >expect &&
+		git rev-list --objects --stream-objects --all >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
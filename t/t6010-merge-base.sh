@@ -162,6 +162,27 @@ test_expect_success '--independent with unsynchronized clocks' '
 	test_cmp expected actual
 '
 
+test_expect_success 'octopus merge bases with unsynchronized clocks' '
+	# OY is a descendant of OX, but much older, so a walk by commit date
+	# sees OX first. Both OA and OB merge OX and OY, so only OY is a
+	# merge base.
+	OR=$(doit 0 OR) &&
+	OX=$(doit 3000 OX $OR) &&
+	OY=$(doit 1000 OY $OX) &&
+	OA=$(doit 3001 OA $OX $OY) &&
+	OB=$(doit 3002 OB $OY $OX) &&
+
+	echo $OY >expected &&
+	printf "X:%s\n" OA OB >input &&
+	GIT_TEST_COMMIT_GRAPH=0 \
+		test-tool reach get_octopus_merge_bases <input >actual.raw &&
+	sed -n "2,\$p" actual.raw >actual &&
+	test_cmp expected actual &&
+
+	git merge-base --all OA OB >actual &&
+	test_cmp expected actual
+'
+
 test_expect_success 'merge-base for octopus-step (setup)' '
 	# Another set to demonstrate base between one commit and a merge
 	# in the documentation.
@@ -12,7 +12,8 @@ test_expect_success 'setup' '
 	test_commit_bulk --id=hidden --ref=refs/hidden/commit 1 &&
 	HIDDEN=$(git rev-parse refs/hidden/commit) &&
 	test_commit_bulk --id=namespace --ref=refs/namespaces/namespace/refs/namespaced/commit 1 &&
-	NAMESPACE=$(git rev-parse refs/namespaces/namespace/refs/namespaced/commit)
+	NAMESPACE=$(git rev-parse refs/namespaces/namespace/refs/namespaced/commit) &&
+	git pack-refs --all
 '
 
 test_expect_success 'invalid section' '
@@ -69,6 +70,22 @@ do
 		test_cmp expected out
 	'
 
+	test_expect_success "$section: hidden refs shown again by a later negation" '
+		git -c transfer.hideRefs=refs/hidden -c transfer.hideRefs=!refs/hidden/commit \
+			rev-list --exclude-hidden=$section --all >out &&
+		cat >expected <<-EOF &&
+		$NAMESPACE
+		$HIDDEN
+		$TAG
+		$COMMIT
+		EOF
+		test_cmp expected out &&
+
+		git -c transfer.hideRefs=refs/hidden -c transfer.hideRefs=!refs \
+			rev-list --exclude-hidden=$section --all >out &&
+		test_cmp expected out
+	'
+
 	test_expect_success "$section: negation without hidden refs marks everything as uninteresting" '
 		git rev-list --all --exclude-hidden=$section --not --all >out &&
 		test_must_be_empty out
@@ -160,4 +177,20 @@ do
 	done
 done
 
+test_expect_success 'hidden and excluded refs are skipped over' '
+	for args in "-c transfer.hideRefs=refs/hidden rev-list --exclude-hidden=fetch" \
+		    "rev-list --exclude=refs/hidden/*"
+	do
+		rm -f perf &&
+		GIT_TRACE2_PERF="$(pwd)/perf" git $args --all >out &&
+		cat >expected <<-EOF &&
+		$NAMESPACE
+		$TAG
+		$COMMIT
+		EOF
+		test_cmp expected out &&
+		grep -E "name:(jumps_made|reseeks_made) value:[1-9]" perf || return 1
+	done
+'
+
 test_done
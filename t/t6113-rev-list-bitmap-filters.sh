@@ -17,13 +17,12 @@ test_expect_success 'set up bitmapped repo' '
 '
 
 test_expect_success 'filters fallback to non-bitmap traversal' '
-	# use a path-based filter, since they are inherently incompatible with
-	# bitmaps (i.e., this test will never get confused by later code to
-	# combine the features)
+	# path-based filters cannot know the path of a tree which was
+	# asked for directly, so they fall back to the regular traversal
 	filter=$(echo "!one" | git hash-object -w --stdin) &&
-	git rev-list --objects --filter=sparse:oid=$filter HEAD >expect &&
+	git rev-list --objects --filter=sparse:oid=$filter HEAD^{tree} >expect &&
 	git rev-list --use-bitmap-index \
-		     --objects --filter=sparse:oid=$filter HEAD >actual &&
+		     --objects --filter=sparse:oid=$filter HEAD^{tree} >actual &&
 	test_cmp expect actual
 '
 
@@ -75,7 +74,7 @@ test_expect_success 'tree:1 filter' '
 	git rev-list --objects --filter=tree:1 HEAD >expect &&
 	git rev-list --use-bitmap-index \
 		     --objects --filter=tree:1 HEAD >actual &&
-	test_cmp expect actual
+	test_bitmap_traversal expect actual
 '
 
 test_expect_success 'object:type filter' '
@@ -143,6 +142,79 @@ test_expect_success 'combine filter with --filter-provided-objects' '
 	done <objects
 '
 
+test_expect_success 'set up repo with paths' '
+	git init paths &&
+	(
+		cd paths &&
+		mkdir -p dir/keep dir/drop other &&
+		echo shared >dir/keep/shared &&
+		echo shared >dir/drop/shared &&
+		echo one >dir/keep/one &&
+		echo two >dir/drop/two &&
+		echo three >other/three &&
+		echo top >top &&
+		git add . &&
+		git commit -m one &&
+
+		# the same tree at a second path
+		cp -R dir/keep other/keep &&
+		echo four >dir/drop/four &&
+		git add . &&
+		git commit -m two &&
+		git repack -adb &&
+
+		echo five >dir/keep/five &&
+		echo six >dir/drop/six &&
+		git add . &&
+		git commit -m three &&
+
+		cat >patterns <<-\EOF &&
+		/*
+		!/dir/
+		/dir/keep/
+		EOF
+		git hash-object -w patterns >patterns.oid
+	)
+'
+
+test_expect_success 'sparse:oid filter' '
+	filter=$(cat paths/patterns.oid) &&
+	git -C paths rev-list --objects --filter=sparse:oid=$filter \
+		HEAD >expect &&
+	git -C paths rev-list --use-bitmap-index --objects \
+		--filter=sparse:oid=$filter HEAD >actual &&
+	test_bitmap_traversal expect actual
+'
+
+test_expect_success 'sparse:oid filter with negative tips' '
+	filter=$(cat paths/patterns.oid) &&
+	git -C paths rev-list --objects --filter=sparse:oid=$filter \
+		HEAD ^HEAD~1 >expect &&
+	git -C paths rev-list --use-bitmap-index --objects \
+		--filter=sparse:oid=$filter HEAD ^HEAD~1 >actual &&
+	test_bitmap_traversal expect actual
+'
+
+test_expect_success 'tree:<depth> filter' '
+	for depth in 1 2 3
+	do
+		git -C paths rev-list --objects --filter=tree:$depth \
+			HEAD >expect &&
+		git -C paths rev-list --use-bitmap-index --objects \
+			--filter=tree:$depth HEAD >actual &&
+		test_bitmap_traversal expect actual || return 1
+	done
+'
+
+test_expect_success 'combine filter with sparse:oid and tree:<depth>' '
+	filter=$(cat paths/patterns.oid) &&
+	git -C paths rev-list --objects --filter=tree:3 \
+		--filter=sparse:oid=$filter --filter=blob:limit=5 HEAD >expect &&
+	git -C paths rev-list --use-bitmap-index --objects --filter=tree:3 \
+		--filter=sparse:oid=$filter --filter=blob:limit=5 HEAD >actual &&
+	test_bitmap_traversal expect actual
+'
+
 test_expect_success 'bitmap traversal with --unpacked' '
 	git repack -adb &&
 	test_commit unpacked &&
@@ -787,4 +787,120 @@ test_expect_success 'do not be fooled by invalid describe format ' '
 	test_must_fail git cat-file -t "refs/tags/super-invalid/./../...../ ~^:/?*[////\\\\\\&}/busted.lock-42-g"$(cat out)
 '
 
+test_expect_success 'setup: describe index' '
+	git init describe-index &&
+	(
+		cd describe-index &&
+		test_commit --annotate v1 &&
+		test_commit --no-tag a &&
+		git branch a &&
+		git checkout -b side &&
+		test_commit --no-tag s1 &&
+		git branch s1 &&
+		test_commit side-tag &&
+		test_commit --no-tag s2 &&
+		git checkout main &&
+		test_commit --no-tag b &&
+		test_tick &&
+		git merge -m m side &&
+		test_commit --no-tag c &&
+		test_commit --annotate v2 &&
+		test_commit --no-tag d &&
+		git branch d &&
+		git commit-graph write --reachable &&
+		git rev-list --all >commits
+	)
+'
+
+check_describe_index () {
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c core.describeIndex=true "$@" >actual &&
+	test_cmp expect actual &&
+	test_trace2_data describe-index hits "$hits" <trace.txt &&
+	if test -n "$dropped"
+	then
+		test_trace2_data describe-index dropped "$dropped" <trace.txt
+	else
+		! grep "\"key\":\"dropped\"" trace.txt
+	fi &&
+	rm -f trace.txt
+}
+
+for opts in "" "--tags" "--tags --first-parent" "--tags --match=v*" \
+	"--tags --exclude=v2" "--tags --candidates=1"
+do
+	test_expect_success "describe --always${opts:+ $opts} with core.describeIndex" '
+		test_when_finished "rm -f describe-index/.git/objects/info/describe-index" &&
+		(
+			cd describe-index &&
+			git describe --always $opts $(cat commits) >expect &&
+			hits=0 dropped= check_describe_index \
+				describe --always $opts $(cat commits) &&
+			test_path_is_file .git/objects/info/describe-index &&
+			git -c core.describeIndex=true describe --always \
+				$opts $(cat commits) >actual &&
+			test_cmp expect actual
+		)
+	'
+done
+
+test_expect_success 'describe index reuses names and drops stale ones' '
+	test_when_finished "rm -f describe-index/.git/objects/info/describe-index" &&
+	(
+		cd describe-index &&
+		git describe --tags $(cat commits) >expect &&
+		hits=0 dropped= check_describe_index describe --tags $(cat commits) &&
+
+		# All but the three tagged commits come from the index.
+		hits=7 dropped= check_describe_index describe --tags $(cat commits) &&
+
+		# A new tag only drops the name of the commit it points at.
+		git tag top d &&
+		git describe --tags $(cat commits) >expect &&
+		hits=6 dropped=1 check_describe_index describe --tags $(cat commits) &&
+
+		# Moving a tag drops the names of the commits that can reach
+		# either of its commits, here s1, s2, m and c.
+		git tag -f side-tag s1 &&
+		git describe --tags $(cat commits) >expect &&
+		hits=2 dropped=4 check_describe_index describe --tags $(cat commits)
+	)
+'
+
+test_expect_success 'name-rev --tags with core.describeIndex' '
+	test_when_finished "rm -f describe-index/.git/objects/info/describe-index" &&
+	(
+		cd describe-index &&
+		git name-rev --tags $(cat commits) >expect &&
+		hits=0 dropped= check_describe_index name-rev --tags $(cat commits) &&
+		hits=10 dropped= check_describe_index name-rev --tags $(cat commits) &&
+
+		git name-rev --tags --name-only $(cat commits) >expect &&
+		hits=10 dropped= check_describe_index \
+			name-rev --tags --name-only $(cat commits) &&
+
+		# A tag on an old commit only drops the names of the commits
+		# it can reach, here v1 and a.
+		git tag old a &&
+		git name-rev --tags $(cat commits) >expect &&
+		hits=8 dropped=2 check_describe_index name-rev --tags $(cat commits) &&
+
+		git describe --contains $(cat commits) >expect &&
+		hits=10 dropped= check_describe_index \
+			describe --contains $(cat commits)
+	)
+'
+
+test_expect_success 'describe index is not used with replace refs' '
+	test_when_finished "git -C describe-index replace -d d" &&
+	(
+		cd describe-index &&
+		git replace --graft d a &&
+		git describe --tags $(cat commits) >expect &&
+		git -c core.describeIndex=true describe --tags $(cat commits) >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/objects/info/describe-index
+	)
+'
+
 test_done
@@ -58,6 +58,9 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git commit-graph write --reachable --reachability-index &&
+	mv .git/objects/info/commit-graph commit-graph-reach &&
+	chmod u+w commit-graph-reach &&
 	git config core.commitGraph true
 '
 
@@ -73,6 +76,9 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -183,6 +189,20 @@ test_expect_success 'get_merge_bases_many' '
 	test_all_modes get_merge_bases_many
 '
 
+test_expect_success 'get_octopus_merge_bases' '
+	cat >input <<-\EOF &&
+	X:commit-5-3
+	X:commit-3-5
+	X:commit-4-4
+	X:commit-2-9
+	EOF
+	{
+		echo "get_octopus_merge_bases(X):" &&
+		git rev-parse commit-2-3
+	} >expect &&
+	test_all_modes get_octopus_merge_bases
+'
+
 test_expect_success 'reduce_heads' '
 	cat >input <<-\EOF &&
 	X:commit-1-10
@@ -307,6 +327,32 @@ test_expect_success 'commit_contains:miss' '
 	test_all_modes commit_contains --tag
 '
 
+test_expect_success 'reachability index answers --contains on the grid' '
+	test_when_finished rm -f .git/objects/info/commit-graph &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	git commit-graph verify &&
+	for x in $(test_seq 1 10)
+	do
+		for y in $(test_seq 1 10)
+		do
+			for i in $(test_seq $x 10)
+			do
+				for j in $(test_seq $y 10)
+				do
+					echo "$i-$j" || return 1
+				done
+			done | sort >expect &&
+			git for-each-ref --format="%(refname)" \
+				--contains commit-$x-$y "refs/heads/commit-*" >refs &&
+			sed "s|refs/heads/commit-||" refs | sort >actual &&
+			test_cmp expect actual &&
+			git tag -l --contains commit-$x-$y "tag-*" >tags &&
+			sed "s|tag-||" tags | sort >actual &&
+			test_cmp expect actual || return 1
+		done
+	done
+'
+
 test_expect_success 'rev-list: basic topo-order' '
 	git rev-parse \
 		commit-6-6 commit-5-6 commit-4-6 commit-3-6 commit-2-6 commit-1-6 \
@@ -391,6 +437,27 @@ test_expect_success 'rev-list: symmetric difference topo-order' '
 	run_all_modes git rev-list --topo-order commit-3-8...commit-6-6
 '
 
+test_expect_success 'rev-list: topo-order with many tips' '
+	git -c core.commitGraph=false rev-list --topo-order --all >expect &&
+	run_all_modes git rev-list --topo-order --all &&
+	git -c core.commitGraph=false rev-list --topo-order \
+		commit-1-9 commit-6-6 commit-9-1 ^commit-3-3 commit-2-2 >expect &&
+	run_all_modes git rev-list --topo-order \
+		commit-1-9 commit-6-6 commit-9-1 ^commit-3-3 commit-2-2
+'
+
+test_expect_success 'rev-list: topo-order does not walk down to old tips' '
+	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git rev-list --topo-order -1 commit-10-10 commit-1-1 >actual &&
+	git rev-parse commit-10-10 >expect &&
+	test_cmp expect actual &&
+	# the whole grid is 100 commits
+	walked=$(sed -n "s/.*\"count_indegree_walked\":\([0-9]*\).*/\1/p" trace2.txt) &&
+	test "$walked" -lt 20
+'
+
 test_expect_success 'get_reachable_subset:all' '
 	cat >input <<-\EOF &&
 	X:commit-9-1
@@ -529,6 +596,67 @@ test_expect_success 'for-each-ref ahead-behind:none' '
 		--format="%(refname) %(ahead-behind:commit-8-4)" --stdin
 '
 
+test_expect_success 'for-each-ref ahead-behind with core.aheadBehindCache' '
+	test_when_finished "rm -f .git/objects/info/ahead-behind; \
+			    git update-ref -d refs/cache/base; \
+			    git update-ref -d refs/cache/tip" &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	test_when_finished rm -f .git/objects/info/commit-graph &&
+	format="%(refname) %(ahead-behind:refs/cache/base)" &&
+	check_cached () {
+		git for-each-ref --format="$format" refs/cache refs/heads/commit-5-5 \
+			>expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+			git -c core.aheadBehindCache=update for-each-ref \
+			--format="$format" refs/cache refs/heads/commit-5-5 >actual &&
+		test_cmp expect actual &&
+		test_trace2_data ahead-behind cache/hit "$1" <trace.txt &&
+		test_trace2_data ahead-behind cache/updated "$2" <trace.txt &&
+		test_trace2_data ahead-behind cache/computed "$3" <trace.txt &&
+		rm -f trace.txt
+	} &&
+
+	git update-ref refs/cache/base commit-3-4 &&
+	git update-ref refs/cache/tip commit-4-3 &&
+	check_cached 0 0 3 &&
+	test_path_is_file .git/objects/info/ahead-behind &&
+	check_cached 3 0 0 &&
+
+	# fast-forward the tip, then the base, then both
+	git update-ref refs/cache/tip commit-6-3 &&
+	check_cached 2 1 0 &&
+	git update-ref refs/cache/base commit-3-7 &&
+	check_cached 0 3 0 &&
+	git update-ref refs/cache/tip commit-8-8 &&
+	git update-ref refs/cache/base commit-4-9 &&
+	check_cached 0 3 0 &&
+
+	# rewinding a side needs a new walk
+	git update-ref refs/cache/tip commit-2-2 &&
+	check_cached 2 0 1 &&
+	check_cached 3 0 0
+'
+
+test_expect_success 'core.aheadBehindCache=true does not write the cache' '
+	test_when_finished "rm -f .git/objects/info/ahead-behind" &&
+	format="%(refname) %(ahead-behind:commit-3-4)" &&
+	git for-each-ref --format="$format" refs/heads/commit-5-5 >expect &&
+	git -c core.aheadBehindCache=true for-each-ref --format="$format" \
+		refs/heads/commit-5-5 >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing .git/objects/info/ahead-behind &&
+
+	git -c core.aheadBehindCache=update for-each-ref --format="$format" \
+		refs/heads/commit-5-5 >actual &&
+	test_path_is_file .git/objects/info/ahead-behind &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c core.aheadBehindCache=true for-each-ref \
+		--format="$format" refs/heads/commit-5-5 >actual &&
+	test_cmp expect actual &&
+	test_trace2_data ahead-behind cache/hit 1 <trace.txt &&
+	rm -f trace.txt
+'
+
 test_expect_success 'for-each-ref merged:linear' '
 	cat >input <<-\EOF &&
 	refs/heads/commit-1-1
@@ -445,4 +445,52 @@ test_expect_success '--geometric -l disables writing bitmaps with non-local pack
 	test_path_is_file member/.git/objects/pack/multi-pack-index-*.bitmap
 '
 
+test_expect_success '--geometric --write-midx=incremental appends MIDX layers' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		midx_chain=$packdir/multi-pack-index.d/multi-pack-index-chain &&
+
+		test_commit_bulk --start=1 1 &&
+		git repack -d --geometric=2 --write-midx=incremental \
+			--write-bitmap-index &&
+		test_path_is_file $midx_chain &&
+		test_line_count = 1 $midx_chain &&
+		ls $packdir/multi-pack-index.d/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+
+		# Packs covered by an existing layer are never rolled up,
+		# so each repack only indexes the newly written pack in a
+		# layer of its own.
+		find $packdir -name "*.pack" | sort >before &&
+		test_commit_bulk --start=2 1 &&
+		git repack -d --geometric=2 --write-midx=incremental \
+			--write-bitmap-index &&
+		find $packdir -name "*.pack" | sort >after &&
+		comm -23 before after >removed &&
+		test_must_be_empty removed &&
+		test_line_count = 2 $midx_chain &&
+		ls $packdir/multi-pack-index.d/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 2 bitmaps &&
+
+		git rev-list --count --all --use-bitmap-index >actual &&
+		git rev-list --count --all >expect &&
+		test_cmp expect actual &&
+
+		# The configuration makes incremental layers the default...
+		test_commit_bulk --start=3 1 &&
+		git -c repack.midxIncremental=true \
+			repack -d --geometric=2 --write-midx &&
+		test_line_count = 3 $midx_chain &&
+
+		# ...but an all-into-one repack compacts the chain.
+		git -c repack.midxIncremental=true repack -ad --write-midx &&
+		test_path_is_missing $midx_chain &&
+		test_path_is_file $midx &&
+		git multi-pack-index verify
+	)
+'
+
 test_done
@@ -800,6 +800,40 @@ test_expect_success 'rerere-gc task with --auto honors maintenance.rerere-gc.aut
 	test_expect_rerere_gc ! git -c maintenance.rerere-gc.auto=0 maintenance run --auto --task=rerere-gc
 '
 
+test_expect_success 'describe-index task names commits again' '
+	test_when_finished "rm -rf describe-index" &&
+	git init describe-index &&
+	(
+		cd describe-index &&
+		test_commit --annotate one &&
+		test_commit --no-tag two &&
+		test_commit --no-tag three &&
+
+		# Nothing to do without the config or the index.
+		! git maintenance is-needed --auto --task=describe-index &&
+		! git -c core.describeIndex=true maintenance is-needed \
+			--auto --task=describe-index &&
+
+		git -c core.describeIndex=true describe HEAD &&
+		test_path_is_file .git/objects/info/describe-index &&
+		git -c core.describeIndex=true maintenance is-needed \
+			--auto --task=describe-index &&
+
+		git tag -a -m two two HEAD~1 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+			git -c core.describeIndex=true maintenance run \
+			--task=describe-index &&
+		test_subcommand git -c core.describeIndex=true describe \
+			--candidates=10 --always $(git rev-parse HEAD) <trace.txt &&
+
+		git describe HEAD >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/hits.txt" \
+			git -c core.describeIndex=true describe HEAD >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"hits\",\"value\":\"1\"" hits.txt
+	)
+'
+
 test_expect_success '--auto and --schedule incompatible' '
 	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
 	test_grep "cannot be used together" err
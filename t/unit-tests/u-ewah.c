@@ -0,0 +1,148 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+
+/*
+ * Build a bitmap which mixes long clean runs of zeroes and ones (which
+ * the EWAH encoding compresses) with dirty words, so that the
+ * operations under test have to handle every kind of marker word.
+ */
+static struct bitmap *make_bitmap(size_t nr_words, unsigned seed)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(nr_words);
+	size_t i = 0;
+
+	while (i < nr_words) {
+		size_t len = 1 + seed % 97, j;
+		unsigned kind = (seed >> 3) % 3;
+
+		for (j = 0; j < len && i < nr_words; j++, i++) {
+			if (kind == 1)
+				bitmap->words[i] = (eword_t)~0;
+			else if (kind == 2)
+				bitmap->words[i] = (eword_t)seed * 0x9e3779b97f4a7c15ull + j;
+		}
+		seed = seed * 1103515245 + 12345;
+	}
+
+	return bitmap;
+}
+
+static struct bitmap *naive_ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(0);
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0;
+
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it)) {
+		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
+		bitmap->words[i++] = word;
+	}
+	bitmap->word_alloc = i;
+
+	return bitmap;
+}
+
+static size_t naive_popcount(struct bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++)
+		count += ewah_bit_popcount64(bitmap->words[i]);
+	return count;
+}
+
+static void check_ops(size_t nr_words, unsigned seed_a, unsigned seed_b)
+{
+	struct bitmap *a = make_bitmap(nr_words, seed_a);
+	struct bitmap *b = make_bitmap(nr_words, seed_b);
+	struct ewah_bitmap *b_ewah = bitmap_to_ewah(b);
+	struct bitmap *expect, *actual;
+	size_t i, count = 0;
+
+	expect = naive_ewah_to_bitmap(b_ewah);
+	actual = ewah_to_bitmap(b_ewah);
+	cl_assert(bitmap_equals(expect, actual));
+	cl_assert(bitmap_equals(b, actual));
+	bitmap_free(actual);
+
+	cl_assert_equal_i(bitmap_popcount(b), naive_popcount(b));
+	cl_assert_equal_i(ewah_bitmap_popcount(b_ewah), naive_popcount(b));
+
+	for (i = 0; i < nr_words; i++)
+		count += ewah_bit_popcount64(a->words[i] & b->words[i]);
+	cl_assert_equal_i(bitmap_and_ewah_popcount(a, b_ewah), count);
+
+	bitmap_or(expect, a);
+	actual = bitmap_dup(a);
+	bitmap_or_ewah(actual, b_ewah);
+	cl_assert(bitmap_equals(expect, actual));
+
+	bitmap_free(actual);
+	bitmap_free(expect);
+	ewah_free(b_ewah);
+	bitmap_free(a);
+	bitmap_free(b);
+}
+
+void test_ewah__empty(void)
+{
+	check_ops(0, 1, 2);
+}
+
+void test_ewah__single_word(void)
+{
+	check_ops(1, 7, 11);
+}
+
+void test_ewah__mixed_runs(void)
+{
+	for (unsigned seed = 1; seed < 32; seed++)
+		check_ops(2048, seed, seed * 31 + 7);
+}
+
+void test_ewah__popcount_block_boundaries(void)
+{
+	/*
+	 * Exercise every combination of whole blocks and leftover words
+	 * in the blocked population count.
+	 */
+	for (size_t nr = 0; nr < 40; nr++) {
+		struct bitmap *bitmap = make_bitmap(nr, nr + 5);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+
+		cl_assert_equal_i(bitmap_popcount(bitmap),
+				  naive_popcount(bitmap));
+		cl_assert_equal_i(ewah_bitmap_popcount(ewah),
+				  naive_popcount(bitmap));
+
+		ewah_free(ewah);
+		bitmap_free(bitmap);
+	}
+}
+
+void test_ewah__popcount_all_ones(void)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(1000);
+
+	memset(bitmap->words, 0xff, 1000 * sizeof(eword_t));
+	cl_assert_equal_i(bitmap_popcount(bitmap), 1000 * BITS_IN_EWORD);
+	bitmap_free(bitmap);
+}
+
+void test_ewah__or_grows_bitmap(void)
+{
+	struct bitmap *small = bitmap_word_alloc(1);
+	struct bitmap *big = make_bitmap(512, 3);
+	struct ewah_bitmap *big_ewah = bitmap_to_ewah(big);
+
+	small->words[0] = 1;
+	bitmap_or_ewah(small, big_ewah);
+	bitmap_or(big, small);
+	cl_assert(bitmap_equals(small, big));
+
+	ewah_free(big_ewah);
+	bitmap_free(small);
+	bitmap_free(big);
+}
@@ -289,6 +289,67 @@ void test_reftable_readwrite__log_write_read(void)
 	reftable_table_decref(table);
 }
 
+void test_reftable_readwrite__log_threaded_compression(void)
+{
+	struct reftable_write_options opts = {
+		.block_size = 256,
+	};
+	struct reftable_buf inline_buf = REFTABLE_BUF_INIT;
+	struct reftable_buf threaded_buf = REFTABLE_BUF_INIT;
+	struct reftable_block_source source = { 0 };
+	struct reftable_log_record *logs, log = { 0 };
+	struct reftable_iterator it = { 0 };
+	struct reftable_table *table;
+	size_t N = 500, i;
+	char **names;
+
+	REFTABLE_CALLOC_ARRAY(names, N + 1);
+	cl_assert(names != NULL);
+	REFTABLE_CALLOC_ARRAY(logs, N);
+	cl_assert(logs != NULL);
+	for (i = 0; i < N; i++) {
+		logs[i].refname = names[i] = xstrfmt("refs/heads/branch%04d", (int)i);
+		logs[i].update_index = i;
+		logs[i].value_type = REFTABLE_LOG_UPDATE;
+		cl_reftable_set_hash(logs[i].value.update.old_hash, i,
+				     REFTABLE_HASH_SHA1);
+		cl_reftable_set_hash(logs[i].value.update.new_hash, i + 1,
+				     REFTABLE_HASH_SHA1);
+		logs[i].value.update.message = (char *) "message";
+	}
+
+	/*
+	 * Compressing the log blocks on separate threads must not change the
+	 * resulting table.
+	 */
+	cl_reftable_write_to_buf(&inline_buf, NULL, 0, logs, N, &opts);
+	opts.log_compression_threads = 4;
+	cl_reftable_write_to_buf(&threaded_buf, NULL, 0, logs, N, &opts);
+	cl_assert_equal_i(inline_buf.len, threaded_buf.len);
+	cl_assert(!memcmp(inline_buf.buf, threaded_buf.buf, inline_buf.len));
+
+	block_source_from_buf(&source, &threaded_buf);
+	cl_assert(!reftable_table_new(&table, &source, "file.log"));
+	cl_assert(!reftable_table_init_log_iterator(table, &it));
+	cl_assert(!reftable_iterator_seek_log(&it, ""));
+	for (i = 0; ; i++) {
+		int err = reftable_iterator_next_log(&it, &log);
+		if (err > 0)
+			break;
+		cl_assert(!err);
+		cl_assert_equal_s(names[i], log.refname);
+	}
+	cl_assert_equal_i(i, N);
+
+	reftable_iterator_destroy(&it);
+	reftable_log_record_release(&log);
+	reftable_table_decref(table);
+	reftable_buf_release(&inline_buf);
+	reftable_buf_release(&threaded_buf);
+	reftable_free(logs);
+	free_names(names);
+}
+
 void test_reftable_readwrite__log_zlib_corruption(void)
 {
 	struct reftable_write_options opts = {
@@ -11,6 +11,7 @@ license that can be found in the LICENSE file or at
 #include "unit-test.h"
 #include "dir.h"
 #include "lib-reftable.h"
+#include "reftable/blockcache.h"
 #include "reftable/merged.h"
 #include "reftable/reftable-error.h"
 #include "reftable/stack.h"
@@ -910,6 +911,87 @@ void test_reftable_stack__reflog_expire(void)
 	reftable_log_record_release(&log);
 }
 
+static void read_logs_with_cache(uint32_t cache_size)
+{
+	char *dir = get_tmp_dir(__LINE__);
+	struct reftable_write_options opts = {
+		.log_block_cache_size = cache_size,
+	};
+	struct reftable_stack *st = NULL;
+	struct reftable_log_record logs[20] = { 0 };
+	struct reftable_log_record log = { 0 };
+	struct reftable_block_cache_stats before, after;
+	size_t i, N = ARRAY_SIZE(logs) - 1;
+
+	cl_assert_equal_i(reftable_new_stack(&st, dir, &opts), 0);
+
+	for (i = 1; i <= N; i++) {
+		struct write_log_arg arg = {
+			.log = &logs[i],
+			.update_index = reftable_stack_next_update_index(st),
+		};
+		char buf[256];
+
+		snprintf(buf, sizeof(buf), "branch%02"PRIuMAX, (uintmax_t)i);
+		logs[i].refname = xstrdup(buf);
+		logs[i].update_index = i;
+		logs[i].value_type = REFTABLE_LOG_UPDATE;
+		logs[i].value.update.time = i;
+		logs[i].value.update.email = xstrdup("identity@invalid");
+		cl_reftable_set_hash(logs[i].value.update.new_hash, i,
+				     REFTABLE_HASH_SHA1);
+
+		cl_assert_equal_i(reftable_stack_add(st, write_test_log,
+						     &arg, 0), 0);
+	}
+
+	cl_assert_equal_i(reftable_stack_read_log(st, logs[7].refname,
+						  &log), 0);
+	cl_assert_equal_s(log.refname, logs[7].refname);
+	reftable_block_cache_stats(st->block_cache, &before);
+
+	cl_assert_equal_i(reftable_stack_read_log(st, logs[7].refname,
+						  &log), 0);
+	cl_assert_equal_s(log.refname, logs[7].refname);
+	reftable_block_cache_stats(st->block_cache, &after);
+
+	if (cache_size > 1) {
+		/* The second read is served from the cache entirely. */
+		cl_assert(before.entries > 0);
+		cl_assert(after.hits > before.hits);
+		cl_assert_equal_i(after.misses, before.misses);
+	} else {
+		/* The blocks are too big to ever be cached. */
+		cl_assert_equal_i(after.entries, 0);
+		cl_assert_equal_i(after.hits, 0);
+	}
+	cl_assert(after.size <= cache_size);
+
+	/* Compaction drops the entries of the old tables. */
+	cl_assert_equal_i(reftable_stack_compact_all(st, NULL), 0);
+	reftable_block_cache_stats(st->block_cache, &after);
+	cl_assert_equal_i(after.entries, 0);
+	cl_assert_equal_i(reftable_stack_read_log(st, logs[7].refname,
+						  &log), 0);
+	cl_assert_equal_s(log.refname, logs[7].refname);
+
+	reftable_stack_destroy(st);
+	for (i = 0; i <= N; i++)
+		reftable_log_record_release(&logs[i]);
+	reftable_log_record_release(&log);
+	clear_dir(dir);
+}
+
+void test_reftable_stack__log_block_cache(void)
+{
+	read_logs_with_cache(1024 * 1024);
+}
+
+void test_reftable_stack__log_block_cache_too_small(void)
+{
+	read_logs_with_cache(1);
+}
+
 static int write_nothing(struct reftable_writer *wr, void *arg UNUSED)
 {
 	cl_assert_equal_i(reftable_writer_set_limits(wr, 1, 1), 0);
@@ -610,6 +610,7 @@ static int allow_hidden_refs(enum allow_uor allow_uor)
 static void for_each_namespaced_ref_1(each_ref_fn fn,
 				      struct upload_pack_data *data)
 {
+	struct strvec excludes_vector = STRVEC_INIT;
 	const char **excludes = NULL;
 	/*
 	 * If `data->allow_uor` allows fetching hidden refs, we need to
@@ -621,10 +622,12 @@ static void for_each_namespaced_ref_1(each_ref_fn fn,
 	 * hidden references.
 	 */
 	if (allow_hidden_refs(data->allow_uor))
-		excludes = hidden_refs_to_excludes(&data->hidden_refs);
+		excludes = hidden_refs_to_excludes(&data->hidden_refs,
+						   &excludes_vector);
 
 	refs_for_each_namespaced_ref(get_main_ref_store(the_repository),
 				     excludes, fn, data);
+	strvec_clear(&excludes_vector);
 }
 
 